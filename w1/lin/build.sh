@@ -2,5 +2,5 @@
 
 mkdir -p bin
 
-g++ server.cpp socket_tools.cpp -std=c++17 -o bin/server
-g++ client.cpp socket_tools.cpp -std=c++17 -o bin/client
+g++ server.cpp socket_tools.cpp udp_batch.cpp event_loop.cpp uring_socket.cpp reliable_link.cpp connect_cookies.cpp -std=c++17 -pthread -o bin/server
+g++ client.cpp socket_tools.cpp reliable_link.cpp -std=c++17 -o bin/client
@@ -1,11 +1,15 @@
+#include <algorithm>
 #include <atomic>
 #include <cstring>
 #include <iostream>
+#include <mutex>
 #include <netdb.h>
 #include <string>
 #include <thread>
 #include <vector>
 
+#include "handshake.h"
+#include "reliable_link.h"
 #include "socket_tools.h"
 
 
@@ -29,16 +33,100 @@ std::vector<std::string> messages = {
 addrinfo addr_info;
 int sfd;
 
+// the server ignores the link's frames until it took a cookie back and welcomed us, hellos are resent until then
+static constexpr std::chrono::milliseconds hello_period(300);
+// a peer silent for a minute is forgotten by the server
+static constexpr std::chrono::seconds keepalive_period(5);
+bool welcomed = false;
+std::string hello;
+
+// used from both threads, sending and receiving both change its state
+std::mutex link_mutex;
+ReliableLink server_link(
+	[](const char* data, size_t size)
+	{
+		if (sendto(sfd, data, size, 0, addr_info.ai_addr, addr_info.ai_addrlen) == -1)
+			std::cout << strerror(errno) << std::endl;
+	});
+
+void send_datagram(std::string_view datagram)
+{
+	if (sendto(sfd, datagram.data(), datagram.size(), 0, addr_info.ai_addr, addr_info.ai_addrlen) == -1)
+		std::cout << strerror(errno) << std::endl;
+}
+
+// "/___hello" or "/___hello <cookie>", padded as the server wants it
+void send_hello(std::string_view cookie)
+{
+	hello = std::string(Handshake::helloMsg);
+	if (!cookie.empty())
+		hello.append(" ").append(cookie);
+	hello.resize(std::max(hello.size(), Handshake::helloSize), ' ');
+	send_datagram(hello);
+}
+
+// Plain datagrams before the link is up, a cookie to echo or the welcome
+void on_handshake_datagram(std::string_view datagram)
+{
+	if (datagram == Handshake::welcomeMsg)
+		welcomed = true;
+	else if (datagram.size() == Handshake::cookieMsg.size() + 1 + Handshake::cookieDigits &&
+		datagram.substr(0, Handshake::cookieMsg.size()) == Handshake::cookieMsg)
+		send_hello(datagram.substr(Handshake::cookieMsg.size() + 1));
+}
+
 void receive_messages()
 {
 	int message_num = -1;
+	auto next_rick = std::chrono::steady_clock::now();
+	auto next_hello = std::chrono::steady_clock::now() + hello_period;
+	auto next_keepalive = std::chrono::steady_clock::now() + keepalive_period;
 	while (running)
 	{
-		message_num = (message_num + 1) % messages.size();
-		std::cout << "\rRick: " << messages[message_num] << "\n";
-		std::cout << "> " << buffered_msg << std::flush;
+		if (std::chrono::steady_clock::now() >= next_rick)
+		{
+			message_num = (message_num + 1) % messages.size();
+			std::cout << "\rRick: " << messages[message_num] << "\n";
+			std::cout << "> " << buffered_msg << std::flush;
+			next_rick += std::chrono::seconds(5);
+		}
+
+		// messages of other clients relayed by the server
+		char buffer[2048];
+		ssize_t num_bytes;
+		{
+			std::lock_guard<std::mutex> lock(link_mutex);
+			while ((num_bytes = recv(sfd, buffer, sizeof(buffer), 0)) > 0)
+			{
+				const bool frame = server_link.receive(buffer, size_t(num_bytes),
+					[](std::string_view message)
+					{
+						std::cout << "\rOther: ";
+						std::cout.write(message.data(), message.size()) << "\n";
+						std::cout << "> " << buffered_msg << std::flush;
+					});
+				if (frame)
+					welcomed = true;
+				else if (!welcomed)
+					on_handshake_datagram(std::string_view(buffer, size_t(num_bytes)));
+			}
+
+			const auto now = std::chrono::steady_clock::now();
+			if (!welcomed && now >= next_hello)
+			{
+				send_datagram(hello);
+				next_hello = now + hello_period;
+			}
+			if (welcomed && now >= next_keepalive)
+			{
+				send_datagram(Handshake::keepaliveMsg);
+				next_keepalive = now + keepalive_period;
+			}
+			server_link.update();
+		}
 
-		std::this_thread::sleep_for(std::chrono::seconds(5));
+		// often enough for the resends and acks of the link
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
 	}
 }
 
@@ -72,11 +160,9 @@ void handle_input()
 		else if (!buffered_msg.empty())
 		{
 			std::cout << "\rYou sent: " << buffered_msg << "\n";
-			ssize_t res =
-				sendto(sfd, buffered_msg.c_str(), buffered_msg.size(), 0, addr_info.ai_addr, addr_info.ai_addrlen);
-			if (res == -1)
 			{
-				std::cout << strerror(errno) << std::endl;
+				std::lock_guard<std::mutex> lock(link_mutex);
+				server_link.send(buffered_msg);
 			}
 
 			buffered_msg.clear();
@@ -94,6 +180,9 @@ int main(int argc, const char** argv)
 		return 1;
 	}
 
+	// what is typed meanwhile waits in the link and gets resent until the server takes it
+	send_hello({});
+
 	std::cout << "ChatClient - Type '/quit' to exit\n"
 			  << "> ";
 
@@ -0,0 +1,106 @@
+#include "connect_cookies.h"
+
+#include <random>
+
+
+static uint64_t rotl(uint64_t x, int b)
+{
+	return (x << b) | (x >> (64 - b));
+}
+
+static uint64_t read_little_endian(const uint8_t* bytes, size_t count)
+{
+	uint64_t value = 0;
+	for (size_t i = 0; i < count; ++i)
+		value |= uint64_t(bytes[i]) << (8 * i);
+	return value;
+}
+
+struct SipState
+{
+	uint64_t v0, v1, v2, v3;
+
+	void round()
+	{
+		v0 += v1;
+		v1 = rotl(v1, 13);
+		v1 ^= v0;
+		v0 = rotl(v0, 32);
+		v2 += v3;
+		v3 = rotl(v3, 16);
+		v3 ^= v2;
+		v0 += v3;
+		v3 = rotl(v3, 21);
+		v3 ^= v0;
+		v2 += v1;
+		v1 = rotl(v1, 17);
+		v1 ^= v2;
+		v2 = rotl(v2, 32);
+	}
+
+	void absorb(uint64_t word)
+	{
+		v3 ^= word;
+		round();
+		round();
+		v0 ^= word;
+	}
+};
+
+// SipHash-2-4 (Aumasson, Bernstein), a keyed hash that is a secure MAC for short inputs and cheap enough to run
+// for every hello
+static uint64_t siphash24(uint64_t key0, uint64_t key1, const uint8_t* data, size_t size)
+{
+	SipState state = {
+		key0 ^ 0x736f6d6570736575ull,
+		key1 ^ 0x646f72616e646f6dull,
+		key0 ^ 0x6c7967656e657261ull,
+		key1 ^ 0x7465646279746573ull,
+	};
+
+	const size_t whole = size / 8 * 8;
+	for (size_t i = 0; i < whole; i += 8)
+		state.absorb(read_little_endian(data + i, 8));
+	state.absorb(read_little_endian(data + whole, size - whole) | (uint64_t(size) << 56));
+
+	state.v2 ^= 0xff;
+	for (int i = 0; i < 4; ++i)
+		state.round();
+	return state.v0 ^ state.v1 ^ state.v2 ^ state.v3;
+}
+
+ConnectCookies::ConnectCookies()
+{
+	std::random_device random;
+	key0 = (uint64_t(random()) << 32) | random();
+	key1 = (uint64_t(random()) << 32) | random();
+}
+
+ConnectCookies::Cookie ConnectCookies::issue(const sockaddr_in& endpoint, Clock::time_point now) const
+{
+	return compute(endpoint, windowOf(now));
+}
+
+bool ConnectCookies::verify(const sockaddr_in& endpoint, Cookie cookie, Clock::time_point now) const
+{
+	const uint64_t current = windowOf(now);
+	return cookie == compute(endpoint, current) || cookie == compute(endpoint, current - 1);
+}
+
+uint64_t ConnectCookies::windowOf(Clock::time_point now)
+{
+	return uint64_t(now.time_since_epoch() / window);
+}
+
+// address and port as they are on the wire, the cookie only has to be the same for the same endpoint
+ConnectCookies::Cookie ConnectCookies::compute(const sockaddr_in& endpoint, uint64_t window_index) const
+{
+	uint8_t message[14];
+	for (int i = 0; i < 4; ++i)
+		message[i] = uint8_t(endpoint.sin_addr.s_addr >> (8 * i));
+	message[4] = uint8_t(endpoint.sin_port);
+	message[5] = uint8_t(endpoint.sin_port >> 8);
+	for (int i = 0; i < 8; ++i)
+		message[6 + i] = uint8_t(window_index >> (8 * i));
+	return siphash24(key0, key1, message, sizeof(message));
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <netinet/in.h>
+
+
+// Stateless proof that a client receives datagrams at the endpoint it sends from. A cookie is SipHash-2-4, keyed
+// with a secret drawn at startup, of the endpoint and the current time window; nothing is stored per endpoint,
+// a cookie is checked by computing it again. Cookies of the current and the previous window are accepted, so one
+// lives between one and two windows.
+class ConnectCookies
+{
+public:
+	using Clock = std::chrono::steady_clock;
+	using Cookie = uint64_t;
+
+	static constexpr std::chrono::seconds window{15};
+
+	ConnectCookies();
+
+	ConnectCookies(const ConnectCookies&) = delete;
+	ConnectCookies& operator=(const ConnectCookies&) = delete;
+
+	Cookie issue(const sockaddr_in& endpoint, Clock::time_point now) const;
+	bool verify(const sockaddr_in& endpoint, Cookie cookie, Clock::time_point now) const;
+
+private:
+	static uint64_t windowOf(Clock::time_point now);
+	Cookie compute(const sockaddr_in& endpoint, uint64_t window_index) const;
+
+private:
+	uint64_t key0;
+	uint64_t key1;
+};
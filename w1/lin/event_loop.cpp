@@ -0,0 +1,162 @@
+#include "event_loop.h"
+
+#include <cerrno>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+EventLoop::EventLoop()
+{
+	epollFd = epoll_create1(EPOLL_CLOEXEC);
+	// steady_clock is CLOCK_MONOTONIC on Linux, so deadlines can be handed over as they are
+	timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (epollFd == -1 || timerFd == -1)
+	{
+		perror("EventLoop");
+		return;
+	}
+
+	epoll_event event = {};
+	event.events = EPOLLIN;
+	event.data.fd = timerFd;
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, timerFd, &event);
+}
+
+EventLoop::~EventLoop()
+{
+	if (timerFd != -1)
+		close(timerFd);
+	if (epollFd != -1)
+		close(epollFd);
+}
+
+bool EventLoop::addSocket(int fd, Callback on_readable)
+{
+	epoll_event event = {};
+	event.events = EPOLLIN | EPOLLET;
+	event.data.fd = fd;
+	if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) != 0)
+		return false;
+	sockets[fd] = std::move(on_readable);
+	return true;
+}
+
+void EventLoop::removeSocket(int fd)
+{
+	epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+	sockets.erase(fd);
+}
+
+EventLoop::TimerId EventLoop::schedule(Clock::time_point deadline, Clock::duration period, Callback callback)
+{
+	const TimerId id = nextTimerId++;
+	timers[id] = Timer{deadline, period, std::move(callback)};
+	deadlines.push({deadline, id});
+	if (deadline < armedDeadline)
+		armTimerFd();
+	return id;
+}
+
+EventLoop::TimerId EventLoop::addTimer(Clock::time_point deadline, Callback callback)
+{
+	return schedule(deadline, Clock::duration::zero(), std::move(callback));
+}
+
+EventLoop::TimerId EventLoop::addPeriodicTimer(Clock::duration period, Callback callback)
+{
+	return schedule(Clock::now() + period, period, std::move(callback));
+}
+
+void EventLoop::cancelTimer(TimerId id)
+{
+	timers.erase(id);
+}
+
+void EventLoop::armTimerFd()
+{
+	while (!deadlines.empty() && timers.count(deadlines.top().id) == 0)
+		deadlines.pop();
+
+	itimerspec spec = {};
+	armedDeadline = deadlines.empty() ? Clock::time_point::max() : deadlines.top().deadline;
+	if (!deadlines.empty())
+	{
+		const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(armedDeadline.time_since_epoch()).count();
+		// an all-zero it_value disarms the timer, a deadline in the past still has to fire
+		spec.it_value.tv_sec = ns / 1000000000;
+		spec.it_value.tv_nsec = ns % 1000000000;
+		if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+			spec.it_value.tv_nsec = 1;
+	}
+	timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+void EventLoop::fireTimers()
+{
+	uint64_t expirations = 0;
+	while (read(timerFd, &expirations, sizeof(expirations)) > 0)
+		;
+
+	const Clock::time_point now = Clock::now();
+	while (!deadlines.empty() && deadlines.top().deadline <= now)
+	{
+		const Deadline top = deadlines.top();
+		deadlines.pop();
+		auto itf = timers.find(top.id);
+		// cancelled, or a stale entry of a timer that was rescheduled
+		if (itf == timers.end() || itf->second.deadline != top.deadline)
+			continue;
+
+		if (itf->second.period == Clock::duration::zero())
+		{
+			Callback callback = std::move(itf->second.callback);
+			timers.erase(itf);
+			callback();
+			continue;
+		}
+
+		Timer& timer = itf->second;
+		timer.deadline += timer.period;
+		// don't try to catch up on periods we slept through
+		if (timer.deadline <= now)
+			timer.deadline = now + timer.period;
+		deadlines.push({timer.deadline, top.id});
+		// a copy, the callback may cancel its own timer
+		Callback callback = timer.callback;
+		callback();
+	}
+	armTimerFd();
+}
+
+void EventLoop::run()
+{
+	constexpr int maxEvents = 64;
+	epoll_event events[maxEvents];
+
+	running = true;
+	while (running)
+	{
+		int num = epoll_wait(epollFd, events, maxEvents, -1);
+		if (num < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			return;
+		}
+
+		for (int i = 0; i < num; ++i)
+		{
+			const int fd = events[i].data.fd;
+			if (fd == timerFd)
+			{
+				fireTimers();
+				continue;
+			}
+			auto itf = sockets.find(fd);
+			if (itf != sockets.end())
+				itf->second();
+		}
+	}
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+
+// Single-threaded reactor over epoll. Sockets are registered edge-triggered, so a handler has to drain
+// its socket until EAGAIN. Timers fire at their exact deadline through one timerfd armed for the earliest one,
+// the loop never wakes up while there is nothing to do.
+class EventLoop
+{
+public:
+	using Clock = std::chrono::steady_clock;
+	using TimerId = uint64_t;
+	using Callback = std::function<void()>;
+
+	EventLoop();
+	~EventLoop();
+
+	EventLoop(const EventLoop&) = delete;
+	EventLoop& operator=(const EventLoop&) = delete;
+
+	bool isValid() const { return epollFd != -1 && timerFd != -1; }
+
+	bool addSocket(int fd, Callback on_readable);
+	void removeSocket(int fd);
+
+	TimerId addTimer(Clock::time_point deadline, Callback callback);
+	TimerId addTimer(Clock::duration delay, Callback callback) { return addTimer(Clock::now() + delay, callback); }
+	// First fires one period from now, deadlines don't drift with handler time
+	TimerId addPeriodicTimer(Clock::duration period, Callback callback);
+	void cancelTimer(TimerId id);
+	bool isTimerPending(TimerId id) const { return timers.count(id) != 0; }
+
+	void run();
+	void stop() { running = false; }
+
+private:
+	struct Timer
+	{
+		Clock::time_point deadline;
+		Clock::duration period;
+		Callback callback;
+	};
+
+	struct Deadline
+	{
+		Clock::time_point deadline;
+		TimerId id;
+
+		bool operator>(const Deadline& other) const { return deadline > other.deadline; }
+	};
+
+	TimerId schedule(Clock::time_point deadline, Clock::duration period, Callback callback);
+	void fireTimers();
+	void armTimerFd();
+
+private:
+	int epollFd = -1;
+	int timerFd = -1;
+	bool running = false;
+
+	std::unordered_map<int, Callback> sockets;
+
+	// cancelled and rescheduled timers leave stale entries behind, they are skipped when they reach the top
+	std::priority_queue<Deadline, std::vector<Deadline>, std::greater<Deadline>> deadlines;
+	std::unordered_map<TimerId, Timer> timers;
+	TimerId nextTimerId = 1;
+	Clock::time_point armedDeadline = Clock::time_point::max();
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+
+
+// How long relaying takes, from the moment a message is handled until the last copy is handed to the kernel.
+// Reported periodically so that a fan-out stalling the loop shows up in the log.
+class FanOutStats
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	FanOutStats() = default;
+	// every worker reports on its own, the label tells them apart
+	explicit FanOutStats(std::string label) : label(std::move(label)) {}
+
+	void record(Clock::duration elapsed, size_t messages, size_t datagrams)
+	{
+		this->messages += messages;
+		this->datagrams += datagrams;
+		// every message of a batch waits for the whole batch to go out
+		total += elapsed * messages;
+		worst = std::max(worst, elapsed);
+	}
+
+	// Prints and resets, nothing when nothing was relayed. One write, lines of several workers don't interleave
+	void report()
+	{
+		if (messages == 0)
+			return;
+		using us = std::chrono::microseconds;
+		std::ostringstream line;
+		line << label << ": " << messages << " messages -> " << datagrams << " datagrams, avg "
+			 << std::chrono::duration_cast<us>(total / messages).count() << " us, max "
+			 << std::chrono::duration_cast<us>(worst).count() << " us\n";
+		std::cout << line.str();
+		messages = datagrams = 0;
+		total = worst = Clock::duration::zero();
+	}
+
+private:
+	std::string label = "fan-out";
+	size_t messages = 0;
+	size_t datagrams = 0;
+	Clock::duration total = Clock::duration::zero();
+	Clock::duration worst = Clock::duration::zero();
+};
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+
+// Plain datagrams, not frames of a link: an endpoint gets its link only once the handshake is done.
+// "/___hello" asks for a cookie, "/___hello <cookie>" echoes it back; the server answers "/___cookie <cookie>" to
+// the first and "/___welcome" to the second, once the peer exists
+namespace Handshake
+{
+	inline constexpr std::string_view helloMsg = "/___hello";
+	inline constexpr std::string_view cookieMsg = "/___cookie";
+	inline constexpr std::string_view welcomeMsg = "/___welcome";
+	// sent by a client with nothing else to say, so the server doesn't forget it
+	inline constexpr std::string_view keepaliveMsg = "/___keepalive";
+	// hellos are padded with spaces to this, so no answer is bigger than what asked for it and the server can't be
+	// used to amplify a flood towards a spoofed address
+	inline constexpr size_t helloSize = 48;
+	inline constexpr size_t cookieDigits = 16; // hex
+} // namespace Handshake
@@ -0,0 +1,388 @@
+#include "reliable_link.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <random>
+
+static constexpr size_t max_assemblies = 64;
+
+static void write_u16(char* at, uint16_t value)
+{
+	at[0] = char(value & 0xff);
+	at[1] = char(value >> 8);
+}
+
+static void write_u32(char* at, uint32_t value)
+{
+	for (int i = 0; i < 4; ++i)
+		at[i] = char((value >> (8 * i)) & 0xff);
+}
+
+static uint16_t read_u16(const char* at)
+{
+	return uint16_t(uint8_t(at[0]) | (uint8_t(at[1]) << 8));
+}
+
+static uint32_t read_u32(const char* at)
+{
+	uint32_t value = 0;
+	for (int i = 0; i < 4; ++i)
+		value |= uint32_t(uint8_t(at[i])) << (8 * i);
+	return value;
+}
+
+// a is newer than b, with wrap-around
+static bool seq_newer(uint16_t a, uint16_t b)
+{
+	return int16_t(uint16_t(a - b)) > 0;
+}
+
+ReliableLink::ReliableLink(Transmit transmit)
+	: transmit(std::move(transmit))
+	// like a TCP ISN: a peer still holding state of an earlier link to us mustn't take new frames for duplicates
+	, nextSeq(uint16_t(std::random_device{}()))
+{
+	receivedSeqs.fill(-1);
+}
+
+bool ReliableLink::send(std::string_view message, bool reliable)
+{
+	if (!reliable)
+	{
+		if (headerSize + message.size() > maxDatagramSize)
+			return false;
+		char frame[maxDatagramSize];
+		frame[0] = char(FrameType::Unreliable);
+		write_u16(frame + 1, 0);
+		writeAckFields(frame);
+		memcpy(frame + headerSize, message.data(), message.size());
+		transmit(frame, headerSize + message.size());
+		++counters.sent;
+		onAckSent();
+		return true;
+	}
+
+	if (headerSize + message.size() <= maxDatagramSize)
+	{
+		sendReliable(FrameType::Reliable, 0, 0, 0, message);
+		return true;
+	}
+	if (message.size() > maxMessageSize)
+		return false;
+
+	const uint16_t messageId = nextMessageId++;
+	const size_t count = (message.size() + maxFragmentPayload - 1) / maxFragmentPayload;
+	for (size_t i = 0; i < count; ++i)
+		sendReliable(FrameType::Fragment, messageId, uint8_t(i), uint8_t(count),
+			message.substr(i * maxFragmentPayload, maxFragmentPayload));
+	return true;
+}
+
+void ReliableLink::sendReliable(
+	FrameType type, uint16_t message_id, uint8_t index, uint8_t count, std::string_view payload)
+{
+	// the slot is still taken by an older frame nobody acked yet, wait for it; frames go out in order
+	if (window[nextSeq % windowSize].inUse || !queued.empty())
+	{
+		queued.push_back({type, message_id, index, count, std::string(payload)});
+		return;
+	}
+	emitReliable(type, message_id, index, count, payload);
+}
+
+void ReliableLink::emitReliable(
+	FrameType type, uint16_t message_id, uint8_t index, uint8_t count, std::string_view payload)
+{
+	SentFrame& sent = window[nextSeq % windowSize];
+	const size_t header = type == FrameType::Fragment ? fragmentHeaderSize : headerSize;
+	sent.frame.resize(header + payload.size());
+	char* frame = sent.frame.data();
+	frame[0] = char(type);
+	write_u16(frame + 1, nextSeq);
+	if (type == FrameType::Fragment)
+	{
+		write_u16(frame + headerSize, message_id);
+		frame[headerSize + 2] = char(index);
+		frame[headerSize + 3] = char(count);
+	}
+	memcpy(frame + header, payload.data(), payload.size());
+
+	sent.inUse = true;
+	sent.seq = nextSeq++;
+	sent.sends = 0;
+	++inFlight;
+	transmitReliable(sent, Clock::now());
+}
+
+void ReliableLink::transmitReliable(SentFrame& sent, Clock::time_point now)
+{
+	// acks are always the latest, also on a resend
+	writeAckFields(sent.frame.data());
+	transmit(sent.frame.data(), sent.frame.size());
+	onAckSent();
+
+	if (sent.sends == 0)
+		++counters.sent;
+	else
+		++counters.retransmitted;
+	++sent.sends;
+	sent.sentAt = now;
+	// doubled on every resend, a lost ack shouldn't turn into a burst of copies
+	const auto backoff =
+		std::min<Clock::duration>(retransmitTimeout * (1 << std::min<int>(sent.sends - 1, 6)), maxRto);
+	sent.retransmitAt = now + backoff;
+	earliestRetransmit = std::min(earliestRetransmit, sent.retransmitAt);
+}
+
+void ReliableLink::writeAckFields(char* frame) const
+{
+	frame[0] = char(haveRemote ? uint8_t(frame[0]) | ackValid : uint8_t(frame[0]) & ~ackValid);
+	write_u16(frame + 3, remoteSeq);
+	write_u32(frame + 5, remoteBits);
+}
+
+void ReliableLink::sendAck()
+{
+	char frame[headerSize];
+	frame[0] = char(FrameType::Ack);
+	write_u16(frame + 1, 0);
+	writeAckFields(frame);
+	transmit(frame, headerSize);
+	onAckSent();
+}
+
+// the frame is too far behind to show up in ackBits, acked on its own with the seq field
+void ReliableLink::sendOldAck(uint16_t seq)
+{
+	char frame[headerSize];
+	frame[0] = char(FrameType::Ack);
+	write_u16(frame + 1, seq);
+	writeAckFields(frame);
+	frame[0] = char(uint8_t(frame[0]) | oldAck);
+	transmit(frame, headerSize);
+	onAckSent();
+}
+
+// every frame carries the acks, whatever went out last made a separate ack unnecessary
+void ReliableLink::onAckSent()
+{
+	ackPending = false;
+	framesSinceAck = 0;
+	ackDeadline = Clock::time_point::max();
+}
+
+bool ReliableLink::receive(const char* data, size_t size, const Deliver& on_message)
+{
+	if (size < headerSize)
+		return false;
+	const FrameType type = FrameType(uint8_t(data[0]) & ~(ackValid | oldAck));
+	if (type != FrameType::Unreliable && type != FrameType::Reliable && type != FrameType::Fragment &&
+		type != FrameType::Ack)
+		return false;
+	if (type == FrameType::Fragment && size < fragmentHeaderSize)
+		return false;
+
+	const Clock::time_point now = Clock::now();
+	if (uint8_t(data[0]) & ackValid)
+		onAck(read_u16(data + 3), read_u32(data + 5), now);
+
+	switch (type)
+	{
+		case FrameType::Unreliable:
+			on_message(std::string_view(data + headerSize, size - headerSize));
+			break;
+		case FrameType::Reliable:
+			if (markReceived(read_u16(data + 1), now))
+				on_message(std::string_view(data + headerSize, size - headerSize));
+			break;
+		case FrameType::Fragment:
+			if (markReceived(read_u16(data + 1), now))
+				onFragment(data, size, on_message);
+			break;
+		case FrameType::Ack:
+			if (uint8_t(data[0]) & oldAck)
+				ackOne(read_u16(data + 1), now);
+			break;
+	}
+
+	sendQueued();
+	return true;
+}
+
+void ReliableLink::onAck(uint16_t ack, uint32_t ack_bits, Clock::time_point now)
+{
+	if (inFlight == 0)
+		return;
+	ackOne(ack, now);
+	for (uint32_t i = 1; i <= 32; ++i)
+		if (ack_bits & (1u << (i - 1)))
+			ackOne(uint16_t(ack - i), now);
+
+	// Fast retransmit, as in RACK: a frame older than one that just got acked was most likely lost once it's had an
+	// RTT plus some slack for reordering to come through; waiting for the RTO would hold its window slot for nothing
+	if (inFlight == 0 || !haveRtt)
+		return;
+	const auto lostAfter = std::chrono::duration_cast<Clock::duration>(
+		std::chrono::duration<double, std::milli>(srttMs + std::max(rttVarMs, srttMs / 4)));
+	for (SentFrame& sent : window)
+		if (sent.inUse && seq_newer(ack, sent.seq) && now - sent.sentAt > lostAfter && sent.sends < maxSends)
+			transmitReliable(sent, now);
+}
+
+void ReliableLink::ackOne(uint16_t seq, Clock::time_point now)
+{
+	SentFrame& sent = window[seq % windowSize];
+	if (!sent.inUse || sent.seq != seq)
+		return;
+	// Karn: a resent frame's ack could belong to either copy, it says nothing about the RTT
+	if (sent.sends == 1)
+		onRttSample(now - sent.sentAt);
+	sent.inUse = false;
+	--inFlight;
+}
+
+void ReliableLink::onRttSample(Clock::duration sample)
+{
+	const double sampleMs = std::chrono::duration<double, std::milli>(sample).count();
+	if (!haveRtt)
+	{
+		srttMs = sampleMs;
+		rttVarMs = sampleMs / 2;
+		haveRtt = true;
+	}
+	else
+	{
+		rttVarMs = 0.75 * rttVarMs + 0.25 * std::abs(srttMs - sampleMs);
+		srttMs = 0.875 * srttMs + 0.125 * sampleMs;
+	}
+	const auto rto = std::chrono::duration<double, std::milli>(srttMs + 4 * rttVarMs);
+	retransmitTimeout = std::clamp<Clock::duration>(
+		std::chrono::duration_cast<Clock::duration>(rto), Clock::duration(minRto), Clock::duration(maxRto));
+}
+
+bool ReliableLink::markReceived(uint16_t seq, Clock::time_point now)
+{
+	// acked even when it's a duplicate, the ack for the first copy may have been lost
+	if (!haveRemote)
+	{
+		haveRemote = true;
+		remoteSeq = seq;
+		remoteBits = 0;
+	}
+	else if (seq_newer(seq, remoteSeq))
+	{
+		const uint16_t shift = uint16_t(seq - remoteSeq);
+		// frames that came in since the last ack would fall out of the bits before anybody saw them acked
+		if (ackPending && (shift > 32 || (remoteBits >> (32 - shift)) != 0))
+			sendAck();
+		remoteBits = shift > 32 ? 0 : ((shift == 32 ? 0 : remoteBits << shift) | (1u << (shift - 1)));
+		remoteSeq = seq;
+	}
+	else if (seq != remoteSeq)
+	{
+		const uint16_t behind = uint16_t(remoteSeq - seq);
+		if (behind <= 32)
+			remoteBits |= 1u << (behind - 1);
+		else
+			sendOldAck(seq);
+	}
+
+	ackPending = true;
+	if (++framesSinceAck >= ackEvery)
+		sendAck();
+	else if (ackDeadline == Clock::time_point::max())
+		ackDeadline = now + ackDelay;
+
+	int32_t& slot = receivedSeqs[seq % receivedHistory];
+	if (slot == seq)
+	{
+		++counters.duplicates;
+		return false;
+	}
+	slot = seq;
+	return true;
+}
+
+void ReliableLink::onFragment(const char* data, size_t size, const Deliver& on_message)
+{
+	const uint16_t messageId = read_u16(data + headerSize);
+	const uint8_t index = uint8_t(data[headerSize + 2]);
+	const uint8_t count = uint8_t(data[headerSize + 3]);
+	if (count == 0 || index >= count)
+		return;
+
+	auto itf = assemblies.find(messageId);
+	if (itf == assemblies.end())
+	{
+		// a peer that never finishes its messages can't make us hold on to everything
+		if (assemblies.size() >= max_assemblies)
+			assemblies.erase(assemblies.begin());
+		itf = assemblies.emplace(messageId, Assembly()).first;
+		itf->second.parts.resize(count);
+	}
+	Assembly& assembly = itf->second;
+	if (assembly.parts.size() != count || !assembly.parts[index].empty())
+		return;
+
+	assembly.parts[index].assign(data + fragmentHeaderSize, size - fragmentHeaderSize);
+	if (++assembly.received < count)
+		return;
+
+	std::string message;
+	for (const std::string& part : assembly.parts)
+		message += part;
+	assemblies.erase(itf);
+	on_message(message);
+}
+
+void ReliableLink::sendQueued()
+{
+	while (!queued.empty() && !window[nextSeq % windowSize].inUse)
+	{
+		const QueuedFrame& frame = queued.front();
+		emitReliable(frame.type, frame.messageId, frame.index, frame.count, frame.payload);
+		queued.pop_front();
+	}
+}
+
+void ReliableLink::update()
+{
+	const Clock::time_point now = Clock::now();
+	if (inFlight > 0 && now >= earliestRetransmit)
+	{
+		earliestRetransmit = Clock::time_point::max();
+		for (SentFrame& sent : window)
+		{
+			if (!sent.inUse)
+				continue;
+			if (now < sent.retransmitAt)
+			{
+				earliestRetransmit = std::min(earliestRetransmit, sent.retransmitAt);
+				continue;
+			}
+			if (sent.sends >= maxSends)
+			{
+				sent.inUse = false;
+				--inFlight;
+				++counters.failed;
+				continue;
+			}
+			transmitReliable(sent, now);
+		}
+		sendQueued();
+	}
+
+	if (ackPending && now >= ackDeadline)
+		sendAck();
+}
+
+ReliableLink::Clock::time_point ReliableLink::nextDeadline() const
+{
+	Clock::time_point deadline = Clock::time_point::max();
+	if (inFlight > 0)
+		deadline = earliestRetransmit;
+	if (ackPending)
+		deadline = std::min(deadline, ackDeadline);
+	return deadline;
+}
@@ -1,47 +1,431 @@
+#include <algorithm>
 #include <arpa/inet.h>
+#include <charconv>
 #include <cstring>
+#include <deque>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <sys/eventfd.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
 
+#include "connect_cookies.h"
+#include "event_loop.h"
+#include "fanout_stats.h"
+#include "handshake.h"
+#include "reliable_link.h"
 #include "socket_tools.h"
+#include "spsc_queue.h"
+#include "udp_batch.h"
+#include "uring_socket.h"
 
 
 const char* PORT = "2026";
+static constexpr std::chrono::seconds fan_out_report_period(10);
+// resends and delayed acks of the reliable links are checked this often
+static constexpr std::chrono::milliseconds link_update_period(10);
+// more workers than this per core only add threads fighting over the same cores
+static constexpr size_t max_workers_per_core = 4;
+// per pair of workers; what doesn't fit waits in the sender's outbox, nothing is dropped
+static constexpr size_t relay_queue_size = 4096;
+// a peer that sent nothing for this long and has nothing in flight is forgotten, clients send keepalives meanwhile
+static constexpr std::chrono::seconds peer_idle_timeout(60);
+static constexpr std::chrono::seconds peer_sweep_period(10);
 
-int main(int argc, const char** argv)
+// puts one datagram on the wire through whichever backend is running, bytes only valid during the call
+using SendDatagram = std::function<void(const sockaddr_in& to, const char* data, size_t size)>;
+
+struct Peer
+{
+	sockaddr_in address;
+	std::unique_ptr<ReliableLink> link;
+	ReliableLink::Clock::time_point lastSeen;
+};
+
+// address and port, what peers are looked up by
+using PeerKey = uint64_t;
+
+// A message another worker received, to be sent to this worker's peers. The text is allocated once and shared by
+// every worker it goes to
+struct Relay
+{
+	std::shared_ptr<const std::string> text;
+	sockaddr_in from;
+};
+
+// One worker thread with its own SO_REUSEPORT socket. The kernel hashes every sender to one of the sockets, so a
+// peer and its link only ever live in one shard and nothing of them is shared between threads; the only traffic
+// between workers are relays through the SPSC queues.
+struct Shard
+{
+	explicit Shard(size_t index) : index(index), stats("fan-out #" + std::to_string(index)) {}
+
+	size_t index;
+	int sfd = -1;
+	int wakeFd = -1; // eventfd, written by the others after they queued relays for this shard
+	// only endpoints that echoed a cookie get in, a spoofed source can't make the table grow
+	std::unordered_map<PeerKey, Peer> peers;
+	// the kernel keeps hashing an endpoint to the same shard, so its cookie is checked where it was issued
+	ConnectCookies cookies;
+	SendDatagram send; // the links of the peers send through it, pointed at the backend in use
+	std::vector<std::unique_ptr<SpscQueue<Relay>>> inboxes; // [from shard], pushed only by that shard's thread
+	std::vector<std::deque<Relay>> outboxes; // [to shard], waiting for room in its inbox
+	FanOutStats stats;
+};
+
+using Shards = std::vector<std::unique_ptr<Shard>>;
+
+static bool same_endpoint(const sockaddr_in& a, const sockaddr_in& b)
+{
+	return a.sin_addr.s_addr == b.sin_addr.s_addr && a.sin_port == b.sin_port;
+}
+
+static PeerKey key_of(const sockaddr_in& address)
+{
+	return (PeerKey(address.sin_addr.s_addr) << 16) | address.sin_port;
+}
+
+static bool is_hello(std::string_view datagram)
+{
+	return datagram.size() >= Handshake::helloSize &&
+		datagram.substr(0, Handshake::helloMsg.size()) == Handshake::helloMsg;
+}
+
+// "/___hello <16 hex digits>" padded with spaces, anything else has no cookie; a hello is long enough for one
+static bool parse_cookie(std::string_view hello, ConnectCookies::Cookie& cookie)
+{
+	if (hello[Handshake::helloMsg.size()] != ' ')
+		return false;
+	const char* first = hello.data() + Handshake::helloMsg.size() + 1;
+	const char* last = first + Handshake::cookieDigits;
+	const auto [end, error] = std::from_chars(first, last, cookie, 16);
+	return error == std::errc() && end == last;
+}
+
+static void send_text(Shard& shard, const sockaddr_in& to, std::string_view text)
+{
+	shard.send(to, text.data(), text.size());
+}
+
+// A datagram from an endpoint without a peer: a hello gets a cookie, a hello echoing a valid one makes the peer.
+// Replies are never bigger than the padded hello, anything else is dropped without an answer
+static void process_hello(Shard& shard, const sockaddr_in& from, std::string_view datagram)
 {
+	if (!is_hello(datagram))
+		return;
 
-	int sfd = create_server(PORT);
-	if (sfd == -1)
+	const auto now = ReliableLink::Clock::now();
+	ConnectCookies::Cookie cookie = 0;
+	if (parse_cookie(datagram, cookie) && shard.cookies.verify(from, cookie, now))
 	{
-		std::cout << "Failed to create a socket\n";
-		return 1;
+		const SendDatagram& send = shard.send;
+		auto link = std::make_unique<ReliableLink>([&send, from](const char* data, size_t size) { send(from, data, size); });
+		shard.peers.emplace(key_of(from), Peer{from, std::move(link), now});
+		send_text(shard, from, Handshake::welcomeMsg);
+		return;
 	}
 
-	std::cout << "ChatServer - Listening!\n";
+	static constexpr char digits[] = "0123456789abcdef";
+	char reply[Handshake::cookieMsg.size() + 1 + Handshake::cookieDigits];
+	char* end = std::copy(Handshake::cookieMsg.begin(), Handshake::cookieMsg.end(), reply);
+	*end++ = ' ';
+	cookie = shard.cookies.issue(from, now);
+	for (size_t i = 0; i < Handshake::cookieDigits; ++i)
+		*end++ = digits[(cookie >> (4 * (Handshake::cookieDigits - 1 - i))) & 0xf];
+	shard.send(from, reply, sizeof(reply));
+}
+
+static void relay_to_peers(std::unordered_map<PeerKey, Peer>& peers, std::string_view text, const sockaddr_in& from)
+{
+	for (auto& [key, peer] : peers)
+		if (!same_endpoint(peer.address, from))
+			peer.link->send(text);
+}
+
+// Decodes the frame, prints every message it completes and relays it to everyone else: this shard's peers right
+// away, the other shards' through their inboxes
+static void handle_message(Shard& shard, const Shards& shards, const Datagram& msg)
+{
+	auto found = shard.peers.find(key_of(*msg.from));
+	if (found == shard.peers.end())
+	{
+		process_hello(shard, *msg.from, std::string_view(msg.data, msg.size));
+		return;
+	}
+	Peer& sender = found->second;
+	sender.lastSeen = ReliableLink::Clock::now();
+	// the welcome got lost and the client still says hello; keepalives and other text are dropped by the link
+	if (is_hello(std::string_view(msg.data, msg.size)))
+	{
+		send_text(shard, sender.address, Handshake::welcomeMsg);
+		return;
+	}
+	const sockaddr_in from = sender.address;
+	sender.link->receive(msg.data, msg.size,
+		[&](std::string_view text)
+		{
+			// inet_ntoa's buffer is shared by all threads, and the line goes out in one write
+			char ip[INET_ADDRSTRLEN];
+			inet_ntop(AF_INET, &from.sin_addr, ip, sizeof(ip));
+			std::string line = "(" + std::string(ip) + ":" + std::to_string(from.sin_port) + "): ";
+			line.append(text).push_back('\n');
+			std::cout << line;
+
+			relay_to_peers(shard.peers, text, from);
+			if (shards.size() == 1)
+				return;
+			auto shared = std::make_shared<const std::string>(text);
+			for (size_t to = 0; to < shards.size(); ++to)
+				if (to != shard.index)
+					shard.outboxes[to].push_back({shared, from});
+		});
+}
 
-	fd_set read_set;
-	FD_ZERO(&read_set);
-	while (true)
+// Moves what fits from the outboxes into the other shards' inboxes and wakes those that got something
+static void flush_outboxes(Shard& shard, const Shards& shards)
+{
+	for (size_t to = 0; to < shards.size(); ++to)
 	{
-		FD_SET(sfd, &read_set);
-		timeval timeout = {0, 100000}; // 100 ms
-		select(sfd + 1, &read_set, NULL, NULL, &timeout);
+		std::deque<Relay>& outbox = shard.outboxes[to];
+		if (outbox.empty())
+			continue;
+		SpscQueue<Relay>& inbox = *shards[to]->inboxes[shard.index];
+		bool pushed = false;
+		while (!outbox.empty() && inbox.tryPush(outbox.front()))
+		{
+			outbox.pop_front();
+			pushed = true;
+		}
+		if (pushed)
+		{
+			const uint64_t one = 1;
+			write(shards[to]->wakeFd, &one, sizeof(one));
+		}
+	}
+}
 
-		if (FD_ISSET(sfd, &read_set))
+// Returns the number of relays taken
+static size_t drain_inboxes(Shard& shard)
+{
+	size_t relays = 0;
+	Relay relay;
+	for (auto& inbox : shard.inboxes)
+	{
+		while (inbox->tryPop(relay))
 		{
-			constexpr size_t buf_size = 1000;
-			static char buffer[buf_size];
-			memset(buffer, 0, buf_size);
+			relay_to_peers(shard.peers, *relay.text, relay.from);
+			++relays;
+		}
+	}
+	return relays;
+}
 
-			sockaddr_in socket_in;
-			socklen_t socket_len = sizeof(sockaddr_in);
-			ssize_t num_bytes = recvfrom(sfd, buffer, buf_size - 1, 0, (sockaddr*)&socket_in, &socket_len);
-			if (num_bytes > 0)
+static void update_links(std::unordered_map<PeerKey, Peer>& peers)
+{
+	for (auto& [key, peer] : peers)
+		peer.link->update();
+}
+
+// Forgets the peers that went silent, a client that comes back says hello again
+static void sweep_peers(std::unordered_map<PeerKey, Peer>& peers)
+{
+	const auto now = ReliableLink::Clock::now();
+	for (auto it = peers.begin(); it != peers.end();)
+	{
+		if (it->second.link->isIdle() && now - it->second.lastSeen >= peer_idle_timeout)
+			it = peers.erase(it);
+		else
+			++it;
+	}
+}
+
+// Relays from the other shards are picked up after every batch of completions, at the latest one tick later.
+// false when io_uring can't be used or its receive failed; the peers stay and carry on over epoll
+static bool run_uring(Shard& shard, const Shards& shards)
+{
+	UringSocket uring(shard.sfd);
+	if (!uring.isValid())
+		return false;
+	uring.setTick(link_update_period);
+
+	auto next_report = FanOutStats::Clock::now() + fan_out_report_period;
+	auto next_sweep = FanOutStats::Clock::now() + peer_sweep_period;
+	FanOutStats::Clock::time_point batch_start;
+	size_t messages = 0;
+	size_t datagrams = 0;
+	shard.send = [&](const sockaddr_in& to, const char* data, size_t size)
+	{
+		uring.send(to, data, size);
+		++datagrams;
+	};
+
+	return uring.run(
+		[&](const Datagram& msg)
+		{
+			if (messages++ == 0)
+				batch_start = FanOutStats::Clock::now();
+			handle_message(shard, shards, msg);
+		},
+		[&]()
+		{
+			if (messages == 0)
+				batch_start = FanOutStats::Clock::now();
+			messages += drain_inboxes(shard);
+			update_links(shard.peers);
+			flush_outboxes(shard, shards);
+			// sends are queued in the ring by now, they go out with the next submit
+			const auto now = FanOutStats::Clock::now();
+			if (messages > 0)
+				shard.stats.record(now - batch_start, messages, datagrams);
+			messages = datagrams = 0;
+			if (now >= next_report)
 			{
-				std::cout << "(" << inet_ntoa(socket_in.sin_addr) << ":" << socket_in.sin_port << "): " << buffer
-						  << std::endl;
+				shard.stats.report();
+				next_report = now + fan_out_report_period;
 			}
+			if (now >= next_sweep)
+			{
+				sweep_peers(shard.peers);
+				next_sweep = now + peer_sweep_period;
+			}
+			std::cout << std::flush;
+		});
+}
+
+static void run_epoll(Shard& shard, const Shards& shards)
+{
+	RecvBatch recv_batch(shard.sfd);
+	SendBatch send_batch(shard.sfd);
+
+	EventLoop loop;
+	if (!loop.isValid())
+		return;
+	if (shard.index == 0 && recv_batch.groEnabled())
+		std::cout << "UDP GRO enabled\n";
+
+	size_t datagrams = 0;
+	// frames are built on the stack or kept for resends, either way they may change before flush()
+	shard.send = [&](const sockaddr_in& to, const char* data, size_t size)
+	{
+		send_batch.addCopy(to, data, size);
+		++datagrams;
+	};
+
+	loop.addPeriodicTimer(fan_out_report_period, [&]() { shard.stats.report(); });
+	loop.addPeriodicTimer(peer_sweep_period, [&]() { sweep_peers(shard.peers); });
+	loop.addPeriodicTimer(link_update_period, [&]()
+		{
+			update_links(shard.peers);
+			send_batch.flush();
+			// retries relays that found an inbox full
+			flush_outboxes(shard, shards);
+		});
+
+	// edge-triggered, so the socket is drained completely on every wakeup
+	loop.addSocket(shard.sfd, [&]()
+		{
+			// up to batch_size datagrams per syscall instead of one recvfrom each
+			while (recv_batch.receive() > 0)
+			{
+				const auto start = FanOutStats::Clock::now();
+				datagrams = 0;
+				for (size_t i = 0; i < recv_batch.size(); ++i)
+					handle_message(shard, shards, recv_batch[i]);
+				// before the next receive() reuses the buffers
+				send_batch.flush();
+				shard.stats.record(FanOutStats::Clock::now() - start, recv_batch.size(), datagrams);
+			}
+			flush_outboxes(shard, shards);
+			std::cout << std::flush;
+		});
+
+	// the counter is read before draining, so relays queued after that wake the loop again
+	loop.addSocket(shard.wakeFd, [&]()
+		{
+			uint64_t count = 0;
+			read(shard.wakeFd, &count, sizeof(count));
+			const auto start = FanOutStats::Clock::now();
+			datagrams = 0;
+			const size_t relays = drain_inboxes(shard);
+			send_batch.flush();
+			if (relays > 0)
+				shard.stats.record(FanOutStats::Clock::now() - start, relays, datagrams);
+		});
+
+	loop.run();
+}
+
+static void run_shard(Shard& shard, const Shards& shards, bool io_uring)
+{
+	// io_uring falls back to epoll when the kernel doesn't allow it or can't receive through it
+	if (io_uring && run_uring(shard, shards))
+		return;
+	if (io_uring && shard.index == 0)
+		std::cout << "io_uring unavailable, using epoll\n";
+	run_epoll(shard, shards);
+}
+
+// ./server [--io-uring] [--workers N], one worker per core by default
+static void print_usage(const char* name)
+{
+	std::cout << "Usage: " << name << " [--io-uring] [--workers N]\n";
+}
+
+int main(int argc, const char** argv)
+{
+	bool io_uring = false;
+	const size_t cores = std::max(1u, std::thread::hardware_concurrency());
+	size_t workers = cores;
+	for (int i = 1; i < argc; ++i)
+	{
+		bool valid = true;
+		if (strcmp(argv[i], "--io-uring") == 0)
+			io_uring = true;
+		else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc)
+		{
+			const char* arg = argv[++i];
+			const char* end = arg + strlen(arg);
+			const auto [ptr, error] = std::from_chars(arg, end, workers);
+			valid = error == std::errc() && ptr == end && workers > 0;
+		}
+		else
+			valid = false;
+		if (!valid)
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+	workers = std::min(workers, cores * max_workers_per_core);
+
+	// every socket is bound before any worker starts, a port taken by someone else fails here and not halfway
+	Shards shards;
+	for (size_t i = 0; i < workers; ++i)
+	{
+		auto shard = std::make_unique<Shard>(i);
+		shard->sfd = create_shared_server(PORT);
+		shard->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (shard->sfd == -1 || shard->wakeFd == -1)
+		{
+			std::cout << "Failed to create a socket\n";
+			return 1;
 		}
+		for (size_t from = 0; from < workers; ++from)
+			shard->inboxes.push_back(std::make_unique<SpscQueue<Relay>>(from == i ? 1 : relay_queue_size));
+		shard->outboxes.resize(workers);
+		shards.push_back(std::move(shard));
 	}
+
+	std::cout << "ChatServer - Listening! (" << workers << " workers" << (io_uring ? ", io_uring" : "") << ")\n";
+
+	std::vector<std::thread> threads;
+	for (auto& shard : shards)
+		threads.emplace_back(run_shard, std::ref(*shard), std::cref(shards), io_uring);
+	for (std::thread& thread : threads)
+		thread.join();
 	return 0;
 }
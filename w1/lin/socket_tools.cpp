@@ -7,7 +7,7 @@
 #include <unistd.h>
 
 // https://linux.die.net/man/3/getaddrinfo
-static int get_dgram_socket(addrinfo* addr, bool is_server, addrinfo* res_addr)
+static int get_dgram_socket(addrinfo* addr, bool is_server, bool reuse_port, addrinfo* res_addr)
 {
 	for (addrinfo* ptr = addr; ptr != nullptr; ptr = ptr->ai_next)
 	{
@@ -22,6 +22,12 @@ static int get_dgram_socket(addrinfo* addr, bool is_server, addrinfo* res_addr)
 
 		int true_val = 1;
 		setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, &true_val, sizeof(int));
+		// every socket bound to the port gets a share of the senders, by the hash of their address and port
+		if (reuse_port && setsockopt(sfd, SOL_SOCKET, SO_REUSEPORT, &true_val, sizeof(int)) != 0)
+		{
+			close(sfd);
+			continue;
+		}
 
 		if (res_addr)
 			*res_addr = *ptr;
@@ -36,7 +42,7 @@ static int get_dgram_socket(addrinfo* addr, bool is_server, addrinfo* res_addr)
 	return -1;
 }
 
-int create_dgram_socket(const char* address, const char* port, addrinfo* res_addr)
+static int create_socket(const char* address, const char* port, bool reuse_port, addrinfo* res_addr)
 {
 	addrinfo hints;
 	memset(&hints, 0, sizeof(addrinfo));
@@ -53,15 +59,25 @@ int create_dgram_socket(const char* address, const char* port, addrinfo* res_add
 	if (getaddrinfo(address, port, &hints, &result) != 0)
 		return -1;
 
-	int sfd = get_dgram_socket(result, is_server, res_addr);
+	int sfd = get_dgram_socket(result, is_server, reuse_port, res_addr);
 
 	// freeaddrinfo(result);
 	return sfd;
 }
 
+int create_dgram_socket(const char* address, const char* port, addrinfo* res_addr)
+{
+	return create_socket(address, port, false, res_addr);
+}
+
 int create_server(const char* port)
 {
-	return create_dgram_socket(nullptr, port, nullptr); // 2026
+	return create_socket(nullptr, port, false, nullptr); // 2026
+}
+
+int create_shared_server(const char* port)
+{
+	return create_socket(nullptr, port, true, nullptr);
 }
 
 int create_client(const char* address, const char* port, addrinfo* res_addr)
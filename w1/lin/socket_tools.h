@@ -6,4 +6,7 @@ int create_dgram_socket(const char* address, const char* port, addrinfo* res_add
 
 int create_server(const char* port);
 
+// With SO_REUSEPORT, any number of them can be bound to the port and the kernel spreads the senders between them
+int create_shared_server(const char* port);
+
 int create_client(const char* address, const char* port, addrinfo* res_addr);
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+
+// Bounded lock-free queue for exactly one producer thread and one consumer thread. A ring of power-of-two size;
+// each side owns one index and only reads the other's, so a push or a pop is one acquire load and one release
+// store, no locks and no CAS loops. The indices sit on their own cache lines so the two threads don't fight
+// over them.
+template <typename T>
+class SpscQueue
+{
+public:
+	// capacity is rounded up to a power of two
+	explicit SpscQueue(size_t capacity)
+	{
+		size_t size = 1;
+		while (size < capacity)
+			size *= 2;
+		mask = size - 1;
+		slots = std::make_unique<T[]>(size);
+	}
+
+	SpscQueue(const SpscQueue&) = delete;
+	SpscQueue& operator=(const SpscQueue&) = delete;
+
+	// Producer side. false when the queue is full, value is left as it was then
+	bool tryPush(T& value)
+	{
+		const size_t tail = tailIndex.load(std::memory_order_relaxed);
+		if (tail - cachedHead > mask)
+		{
+			cachedHead = headIndex.load(std::memory_order_acquire);
+			if (tail - cachedHead > mask)
+				return false;
+		}
+		slots[tail & mask] = std::move(value);
+		tailIndex.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer side. false when the queue is empty
+	bool tryPop(T& value)
+	{
+		const size_t head = headIndex.load(std::memory_order_relaxed);
+		if (head == cachedTail)
+		{
+			cachedTail = tailIndex.load(std::memory_order_acquire);
+			if (head == cachedTail)
+				return false;
+		}
+		value = std::move(slots[head & mask]);
+		slots[head & mask] = T(); // whatever it owns is released by the consumer, not when the slot is reused
+		headIndex.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	std::unique_ptr<T[]> slots;
+	size_t mask = 0;
+
+	alignas(64) std::atomic<size_t> headIndex{0};
+	size_t cachedTail = 0; // consumer's last look at tailIndex
+	alignas(64) std::atomic<size_t> tailIndex{0};
+	size_t cachedHead = 0; // producer's last look at headIndex
+};
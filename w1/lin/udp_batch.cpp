@@ -0,0 +1,142 @@
+#include "udp_batch.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <netinet/udp.h>
+
+#ifndef SOL_UDP
+#define SOL_UDP IPPROTO_UDP
+#endif
+
+// Plain datagrams are capped well below this, a GRO burst can take up to 64 KiB
+static constexpr size_t plain_slot_size = 2048;
+static constexpr size_t gro_slot_size = 65536;
+
+RecvBatch::RecvBatch(int sfd, bool gro)
+	: sfd(sfd)
+{
+#ifdef UDP_GRO
+	int true_val = 1;
+	this->gro = gro && setsockopt(sfd, SOL_UDP, UDP_GRO, &true_val, sizeof(int)) == 0;
+#else
+	(void)gro;
+#endif
+	slotSize = this->gro ? gro_slot_size : plain_slot_size;
+
+	buffers.resize(batch_size * slotSize);
+	addresses.resize(batch_size);
+	iovecs.resize(batch_size);
+	controls.resize(batch_size * CMSG_SPACE(sizeof(int)));
+	headers.resize(batch_size);
+	datagrams.reserve(batch_size);
+}
+
+int RecvBatch::receive()
+{
+	datagrams.clear();
+
+	// recvmmsg overwrites the lengths, everything else has to be reset each time
+	for (size_t i = 0; i < batch_size; ++i)
+	{
+		iovecs[i] = {&buffers[i * slotSize], slotSize};
+		msghdr& hdr = headers[i].msg_hdr;
+		hdr.msg_name = &addresses[i];
+		hdr.msg_namelen = sizeof(sockaddr_in);
+		hdr.msg_iov = &iovecs[i];
+		hdr.msg_iovlen = 1;
+		hdr.msg_control = gro ? &controls[i * CMSG_SPACE(sizeof(int))] : nullptr;
+		hdr.msg_controllen = gro ? CMSG_SPACE(sizeof(int)) : 0;
+		hdr.msg_flags = 0;
+		headers[i].msg_len = 0;
+	}
+
+	int num = recvmmsg(sfd, headers.data(), batch_size, MSG_DONTWAIT, nullptr);
+	if (num < 0)
+		return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+
+	for (int i = 0; i < num; ++i)
+	{
+		const char* data = &buffers[i * slotSize];
+		size_t size = headers[i].msg_len;
+		size_t segment = size;
+#ifdef UDP_GRO
+		msghdr& hdr = headers[i].msg_hdr;
+		for (cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); gro && cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg))
+			if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+			{
+				int gso_size = 0;
+				memcpy(&gso_size, CMSG_DATA(cmsg), sizeof(int));
+				if (gso_size > 0)
+					segment = size_t(gso_size);
+			}
+#endif
+		// every segment is gso_size long except maybe the last one
+		for (size_t offset = 0; offset < size; offset += segment)
+			datagrams.push_back({data + offset, std::min(segment, size - offset), &addresses[i]});
+		if (size == 0)
+			datagrams.push_back({data, 0, &addresses[i]});
+	}
+	return int(datagrams.size());
+}
+
+SendBatch::SendBatch(int sfd)
+	: sfd(sfd)
+	, addresses(batch_size)
+	, iovecs(batch_size)
+	, headers(batch_size)
+	, copies(batch_size)
+{
+}
+
+void SendBatch::add(const sockaddr_in& to, const char* data, size_t size)
+{
+	if (count == batch_size)
+		flush();
+
+	addresses[count] = to;
+	iovecs[count] = {const_cast<char*>(data), size};
+	msghdr& hdr = headers[count].msg_hdr;
+	memset(&hdr, 0, sizeof(msghdr));
+	hdr.msg_name = &addresses[count];
+	hdr.msg_namelen = sizeof(sockaddr_in);
+	hdr.msg_iov = &iovecs[count];
+	hdr.msg_iovlen = 1;
+	++count;
+}
+
+void SendBatch::addCopy(const sockaddr_in& to, const char* data, size_t size)
+{
+	if (count == batch_size)
+		flush();
+
+	copies[count].assign(data, data + size);
+	add(to, copies[count].data(), size);
+}
+
+size_t SendBatch::flush()
+{
+	size_t sent = 0;
+	size_t failed = 0;
+	while (sent < count)
+	{
+		int num = sendmmsg(sfd, headers.data() + sent, unsigned(count - sent), 0);
+		if (num < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			// the datagram at the front failed, skip it and keep going with the rest
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				++sent;
+				++failed;
+				continue;
+			}
+			break;
+		}
+		sent += size_t(num);
+	}
+	const size_t delivered = sent - failed;
+	count = 0;
+	return delivered;
+}
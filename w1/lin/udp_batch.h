@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <vector>
+
+
+struct Datagram
+{
+	const char* data;
+	size_t size;
+	const sockaddr_in* from;
+};
+
+// Drains up to batch_size datagrams per recvmmsg call into preallocated slots.
+// With UDP GRO the kernel may coalesce several datagrams of one sender into one slot,
+// they are split back into separate Datagrams here.
+class RecvBatch
+{
+public:
+	static constexpr size_t batch_size = 64;
+
+	// gro: ask for UDP_GRO on the socket, slots then have to fit a whole coalesced burst
+	explicit RecvBatch(int sfd, bool gro = true);
+
+	// Non-blocking, 0 when the socket is drained, -1 on error.
+	// Datagrams stay valid until the next call.
+	int receive();
+
+	size_t size() const { return datagrams.size(); }
+	const Datagram& operator[](size_t i) const { return datagrams[i]; }
+
+	bool groEnabled() const { return gro; }
+
+private:
+	int sfd;
+	bool gro = false;
+	size_t slotSize;
+	std::vector<char> buffers;
+	std::vector<sockaddr_in> addresses;
+	std::vector<iovec> iovecs;
+	std::vector<char> controls;
+	std::vector<mmsghdr> headers;
+	std::vector<Datagram> datagrams;
+};
+
+// Queues datagrams and sends them with one sendmmsg per batch_size.
+// Payloads aren't copied, they have to stay alive until flush(): a message fanned out to many peers
+// is queued as many headers pointing at the same bytes.
+class SendBatch
+{
+public:
+	// the most sendmmsg takes per call (UIO_MAXIOV), one relayed message can fan out to thousands of peers
+	static constexpr size_t batch_size = 1024;
+
+	explicit SendBatch(int sfd);
+
+	void add(const sockaddr_in& to, const char* data, size_t size);
+	// For payloads that don't outlive the call, they are copied into the slot
+	void addCopy(const sockaddr_in& to, const char* data, size_t size);
+	// Number of datagrams the kernel took, the rest are dropped like a failed sendto would
+	size_t flush();
+
+private:
+	int sfd;
+	size_t count = 0;
+	std::vector<sockaddr_in> addresses;
+	std::vector<iovec> iovecs;
+	std::vector<mmsghdr> headers;
+	std::vector<std::vector<char>> copies; // per slot, keeps its capacity between batches
+};
@@ -0,0 +1,409 @@
+#include "uring_socket.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifdef CHAT_HAS_IO_URING
+#include <linux/io_uring.h>
+
+static constexpr uint64_t recv_user_data = ~0ull;
+static constexpr uint64_t tick_user_data = ~0ull - 1;
+static constexpr uint16_t buffer_group = 0;
+
+static int io_uring_setup(unsigned entries, io_uring_params* params)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+static int io_uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args)
+{
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+UringSocket::UringSocket(int sfd)
+	: sfd(sfd)
+{
+	io_uring_params params = {};
+	// multishot receive posts a completion per datagram, leave room for bursts on top of the sends
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = 8 * queue_depth + buffer_count;
+	int fd = io_uring_setup(queue_depth, &params);
+	if (fd < 0)
+	{
+		perror("io_uring_setup");
+		return;
+	}
+	if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+	{
+		printf("io_uring: kernel too old, no single mmap\n");
+		close(fd);
+		return;
+	}
+
+	const size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	const size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	ringSize = sqSize > cqSize ? sqSize : cqSize;
+	ringPtr = mmap(nullptr, ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+	void* sqesPtr = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (ringPtr == MAP_FAILED || sqesPtr == MAP_FAILED)
+	{
+		perror("io_uring mmap");
+		if (ringPtr != MAP_FAILED)
+			munmap(ringPtr, ringSize);
+		if (sqesPtr != MAP_FAILED)
+			munmap(sqesPtr, sqesSize);
+		ringPtr = nullptr;
+		close(fd);
+		return;
+	}
+
+	char* ring = static_cast<char*>(ringPtr);
+	sqHead = reinterpret_cast<unsigned*>(ring + params.sq_off.head);
+	sqTail = reinterpret_cast<unsigned*>(ring + params.sq_off.tail);
+	sqMask = *reinterpret_cast<unsigned*>(ring + params.sq_off.ring_mask);
+	sqEntries = params.sq_entries;
+	sqArray = reinterpret_cast<unsigned*>(ring + params.sq_off.array);
+	cqHead = reinterpret_cast<unsigned*>(ring + params.cq_off.head);
+	cqTail = reinterpret_cast<unsigned*>(ring + params.cq_off.tail);
+	cqMask = *reinterpret_cast<unsigned*>(ring + params.cq_off.ring_mask);
+	cqes = reinterpret_cast<io_uring_cqe*>(ring + params.cq_off.cqes);
+	sqes = static_cast<io_uring_sqe*>(sqesPtr);
+	ringFd = fd;
+
+	if (!probeOpcodes() || !setupBufferRing())
+	{
+		close(ringFd);
+		ringFd = -1;
+		return;
+	}
+
+	sendSlots = std::make_unique<SendSlot[]>(max_sends_in_flight);
+	freeSendSlots.reserve(max_sends_in_flight);
+	for (uint32_t i = max_sends_in_flight; i > 0; --i)
+		freeSendSlots.push_back(i - 1);
+
+	recvMsg.msg_namelen = sizeof(sockaddr_in);
+}
+
+UringSocket::~UringSocket()
+{
+	// closing the ring cancels whatever is still in flight
+	if (ringFd != -1)
+		close(ringFd);
+	if (bufRing)
+		munmap(bufRing, bufRingSize);
+	if (sqes)
+		munmap(sqes, sqesSize);
+	if (ringPtr)
+		munmap(ringPtr, ringSize);
+}
+
+// A ring can be set up on kernels that lack some of the opcodes used here, they would only fail once submitted.
+// The multishot flag of recvmsg isn't in the probe, a kernel without it fails the first receive and run() gives up
+bool UringSocket::probeOpcodes()
+{
+	constexpr unsigned opCount = 256;
+	std::vector<char> storage(sizeof(io_uring_probe) + opCount * sizeof(io_uring_probe_op));
+	io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(storage.data());
+	if (io_uring_register(ringFd, IORING_REGISTER_PROBE, probe, opCount) != 0)
+	{
+		perror("io_uring probe");
+		return false;
+	}
+	for (uint8_t op : {IORING_OP_RECVMSG, IORING_OP_SENDMSG, IORING_OP_TIMEOUT})
+	{
+		if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+		{
+			printf("io_uring: kernel lacks opcode %u\n", unsigned(op));
+			return false;
+		}
+	}
+	return true;
+}
+
+bool UringSocket::setupBufferRing()
+{
+	bufRingSize = buffer_count * sizeof(io_uring_buf);
+	void* mem = mmap(nullptr, bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED)
+		return false;
+	bufRing = static_cast<io_uring_buf_ring*>(mem);
+
+	io_uring_buf_reg reg = {};
+	reg.ring_addr = reinterpret_cast<uint64_t>(mem);
+	reg.ring_entries = buffer_count;
+	reg.bgid = buffer_group;
+	if (io_uring_register(ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+	{
+		perror("io_uring provided buffer ring");
+		return false;
+	}
+
+	buffers = std::make_unique<char[]>(size_t(buffer_count) * buffer_size);
+	bufferRefs.assign(buffer_count, 0);
+	for (unsigned i = 0; i < buffer_count; ++i)
+		releaseBuffer(int(i));
+	return true;
+}
+
+void UringSocket::releaseBuffer(int buffer_id)
+{
+	// not bufRing->bufs: in C++ the kernel header's flex array macro shifts it past an empty struct
+	io_uring_buf& buf = reinterpret_cast<io_uring_buf*>(bufRing)[bufRingTail & (buffer_count - 1)];
+	buf.addr = reinterpret_cast<uint64_t>(&buffers[size_t(buffer_id) * buffer_size]);
+	buf.len = buffer_size;
+	buf.bid = uint16_t(buffer_id);
+	++bufRingTail;
+	__atomic_store_n(&bufRing->tail, bufRingTail, __ATOMIC_RELEASE);
+}
+
+io_uring_sqe* UringSocket::getSqe()
+{
+	unsigned tail = *sqTail;
+	if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) == sqEntries)
+	{
+		submit(false);
+		tail = *sqTail;
+		if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) == sqEntries)
+			return nullptr;
+	}
+
+	const unsigned index = tail & sqMask;
+	io_uring_sqe* sqe = &sqes[index];
+	memset(sqe, 0, sizeof(io_uring_sqe));
+	sqArray[index] = index;
+	__atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+	++toSubmit;
+	return sqe;
+}
+
+int UringSocket::submit(bool wait)
+{
+	int res = io_uring_enter(ringFd, toSubmit, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0);
+	if (res >= 0)
+		toSubmit -= unsigned(res);
+	return res;
+}
+
+void UringSocket::armRecv()
+{
+	io_uring_sqe* sqe = getSqe();
+	if (!sqe)
+		return;
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = sfd;
+	sqe->addr = reinterpret_cast<uint64_t>(&recvMsg);
+	sqe->len = 1;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = buffer_group;
+	sqe->user_data = recv_user_data;
+	recvArmed = true;
+}
+
+void UringSocket::armTick()
+{
+	static_assert(sizeof(TickSpec) == sizeof(__kernel_timespec), "TickSpec has to match __kernel_timespec");
+	io_uring_sqe* sqe = getSqe();
+	if (!sqe)
+		return;
+	tickSpec.sec = tickPeriod.count() / 1000000000;
+	tickSpec.nsec = tickPeriod.count() % 1000000000;
+	// no completion count, a pure timeout that completes with -ETIME
+	sqe->opcode = IORING_OP_TIMEOUT;
+	sqe->addr = reinterpret_cast<uint64_t>(&tickSpec);
+	sqe->len = 1;
+	sqe->user_data = tick_user_data;
+	tickArmed = true;
+}
+
+void UringSocket::send(const sockaddr_in& to, const char* data, size_t size)
+{
+	// every slot in flight, wait for some to come back; datagrams arriving meanwhile are handled later
+	while (freeSendSlots.empty())
+	{
+		if (submit(true) < 0 && errno != EINTR)
+			return;
+		processCompletions(nullptr);
+	}
+
+	const uint32_t slotIndex = freeSendSlots.back();
+	SendSlot& slot = sendSlots[slotIndex];
+	slot.to = to;
+	slot.bufferId = -1;
+
+	const char* current = currentBuffer >= 0 ? &buffers[size_t(currentBuffer) * buffer_size] : nullptr;
+	if (current && data >= current && data + size <= current + buffer_size)
+	{
+		slot.bufferId = currentBuffer;
+		++bufferRefs[currentBuffer];
+		slot.iov = {const_cast<char*>(data), size};
+	}
+	else
+	{
+		slot.copy.assign(data, data + size);
+		slot.iov = {slot.copy.data(), size};
+	}
+
+	slot.hdr = {};
+	slot.hdr.msg_name = &slot.to;
+	slot.hdr.msg_namelen = sizeof(sockaddr_in);
+	slot.hdr.msg_iov = &slot.iov;
+	slot.hdr.msg_iovlen = 1;
+
+	io_uring_sqe* sqe = getSqe();
+	if (!sqe)
+	{
+		if (slot.bufferId >= 0)
+			--bufferRefs[slot.bufferId];
+		return;
+	}
+	freeSendSlots.pop_back();
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = sfd;
+	sqe->addr = reinterpret_cast<uint64_t>(&slot.hdr);
+	sqe->len = 1;
+	sqe->user_data = slotIndex;
+}
+
+void UringSocket::onSendDone(uint32_t slot_index)
+{
+	SendSlot& slot = sendSlots[slot_index];
+	if (slot.bufferId >= 0 && --bufferRefs[slot.bufferId] == 0)
+		releaseBuffer(slot.bufferId);
+	freeSendSlots.push_back(slot_index);
+}
+
+void UringSocket::onRecv(const io_uring_cqe& cqe, const DatagramHandler& on_datagram)
+{
+	// out of buffers, armed again once some are released; other errors stopped run() already
+	if (cqe.res < 0)
+		return;
+	if (!(cqe.flags & IORING_CQE_F_BUFFER))
+		return;
+
+	const int bufferId = int(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+	const char* buf = &buffers[size_t(bufferId) * buffer_size];
+	// io_uring_recvmsg_out, then the address and the (empty) control data, then the payload
+	io_uring_recvmsg_out out;
+	memcpy(&out, buf, sizeof(out));
+	sockaddr_in from = {};
+	memcpy(&from, buf + sizeof(out), out.namelen < sizeof(from) ? out.namelen : sizeof(from));
+	const char* payload = buf + sizeof(out) + recvMsg.msg_namelen + recvMsg.msg_controllen;
+	size_t size = out.payloadlen;
+	const size_t room = buffer_size - (payload - buf);
+	if (size > room)
+		size = room; // truncated, like recvfrom into a short buffer
+
+	// the handler holds the buffer, sends of its payload add their own references
+	bufferRefs[bufferId] = 1;
+	currentBuffer = bufferId;
+	on_datagram(Datagram{payload, size, &from});
+	currentBuffer = -1;
+	if (--bufferRefs[bufferId] == 0)
+		releaseBuffer(bufferId);
+}
+
+void UringSocket::processCompletions(const DatagramHandler& on_datagram)
+{
+	unsigned head = *cqHead;
+	while (true)
+	{
+		const unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+		if (head == tail)
+			break;
+		const io_uring_cqe cqe = cqes[head & cqMask];
+		++head;
+		// hand the slot back before handling, handlers may block waiting for more completions
+		__atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+
+		if (cqe.user_data == tick_user_data)
+		{
+			tickArmed = false;
+			continue;
+		}
+		if (cqe.user_data != recv_user_data)
+		{
+			onSendDone(uint32_t(cqe.user_data));
+			continue;
+		}
+		if (!(cqe.flags & IORING_CQE_F_MORE))
+			recvArmed = false; // ran out of buffers or failed, armed again by run()
+		// re-arming would only fail the same way, EINVAL from a kernel without multishot recvmsg most of all
+		if (cqe.res < 0 && cqe.res != -ENOBUFS && !recvFailed)
+		{
+			printf("io_uring recvmsg failed: %s\n", strerror(-cqe.res));
+			recvFailed = true;
+			running = false;
+		}
+		if (on_datagram)
+			onRecv(cqe, on_datagram);
+		else
+			deferredRecvs.push_back(cqe);
+	}
+}
+
+bool UringSocket::run(const DatagramHandler& on_datagram, const BatchHandler& on_batch_end)
+{
+	running = true;
+	while (running)
+	{
+		if (!recvArmed)
+			armRecv();
+		if (tickPeriod.count() > 0 && !tickArmed)
+			armTick();
+
+		// queued sends go out with the same syscall that waits for the next completions
+		if (submit(true) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+		{
+			perror("io_uring_enter");
+			return false;
+		}
+		processCompletions(on_datagram);
+		// received while a handler was waiting for send slots
+		for (size_t i = 0; i < deferredRecvs.size(); ++i)
+		{
+			const io_uring_cqe cqe = deferredRecvs[i];
+			onRecv(cqe, on_datagram);
+		}
+		deferredRecvs.clear();
+		if (on_batch_end)
+			on_batch_end();
+	}
+	return !recvFailed;
+}
+
+#else
+
+struct io_uring_cqe
+{
+};
+
+UringSocket::UringSocket(int sfd)
+	: sfd(sfd)
+{
+	printf("Built without io_uring support\n");
+}
+
+UringSocket::~UringSocket() = default;
+
+void UringSocket::send(const sockaddr_in&, const char*, size_t)
+{
+}
+
+bool UringSocket::run(const DatagramHandler&, const BatchHandler&)
+{
+	return false;
+}
+
+#endif
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <vector>
+
+#include "udp_batch.h"
+
+#if __has_include(<linux/io_uring.h>)
+#define CHAT_HAS_IO_URING 1
+#endif
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+// io_uring backend for one UDP socket, an alternative to EventLoop + RecvBatch/SendBatch.
+// Receiving is a single multishot recvmsg that picks buffers from a provided buffer ring, so no syscall is
+// made per datagram or per batch of datagrams. Sends are queued as SQEs and submitted together with the wait
+// for the next completions. Talks to the kernel through the raw syscalls, no liburing needed.
+class UringSocket
+{
+public:
+	static constexpr unsigned queue_depth = 256;
+	static constexpr unsigned buffer_count = 256; // power of two
+	static constexpr unsigned buffer_size = 2048;
+	static constexpr unsigned max_sends_in_flight = 4096;
+
+	using DatagramHandler = std::function<void(const Datagram&)>;
+	using BatchHandler = std::function<void()>;
+
+	explicit UringSocket(int sfd);
+	~UringSocket();
+
+	UringSocket(const UringSocket&) = delete;
+	UringSocket& operator=(const UringSocket&) = delete;
+
+	// false when the kernel doesn't support io_uring (or blocks it) or lacks an opcode used here, fall back to the
+	// epoll path then
+	bool isValid() const { return ringFd != -1; }
+
+	// Payload of the datagram being handled is sent without a copy, the receive buffer is held until
+	// the send completes; anything else is copied.
+	void send(const sockaddr_in& to, const char* data, size_t size);
+
+	// on_batch_end also runs at least once per period when nothing arrives, for timers of the caller
+	void setTick(std::chrono::nanoseconds period) { tickPeriod = period; }
+
+	// Completion-driven: on_datagram for every received datagram, on_batch_end after each batch of completions.
+	// false when receiving or waiting failed for good, the socket is left for the epoll path to take over
+	bool run(const DatagramHandler& on_datagram, const BatchHandler& on_batch_end);
+	void stop() { running = false; }
+
+private:
+	struct SendSlot
+	{
+		msghdr hdr;
+		iovec iov;
+		sockaddr_in to;
+		int bufferId;
+		std::vector<char> copy;
+	};
+
+	io_uring_sqe* getSqe();
+	int submit(bool wait);
+	void armRecv();
+	void armTick();
+	void processCompletions(const DatagramHandler& on_datagram);
+	void onRecv(const io_uring_cqe& cqe, const DatagramHandler& on_datagram);
+	void onSendDone(uint32_t slot);
+	void releaseBuffer(int buffer_id);
+	bool probeOpcodes();
+	bool setupBufferRing();
+
+private:
+	int sfd;
+	int ringFd = -1;
+	bool running = false;
+
+	void* ringPtr = nullptr;
+	size_t ringSize = 0;
+	io_uring_sqe* sqes = nullptr;
+	size_t sqesSize = 0;
+	unsigned* sqHead = nullptr;
+	unsigned* sqTail = nullptr;
+	unsigned sqMask = 0;
+	unsigned sqEntries = 0;
+	unsigned* sqArray = nullptr;
+	unsigned* cqHead = nullptr;
+	unsigned* cqTail = nullptr;
+	unsigned cqMask = 0;
+	io_uring_cqe* cqes = nullptr;
+	unsigned toSubmit = 0;
+
+	io_uring_buf_ring* bufRing = nullptr;
+	size_t bufRingSize = 0;
+	uint16_t bufRingTail = 0;
+	std::unique_ptr<char[]> buffers;
+	std::vector<uint32_t> bufferRefs; // the handler and every in-flight send hold a buffer
+	int currentBuffer = -1;
+
+	msghdr recvMsg = {};
+	bool recvArmed = false;
+	bool recvFailed = false;
+
+	// laid out as __kernel_timespec, the kernel reads it until the timeout completes
+	struct TickSpec
+	{
+		int64_t sec;
+		int64_t nsec;
+	};
+	std::chrono::nanoseconds tickPeriod{0};
+	TickSpec tickSpec = {};
+	bool tickArmed = false;
+	std::vector<io_uring_cqe> deferredRecvs;
+
+	std::unique_ptr<SendSlot[]> sendSlots;
+	std::vector<uint32_t> freeSendSlots;
+};
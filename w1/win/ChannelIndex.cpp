@@ -0,0 +1,134 @@
+#include "ChannelIndex.h"
+
+#include <algorithm>
+
+
+static bool is_valid_name(std::string_view name)
+{
+	if (name.empty() || name.size() > ChannelIndex::maxNameLength)
+	{
+		return false;
+	}
+	return std::all_of(name.begin(), name.end(), [](char c) { return c > ' ' && c <= '~'; });
+}
+
+ChannelIndex::ChannelIndex()
+{
+	channels.resize(maxChannels);
+	freeIds.reserve(maxChannels);
+	for (size_t id = maxChannels; id > 0; --id)
+	{
+		freeIds.push_back(ChannelId(id - 1));
+	}
+}
+
+const ChannelIndex::ChannelId* ChannelIndex::findId(std::string_view name) const
+{
+	auto itf = ids.find(name);
+	return itf != ids.end() ? &itf->second : nullptr;
+}
+
+ChannelIndex::JoinResult ChannelIndex::join(uint32_t client_id, std::string_view name)
+{
+	if (!is_valid_name(name))
+	{
+		return JoinResult::InvalidName;
+	}
+
+	ChannelId id = 0;
+	if (const ChannelId* existing = findId(name))
+	{
+		id = *existing;
+	}
+	else
+	{
+		if (freeIds.empty())
+		{
+			return JoinResult::TooManyChannels;
+		}
+		id = freeIds.back();
+		freeIds.pop_back();
+		channels[id].name = name;
+		ids.emplace(channels[id].name, id);
+	}
+
+	Membership& membership = memberships[client_id];
+	if (membership.test(id))
+	{
+		return JoinResult::AlreadyMember;
+	}
+	membership.set(id);
+	channels[id].subscribers.push_back(client_id);
+	return JoinResult::Joined;
+}
+
+bool ChannelIndex::leave(uint32_t client_id, std::string_view name)
+{
+	const ChannelId* id = findId(name);
+	auto itf = memberships.find(client_id);
+	if (id == nullptr || itf == memberships.end() || !itf->second.test(*id))
+	{
+		return false;
+	}
+
+	itf->second.reset(*id);
+	if (itf->second.none())
+	{
+		memberships.erase(itf);
+	}
+	removeSubscriber(*id, client_id);
+	return true;
+}
+
+void ChannelIndex::leaveAll(uint32_t client_id)
+{
+	auto itf = memberships.find(client_id);
+	if (itf == memberships.end())
+	{
+		return;
+	}
+
+	const Membership membership = itf->second;
+	memberships.erase(itf);
+	for (size_t id = 0; id < maxChannels; ++id)
+	{
+		if (membership.test(id))
+		{
+			removeSubscriber(ChannelId(id), client_id);
+		}
+	}
+}
+
+// Swap with the last one, the order of subscribers doesn't matter
+void ChannelIndex::removeSubscriber(ChannelId id, uint32_t client_id)
+{
+	Channel& channel = channels[id];
+	auto itf = std::find(channel.subscribers.begin(), channel.subscribers.end(), client_id);
+	if (itf != channel.subscribers.end())
+	{
+		*itf = channel.subscribers.back();
+		channel.subscribers.pop_back();
+	}
+
+	if (channel.subscribers.empty())
+	{
+		ids.erase(channel.name);
+		channel.name.clear();
+		freeIds.push_back(id);
+	}
+}
+
+const std::vector<uint32_t>* ChannelIndex::subscribersFor(uint32_t client_id, std::string_view name) const
+{
+	const ChannelId* id = findId(name);
+	if (id == nullptr)
+	{
+		return nullptr;
+	}
+	auto itf = memberships.find(client_id);
+	if (itf == memberships.end() || !itf->second.test(*id))
+	{
+		return nullptr;
+	}
+	return &channels[*id].subscribers;
+}
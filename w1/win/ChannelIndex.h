@@ -0,0 +1,68 @@
+#pragma once
+
+#include <bitset>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+
+// Named chat channels. Every channel keeps its subscribers' client ids in a dense vector, so posting walks exactly
+// the channel's subscribers and nobody else; every client has a bitset of the channels it's in, for membership
+// checks and for leaving them all on disconnect.
+class ChannelIndex
+{
+public:
+	using ChannelId = uint16_t;
+
+	static constexpr size_t maxChannels = 256;
+	static constexpr size_t maxNameLength = 32;
+
+	enum class JoinResult : uint8_t
+	{
+		Joined,
+		AlreadyMember,
+		InvalidName,
+		TooManyChannels,
+	};
+
+	ChannelIndex();
+
+	ChannelIndex(const ChannelIndex&) = delete;
+	ChannelIndex& operator=(const ChannelIndex&) = delete;
+
+	// Creates the channel when it doesn't exist yet
+	JoinResult join(uint32_t client_id, std::string_view name);
+	// Empty channels are removed, their ids are reused
+	bool leave(uint32_t client_id, std::string_view name);
+	void leaveAll(uint32_t client_id);
+
+	// nullptr when there is no such channel or the client isn't in it
+	const std::vector<uint32_t>* subscribersFor(uint32_t client_id, std::string_view name) const;
+
+private:
+	using Membership = std::bitset<maxChannels>;
+
+	struct Channel
+	{
+		std::string name;
+		std::vector<uint32_t> subscribers; // client ids
+	};
+
+	// lets find() take a string_view without building a std::string
+	struct NameHash
+	{
+		using is_transparent = void;
+		size_t operator()(std::string_view name) const { return std::hash<std::string_view>{}(name); }
+	};
+
+	const ChannelId* findId(std::string_view name) const;
+	void removeSubscriber(ChannelId id, uint32_t client_id);
+
+private:
+	std::vector<Channel> channels; // indexed by ChannelId
+	std::vector<ChannelId> freeIds;
+	std::unordered_map<std::string, ChannelId, NameHash, std::equal_to<>> ids;
+	std::unordered_map<uint32_t, Membership> memberships;
+};
@@ -0,0 +1,218 @@
+#include "ChatHistory.h"
+
+#include <atomic>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+#include "DisplayLog.h"
+
+static constexpr uint32_t recordMarker = 0x43484154; // "CHAT"
+static constexpr size_t offsetDigits = 20;
+
+static uint64_t align_record(uint64_t position)
+{
+	return (position + 7) & ~uint64_t(7);
+}
+
+static std::string segment_path(const std::string& directory, ChatHistory::Offset base, const char* extension)
+{
+	const std::string digits = std::to_string(base);
+	return directory + "/" + std::string(offsetDigits - digits.size(), '0') + digits + extension;
+}
+
+ChatHistory::ChatHistory(const std::string& directory)
+	: directory(directory)
+{
+	std::error_code error;
+	std::filesystem::create_directories(directory, error);
+
+	std::vector<Offset> bases;
+	for (const auto& entry : std::filesystem::directory_iterator(directory, error))
+	{
+		const std::string stem = entry.path().stem().string();
+		Offset base = 0;
+		const auto [end, parseError] = std::from_chars(stem.data(), stem.data() + stem.size(), base);
+		if (entry.path().extension() == ".log" && parseError == std::errc() && end == stem.data() + stem.size())
+		{
+			bases.push_back(base);
+		}
+	}
+	std::sort(bases.begin(), bases.end());
+
+	for (const Offset base : bases)
+	{
+		if (!openSegment(base))
+		{
+			std::cout << Log::msg(Log::Type::Error) << "Failed to open chat history segment " << base << std::endl;
+			segments.clear();
+			return;
+		}
+	}
+	if (segments.empty() && !openSegment(0))
+	{
+		std::cout << Log::msg(Log::Type::Error) << "Failed to create chat history in " << directory << std::endl;
+		return;
+	}
+
+	recover();
+	std::cout << Log::msg(Log::Type::Info) << "Chat history: " << next - firstOffset() << " messages in "
+			  << segments.size() << " segments." << std::endl;
+}
+
+ChatHistory::~ChatHistory()
+{
+	if (!segments.empty())
+	{
+		segments.back().log.flush();
+	}
+}
+
+bool ChatHistory::openSegment(Offset base)
+{
+	Segment segment;
+	segment.base = base;
+	if (!segment.log.open(segment_path(directory, base, ".log"), segmentSize))
+	{
+		return false;
+	}
+
+	const std::string indexPath = segment_path(directory, base, ".index");
+	std::ifstream indexFile(indexPath, std::ios::binary);
+	IndexEntry entry;
+	while (indexFile.read(reinterpret_cast<char*>(&entry), sizeof(entry)))
+	{
+		segment.index.push_back(entry);
+	}
+
+	activeIndex = std::ofstream(indexPath, std::ios::binary | std::ios::app);
+	segments.push_back(std::move(segment));
+	writePosition = 0;
+	next = base;
+	return true;
+}
+
+// Finds the end of the log from the last index entry, adds the entries a crash may have kept from being written
+// and refills the ring of recent messages
+void ChatHistory::recover()
+{
+	Segment& last = segments.back();
+	uint64_t position = last.index.empty() ? 0 : last.index.back().position;
+	next = last.index.empty() ? last.base : last.index.back().offset;
+
+	Record record;
+	while (readRecord(last, position, record) && record.offset == next)
+	{
+		if (record.offset % indexInterval == 0 && (last.index.empty() || last.index.back().offset < record.offset))
+		{
+			const IndexEntry entry = {record.offset, position};
+			last.index.push_back(entry);
+			activeIndex.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+		}
+		position = record.nextPosition;
+		next = record.offset + 1;
+	}
+	activeIndex.flush();
+	writePosition = position;
+
+	recentCount = 0;
+	readSince(next - std::min<Offset>(recentCapacity, next - firstOffset()), next,
+		[this](Offset offset, std::string_view message) { remember(offset, message); });
+}
+
+bool ChatHistory::readRecord(const Segment& segment, uint64_t position, Record& record) const
+{
+	const size_t size = segment.log.size();
+	if (position + sizeof(RecordHeader) > size)
+	{
+		return false;
+	}
+
+	RecordHeader header;
+	memcpy(&header, segment.log.data() + position, sizeof(header));
+	if (header.marker != recordMarker || position + sizeof(header) + header.size > size)
+	{
+		return false;
+	}
+
+	record.offset = header.offset;
+	record.message = std::string_view(segment.log.data() + position + sizeof(header), header.size);
+	record.nextPosition = align_record(position + sizeof(header) + header.size);
+	return true;
+}
+
+std::pair<size_t, uint64_t> ChatHistory::seek(Offset offset) const
+{
+	auto segment = std::upper_bound(segments.begin(), segments.end(), offset,
+		[](Offset value, const Segment& segment) { return value < segment.base; });
+	if (segment == segments.begin())
+	{
+		return {0, 0};
+	}
+	--segment;
+
+	auto entry = std::upper_bound(segment->index.begin(), segment->index.end(), offset,
+		[](Offset value, const IndexEntry& entry) { return value < entry.offset; });
+	const uint64_t position = entry == segment->index.begin() ? 0 : std::prev(entry)->position;
+	return {size_t(segment - segments.begin()), position};
+}
+
+void ChatHistory::remember(Offset offset, std::string_view message)
+{
+	recent[offset % recentCapacity] = message;
+	recentCount = std::min(recentCount + 1, recentCapacity);
+}
+
+std::string_view ChatHistory::append(std::string_view message)
+{
+	if (segments.empty())
+	{
+		return {};
+	}
+
+	char prefix[offsetDigits + 2] = {'#'};
+	char* prefixEnd = std::to_chars(prefix + 1, prefix + sizeof(prefix) - 1, next).ptr;
+	*prefixEnd++ = ' ';
+	const size_t prefixSize = prefixEnd - prefix;
+	const uint64_t recordSize = align_record(sizeof(RecordHeader) + prefixSize + message.size());
+	if (recordSize > segmentSize)
+	{
+		return {};
+	}
+
+	if (writePosition + recordSize > segments.back().log.size())
+	{
+		segments.back().log.flush();
+		if (!openSegment(next))
+		{
+			std::cout << Log::msg(Log::Type::Error) << "Failed to open a new chat history segment." << std::endl;
+			return {};
+		}
+	}
+
+	Segment& segment = segments.back();
+	char* data = segment.log.data() + writePosition;
+	memcpy(data + sizeof(RecordHeader), prefix, prefixSize);
+	memcpy(data + sizeof(RecordHeader) + prefixSize, message.data(), message.size());
+	RecordHeader header = {0, uint32_t(prefixSize + message.size()), next};
+	memcpy(data, &header, sizeof(header));
+	// the marker goes in last, a crash before this point leaves no record behind
+	std::atomic_thread_fence(std::memory_order_release);
+	header.marker = recordMarker;
+	memcpy(data, &header.marker, sizeof(header.marker));
+
+	if (next % indexInterval == 0)
+	{
+		const IndexEntry entry = {next, writePosition};
+		segment.index.push_back(entry);
+		activeIndex.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+		activeIndex.flush();
+	}
+
+	const std::string_view stored(data + sizeof(RecordHeader), header.size);
+	remember(next, stored);
+	writePosition += recordSize;
+	++next;
+	return stored;
+}
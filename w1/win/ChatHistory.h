@@ -0,0 +1,150 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "MappedFile.h"
+
+
+// Append-only chat log in memory-mapped segment files, <base offset>.log, each with a sparse <base offset>.index
+// next to it that points at every indexInterval-th message. Messages are stored ready to send ("#<offset> text"),
+// readers get views straight into the mapping, so catching a client up never copies a message.
+// The last recentCapacity messages are also kept in a ring in memory. A restart only loads the index files and
+// scans the tail of the last segment past its last index entry.
+class ChatHistory
+{
+public:
+	using Offset = uint64_t;
+
+	static constexpr size_t segmentSize = 4 << 20;
+	static constexpr Offset indexInterval = 64;
+	static constexpr size_t recentCapacity = 256;
+
+	explicit ChatHistory(const std::string& directory);
+	~ChatHistory();
+
+	ChatHistory(const ChatHistory&) = delete;
+	ChatHistory& operator=(const ChatHistory&) = delete;
+
+	bool isValid() const { return !segments.empty(); }
+
+	// Returns the stored message, it stays valid as long as the history does; empty when it couldn't be stored
+	std::string_view append(std::string_view message);
+
+	Offset firstOffset() const { return segments.empty() ? 0 : segments.front().base; }
+	Offset nextOffset() const { return next; }
+
+	// on_message(offset, message) for up to count messages from offset on
+	template <typename OnMessage>
+	void forEachSince(Offset offset, size_t count, OnMessage on_message) const;
+	template <typename OnMessage>
+	void forEachLast(size_t count, OnMessage on_message) const;
+
+private:
+	struct RecordHeader
+	{
+		uint32_t marker; // written last, a record without it was cut short by a crash
+		uint32_t size;
+		Offset offset;
+	};
+
+	struct IndexEntry
+	{
+		Offset offset;
+		uint64_t position;
+	};
+
+	struct Segment
+	{
+		Offset base = 0;
+		MappedFile log;
+		std::vector<IndexEntry> index;
+	};
+
+	struct Record
+	{
+		Offset offset;
+		std::string_view message;
+		uint64_t nextPosition;
+	};
+
+	bool openSegment(Offset base);
+	void recover();
+	bool readRecord(const Segment& segment, uint64_t position, Record& record) const;
+	// where to start reading to reach offset: the segment holding it and the closest indexed position before it
+	std::pair<size_t, uint64_t> seek(Offset offset) const;
+	void remember(Offset offset, std::string_view message);
+
+	// reads the segments, not the ring
+	template <typename OnMessage>
+	void readSince(Offset offset, Offset end, OnMessage on_message) const;
+
+private:
+	std::string directory;
+	std::vector<Segment> segments;
+	std::ofstream activeIndex; // index file of the last segment
+	uint64_t writePosition = 0;
+	Offset next = 0;
+
+	// offset % recentCapacity, holds [next - recentCount, next)
+	std::array<std::string_view, recentCapacity> recent;
+	size_t recentCount = 0;
+};
+
+template <typename OnMessage>
+void ChatHistory::forEachSince(Offset offset, size_t count, OnMessage on_message) const
+{
+	offset = std::max(offset, firstOffset());
+	if (offset >= next)
+	{
+		return;
+	}
+	const Offset end = next - offset > count ? offset + count : next;
+
+	if (offset >= next - recentCount)
+	{
+		for (Offset current = offset; current < end; ++current)
+		{
+			on_message(current, recent[current % recentCapacity]);
+		}
+		return;
+	}
+	readSince(offset, end, on_message);
+}
+
+template <typename OnMessage>
+void ChatHistory::forEachLast(size_t count, OnMessage on_message) const
+{
+	const Offset available = next - firstOffset();
+	forEachSince(next - std::min<Offset>(count, available), count, on_message);
+}
+
+template <typename OnMessage>
+void ChatHistory::readSince(Offset offset, Offset end, OnMessage on_message) const
+{
+	auto [segmentIndex, position] = seek(offset);
+	while (segmentIndex < segments.size())
+	{
+		Record record;
+		if (!readRecord(segments[segmentIndex], position, record))
+		{
+			++segmentIndex;
+			position = 0;
+			continue;
+		}
+		position = record.nextPosition;
+		if (record.offset >= end)
+		{
+			return;
+		}
+		if (record.offset >= offset)
+		{
+			on_message(record.offset, record.message);
+		}
+	}
+}
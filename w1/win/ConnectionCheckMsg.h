@@ -1,9 +1,9 @@
 #pragma once
 
-#include <string>
+#include <string_view>
 
 namespace ConnectionCheck
 {
-	static inline const std::string checkMsg = "/___check";
-	static inline const std::string checkAnswerMsg = "/___check_answer";
+	inline constexpr std::string_view checkMsg = "/___check";
+	inline constexpr std::string_view checkAnswerMsg = "/___check_answer";
 } // namespace ConnectionCheck
@@ -1,4 +1,4 @@
-#pragma onceF
+#pragma once
 
 #include <cstdint>
 #include <string>
@@ -1,87 +1,300 @@
 #include "DuelsExtention.h"
 
+#include <algorithm>
 #include <iostream>
 
 #include "DisplayLog.h"
 
 
+static const std::chrono::milliseconds expiryTick = std::chrono::milliseconds(250);
+static const std::chrono::seconds pendingTimeout = std::chrono::seconds(30);
+static const std::chrono::seconds answerTimeout = std::chrono::seconds(60);
+// a waiting duel accepts opponents one bucket further away every time this passes
+static const std::chrono::seconds widenAfter = std::chrono::seconds(5);
+static const uint32_t duelsBeforeBucket = 3; // until then the player is in the middle bucket
+static const std::chrono::minutes ratingIdleTimeout = std::chrono::minutes(30);
+
 DuelsExtention::DuelsExtention()
 	: generator(0, 100)
+	, expiries(expiryTick, Clock::now())
 {
 }
 
-std::tuple<std::string, uint32_t, uint32_t> DuelsExtention::initiateDuel(uint32_t client_port)
+DuelsExtention::StartResult DuelsExtention::initiateDuel(uint32_t client_id, const Endpoint& endpoint)
 {
-	if (awaitingDuel.hasPlayer(client_port))
+	const TimePoint now = Clock::now();
+	auto [itf, isNew] = players.try_emplace(client_id);
+	Player& player = itf->second;
+	if (isNew)
+	{
+		player.rating = ratingOf(endpoint, now);
+		++ratings[player.rating].holders;
+	}
+	ratings[player.rating].lastUsed = now;
+	if (player.duel != Player::noDuel)
 	{
-		std::cout << Log::msg(Log::Type::Info) << "Player with port " << client_port << " is already awaiting duel."
+		std::cout << Log::msg(Log::Type::Info) << "Player " << client_id << " is already in a duel."
 				  << std::endl;
-		return {"", 0, 0};
+		return {StartStatus::AlreadyInDuel};
 	}
 
-	if (awaitingDuel.firstPlayerPort != 0)
-	{
-		awaitingDuel.secondPlayerPort = client_port;
-		duels[awaitingDuel.firstPlayerPort] = awaitingDuel;
-		duels[awaitingDuel.secondPlayerPort] = awaitingDuel;
-		std::tuple<std::string, uint32_t, uint32_t> res = {
-			awaitingDuel.equation, awaitingDuel.firstPlayerPort, awaitingDuel.secondPlayerPort};
+	++stats.requested;
+	const size_t bucket = bucketOf(ratings[player.rating]);
 
-		awaitingDuel = {
-			.firstPlayerPort = 0,
-			.secondPlayerPort = 0,
-			.equation = "",
-			.answer = 0,
-		};
+	const DuelId opponentDuel = findOpponent(bucket, now);
+	if (opponentDuel != Player::noDuel)
+	{
+		DuelSlot& slot = slots[opponentDuel];
+		slot.state = DuelState::Active;
+		slot.secondPlayerId = client_id;
+		slot.startedAt = now;
+		player.duel = opponentDuel;
+		scheduleExpiry(opponentDuel, now + answerTimeout);
 
-		return res;
+		++stats.matched;
+		stats.waited += now - slot.createdAt;
+		return {StartStatus::Matched, slot.firstPlayerId, slot.equation};
 	}
 
+	const DuelId id = allocateSlot();
+	DuelSlot& slot = slots[id];
 	auto [equation, answer] = generateEquation();
+	slot.state = DuelState::Pending;
+	slot.firstPlayerId = client_id;
+	slot.secondPlayerId = 0;
+	slot.equation = std::move(equation);
+	slot.answer = answer;
+	slot.createdAt = now;
+	player.duel = id;
+	scheduleExpiry(id, now + pendingTimeout);
+	waiting[bucket].push_back({id, slot.generation});
+	return {StartStatus::Queued};
+}
 
-	awaitingDuel = DuelInfo{
-		.firstPlayerPort = client_port,
-		.secondPlayerPort = 0,
-		.equation = equation,
-		.answer = answer,
-	};
+DuelsExtention::DuelId DuelsExtention::findOpponent(size_t bucket, TimePoint now)
+{
+	for (size_t distance = 0; distance < bucketCount; ++distance)
+	{
+		// bucket - distance wraps around below 0 and is skipped like any other bucket out of range
+		if (bucket - distance < bucketCount)
+		{
+			if (const DuelId id = takeWaiting(bucket - distance, widenAfter * distance, now); id != Player::noDuel)
+			{
+				return id;
+			}
+		}
+		if (distance > 0 && bucket + distance < bucketCount)
+		{
+			if (const DuelId id = takeWaiting(bucket + distance, widenAfter * distance, now); id != Player::noDuel)
+			{
+				return id;
+			}
+		}
+	}
+	return Player::noDuel;
+}
 
-	return {"", 0, 0};
+// Queues are FIFO, so the front is the longest waiting duel of the bucket. Entries of duels that ended meanwhile
+// are dropped when they get to the front.
+DuelsExtention::DuelId DuelsExtention::takeWaiting(size_t bucket, Clock::duration min_wait, TimePoint now)
+{
+	std::deque<QueueEntry>& queue = waiting[bucket];
+	while (!queue.empty())
+	{
+		const QueueEntry entry = queue.front();
+		const DuelSlot& slot = slots[entry.id];
+		if (slot.generation != entry.generation || slot.state != DuelState::Pending)
+		{
+			queue.pop_front();
+			continue;
+		}
+		if (now - slot.createdAt < min_wait)
+		{
+			return Player::noDuel;
+		}
+		queue.pop_front();
+		return entry.id;
+	}
+	return Player::noDuel;
 }
 
-bool DuelsExtention::isAnswerCorrect(uint32_t client_port, int32_t client_answer)
+bool DuelsExtention::isAnswerCorrect(uint32_t client_id, int32_t client_answer)
 {
-	if (!duels.contains(client_port))
+	auto itf = players.find(client_id);
+	if (itf == players.end() || itf->second.duel == Player::noDuel)
 	{
 		return false;
 	}
 
-	if (duels[client_port].answer == client_answer)
+	const DuelId id = itf->second.duel;
+	DuelSlot& slot = slots[id];
+	if (slot.state != DuelState::Active || slot.answer != client_answer)
+	{
+		return false;
+	}
+
+	++stats.won;
+	stats.solving += Clock::now() - slot.startedAt;
+	const uint32_t loserId = client_id == slot.firstPlayerId ? slot.secondPlayerId : slot.firstPlayerId;
+	releaseSlot(id);
+	recordResult(client_id, loserId);
+	return true;
+}
+
+uint32_t DuelsExtention::removePlayer(uint32_t client_id)
+{
+	auto itf = players.find(client_id);
+	if (itf == players.end())
+	{
+		return 0;
+	}
+
+	uint32_t opponentId = 0;
+	if (itf->second.duel != Player::noDuel)
+	{
+		const DuelSlot& slot = slots[itf->second.duel];
+		if (slot.state == DuelState::Active)
+		{
+			opponentId = client_id == slot.firstPlayerId ? slot.secondPlayerId : slot.firstPlayerId;
+			std::cout << Log::msg(Log::Type::Info) << "Duel between " << slot.firstPlayerId << " and "
+					  << slot.secondPlayerId << " is cancelled." << std::endl;
+		}
+		++stats.cancelled;
+		releaseSlot(itf->second.duel);
+	}
+	Rating& rating = ratings[itf->second.rating];
+	--rating.holders;
+	rating.lastUsed = Clock::now();
+	players.erase(itf);
+	return opponentId;
+}
+
+uint32_t DuelsExtention::ratingOf(const Endpoint& endpoint, TimePoint now)
+{
+	Endpoint address = endpoint;
+	address.port = 0;
+	if (const EndpointTable::Value* id = ratingIds.find(address))
+	{
+		return *id;
+	}
+
+	uint32_t id;
+	if (freeRatings.empty())
+	{
+		id = static_cast<uint32_t>(ratings.size());
+		ratings.emplace_back();
+	}
+	else
 	{
-		terminateDuel(client_port, true);
-		return true;
+		id = freeRatings.back();
+		freeRatings.pop_back();
+		ratings[id] = Rating();
 	}
+	ratings[id].lastUsed = now;
+	ratings[id].address = address;
+	ratingIds.insert(address, id);
+	return id;
+}
 
-	return false;
+void DuelsExtention::forgetIdleRatings(TimePoint now)
+{
+	for (uint32_t id = 0; id < ratings.size(); ++id)
+	{
+		const Rating& rating = ratings[id];
+		if (rating.holders != 0 || now - rating.lastUsed < ratingIdleTimeout)
+		{
+			continue;
+		}
+		// a freed record's address may belong to a newer one by now
+		const EndpointTable::Value* owner = ratingIds.find(rating.address);
+		if (owner != nullptr && *owner == id)
+		{
+			ratingIds.erase(rating.address);
+			freeRatings.push_back(id);
+		}
+	}
+}
+
+size_t DuelsExtention::bucketOf(const Rating& rating) const
+{
+	if (rating.played < duelsBeforeBucket)
+	{
+		return bucketCount / 2;
+	}
+	return std::min<size_t>(bucketCount - 1, size_t(rating.wins) * bucketCount / rating.played);
+}
+
+DuelsExtention::DuelId DuelsExtention::allocateSlot()
+{
+	if (freeSlots.empty())
+	{
+		slots.emplace_back();
+		return DuelId(slots.size() - 1);
+	}
+	const DuelId id = freeSlots.back();
+	freeSlots.pop_back();
+	return id;
+}
+
+// The equation keeps its capacity for the next duel in this slot
+void DuelsExtention::releaseSlot(DuelId id)
+{
+	DuelSlot& slot = slots[id];
+	for (const uint32_t playerId : {slot.firstPlayerId, slot.secondPlayerId})
+	{
+		auto itf = players.find(playerId);
+		if (itf != players.end() && itf->second.duel == id)
+		{
+			itf->second.duel = Player::noDuel;
+		}
+	}
+	slot.state = DuelState::Free;
+	++slot.generation;
+	slot.firstPlayerId = 0;
+	slot.secondPlayerId = 0;
+	freeSlots.push_back(id);
+}
+
+void DuelsExtention::scheduleExpiry(DuelId id, TimePoint deadline)
+{
+	slots[id].expiryTick = expiries.schedule(id, deadline);
+}
+
+// Both are still players, the duel has only just ended
+void DuelsExtention::recordResult(uint32_t winner_id, uint32_t loser_id)
+{
+	Rating& winner = ratings[players.at(winner_id).rating];
+	++winner.wins;
+	++winner.played;
+	++ratings[players.at(loser_id).rating].played;
 }
 
-void DuelsExtention::terminateDuel(uint32_t client_port, bool after_win)
+void DuelsExtention::reportStats()
 {
-	if (!duels.contains(client_port))
+	forgetIdleRatings(Clock::now());
+	if (stats.requested == 0 && stats.expiredPending == 0 && stats.expiredActive == 0)
 	{
 		return;
 	}
 
-	DuelInfo currentDuel = duels[client_port];
+	using ms = std::chrono::milliseconds;
+	const auto average = [](Clock::duration total, size_t count)
+	{ return count == 0 ? 0 : std::chrono::duration_cast<ms>(total / count).count(); };
 
-	if (!after_win)
+	size_t pending = 0;
+	size_t active = 0;
+	for (const DuelSlot& slot : slots)
 	{
-		std::cout << Log::msg(Log::Type::Info) << "Duel between " << currentDuel.firstPlayerPort << " and "
-				  << currentDuel.secondPlayerPort << " is cancelled." << std::endl;
+		pending += slot.state == DuelState::Pending;
+		active += slot.state == DuelState::Active;
 	}
 
-	duels.erase(currentDuel.firstPlayerPort);
-	duels.erase(currentDuel.secondPlayerPort);
+	std::cout << Log::msg(Log::Type::Info) << "duels: " << stats.requested << " requested, " << stats.matched
+			  << " matched (avg wait " << average(stats.waited, stats.matched) << " ms), " << stats.won
+			  << " won (avg solve " << average(stats.solving, stats.won) << " ms), " << stats.expiredPending
+			  << " unmatched and " << stats.expiredActive << " unanswered expired, " << stats.cancelled
+			  << " cancelled; " << pending << " waiting, " << active << " running" << std::endl;
+	stats = Stats();
 }
 
 std::pair<std::string, int32_t> DuelsExtention::generateEquation()
@@ -1,23 +1,56 @@
 #pragma once
 
+#include <array>
+#include <chrono>
 #include <cstdint>
+#include <deque>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
 
+#include "EndpointTable.h"
 #include "NumberGenerator.h"
+#include "TimingWheel.h"
 
 
+// Matchmaking for /duel. Any number of duels can be waiting for an opponent or running at once; their records
+// live in a pooled slot array and are referred to by index, freed slots are reused. Waiting duels are queued by
+// the skill bucket of their player (win rate after a few duels), a request is matched within its own bucket
+// first and with neighbouring ones once those have waited long enough. Waiting and unanswered duels expire.
+// Win rates are kept by the address a player duels from, apart from the per-client duel state: a client that
+// disconnects loses its duel, not its record, and finds it again when it comes back from the same address, whatever
+// its port. Players behind one address share a record. Records nobody used for a while are forgotten, so the table
+// only holds the addresses that dueled lately.
 class DuelsExtention
 {
 public:
-	struct DuelInfo
+	using Clock = std::chrono::steady_clock;
+	using TimePoint = Clock::time_point;
+	using DuelId = uint32_t;
+
+	static constexpr size_t bucketCount = 4;
+
+	enum class StartStatus : uint8_t
 	{
-		uint32_t firstPlayerPort = 0;
-		uint32_t secondPlayerPort = 0;
-		std::string equation = "";
-		int32_t answer = 0;
+		Queued,
+		Matched,
+		AlreadyInDuel,
+	};
 
-		bool hasPlayer(uint32_t port) { return port == firstPlayerPort || port == secondPlayerPort; }
+	struct StartResult
+	{
+		StartStatus status;
+		uint32_t opponentId = 0;
+		std::string_view equation; // valid until the duel ends
+	};
+
+	struct Expired
+	{
+		bool wasActive; // false: nobody took up the challenge
+		uint32_t firstPlayerId;
+		uint32_t secondPlayerId;
+		int32_t answer;
 	};
 
 public:
@@ -26,18 +59,121 @@ public:
 	DuelsExtention(const DuelsExtention&) = delete;
 	DuelsExtention& operator=(const DuelsExtention&) = delete;
 
-	std::tuple<std::string, uint32_t, uint32_t> initiateDuel(uint32_t client_port);
-	bool isAnswerCorrect(uint32_t client_port, int32_t client_answer);
+	StartResult initiateDuel(uint32_t client_id, const Endpoint& endpoint);
+	// A correct answer wins the duel and ends it
+	bool isAnswerCorrect(uint32_t client_id, int32_t client_answer);
+	// Cancels the player's duel and forgets the client, its rating stays. Returns the opponent of a running duel,
+	// 0 if none
+	uint32_t removePlayer(uint32_t client_id);
+
+	// Calls on_expired(const Expired&) for every duel that timed out by now
+	template <typename OnExpired>
+	void expire(TimePoint now, OnExpired on_expired);
+	TimePoint nextExpiry() const { return expiries.nextExpiry(); }
 
-	void terminateDuel(uint32_t client_port, bool after_win);
+	// Prints and resets the counters, nothing when there were no duels; forgets the ratings gone unused
+	void reportStats();
 
 private:
+	enum class DuelState : uint8_t
+	{
+		Free,
+		Pending,
+		Active,
+	};
+
+	struct DuelSlot
+	{
+		DuelState state = DuelState::Free;
+		uint32_t generation = 0; // bumped on every release, queue entries of an earlier duel are stale
+		uint32_t firstPlayerId = 0;
+		uint32_t secondPlayerId = 0;
+		std::string equation;
+		int32_t answer = 0;
+		TimePoint createdAt;
+		TimePoint startedAt;
+		uint64_t expiryTick = 0; // the slot's current entry in expiries, older ones are stale
+	};
+
+	struct QueueEntry
+	{
+		DuelId id;
+		uint32_t generation;
+	};
+
+	struct Player
+	{
+		static constexpr DuelId noDuel = ~DuelId(0);
+
+		DuelId duel = noDuel;
+		uint32_t rating = 0; // index into ratings
+	};
+
+	struct Rating
+	{
+		uint32_t wins = 0;
+		uint32_t played = 0;
+		uint32_t holders = 0; // players pointing at it, it stays while there are any
+		TimePoint lastUsed;
+		Endpoint address; // its key in ratingIds, port 0
+	};
+
+	struct Stats
+	{
+		size_t requested = 0;
+		size_t matched = 0;
+		size_t won = 0;
+		size_t expiredPending = 0;
+		size_t expiredActive = 0;
+		size_t cancelled = 0;
+		Clock::duration waited = Clock::duration::zero();
+		Clock::duration solving = Clock::duration::zero();
+	};
+
+	uint32_t ratingOf(const Endpoint& endpoint, TimePoint now);
+	void forgetIdleRatings(TimePoint now);
+	size_t bucketOf(const Rating& rating) const;
+	// The oldest waiting duel this player may join, Player::noDuel if there is none
+	DuelId findOpponent(size_t bucket, TimePoint now);
+	DuelId takeWaiting(size_t bucket, Clock::duration min_wait, TimePoint now);
+	DuelId allocateSlot();
+	void releaseSlot(DuelId id);
+	void scheduleExpiry(DuelId id, TimePoint deadline);
+	void recordResult(uint32_t winner_id, uint32_t loser_id);
+
 	std::pair<std::string, int> generateEquation();
 
 private:
 	NumberGenerator generator;
 
-	std::unordered_map<uint32_t, DuelInfo> duels;
+	std::vector<DuelSlot> slots; // indexed by DuelId
+	std::vector<DuelId> freeSlots;
+	std::array<std::deque<QueueEntry>, bucketCount> waiting;
+	std::unordered_map<uint32_t, Player> players; // by client id, from their first /duel until they disconnect
+	EndpointTable ratingIds; // by address, the port of a client changes when it reconnects
+	std::vector<Rating> ratings;
+	std::vector<uint32_t> freeRatings;
+
+	TimingWheel expiries;
+	Stats stats;
+};
+
+template <typename OnExpired>
+void DuelsExtention::expire(TimePoint now, OnExpired on_expired)
+{
+	expiries.advance(now,
+		[&](DuelId id, uint64_t tick)
+		{
+			DuelSlot& slot = slots[id];
+			if (slot.state == DuelState::Free || slot.expiryTick != tick)
+			{
+				return; // ended, or the slot was reused since
+			}
 
-	DuelInfo awaitingDuel;
-};
\ No newline at end of file
+			const bool wasActive = slot.state == DuelState::Active;
+			++(wasActive ? stats.expiredActive : stats.expiredPending);
+			const Expired expired = {wasActive, slot.firstPlayerId, slot.secondPlayerId, slot.answer};
+			releaseSlot(id);
+			on_expired(expired);
+		});
+}
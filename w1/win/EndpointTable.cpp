@@ -0,0 +1,140 @@
+#include "EndpointTable.h"
+
+#include <cstring>
+
+
+static constexpr size_t initialCapacity = 64;
+static constexpr uint64_t ipv4MappedPrefix = 0xffffull << 32;
+
+static uint64_t read_big_endian(const unsigned char* bytes)
+{
+	uint64_t value = 0;
+	for (int i = 0; i < 8; ++i)
+	{
+		value = (value << 8) | bytes[i];
+	}
+	return value;
+}
+
+Endpoint Endpoint::from(const sockaddr_in& address)
+{
+	return {0, ipv4MappedPrefix | ntohl(address.sin_addr.s_addr), ntohs(address.sin_port)};
+}
+
+Endpoint Endpoint::from(const sockaddr_in6& address)
+{
+	unsigned char bytes[16];
+	memcpy(bytes, &address.sin6_addr, sizeof(bytes));
+	return {read_big_endian(bytes), read_big_endian(bytes + 8), ntohs(address.sin6_port)};
+}
+
+std::string Endpoint::toString() const
+{
+	if (addressHigh == 0 && (addressLow >> 32) == 0xffff)
+	{
+		const uint32_t ip = uint32_t(addressLow);
+		return std::to_string(ip >> 24) + "." + std::to_string((ip >> 16) & 0xff) + "." +
+			std::to_string((ip >> 8) & 0xff) + "." + std::to_string(ip & 0xff) + ":" + std::to_string(port);
+	}
+
+	unsigned char bytes[16];
+	for (int i = 0; i < 8; ++i)
+	{
+		bytes[i] = (unsigned char)(addressHigh >> (56 - 8 * i));
+		bytes[8 + i] = (unsigned char)(addressLow >> (56 - 8 * i));
+	}
+	char text[INET6_ADDRSTRLEN] = {};
+	inet_ntop(AF_INET6, bytes, text, sizeof(text));
+	return "[" + std::string(text) + "]:" + std::to_string(port);
+}
+
+EndpointTable::EndpointTable()
+	: slots(initialCapacity)
+	, mask(initialCapacity - 1)
+{
+}
+
+// Murmur3's finalizer over the folded key, cheap and good enough for addresses that only differ in a few bits
+size_t EndpointTable::hash(const Endpoint& key)
+{
+	uint64_t h = key.addressLow ^ (key.addressHigh * 0x9e3779b97f4a7c15ull) ^ (uint64_t(key.port) << 48);
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+	return size_t(h);
+}
+
+size_t EndpointTable::probe(const Endpoint& key) const
+{
+	size_t index = hash(key) & mask;
+	while (slots[index].used && !(slots[index].key == key))
+	{
+		index = (index + 1) & mask;
+	}
+	return index;
+}
+
+const EndpointTable::Value* EndpointTable::find(const Endpoint& key) const
+{
+	const Slot& slot = slots[probe(key)];
+	return slot.used ? &slot.value : nullptr;
+}
+
+bool EndpointTable::insert(const Endpoint& key, Value value)
+{
+	if ((count + 1) * 2 > slots.size())
+	{
+		grow();
+	}
+
+	Slot& slot = slots[probe(key)];
+	if (slot.used)
+	{
+		return false;
+	}
+	slot = {key, value, true};
+	++count;
+	return true;
+}
+
+// Backward-shift deletion: every entry after the hole that could live in it moves up, the probe sequences stay
+// unbroken without tombstones
+bool EndpointTable::erase(const Endpoint& key)
+{
+	size_t hole = probe(key);
+	if (!slots[hole].used)
+	{
+		return false;
+	}
+
+	slots[hole].used = false;
+	--count;
+	for (size_t index = (hole + 1) & mask; slots[index].used; index = (index + 1) & mask)
+	{
+		// distance from the entry's home slot, the entry may move to the hole only if that's not further back
+		const size_t home = hash(slots[index].key) & mask;
+		if (((index - home) & mask) >= ((index - hole) & mask))
+		{
+			slots[hole] = slots[index];
+			slots[index].used = false;
+			hole = index;
+		}
+	}
+	return true;
+}
+
+void EndpointTable::grow()
+{
+	std::vector<Slot> old(slots.size() * 2);
+	old.swap(slots);
+	mask = slots.size() - 1;
+	for (const Slot& slot : old)
+	{
+		if (slot.used)
+		{
+			slots[probe(slot.key)] = slot;
+		}
+	}
+}
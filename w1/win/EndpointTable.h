@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+
+// Address and port of a peer. IPv4 addresses are kept IPv4-mapped (::ffff:a.b.c.d), so both families compare and
+// hash the same way; no strings, formatting is left to toString() for the logs.
+struct Endpoint
+{
+	uint64_t addressHigh = 0; // the 16 address bytes, big-endian
+	uint64_t addressLow = 0;
+	uint16_t port = 0; // host order
+
+	static Endpoint from(const sockaddr_in& address);
+	static Endpoint from(const sockaddr_in6& address);
+
+	bool operator==(const Endpoint& other) const = default;
+
+	// "a.b.c.d:port" or "[v6 address]:port"
+	std::string toString() const;
+};
+
+// Flat hash map from Endpoint to a small integer, open addressing with linear probing in one array kept at most
+// half full. Erasing shifts the following entries back instead of leaving tombstones, so lookups stay short
+// however many peers come and go.
+class EndpointTable
+{
+public:
+	using Value = uint32_t;
+
+	EndpointTable();
+
+	EndpointTable(const EndpointTable&) = delete;
+	EndpointTable& operator=(const EndpointTable&) = delete;
+
+	// nullptr when there is no such endpoint
+	const Value* find(const Endpoint& key) const;
+	// false when the endpoint is in already, its value is left as it is
+	bool insert(const Endpoint& key, Value value);
+	bool erase(const Endpoint& key);
+
+	size_t size() const { return count; }
+
+private:
+	struct Slot
+	{
+		Endpoint key;
+		Value value = 0;
+		bool used = false;
+	};
+
+	static size_t hash(const Endpoint& key);
+	// the slot holding key, or the empty one where it would go
+	size_t probe(const Endpoint& key) const;
+	void grow();
+
+private:
+	std::vector<Slot> slots; // size is a power of two
+	size_t mask;
+	size_t count = 0;
+};
@@ -0,0 +1,130 @@
+#include "EventLoop.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include "DisplayLog.h"
+
+bool EventLoop::addSocket(int fd, Callback on_readable)
+{
+	if (sockets.contains(fd))
+		return false;
+	WSAPOLLFD pollFd = {};
+	pollFd.fd = (SOCKET)fd;
+	pollFd.events = POLLRDNORM;
+	pollFds.push_back(pollFd);
+	sockets[fd] = std::move(on_readable);
+	return true;
+}
+
+void EventLoop::removeSocket(int fd)
+{
+	std::erase_if(pollFds, [fd](const WSAPOLLFD& pollFd) { return pollFd.fd == (SOCKET)fd; });
+	sockets.erase(fd);
+}
+
+EventLoop::TimerId EventLoop::schedule(Clock::time_point deadline, Clock::duration period, Callback callback)
+{
+	const TimerId id = nextTimerId++;
+	timers[id] = Timer{deadline, period, std::move(callback)};
+	deadlines.push({deadline, id});
+	return id;
+}
+
+EventLoop::TimerId EventLoop::addTimer(Clock::time_point deadline, Callback callback)
+{
+	return schedule(deadline, Clock::duration::zero(), std::move(callback));
+}
+
+EventLoop::TimerId EventLoop::addPeriodicTimer(Clock::duration period, Callback callback)
+{
+	return schedule(Clock::now() + period, period, std::move(callback));
+}
+
+void EventLoop::cancelTimer(TimerId id)
+{
+	timers.erase(id);
+}
+
+int EventLoop::pollTimeoutMs()
+{
+	while (!deadlines.empty() && !timers.contains(deadlines.top().id))
+		deadlines.pop();
+	if (deadlines.empty())
+		return -1; // nothing scheduled, sleep until a socket wakes us
+
+	const auto left = deadlines.top().deadline - Clock::now();
+	if (left <= Clock::duration::zero())
+		return 0;
+	// rounded up, waking up early would only mean another poll with a zero timeout
+	const auto ms = std::chrono::ceil<std::chrono::milliseconds>(left).count();
+	return (int)std::min<long long>(ms, INT32_MAX);
+}
+
+void EventLoop::fireTimers()
+{
+	const Clock::time_point now = Clock::now();
+	while (!deadlines.empty() && deadlines.top().deadline <= now)
+	{
+		const Deadline top = deadlines.top();
+		deadlines.pop();
+		auto itf = timers.find(top.id);
+		// cancelled, or a stale entry of a timer that was rescheduled
+		if (itf == timers.end() || itf->second.deadline != top.deadline)
+			continue;
+
+		if (itf->second.period == Clock::duration::zero())
+		{
+			Callback callback = std::move(itf->second.callback);
+			timers.erase(itf);
+			callback();
+			continue;
+		}
+
+		Timer& timer = itf->second;
+		timer.deadline += timer.period;
+		// don't try to catch up on periods we slept through
+		if (timer.deadline <= now)
+			timer.deadline = now + timer.period;
+		deadlines.push({timer.deadline, top.id});
+		// a copy, the callback may cancel its own timer
+		Callback callback = timer.callback;
+		callback();
+	}
+}
+
+void EventLoop::run()
+{
+	running = true;
+	while (running)
+	{
+		const int timeout = pollTimeoutMs();
+		if (pollFds.empty() && timeout < 0)
+			return; // nothing left that could ever wake us
+
+		// WSAPoll rejects an empty set, a timer-only loop just sleeps
+		int num = 0;
+		if (!pollFds.empty())
+			num = WSAPoll(pollFds.data(), (ULONG)pollFds.size(), timeout);
+		else if (timeout > 0)
+			Sleep((DWORD)timeout);
+
+		if (num == SOCKET_ERROR)
+		{
+			std::cout << Log::msg(Log::Type::Error) << "WSAPoll failed with " << WSAGetLastError() << std::endl;
+			return;
+		}
+
+		for (size_t i = 0; num > 0 && i < pollFds.size(); ++i)
+		{
+			if (pollFds[i].revents == 0)
+				continue;
+			--num;
+			auto itf = sockets.find((int)pollFds[i].fd);
+			if (itf != sockets.end())
+				itf->second();
+		}
+
+		fireTimers();
+	}
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+#include <winsock2.h>
+
+
+// Single-threaded reactor over WSAPoll. There is no epoll/timerfd on Windows, so the poll timeout is computed
+// from the earliest timer deadline instead: the loop sleeps exactly until the next timer or socket event.
+// WSAPoll is level-triggered, handlers should still drain their socket until WSAEWOULDBLOCK to save wakeups.
+class EventLoop
+{
+public:
+	using Clock = std::chrono::steady_clock;
+	using TimerId = uint64_t;
+	using Callback = std::function<void()>;
+
+	EventLoop() = default;
+
+	EventLoop(const EventLoop&) = delete;
+	EventLoop& operator=(const EventLoop&) = delete;
+
+	bool addSocket(int fd, Callback on_readable);
+	void removeSocket(int fd);
+
+	TimerId addTimer(Clock::time_point deadline, Callback callback);
+	TimerId addTimer(Clock::duration delay, Callback callback) { return addTimer(Clock::now() + delay, callback); }
+	// First fires one period from now, deadlines don't drift with handler time
+	TimerId addPeriodicTimer(Clock::duration period, Callback callback);
+	void cancelTimer(TimerId id);
+	bool isTimerPending(TimerId id) const { return timers.contains(id); }
+
+	void run();
+	void stop() { running = false; }
+
+private:
+	struct Timer
+	{
+		Clock::time_point deadline;
+		Clock::duration period;
+		Callback callback;
+	};
+
+	struct Deadline
+	{
+		Clock::time_point deadline;
+		TimerId id;
+
+		bool operator>(const Deadline& other) const { return deadline > other.deadline; }
+	};
+
+	TimerId schedule(Clock::time_point deadline, Clock::duration period, Callback callback);
+	void fireTimers();
+	int pollTimeoutMs();
+
+private:
+	bool running = false;
+
+	std::vector<WSAPOLLFD> pollFds;
+	std::unordered_map<int, Callback> sockets;
+
+	// cancelled and rescheduled timers leave stale entries behind, they are skipped when they reach the top
+	std::priority_queue<Deadline, std::vector<Deadline>, std::greater<Deadline>> deadlines;
+	std::unordered_map<TimerId, Timer> timers;
+	TimerId nextTimerId = 1;
+};
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+
+#include "DisplayLog.h"
+
+
+// How long broadcasts take, from the first sendto to the last one.
+// Reported periodically so that a fan-out stalling the loop shows up in the log.
+class FanOutStats
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	void record(Clock::duration elapsed, size_t destinations)
+	{
+		++broadcasts;
+		datagrams += destinations;
+		total += elapsed;
+		worst = std::max(worst, elapsed);
+	}
+
+	// Prints and resets, nothing when there were no broadcasts
+	void report()
+	{
+		if (broadcasts == 0)
+		{
+			return;
+		}
+		using us = std::chrono::microseconds;
+		std::cout << Log::msg(Log::Type::Info) << "fan-out: " << broadcasts << " broadcasts -> " << datagrams
+				  << " datagrams, avg " << std::chrono::duration_cast<us>(total / broadcasts).count() << " us, max "
+				  << std::chrono::duration_cast<us>(worst).count() << " us" << std::endl;
+		*this = FanOutStats();
+	}
+
+private:
+	size_t broadcasts = 0;
+	size_t datagrams = 0;
+	Clock::duration total = Clock::duration::zero();
+	Clock::duration worst = Clock::duration::zero();
+};
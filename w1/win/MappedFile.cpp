@@ -0,0 +1,169 @@
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+{
+	*this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+	if (this != &other)
+	{
+		close();
+		std::swap(mapping, other.mapping);
+		std::swap(mappedSize, other.mappedSize);
+#ifdef _WIN32
+		std::swap(file, other.file);
+		std::swap(fileMapping, other.fileMapping);
+#else
+		std::swap(fd, other.fd);
+#endif
+	}
+	return *this;
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string& path, size_t size)
+{
+	close();
+
+	HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (handle == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER fileSize = {};
+	GetFileSizeEx(handle, &fileSize);
+	const size_t mapSize = std::max(size, (size_t)fileSize.QuadPart);
+
+	// mapping more than the file holds grows the file, the new part reads as zeroes
+	HANDLE handleMapping = CreateFileMappingA(
+		handle, nullptr, PAGE_READWRITE, (DWORD)((uint64_t)mapSize >> 32), (DWORD)(mapSize & 0xffffffff), nullptr);
+	if (handleMapping == nullptr)
+	{
+		CloseHandle(handle);
+		return false;
+	}
+
+	void* view = MapViewOfFile(handleMapping, FILE_MAP_ALL_ACCESS, 0, 0, mapSize);
+	if (view == nullptr)
+	{
+		CloseHandle(handleMapping);
+		CloseHandle(handle);
+		return false;
+	}
+
+	file = handle;
+	fileMapping = handleMapping;
+	mapping = static_cast<char*>(view);
+	mappedSize = mapSize;
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (mapping)
+	{
+		UnmapViewOfFile(mapping);
+		CloseHandle(fileMapping);
+		CloseHandle(file);
+	}
+	mapping = nullptr;
+	mappedSize = 0;
+	file = nullptr;
+	fileMapping = nullptr;
+}
+
+void MappedFile::flush()
+{
+	if (mapping)
+	{
+		FlushViewOfFile(mapping, mappedSize);
+		FlushFileBuffers(file);
+	}
+}
+
+#else
+
+bool MappedFile::open(const std::string& path, size_t size)
+{
+	close();
+
+	int handle = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+	if (handle == -1)
+	{
+		return false;
+	}
+
+	struct stat info = {};
+	fstat(handle, &info);
+	size_t mapSize = (size_t)info.st_size;
+	// the new part of the file reads as zeroes
+	if (mapSize < size)
+	{
+		if (ftruncate(handle, (off_t)size) != 0)
+		{
+			::close(handle);
+			return false;
+		}
+		mapSize = size;
+	}
+
+	void* view = mmap(nullptr, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, handle, 0);
+	if (view == MAP_FAILED)
+	{
+		::close(handle);
+		return false;
+	}
+
+	fd = handle;
+	mapping = static_cast<char*>(view);
+	mappedSize = mapSize;
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (mapping)
+	{
+		munmap(mapping, mappedSize);
+		::close(fd);
+	}
+	mapping = nullptr;
+	mappedSize = 0;
+	fd = -1;
+}
+
+void MappedFile::flush()
+{
+	if (mapping)
+	{
+		msync(mapping, mappedSize, MS_SYNC);
+	}
+}
+
+#endif
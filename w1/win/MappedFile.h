@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+
+// A file mapped read-write into memory, grown to the requested size when it's shorter.
+// Writes land in the page cache directly, they survive the process crashing; flush() pushes them to disk.
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	MappedFile(MappedFile&& other) noexcept;
+	MappedFile& operator=(MappedFile&& other) noexcept;
+
+	bool open(const std::string& path, size_t size);
+	void close();
+	void flush();
+
+	bool isOpen() const { return mapping != nullptr; }
+	char* data() const { return mapping; }
+	size_t size() const { return mappedSize; }
+
+private:
+	char* mapping = nullptr;
+	size_t mappedSize = 0;
+#ifdef _WIN32
+	void* file = nullptr; // HANDLE, windows.h stays out of the header
+	void* fileMapping = nullptr;
+#else
+	int fd = -1;
+#endif
+};
@@ -0,0 +1,68 @@
+#include "RateLimiter.h"
+
+#include <algorithm>
+
+
+// Frames, acks and fragments all count: a 3 KB message is three datagrams
+static constexpr RateLimit datagramLimit = {200.f, 400.f};
+static constexpr std::array<RateLimit, size_t(TrafficClass::Count)> requestLimits = {{
+	{5.f, 20.f}, // Control
+	{10.f, 30.f}, // Chat, a broadcast costs a send to every client
+	{1.f, 5.f}, // Expensive, a catch-up is up to a thousand sends
+}};
+
+static constexpr uint32_t strikesBeforeBan = 100;
+static constexpr std::chrono::seconds strikeWindow(10);
+static constexpr std::chrono::seconds firstBan(30);
+static constexpr std::chrono::seconds longestBan(600);
+
+bool TokenBucket::take(const RateLimit& limit, Clock::time_point now)
+{
+	const float elapsed = std::chrono::duration<float>(now - refilledAt).count();
+	tokens = std::min(limit.burst, tokens + elapsed * limit.perSecond);
+	refilledAt = now;
+	if (tokens < 1.f)
+	{
+		return false;
+	}
+	tokens -= 1.f;
+	return true;
+}
+
+RateLimiter::Verdict RateLimiter::admitDatagram(TimePoint now)
+{
+	if (isBanned(now))
+	{
+		return Verdict::Drop;
+	}
+	return datagrams.take(datagramLimit, now) ? Verdict::Pass : strike(now);
+}
+
+RateLimiter::Verdict RateLimiter::admitRequest(TrafficClass traffic_class, TimePoint now)
+{
+	if (isBanned(now))
+	{
+		return Verdict::Drop;
+	}
+	const size_t index = size_t(traffic_class);
+	return requests[index].take(requestLimits[index], now) ? Verdict::Pass : strike(now);
+}
+
+RateLimiter::Verdict RateLimiter::strike(TimePoint now)
+{
+	if (now - strikesSince >= strikeWindow)
+	{
+		strikesSince = now;
+		strikes = 0;
+	}
+	if (++strikes < strikesBeforeBan)
+	{
+		return Verdict::Drop;
+	}
+
+	strikes = 0;
+	const auto duration = std::min<std::chrono::seconds>(firstBan * (1u << std::min(bans, 5u)), longestBan);
+	++bans;
+	banEnd = now + duration;
+	return Verdict::Ban;
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+
+#include "DisplayLog.h"
+#include "RequestParser.h"
+
+
+// Requests with a budget of their own, so a flood of chat doesn't use up the budget for answering checks
+enum class TrafficClass : uint8_t
+{
+	Control, // connect, connection checks, quit
+	Chat, // broadcasts, direct and channel messages, duel answers
+	Expensive, // history catch-ups, channel membership, duel requests
+	Count,
+};
+
+constexpr TrafficClass traffic_class(RequestType type)
+{
+	switch (type)
+	{
+		case RequestType::Connect:
+		case RequestType::ConnectionCheck:
+		case RequestType::Disconnect:
+			return TrafficClass::Control;
+		case RequestType::History:
+		case RequestType::HistorySince:
+		case RequestType::ChannelJoin:
+		case RequestType::ChannelLeave:
+		case RequestType::DuelStart:
+			return TrafficClass::Expensive;
+		default:
+			return TrafficClass::Chat;
+	}
+}
+
+struct RateLimit
+{
+	float perSecond;
+	float burst;
+};
+
+// Refills continuously at perSecond up to burst, every packet takes a token. Only the tokens and the time of the
+// last refill are kept, the limits are shared constants; a new bucket starts full.
+class TokenBucket
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	bool take(const RateLimit& limit, Clock::time_point now);
+
+private:
+	float tokens = 0.f;
+	Clock::time_point refilledAt;
+};
+
+// Limits of one endpoint: a bucket for all of its datagrams, checked before the link decodes them, and one per
+// traffic class, checked before a request is handled. Every drop is a strike; too many strikes within
+// strikeWindow ban the endpoint, for twice as long every time it gets banned again.
+class RateLimiter
+{
+public:
+	using Clock = std::chrono::steady_clock;
+	using TimePoint = Clock::time_point;
+
+	enum class Verdict : uint8_t
+	{
+		Pass,
+		Drop,
+		Ban, // dropped, and the endpoint is banned from now on
+	};
+
+	Verdict admitDatagram(TimePoint now);
+	Verdict admitRequest(TrafficClass traffic_class, TimePoint now);
+
+	bool isBanned(TimePoint now) const { return now < banEnd; }
+	TimePoint bannedUntil() const { return banEnd; }
+
+private:
+	Verdict strike(TimePoint now);
+
+private:
+	TokenBucket datagrams;
+	std::array<TokenBucket, size_t(TrafficClass::Count)> requests;
+
+	uint32_t strikes = 0;
+	TimePoint strikesSince;
+	uint32_t bans = 0;
+	TimePoint banEnd;
+};
+
+// Shed load, reported periodically so that a flood shows up in the log
+class FloodStats
+{
+public:
+	void onDroppedDatagram() { ++datagrams; }
+	void onDroppedRequest() { ++requests; }
+	void onBan() { ++bans; }
+	void onCookieSent() { ++cookies; }
+
+	// Prints and resets, nothing when nothing was dropped and no handshake was started
+	void report()
+	{
+		if (datagrams == 0 && requests == 0 && cookies == 0)
+		{
+			return;
+		}
+		std::cout << Log::msg(Log::Type::Info) << "flood: dropped " << datagrams << " datagrams and " << requests
+				  << " requests, " << bans << " bans, " << cookies << " cookies sent" << std::endl;
+		*this = FloodStats();
+	}
+
+private:
+	uint64_t datagrams = 0;
+	uint64_t requests = 0;
+	uint64_t bans = 0;
+	uint64_t cookies = 0;
+};
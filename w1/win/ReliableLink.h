@@ -0,0 +1,160 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+// Reliability layer for one peer over plain datagrams, without TCP's head-of-line blocking: every reliable frame
+// is acknowledged on its own and delivered as soon as it arrives, a lost message only delays itself.
+//
+// Frame header, little-endian:
+//   u8  type      FrameType, high bit set so stray text datagrams are never mistaken for frames,
+//                 | ackValid once the sender has received a reliable frame and the ack fields mean something
+//   u16 seq       of this frame, reliable and fragment frames only
+//   u16 ack       latest reliable seq received from the peer
+//   u32 ackBits   bit i: seq ack - 1 - i was received too
+//   an ack-only frame | oldAck acks its seq field as well, for frames that arrived too late for ackBits
+//   fragments add u16 message id, u8 fragment index, u8 fragment count
+//
+// Acks ride on every frame going the other way; when there is nothing to send an ack-only frame goes out after
+// ackDelay, or right away once ackEvery frames wait for one. Frames not acked within the RTO are resent
+// (selectively, only those) with exponential backoff; the RTO follows the measured RTT as in RFC 6298. Frames
+// older than an acked one are resent after an RTT and a bit, without waiting for the RTO.
+// Messages bigger than a datagram are split into up to 255 reliable fragments and reassembled on the other side.
+class ReliableLink
+{
+public:
+	using Clock = std::chrono::steady_clock;
+	// puts one datagram on the wire, the bytes are only valid during the call
+	using Transmit = std::function<void(const char* data, size_t size)>;
+	using Deliver = std::function<void(std::string_view message)>;
+
+	static constexpr size_t maxDatagramSize = 1200;
+	static constexpr size_t headerSize = 9;
+	static constexpr uint8_t ackValid = 0x40;
+	static constexpr uint8_t oldAck = 0x20;
+	static constexpr size_t fragmentHeaderSize = headerSize + 4;
+	static constexpr size_t maxFragmentPayload = maxDatagramSize - fragmentHeaderSize;
+	static constexpr size_t maxMessageSize = maxFragmentPayload * 255;
+
+	enum class FrameType : uint8_t
+	{
+		Unreliable = 0x81,
+		Reliable = 0x82,
+		Fragment = 0x83,
+		Ack = 0x84,
+	};
+
+	struct Stats
+	{
+		uint64_t sent = 0;
+		uint64_t retransmitted = 0;
+		uint64_t failed = 0; // given up on after maxSends
+		uint64_t duplicates = 0;
+	};
+
+	explicit ReliableLink(Transmit transmit);
+
+	ReliableLink(const ReliableLink&) = delete;
+	ReliableLink& operator=(const ReliableLink&) = delete;
+
+	// false when the message is too big (unreliable ones have to fit into one datagram)
+	bool send(std::string_view message, bool reliable = true);
+
+	// Handles a received datagram, on_message for every message it completes. false when it isn't a frame
+	bool receive(const char* data, size_t size, const Deliver& on_message);
+
+	// Resends what timed out and sends pending acks; call it by nextDeadline()
+	void update();
+	// max() when there is nothing to wait for
+	Clock::time_point nextDeadline() const;
+	bool isIdle() const { return inFlight == 0 && !ackPending; }
+
+	Clock::duration rto() const { return retransmitTimeout; }
+	const Stats& stats() const { return counters; }
+
+private:
+	static constexpr size_t windowSize = 256;
+	static constexpr size_t receivedHistory = 1024;
+	static constexpr uint32_t ackEvery = 16;
+	static constexpr uint8_t maxSends = 12;
+	static constexpr std::chrono::milliseconds ackDelay{10};
+	static constexpr std::chrono::milliseconds initialRto{200};
+	static constexpr std::chrono::milliseconds minRto{30};
+	static constexpr std::chrono::milliseconds maxRto{2000};
+
+	struct SentFrame
+	{
+		bool inUse = false;
+		uint16_t seq = 0;
+		uint8_t sends = 0;
+		Clock::time_point sentAt;
+		Clock::time_point retransmitAt;
+		std::vector<char> frame;
+	};
+
+	struct QueuedFrame
+	{
+		FrameType type;
+		uint16_t messageId;
+		uint8_t index;
+		uint8_t count;
+		std::string payload;
+	};
+
+	struct Assembly
+	{
+		uint8_t received = 0;
+		std::vector<std::string> parts;
+	};
+
+	void sendReliable(FrameType type, uint16_t message_id, uint8_t index, uint8_t count, std::string_view payload);
+	void emitReliable(FrameType type, uint16_t message_id, uint8_t index, uint8_t count, std::string_view payload);
+	void transmitReliable(SentFrame& sent, Clock::time_point now);
+	void sendAck();
+	void sendOldAck(uint16_t seq);
+	void onAckSent();
+	void writeAckFields(char* frame) const;
+	void onAck(uint16_t ack, uint32_t ack_bits, Clock::time_point now);
+	void ackOne(uint16_t seq, Clock::time_point now);
+	void onRttSample(Clock::duration sample);
+	// true when the frame is new, false for a duplicate
+	bool markReceived(uint16_t seq, Clock::time_point now);
+	void onFragment(const char* data, size_t size, const Deliver& on_message);
+	void sendQueued();
+
+private:
+	Transmit transmit;
+
+	uint16_t nextSeq;
+	std::array<SentFrame, windowSize> window;
+	size_t inFlight = 0;
+	Clock::time_point earliestRetransmit = Clock::time_point::max();
+	std::deque<QueuedFrame> queued; // waiting for a free window slot
+	uint16_t nextMessageId = 0;
+
+	bool haveRemote = false;
+	uint16_t remoteSeq = 0;
+	uint32_t remoteBits = 0;
+	std::array<int32_t, receivedHistory> receivedSeqs;
+	bool ackPending = false;
+	uint32_t framesSinceAck = 0;
+	Clock::time_point ackDeadline = Clock::time_point::max();
+
+	std::map<uint16_t, Assembly> assemblies;
+
+	bool haveRtt = false;
+	double srttMs = 0.0;
+	double rttVarMs = 0.0;
+	Clock::duration retransmitTimeout = initialRto;
+
+	Stats counters;
+};
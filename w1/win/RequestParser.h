@@ -0,0 +1,122 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+
+#include "ConnectionCheckMsg.h"
+
+
+enum class RequestType : uint8_t
+{
+	None,
+	Connect,
+	Broadcast,
+	DirectMessage,
+	DuelStart,
+	DuelAnswer,
+	ConnectionCheck,
+	Disconnect,
+	History,
+	HistorySince,
+	ChannelJoin,
+	ChannelLeave,
+	ChannelMessage,
+};
+
+// A message split into views of the receive buffer, nothing is copied
+struct Request
+{
+	RequestType type = RequestType::None;
+	std::string_view text; // the whole message
+	std::string_view args; // everything after the command and its separator
+	bool unknownCommand = false; // starts with '/' but isn't a command, handled as a regular message
+};
+
+// First word and what follows it, both empty-safe: ("1234 hello there") -> ("1234", "hello there")
+constexpr std::pair<std::string_view, std::string_view> split_first_word(std::string_view text)
+{
+	const size_t index = text.find_first_of(" \t");
+	if (index == std::string_view::npos)
+		return {text, {}};
+	return {text.substr(0, index), text.substr(index + 1)};
+}
+
+namespace RequestParser
+{
+	struct Command
+	{
+		std::string_view name;
+		RequestType type;
+		bool hasArgs; // "/all <message>" vs exactly "/duel"
+	};
+
+	inline constexpr std::array<Command, 12> commands = {{
+		{"/___autoconnect", RequestType::Connect, false},
+		{"/duel", RequestType::DuelStart, false},
+		{ConnectionCheck::checkAnswerMsg, RequestType::ConnectionCheck, false},
+		{"/quit", RequestType::Disconnect, false},
+		{"/all", RequestType::Broadcast, true},
+		{"/w", RequestType::DirectMessage, true},
+		{"/answer", RequestType::DuelAnswer, true},
+		{"/history", RequestType::History, true},
+		{"/since", RequestType::HistorySince, true},
+		{"/join", RequestType::ChannelJoin, true},
+		{"/leave", RequestType::ChannelLeave, true},
+		{"/ch", RequestType::ChannelMessage, true},
+	}};
+
+	// Second and last characters and the length tell all the commands apart, checked below, so a lookup is one
+	// table read and one comparison
+	inline constexpr size_t tableSize = 32;
+
+	constexpr size_t hash(std::string_view word)
+	{
+		const size_t second = word.size() > 1 ? uint8_t(word[1]) : 0;
+		return (second + uint8_t(word.back()) + word.size()) & (tableSize - 1);
+	}
+
+	inline constexpr std::array<int8_t, tableSize> table = []()
+	{
+		std::array<int8_t, tableSize> slots = {};
+		slots.fill(-1);
+		for (size_t i = 0; i < commands.size(); ++i)
+			slots[hash(commands[i].name)] = int8_t(i);
+		return slots;
+	}();
+
+	constexpr bool isPerfect()
+	{
+		for (size_t i = 0; i < commands.size(); ++i)
+			if (table[hash(commands[i].name)] != int8_t(i))
+				return false;
+		return true;
+	}
+	static_assert(isPerfect(), "command hash collides, change the hash function");
+
+	constexpr Request parse(std::string_view text)
+	{
+		Request request;
+		request.text = text;
+		if (text.empty() || text.front() != '/')
+			return request;
+
+		// commands are separated from their arguments by a space only, "/all\tmessage" is a regular message
+		const size_t separator = text.find(' ');
+		const std::string_view word = text.substr(0, separator);
+		const int8_t slot = table[hash(word)];
+		if (slot >= 0)
+		{
+			const Command& command = commands[slot];
+			if (command.name == word && command.hasArgs == (separator != std::string_view::npos))
+			{
+				request.type = command.type;
+				request.args = command.hasArgs ? text.substr(separator + 1) : std::string_view();
+				return request;
+			}
+		}
+		request.unknownCommand = true;
+		return request;
+	}
+} // namespace RequestParser
@@ -2,13 +2,25 @@
 #include <chrono>
 #include <memory>
 #include <string>
-#include <unordered_map>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
 
 
 #define _WINSOCK_DEPRECATED_NO_WARNINGS
 #include <ws2tcpip.h>
 
+#include "ChannelIndex.h"
+#include "ChatHistory.h"
+#include "ConnectCookies.h"
 #include "DuelsExtention.h"
+#include "EndpointTable.h"
+#include "EventLoop.h"
+#include "FanOutStats.h"
+#include "RateLimiter.h"
+#include "ReliableLink.h"
+#include "RequestParser.h"
+#include "TimingWheel.h"
 #include "socket_tools.h"
 
 
@@ -19,26 +31,30 @@ public:
 	using TimePoint = Clock::time_point;
 	using TimeDuration = std::chrono::seconds;
 
+	using ClientId = uint32_t; // 0 is nobody
+
+	// Every endpoint that went through the handshake gets one, whether connected or not: the link lives from the
+	// echoed cookie on and outlives the connection until it's idle. Updated in place, nothing is formatted per
+	// datagram.
 	struct ClientInfo
 	{
+		ClientInfo(const Endpoint& endpoint, const sockaddr_in& socket_info, ReliableLink::Transmit transmit)
+			: endpoint(endpoint)
+			, socketInfo(socket_info)
+			, link(std::move(transmit))
+		{
+		}
+
+		Endpoint endpoint;
 		sockaddr_in socketInfo;
-		std::string ip;
-		uint32_t port;
-		TimePoint lastCheck;
-
-		std::string getAddress() const { return ip + ":" + std::to_string(port); }
-	};
-
-	enum class RequestType : uint8_t
-	{
-		None,
-		Connect,
-		Broadcast,
-		DirectMessage,
-		DuelStart,
-		DuelAnswer,
-		ConnectionCheck,
-		Disconnect,
+		ReliableLink link;
+		RateLimiter limiter;
+		bool connected = false; // from /___autoconnect until it disconnects or times out
+		TimePoint lastSeen; // any datagram counts, not only answers to checks
+		uint64_t livenessTick = 0; // the client's current entry in livenessWheel, older ones are stale
+
+		// for the logs, formats the address every time
+		std::string getAddress() const { return endpoint.toString(); }
 	};
 
 public:
@@ -51,25 +67,67 @@ public:
 	void run();
 
 private:
-	void processRequest(const ClientInfo& client, const std::string& request_buffer, uint32_t client_port);
-	RequestType getRequestTypeFromBuffer(const std::string& request_buffer);
-
-	void sendConnectionChecks();
-	void checkConnections();
-
-	void broadcast(const std::string& message, uint32_t exclude_port); // exclude_port == 0 -> send to everyone
-	void directMessage(const std::string& message, const std::string& receiver_port, uint32_t exclude_port);
-	void sendMessage(const std::string& message, const sockaddr_in& address_info);
-
-	void processDuelStart(uint32_t client_port);
-	void processDuelAnswer(uint32_t client_port, const std::string& client_answer);
+	void receiveRequests();
+	void processRequest(ClientId client_id, std::string_view request_buffer);
+
+	// Datagrams of endpoints without a client, answered with a cookie; echoing it back makes them a client
+	void processHello(const Endpoint& endpoint, const sockaddr_in& address, std::string_view datagram);
+	ClientId addClient(const Endpoint& endpoint, const sockaddr_in& address);
+	// nullptr unless the client is connected
+	ClientInfo* findClient(ClientId client_id);
+	// true for Pass; a Ban disconnects the client
+	bool admit(ClientId client_id, RateLimiter::Verdict verdict);
+
+	void scheduleLiveness(ClientId client_id, TimePoint deadline);
+	void checkLiveness(ClientId client_id, uint64_t tick);
+	void armLivenessTimer();
+
+	void watchLink(ClientId client_id);
+	void updateLinks();
+	void armLinkTimer(TimePoint deadline);
+	void sweepClients();
+
+	void broadcast(std::string_view message, ClientId exclude_id); // exclude_id == 0 -> send to everyone
+	void directMessage(std::string_view message, std::string_view receiver_id, ClientId exclude_id);
+	void sendMessage(std::string_view message, ClientId client_id, bool reliable = true);
+	void sendHistory(ClientId client_id, std::string_view argument, bool since);
+
+	void joinChannel(ClientId client_id, std::string_view name);
+	void leaveChannel(ClientId client_id, std::string_view name);
+	void channelMessage(ClientId client_id, std::string_view name, std::string_view message);
+
+	void disconnectClient(ClientId client_id);
+
+	void processDuelStart(ClientId client_id);
+	void processDuelAnswer(ClientId client_id, std::string_view client_answer);
+	void onDuelExpired(const DuelsExtention::Expired& expired);
+	void armDuelTimer();
 
 private:
 	int fd;
 	std::unique_ptr<WSA> wsa = nullptr;
 
-	std::unordered_map<uint32_t, ClientInfo> clientInfos;
+	std::vector<std::unique_ptr<ClientInfo>> clients; // indexed by ClientId, ids of dropped clients are reused
+	std::vector<ClientId> freeClientIds;
+	EndpointTable clientIds;
+	ConnectCookies cookies;
 	bool valid;
 
+	EventLoop loop;
+	TimingWheel livenessWheel;
+	EventLoop::TimerId livenessTimer = 0;
+	TimePoint livenessTimerDeadline;
+
+	std::unordered_set<ClientId> busyLinks; // with frames in flight or acks pending, the only ones updateLinks visits
+	EventLoop::TimerId linkTimer = 0;
+	TimePoint linkTimerDeadline;
+
+	FanOutStats fanOutStats;
+	FloodStats floodStats;
+	ChatHistory history;
+	ChannelIndex channels;
+
 	DuelsExtention duelsExtention;
+	EventLoop::TimerId duelTimer = 0;
+	TimePoint duelTimerDeadline;
 };
\ No newline at end of file
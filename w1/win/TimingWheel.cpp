@@ -0,0 +1,68 @@
+#include "TimingWheel.h"
+
+#include <algorithm>
+
+
+TimingWheel::TimingWheel(Clock::duration tick, Clock::time_point start)
+	: tickDuration(tick)
+	, start(start)
+{
+}
+
+uint64_t TimingWheel::schedule(Key key, Clock::time_point deadline)
+{
+	uint64_t tick = currentTick + 1;
+	if (deadline > timeOfTick(currentTick))
+	{
+		// rounded up, firing a bit late is fine, firing early isn't
+		tick = (uint64_t)((deadline - start + tickDuration - Clock::duration(1)) / tickDuration);
+		tick = std::max(tick, currentTick + 1);
+	}
+
+	insert({key, tick});
+	++count;
+	return tick;
+}
+
+void TimingWheel::insert(const Entry& entry)
+{
+	const uint64_t delta = entry.tick - currentTick;
+	for (uint32_t level = 0; level + 1 < levelCount; ++level)
+	{
+		if (delta < (uint64_t(1) << (slotBits * (level + 1))))
+		{
+			levels[level][(entry.tick >> (slotBits * level)) & (slotCount - 1)].push_back(entry);
+			return;
+		}
+	}
+
+	// beyond the top level: parked in its furthest slot, cascading brings it back here until it's in range
+	const uint32_t top = levelCount - 1;
+	const uint64_t range = uint64_t(1) << (slotBits * levelCount);
+	const uint64_t tick = std::min(entry.tick, currentTick + range - 1);
+	levels[top][(tick >> (slotBits * top)) & (slotCount - 1)].push_back(entry);
+}
+
+void TimingWheel::cascade(uint32_t level)
+{
+	std::vector<Entry>& slot = levels[level][(currentTick >> (slotBits * level)) & (slotCount - 1)];
+	if (slot.empty())
+		return;
+	expiring.swap(slot);
+	for (const Entry& entry : expiring)
+		insert(entry);
+	expiring.clear();
+}
+
+TimingWheel::Clock::time_point TimingWheel::nextExpiry() const
+{
+	if (count == 0)
+		return Clock::time_point::max();
+
+	// level 0 holds everything due before the next cascade
+	const uint64_t nextCascade = (currentTick | (slotCount - 1)) + 1;
+	for (uint64_t tick = currentTick + 1; tick < nextCascade; ++tick)
+		if (!levels[0][tick & (slotCount - 1)].empty())
+			return timeOfTick(tick);
+	return timeOfTick(nextCascade);
+}
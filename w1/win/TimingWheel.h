@@ -0,0 +1,88 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+
+// Hierarchical timing wheel for per-client deadlines. Scheduling is O(1) and advancing only touches the slots
+// that are due, plus a cascade of one upper slot every slotCount ticks, so expiring is O(expired) however
+// many clients are waiting. Entries can't be cancelled: the owner remembers the tick returned by schedule()
+// and ignores expirations that don't match it any more.
+class TimingWheel
+{
+public:
+	using Clock = std::chrono::steady_clock;
+	using Key = uint32_t;
+
+	static constexpr uint32_t slotBits = 6;
+	static constexpr uint32_t slotCount = 1 << slotBits;
+	static constexpr uint32_t levelCount = 3; // with 100 ms ticks: 6.4 s, 6.8 min, 7.3 h
+
+	TimingWheel(Clock::duration tick, Clock::time_point start);
+
+	TimingWheel(const TimingWheel&) = delete;
+	TimingWheel& operator=(const TimingWheel&) = delete;
+
+	// Fires on the first tick at or after deadline, never earlier. Returns that tick
+	uint64_t schedule(Key key, Clock::time_point deadline);
+
+	// Calls on_expired(key, tick) for everything due by now, on_expired may schedule again
+	template <typename OnExpired>
+	void advance(Clock::time_point now, OnExpired on_expired);
+
+	// When advance() next has something to do, max() when the wheel is empty
+	Clock::time_point nextExpiry() const;
+
+	size_t size() const { return count; }
+
+private:
+	struct Entry
+	{
+		Key key;
+		uint64_t tick;
+	};
+
+	void insert(const Entry& entry);
+	void cascade(uint32_t level);
+	Clock::time_point timeOfTick(uint64_t tick) const { return start + tickDuration * tick; }
+
+private:
+	Clock::duration tickDuration;
+	Clock::time_point start;
+	uint64_t currentTick = 0;
+	size_t count = 0;
+
+	std::array<std::array<std::vector<Entry>, slotCount>, levelCount> levels;
+	std::vector<Entry> expiring; // swapped with the due slot, keeps both buffers' capacity
+};
+
+template <typename OnExpired>
+void TimingWheel::advance(Clock::time_point now, OnExpired on_expired)
+{
+	const uint64_t targetTick = (uint64_t)((now - start) / tickDuration);
+	while (currentTick < targetTick)
+	{
+		++currentTick;
+		// upper levels are emptied into the lower ones when the lower one wraps around
+		if ((currentTick & (slotCount - 1)) == 0)
+		{
+			uint32_t level = 1;
+			while (level + 1 < levelCount && ((currentTick >> (slotBits * level)) & (slotCount - 1)) == 0)
+				++level;
+			for (; level > 0; --level)
+				cascade(level);
+		}
+
+		std::vector<Entry>& slot = levels[0][currentTick & (slotCount - 1)];
+		if (slot.empty())
+			continue;
+		expiring.swap(slot);
+		count -= expiring.size();
+		for (const Entry& entry : expiring)
+			on_expired(entry.key, entry.tick);
+		expiring.clear();
+	}
+}
@@ -4,5 +4,5 @@ if not exist bin\ (
     mkdir bin
 )
 
-clang++ server_main.cpp socket_tools.cpp Server.cpp DuelsExtention.cpp -std=c++20 -o bin/server.exe -lws2_32
-clang++ client.cpp socket_tools.cpp -std=c++20 -o bin/client.exe -lws2_32
+clang++ server_main.cpp socket_tools.cpp Server.cpp DuelsExtention.cpp EventLoop.cpp TimingWheel.cpp MappedFile.cpp ChatHistory.cpp ChannelIndex.cpp ReliableLink.cpp EndpointTable.cpp RateLimiter.cpp ConnectCookies.cpp -std=c++20 -o bin/server.exe -lws2_32
+clang++ client.cpp socket_tools.cpp ReliableLink.cpp -std=c++20 -o bin/client.exe -lws2_32
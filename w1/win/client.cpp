@@ -1,13 +1,18 @@
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <cstring>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <winsock2.h>
 #include <ws2tcpip.h>
 
 #include "ConnectionCheckMsg.h"
+#include "HandshakeMsg.h"
+#include "ReliableLink.h"
 #include "socket_tools.h"
 
 const char* PORT = "2026";
@@ -19,38 +24,111 @@ std::string buffered_msg;
 addrinfo addr_info;
 int sfd;
 
-void receive_messages()
+// the server ignores the link's frames until it echoed a cookie back, resent every so often until the first frame
+// from the server shows it's done
+static constexpr std::chrono::milliseconds hello_period(300);
+bool accepted = false;
+std::string hello;
+std::chrono::steady_clock::time_point next_hello;
+
+// shared by the input and the receiving thread, both change its state
+std::mutex link_mutex;
+ReliableLink server_link(
+	[](const char* data, size_t size)
+	{
+		int res = sendto((SOCKET)sfd, data, static_cast<int>(size), 0, addr_info.ai_addr, addr_info.ai_addrlen);
+		if (res == SOCKET_ERROR)
+		{
+			std::cout << "Error: " << WSAGetLastError() << std::endl;
+		}
+	});
+
+// "/___hello" or "/___hello <cookie>", padded as the server wants it
+void send_hello(std::string_view cookie)
 {
-	fd_set readSet;
-	FD_ZERO(&readSet);
-	timeval timeout = {0, 100000}; // 100 ms
-	while (running)
+	hello = std::string(Handshake::helloMsg);
+	if (!cookie.empty())
+	{
+		hello += ' ';
+		hello += cookie;
+	}
+	hello.resize(std::max(hello.size(), Handshake::helloSize), ' ');
+	sendto((SOCKET)sfd, hello.data(), static_cast<int>(hello.size()), 0, addr_info.ai_addr, addr_info.ai_addrlen);
+	next_hello = std::chrono::steady_clock::now() + hello_period;
+}
+
+// Plain datagrams before the link is up, only a cookie is expected
+void on_handshake_datagram(std::string_view datagram)
+{
+	if (datagram.size() == Handshake::cookieMsg.size() + 1 + Handshake::cookieDigits &&
+		datagram.substr(0, Handshake::cookieMsg.size()) == Handshake::cookieMsg)
 	{
-		constexpr size_t bufferSize = 1000;
-		static char buffer[bufferSize];
+		send_hello(datagram.substr(Handshake::cookieMsg.size() + 1));
+	}
+}
 
-		FD_SET(sfd, &readSet);
-		select((int)sfd + 1, &readSet, NULL, NULL, &timeout);
+void send_to_server(std::string_view message)
+{
+	std::lock_guard<std::mutex> lock(link_mutex);
+	server_link.send(message);
+}
 
-		if (FD_ISSET((SOCKET)sfd, &readSet))
-		{
-			memset(buffer, 0, bufferSize);
-			sockaddr_in socketInfo;
-			int socketLen = sizeof(sockaddr_in);
-			int num_bytes = recvfrom((SOCKET)sfd, buffer, bufferSize - 1, 0, (sockaddr*)&socketInfo, &socketLen);
+void on_server_message(std::string_view message)
+{
+	if (message == ConnectionCheck::checkMsg)
+	{
+		// a lost answer is covered by the next check, no point in resending it
+		server_link.send(ConnectionCheck::checkAnswerMsg, false);
+		return;
+	}
 
-			if (std::string(buffer) == ConnectionCheck::checkMsg)
+	std::cout << "From server: " << message << "\n";
+	std::cout << "> " << buffered_msg << std::flush;
+}
+
+// Waits up to timeout for a datagram, then lets the link resend and ack whatever is due
+void poll_server(timeval timeout)
+{
+	constexpr size_t bufferSize = 2048;
+	static char buffer[bufferSize];
+
+	fd_set readSet;
+	FD_ZERO(&readSet);
+	FD_SET(sfd, &readSet);
+	select((int)sfd + 1, &readSet, NULL, NULL, &timeout);
+
+	std::lock_guard<std::mutex> lock(link_mutex);
+	if (FD_ISSET((SOCKET)sfd, &readSet))
+	{
+		sockaddr_in socketInfo;
+		int socketLen = sizeof(sockaddr_in);
+		int num_bytes = recvfrom((SOCKET)sfd, buffer, bufferSize, 0, (sockaddr*)&socketInfo, &socketLen);
+		if (num_bytes > 0)
+		{
+			if (server_link.receive(buffer, num_bytes, on_server_message))
 			{
-				sendto((SOCKET)sfd, ConnectionCheck::checkAnswerMsg.c_str(),
-					static_cast<int>(ConnectionCheck::checkAnswerMsg.size()), 0, addr_info.ai_addr,
-					addr_info.ai_addrlen);
-				continue;
+				accepted = true;
+			}
+			else if (!accepted)
+			{
+				on_handshake_datagram(std::string_view(buffer, num_bytes));
 			}
-
-			std::cout << "From server: " << buffer << "\n";
-			std::cout << "> " << buffered_msg << std::flush;
 		}
 	}
+	if (!accepted && std::chrono::steady_clock::now() >= next_hello)
+	{
+		sendto((SOCKET)sfd, hello.data(), static_cast<int>(hello.size()), 0, addr_info.ai_addr, addr_info.ai_addrlen);
+		next_hello = std::chrono::steady_clock::now() + hello_period;
+	}
+	server_link.update();
+}
+
+void receive_messages()
+{
+	while (running)
+	{
+		poll_server({0, 10000}); // 10 ms, resends and acks of the link are due that often
+	}
 }
 
 void handle_input()
@@ -77,20 +155,14 @@ void handle_input()
 	{
 		if (buffered_msg == "/quit")
 		{
-			sendto((SOCKET)sfd, buffered_msg.c_str(), buffered_msg.size(), 0, addr_info.ai_addr, addr_info.ai_addrlen);
+			send_to_server(buffered_msg);
 			running = false;
 			std::cout << "\nExiting...\n";
 		}
 		else if (!buffered_msg.empty())
 		{
 			std::cout << "\rYou sent: " << buffered_msg << "\n";
-			int res =
-				sendto(sfd, buffered_msg.c_str(), buffered_msg.size(), 0, addr_info.ai_addr, addr_info.ai_addrlen);
-			if (res == SOCKET_ERROR)
-			{
-				int err = WSAGetLastError();
-				std::cout << "Error: " << err << std::endl;
-			}
+			send_to_server(buffered_msg);
 
 			buffered_msg.clear();
 			std::cout << "> " << std::flush;
@@ -114,9 +186,11 @@ int main(int argc, const char** argv)
 		return 1;
 	}
 
-	const std::string autoconnect = "/___autoconnect";
-	sendto((SOCKET)sfd, autoconnect.c_str(), static_cast<int>(autoconnect.size()), 0, addr_info.ai_addr,
-		addr_info.ai_addrlen);
+	// the link's frames are queued meanwhile and get resent until the server takes them
+	send_hello({});
+	send_to_server("/___autoconnect");
+	// catch up on what was said before we joined, "/since <#number>" gets everything after a message
+	send_to_server("/history 20");
 
 	std::cout << "ChatClient - Type '/quit' to exit\n"
 			  << "> ";
@@ -128,5 +202,12 @@ int main(int argc, const char** argv)
 	}
 
 	receiver.join();
+
+	// give the server a moment to ack the /quit, it's still in flight otherwise
+	const auto quitDeadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+	while (!server_link.isIdle() && std::chrono::steady_clock::now() < quitDeadline)
+	{
+		poll_server({0, 10000});
+	}
 	return 0;
 }
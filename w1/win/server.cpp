@@ -1,36 +1,51 @@
 #include "Server.h"
 
+#include <algorithm>
+#include <cctype>
+#include <charconv>
 #include <iostream>
 
 #include "ConnectionCheckMsg.h"
 #include "DisplayLog.h"
-
-static const std::unordered_map<std::string, Server::RequestType> simpleRequests = {
-	{"/___autoconnect", Server::RequestType::Connect},
-	{"/duel", Server::RequestType::DuelStart},
-	{ConnectionCheck::checkAnswerMsg, Server::RequestType::ConnectionCheck},
-	{"/quit", Server::RequestType::Disconnect},
-};
-
-static const std::unordered_map<std::string, Server::RequestType> compositeRequests = {
-	{"/all ", Server::RequestType::Broadcast},
-	{"/w ", Server::RequestType::DirectMessage},
-	{"/answer ", Server::RequestType::DuelAnswer},
-};
+#include "HandshakeMsg.h"
 
 static const Server::TimeDuration timeBeforeDisconnect = Server::TimeDuration(5);
+static const Server::TimeDuration timeBeforeCheck = Server::TimeDuration(2); // silence before the first probe
 static const Server::TimeDuration timeBetweenChecks = Server::TimeDuration(1);
-static Server::TimePoint lastGlobalCheck;
+static const std::chrono::milliseconds livenessTick = std::chrono::milliseconds(100);
+static const char* historyDirectory = "history";
+static const size_t maxHistoryPerRequest = 1000; // a catch-up mustn't stall everyone else, ask again for more
+static const Server::TimeDuration timeBetweenFanOutReports = Server::TimeDuration(10);
+static const Server::TimeDuration timeBetweenDuelReports = Server::TimeDuration(30);
+static const Server::TimeDuration timeBetweenFloodReports = Server::TimeDuration(10);
+// an endpoint that's no longer connected is forgotten, link and id, after this much silence
+static const Server::TimeDuration clientIdleTimeout = Server::TimeDuration(60);
+static const size_t maxEchoedRequest = 32; // of a dropped request, enough for the client to tell which one it was
+
+// Parses the whole of text as a number, no allocations unlike stoi + to_string
+template <typename T>
+static bool parse_number(std::string_view text, T& value)
+{
+	const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+	return error == std::errc() && end == text.data() + text.size();
+}
 
-static __forceinline std::string cutFirstWordStr(const std::string& string)
+static bool parse_cookie(std::string_view text, ConnectCookies::Cookie& cookie)
 {
-	std::string::size_type index = string.find_first_of(" \t");
-	return (index != std::string::npos) ? string.substr(index + 1) : "";
+	if (text.size() != Handshake::cookieDigits)
+	{
+		return false;
+	}
+	const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), cookie, 16);
+	return error == std::errc() && end == text.data() + text.size();
 }
 
 Server::Server()
 	: fd(-1)
+	, clients(1) // ClientId 0 is nobody, its slot stays empty
 	, valid(false)
+	, livenessWheel(livenessTick, Clock::now())
+	, history(historyDirectory)
 {
 	wsa = std::make_unique<WSA>();
 	if (!wsa->is_initialized())
@@ -55,249 +70,658 @@ Server::Server()
 
 void Server::run()
 {
-	fd_set readSet;
-	FD_ZERO(&readSet);
-	timeval timeout = {0, 100000}; // 100 ms
+	loop.addSocket(fd, [this]() { receiveRequests(); });
+	loop.addPeriodicTimer(timeBetweenFanOutReports, [this]() { fanOutStats.report(); });
+	loop.addPeriodicTimer(timeBetweenDuelReports, [this]() { duelsExtention.reportStats(); });
+	loop.addPeriodicTimer(timeBetweenFloodReports, [this]() { floodStats.report(); });
+	loop.addPeriodicTimer(clientIdleTimeout, [this]() { sweepClients(); });
+	loop.run();
+}
 
-	lastGlobalCheck = Clock::now();
+void Server::receiveRequests()
+{
+	// drain everything that arrived, one poll wakeup for a whole burst
 	while (true)
 	{
-		FD_SET(fd, &readSet);
-		select((int)fd + 1, &readSet, NULL, NULL, &timeout);
+		constexpr size_t bufferSize = 2048; // above ReliableLink::maxDatagramSize
+		static char buffer[bufferSize];
+
+		sockaddr_in socketInfo;
+		int socketLen = sizeof(sockaddr_in);
+		int num_bytes = recvfrom((SOCKET)fd, buffer, bufferSize, 0, (sockaddr*)&socketInfo, &socketLen);
 
-		if (FD_ISSET((SOCKET)fd, &readSet))
+		if (num_bytes == SOCKET_ERROR)
 		{
-			constexpr size_t bufferSize = 1000;
-			static char buffer[bufferSize];
-			memset(buffer, 0, bufferSize);
+			// ICMP port unreachable from an earlier send, nothing to do with this read
+			if (WSAGetLastError() == WSAECONNRESET)
+				continue;
+			return;
+		}
 
-			sockaddr_in socketInfo;
-			int socketLen = sizeof(sockaddr_in);
-			int num_bytes = recvfrom((SOCKET)fd, buffer, bufferSize - 1, 0, (sockaddr*)&socketInfo, &socketLen);
+		if (num_bytes > 0)
+		{
+			const Endpoint endpoint = Endpoint::from(socketInfo);
+			const ClientId* knownId = clientIds.find(endpoint);
+			if (knownId == nullptr)
+			{
+				processHello(endpoint, socketInfo, std::string_view(buffer, num_bytes));
+				continue;
+			}
 
-			if (num_bytes > 0)
+			// over the limit or banned, dropped for the price of one table lookup before the link decodes anything
+			const ClientId clientId = *knownId;
+			ClientInfo& client = *clients[clientId];
+			const TimePoint now = Clock::now();
+			if (!admit(clientId, client.limiter.admitDatagram(now)))
 			{
-				uint32_t clientPort = ntohs(socketInfo.sin_port);
-
-				auto now = Clock::now();
-				ClientInfo client = {
-					.socketInfo = socketInfo,
-					.ip = inet_ntoa(socketInfo.sin_addr),
-					.port = clientPort,
-					.lastCheck = now,
-				};
-
-				std::string requestBuffer = buffer;
-				processRequest(client, requestBuffer, clientPort);
+				floodStats.onDroppedDatagram();
+				continue;
 			}
-		}
 
-		sendConnectionChecks();
-		checkConnections();
+			// handlers get views into the receive buffer (or the reassembled message), valid until the next
+			// recvfrom; datagrams that aren't frames are dropped by the link.
+			// Whatever a client sends proves it's alive, only the silent ones get probed; the wheel entry is left
+			// as it is and picks up the new time when it fires
+			client.lastSeen = now;
+			client.link.receive(
+				buffer, num_bytes, [this, clientId](std::string_view message) { processRequest(clientId, message); });
+			watchLink(clientId);
+		}
 	}
 }
 
-void Server::processRequest(const ClientInfo& client, const std::string& request_buffer, uint32_t client_port)
+void Server::processRequest(ClientId client_id, std::string_view request_buffer)
 {
-	Server::RequestType type = getRequestTypeFromBuffer(request_buffer);
-	std::string truncatedMessage = "";
-	std::string port = "";
+	// parsing is a table lookup on the views, it's what the request does that is limited
+	const Request request = RequestParser::parse(request_buffer);
+	const RateLimiter::Verdict verdict =
+		clients[client_id]->limiter.admitRequest(traffic_class(request.type), Clock::now());
+	if (!admit(client_id, verdict))
+	{
+		floodStats.onDroppedRequest();
+		// the link acked the frame already, without a word the client would take it as delivered; the reply
+		// costs no more than the request did, and the datagram limit caps both
+		if (verdict == RateLimiter::Verdict::Drop)
+		{
+			sendMessage("Rate limited, dropped: " + std::string(request_buffer.substr(0, maxEchoedRequest)), client_id);
+		}
+		return;
+	}
 
-	switch (type)
+	switch (request.type)
 	{
 		case RequestType::Connect:
-			if (!clientInfos.contains(client_port))
+		{
+			ClientInfo& client = *clients[client_id];
+			if (!client.connected)
 			{
-				std::cout << "Client with address " << client.getAddress() << " connected." << std::endl;
+				std::cout << "Client with address " << client.getAddress() << " connected as " << client_id << "."
+						  << std::endl;
+				client.connected = true;
+				sendMessage("Your id is " + std::to_string(client_id), client_id);
 			}
-			clientInfos[client_port] = client;
+			scheduleLiveness(client_id, client.lastSeen + timeBeforeCheck);
+			armLivenessTimer();
 			break;
+		}
 		case RequestType::Broadcast:
-			broadcast(cutFirstWordStr(request_buffer), client_port);
+			broadcast(request.args, client_id);
 			break;
 		case RequestType::DirectMessage:
-			truncatedMessage = cutFirstWordStr(request_buffer);
-			port = truncatedMessage.substr(0, truncatedMessage.find_first_of(" \t"));
-			directMessage(cutFirstWordStr(truncatedMessage), port, client_port);
+		{
+			const auto [receiver, message] = split_first_word(request.args);
+			directMessage(message, receiver, client_id);
 			break;
+		}
 		case RequestType::DuelStart:
-			processDuelStart(client_port);
+			processDuelStart(client_id);
 			break;
 		case RequestType::DuelAnswer:
-			truncatedMessage = cutFirstWordStr(request_buffer);
-			processDuelAnswer(client_port, truncatedMessage.substr(0, truncatedMessage.find_first_of(" \t")));
+			processDuelAnswer(client_id, split_first_word(request.args).first);
 			break;
 		case RequestType::ConnectionCheck:
-			clientInfos[client_port].lastCheck = Clock::now();
+			break; // lastSeen is already updated
+		case RequestType::History:
+			sendHistory(client_id, split_first_word(request.args).first, false);
+			break;
+		case RequestType::HistorySince:
+			sendHistory(client_id, split_first_word(request.args).first, true);
 			break;
+		case RequestType::ChannelJoin:
+			joinChannel(client_id, split_first_word(request.args).first);
+			break;
+		case RequestType::ChannelLeave:
+			leaveChannel(client_id, split_first_word(request.args).first);
+			break;
+		case RequestType::ChannelMessage:
+		{
+			const auto [name, message] = split_first_word(request.args);
+			channelMessage(client_id, name, message);
+			break;
+		}
 		case RequestType::Disconnect:
-			std::cout << clientInfos[client_port].getAddress() << " has disconnected." << std::endl;
-			duelsExtention.terminateDuel(client_port, false);
-			clientInfos.erase(client_port);
+			std::cout << clients[client_id]->getAddress() << " has disconnected." << std::endl;
+			disconnectClient(client_id);
 			break;
 		case RequestType::None:
 		default:
-			std::cout << "<" << clientInfos[client_port].getAddress() << "> " << request_buffer << std::endl;
+			if (request.unknownCommand)
+			{
+				std::cout << Log::msg(Log::Type::Warning)
+						  << "Unknown command encountered. Treaing it as regular message." << std::endl;
+			}
+			std::cout << "<" << clients[client_id]->getAddress() << "> " << request_buffer << std::endl;
 			break;
 	}
 }
 
-Server::RequestType Server::getRequestTypeFromBuffer(const std::string& request_buffer)
+// Nothing is allocated for a stranger, spoofed source addresses can't grow the tables: every datagram costs one
+// hash and at most one reply, no bigger than the hello it answers. Only an endpoint that got its cookie, and so
+// really is where it claims to be, gets a client.
+void Server::processHello(const Endpoint& endpoint, const sockaddr_in& address, std::string_view datagram)
 {
-	for (const auto& [prefix, type] : simpleRequests)
+	if (datagram.size() < Handshake::helloSize || !datagram.starts_with(Handshake::helloMsg))
 	{
-		if (request_buffer == prefix)
-		{
-			return type;
-		}
+		floodStats.onDroppedDatagram();
+		return;
 	}
 
-	for (const auto& [prefix, type] : compositeRequests)
+	const TimePoint now = Clock::now();
+	const std::string_view echoed = split_first_word(split_first_word(datagram).second).first;
+	ConnectCookies::Cookie cookie = 0;
+	if (parse_cookie(echoed, cookie) && cookies.verify(endpoint, cookie, now))
 	{
-		if (request_buffer.starts_with(prefix))
+		addClient(endpoint, address);
+		return;
+	}
+
+	// a hello without a cookie or with an expired one, "/___cookie <16 hex digits>"
+	static constexpr char digits[] = "0123456789abcdef";
+	char reply[Handshake::cookieMsg.size() + 1 + Handshake::cookieDigits];
+	char* end = std::copy(Handshake::cookieMsg.begin(), Handshake::cookieMsg.end(), reply);
+	*end++ = ' ';
+	cookie = cookies.issue(endpoint, now);
+	for (size_t i = 0; i < Handshake::cookieDigits; ++i)
+	{
+		*end++ = digits[(cookie >> (4 * (Handshake::cookieDigits - 1 - i))) & 0xf];
+	}
+	sendto((SOCKET)fd, reply, static_cast<int>(sizeof(reply)), 0, (const sockaddr*)&address, sizeof(address));
+	floodStats.onCookieSent();
+}
+
+Server::ClientId Server::addClient(const Endpoint& endpoint, const sockaddr_in& address)
+{
+	ClientId id = 0;
+	if (!freeClientIds.empty())
+	{
+		id = freeClientIds.back();
+		freeClientIds.pop_back();
+	}
+	else
+	{
+		id = static_cast<ClientId>(clients.size());
+		clients.emplace_back();
+	}
+
+	// the link outlives neither the client nor its id, so it sends to the client's own sockaddr
+	clients[id] = std::make_unique<ClientInfo>(endpoint, address,
+		[this, id](const char* data, size_t size)
 		{
-			return type;
-		}
+			const sockaddr_in& socketInfo = clients[id]->socketInfo;
+			sendto((SOCKET)fd, data, static_cast<int>(size), 0, (const sockaddr*)&socketInfo, sizeof(socketInfo));
+		});
+	clients[id]->lastSeen = Clock::now();
+	clientIds.insert(endpoint, id);
+	return id;
+}
+
+Server::ClientInfo* Server::findClient(ClientId client_id)
+{
+	if (client_id >= clients.size() || clients[client_id] == nullptr || !clients[client_id]->connected)
+	{
+		return nullptr;
 	}
-	if (request_buffer.starts_with('/'))
+	return clients[client_id].get();
+}
+
+bool Server::admit(ClientId client_id, RateLimiter::Verdict verdict)
+{
+	if (verdict != RateLimiter::Verdict::Ban)
 	{
-		std::cout << Log::msg(Log::Type::Warning) << "Unknown command encountered. Treaing it as regular message."
-				  << std::endl;
+		return verdict == RateLimiter::Verdict::Pass;
 	}
-	return RequestType::None;
+
+	ClientInfo& client = *clients[client_id];
+	const auto seconds = std::chrono::ceil<std::chrono::seconds>(client.limiter.bannedUntil() - Clock::now()).count();
+	std::cout << Log::msg(Log::Type::Warning) << client.getAddress() << " is banned for " << seconds
+			  << " s for flooding." << std::endl;
+	floodStats.onBan();
+	if (client.connected)
+	{
+		disconnectClient(client_id);
+	}
+	return false;
+}
+
+void Server::scheduleLiveness(ClientId client_id, TimePoint deadline)
+{
+	clients[client_id]->livenessTick = livenessWheel.schedule(client_id, deadline);
 }
 
-void Server::sendConnectionChecks()
+// Runs when a client's wheel entry expires: silent clients are probed every timeBetweenChecks and dropped
+// after timeBeforeDisconnect, the ones that sent anything meanwhile are just rescheduled.
+void Server::checkLiveness(ClientId client_id, uint64_t tick)
 {
-	const auto now = Clock::now();
-	if (now - lastGlobalCheck < timeBetweenChecks)
+	const ClientInfo* client = findClient(client_id);
+	if (client == nullptr || client->livenessTick != tick)
 	{
+		return; // disconnected, or reconnected with a newer entry
+	}
+
+	const TimePoint now = Clock::now();
+	if (now - client->lastSeen >= timeBeforeDisconnect)
+	{
+		std::cout << client->getAddress() << " has disconnected (timeout)." << std::endl;
+		disconnectClient(client_id);
 		return;
 	}
 
-	for (const auto& [port, client] : clientInfos)
+	if (now - client->lastSeen >= timeBeforeCheck)
 	{
-		sendMessage(ConnectionCheck::checkMsg, client.socketInfo);
+		// the next check goes out soon anyway, a lost one isn't worth resending
+		sendMessage(ConnectionCheck::checkMsg, client_id, false);
+		scheduleLiveness(client_id, std::min(now + timeBetweenChecks, client->lastSeen + timeBeforeDisconnect));
+		return;
 	}
 
-	lastGlobalCheck = now;
+	scheduleLiveness(client_id, client->lastSeen + timeBeforeCheck);
 }
 
-void Server::checkConnections()
+// One loop timer for the whole wheel, armed for whatever is due first. Entries rescheduled while the wheel
+// advances are picked up when the timer callback re-arms it.
+void Server::armLivenessTimer()
 {
-	const auto now = Clock::now();
-	std::vector<uint32_t> portsTodisconnect;
-
-	for (const auto& [port, client] : clientInfos)
+	const TimePoint next = livenessWheel.nextExpiry();
+	if (loop.isTimerPending(livenessTimer))
 	{
-		if (now - client.lastCheck > timeBeforeDisconnect)
+		if (livenessTimerDeadline <= next)
 		{
-			std::cout << client.getAddress() << " has disconnected (timeout)." << std::endl;
-
-			portsTodisconnect.emplace_back(port);
+			return;
 		}
+		loop.cancelTimer(livenessTimer);
 	}
+	if (next == TimePoint::max())
+	{
+		return;
+	}
+
+	livenessTimerDeadline = next;
+	livenessTimer = loop.addTimer(next,
+		[this]()
+		{
+			livenessWheel.advance(
+				Clock::now(), [this](ClientId client_id, uint64_t tick) { checkLiveness(client_id, tick); });
+			armLivenessTimer();
+		});
+}
 
-	for (const uint32_t port : portsTodisconnect)
+// Links with something in flight are tracked in busyLinks, one loop timer is armed for the earliest deadline
+void Server::watchLink(ClientId client_id)
+{
+	const ReliableLink& link = clients[client_id]->link;
+	if (link.isIdle())
 	{
-		duelsExtention.terminateDuel(port, false);
-		clientInfos.erase(port);
+		return;
 	}
+	busyLinks.insert(client_id);
+	armLinkTimer(link.nextDeadline());
 }
 
-void Server::broadcast(const std::string& message, uint32_t exclude_port)
+void Server::updateLinks()
 {
-	for (const auto& [port, client] : clientInfos)
+	TimePoint next = TimePoint::max();
+	for (auto it = busyLinks.begin(); it != busyLinks.end();)
 	{
-		if (port != exclude_port)
+		if (clients[*it] == nullptr)
+		{
+			it = busyLinks.erase(it);
+			continue;
+		}
+		ReliableLink& link = clients[*it]->link;
+		link.update();
+		if (link.isIdle())
 		{
-			sendMessage(message, client.socketInfo);
+			it = busyLinks.erase(it);
+			continue;
 		}
+		next = std::min(next, link.nextDeadline());
+		++it;
 	}
+	armLinkTimer(next);
 }
 
-void Server::directMessage(const std::string& message, const std::string& receiver_port, uint32_t exclude_port)
+void Server::armLinkTimer(TimePoint deadline)
 {
-	uint32_t port = 0;
-	try
+	if (loop.isTimerPending(linkTimer))
 	{
-		port = std::stoul(receiver_port);
+		if (linkTimerDeadline <= deadline)
+		{
+			return;
+		}
+		loop.cancelTimer(linkTimer);
 	}
-	catch (...)
+	if (deadline == TimePoint::max())
 	{
-		std::cout << Log::msg(Log::Type::Error) << "Unvalid port in direct message." << std::endl;
 		return;
 	}
 
-	if (port == 0 || port > 65536)
+	linkTimerDeadline = deadline;
+	linkTimer = loop.addTimer(deadline, [this]() { updateLinks(); });
+}
+
+// Clients aren't dropped on disconnect: a reconnect from the same endpoint goes on with the same id and sequence
+// numbers, and the last frames still get resent. Only idle, silent ones are forgotten and their ids reused; banned
+// ones are kept until the ban is over, so that it holds.
+void Server::sweepClients()
+{
+	const TimePoint now = Clock::now();
+	for (ClientId id = 1; id < clients.size(); ++id)
+	{
+		const ClientInfo* client = clients[id].get();
+		if (client != nullptr && !client->connected && client->link.isIdle() && !client->limiter.isBanned(now) &&
+			now - client->lastSeen >= clientIdleTimeout)
+		{
+			clientIds.erase(client->endpoint);
+			clients[id].reset();
+			freeClientIds.push_back(id);
+		}
+	}
+}
+
+// The message is encoded once into the history log, every client's link frames the same logged bytes
+void Server::broadcast(std::string_view message, ClientId exclude_id)
+{
+	const std::string_view stored = history.append(message);
+	if (!stored.empty())
+	{
+		message = stored;
+	}
+
+	const auto start = FanOutStats::Clock::now();
+	size_t sent = 0;
+	for (ClientId id = 1; id < clients.size(); ++id)
+	{
+		if (id != exclude_id && clients[id] != nullptr && clients[id]->connected)
+		{
+			sendMessage(message, id);
+			++sent;
+		}
+	}
+	fanOutStats.record(FanOutStats::Clock::now() - start, sent);
+}
+
+void Server::directMessage(std::string_view message, std::string_view receiver_id, ClientId exclude_id)
+{
+	ClientId id = 0;
+	if (receiver_id.empty() || !std::isdigit((unsigned char)receiver_id.front()))
 	{
-		std::cout << Log::msg(Log::Type::Error) << "Port is out of possible range." << std::endl;
+		std::cout << Log::msg(Log::Type::Error) << "Unvalid id in direct message." << std::endl;
 		return;
 	}
 
-	if (std::to_string(port).size() != receiver_port.size())
+	if (!parse_number(receiver_id, id))
 	{
-		std::cout << Log::msg(Log::Type::Error) << "Port contains incorrect characters, only digits are possible."
+		std::cout << Log::msg(Log::Type::Error) << "Id contains incorrect characters, only digits are possible."
 				  << std::endl;
 		return;
 	}
 
-	if (port == exclude_port)
+	if (id == exclude_id)
 	{
 		std::cout << Log::msg(Log::Type::Warning)
 				  << "Sending message to self is prohibited, so no action will be taken." << std::endl;
 		return;
 	}
 
-	if (!clientInfos.contains(port))
+	if (findClient(id) == nullptr)
 	{
-		static const std::string errorString = Log::msg(Log::Type::Error) + "No user is connected to this port.";
-		sendMessage(errorString, clientInfos[exclude_port].socketInfo);
+		static const std::string errorString = Log::msg(Log::Type::Error) + "No user is connected with this id.";
+		sendMessage(errorString, exclude_id);
 		return;
 	}
 
-	sendMessage(message, clientInfos[port].socketInfo);
+	sendMessage(message, id);
 }
 
-void Server::sendMessage(const std::string& message, const sockaddr_in& address_info)
+// Framed by the client's link, which keeps a copy for resends
+void Server::sendMessage(std::string_view message, ClientId client_id, bool reliable)
 {
-	sendto((SOCKET)fd, message.c_str(), static_cast<int>(message.size()), 0, (sockaddr*)&address_info,
-		sizeof(address_info));
+	if (client_id >= clients.size() || clients[client_id] == nullptr)
+	{
+		return;
+	}
+
+	if (!clients[client_id]->link.send(message, reliable))
+	{
+		std::cout << Log::msg(Log::Type::Error) << "Message of " << message.size() << " bytes is too big to send."
+				  << std::endl;
+		return;
+	}
+	watchLink(client_id);
 }
 
-void Server::processDuelStart(uint32_t client_port)
+// "/history N" sends the last N messages, "/since OFFSET" everything from OFFSET on, maxHistoryPerRequest at most.
+// Messages are handed to the client's link straight from the mapped log.
+void Server::sendHistory(ClientId client_id, std::string_view argument, bool since)
 {
-	auto [equation, firstPlayerPort, secondPlayerPort] = duelsExtention.initiateDuel(client_port);
-	if (equation != "")
+	if (findClient(client_id) == nullptr)
 	{
-		sendMessage(equation, clientInfos[firstPlayerPort].socketInfo);
-		sendMessage(equation, clientInfos[secondPlayerPort].socketInfo);
+		return;
+	}
+
+	uint64_t value = 0;
+	if (!parse_number(argument, value))
+	{
+		std::cout << Log::msg(Log::Type::Error) << "Unvalid history request, a number is expected." << std::endl;
+		return;
+	}
+
+	const auto send = [&](ChatHistory::Offset, std::string_view message) { sendMessage(message, client_id); };
+	if (since)
+	{
+		history.forEachSince(value, maxHistoryPerRequest, send);
+	}
+	else
+	{
+		history.forEachLast(std::min<uint64_t>(value, maxHistoryPerRequest), send);
 	}
 }
 
-void Server::processDuelAnswer(uint32_t client_port, const std::string& client_answer)
+void Server::joinChannel(ClientId client_id, std::string_view name)
 {
-	int32_t answer = 0;
-	try
+	if (findClient(client_id) == nullptr)
+	{
+		return;
+	}
+
+	switch (channels.join(client_id, name))
 	{
-		answer = std::stoi(client_answer);
+		case ChannelIndex::JoinResult::Joined:
+			sendMessage("Joined channel " + std::string(name), client_id);
+			break;
+		case ChannelIndex::JoinResult::AlreadyMember:
+			sendMessage(Log::msg(Log::Type::Warning) + "Already in channel " + std::string(name), client_id);
+			break;
+		case ChannelIndex::JoinResult::InvalidName:
+			sendMessage(Log::msg(Log::Type::Error) + "Channel names are 1 to " +
+							std::to_string(ChannelIndex::maxNameLength) + " printable characters.",
+				client_id);
+			break;
+		case ChannelIndex::JoinResult::TooManyChannels:
+			sendMessage(Log::msg(Log::Type::Error) + "No more channels can be created.", client_id);
+			break;
+	}
+}
+
+void Server::leaveChannel(ClientId client_id, std::string_view name)
+{
+	if (findClient(client_id) == nullptr)
+	{
+		return;
+	}
+
+	if (channels.leave(client_id, name))
+	{
+		sendMessage("Left channel " + std::string(name), client_id);
 	}
-	catch (...)
+	else
+	{
+		sendMessage(Log::msg(Log::Type::Error) + "Not in channel " + std::string(name), client_id);
+	}
+}
+
+// Costs O(subscribers of the channel), the rest of the clients aren't looked at
+void Server::channelMessage(ClientId client_id, std::string_view name, std::string_view message)
+{
+	const std::vector<ClientId>* subscribers = channels.subscribersFor(client_id, name);
+	if (subscribers == nullptr)
+	{
+		if (findClient(client_id) != nullptr)
+		{
+			static const std::string errorString = Log::msg(Log::Type::Error) + "Join the channel first.";
+			sendMessage(errorString, client_id);
+		}
+		return;
+	}
+
+	// "[name] id: message", encoded once for every subscriber; the link fragments it however long it is
+	char id[10];
+	const std::string_view idText(id, std::to_chars(id, id + sizeof(id), client_id).ptr - id);
+	std::string encoded;
+	encoded.reserve(name.size() + idText.size() + message.size() + 5);
+	encoded.append("[").append(name).append("] ").append(idText).append(": ").append(message);
+	if (encoded.size() > ReliableLink::maxMessageSize)
+	{
+		sendMessage(Log::msg(Log::Type::Error) + "Message is too long for the channel.", client_id);
+		return;
+	}
+
+	const auto start = FanOutStats::Clock::now();
+	size_t sent = 0;
+	for (const ClientId subscriber : *subscribers)
+	{
+		if (subscriber != client_id)
+		{
+			sendMessage(encoded, subscriber);
+			++sent;
+		}
+	}
+	fanOutStats.record(FanOutStats::Clock::now() - start, sent);
+}
+
+void Server::disconnectClient(ClientId client_id)
+{
+	if (const ClientId opponentId = duelsExtention.removePlayer(client_id); findClient(opponentId) != nullptr)
+	{
+		sendMessage("Your opponent has left, the duel is cancelled.", opponentId);
+	}
+	channels.leaveAll(client_id);
+	clients[client_id]->connected = false;
+}
+
+void Server::processDuelStart(ClientId client_id)
+{
+	const auto [status, opponentId, equation] = duelsExtention.initiateDuel(client_id, clients[client_id]->endpoint);
+	switch (status)
+	{
+		case DuelsExtention::StartStatus::Queued:
+			sendMessage("Waiting for an opponent...", client_id);
+			armDuelTimer();
+			break;
+		case DuelsExtention::StartStatus::Matched:
+			sendMessage(equation, opponentId);
+			sendMessage(equation, client_id);
+			armDuelTimer();
+			break;
+		case DuelsExtention::StartStatus::AlreadyInDuel:
+			sendMessage(Log::msg(Log::Type::Warning) + "You are already in a duel.", client_id);
+			break;
+	}
+}
+
+void Server::onDuelExpired(const DuelsExtention::Expired& expired)
+{
+	if (!expired.wasActive)
+	{
+		if (findClient(expired.firstPlayerId) != nullptr)
+		{
+			sendMessage("Nobody took up your duel, try /duel again.", expired.firstPlayerId);
+		}
+		return;
+	}
+
+	char message[64];
+	static constexpr std::string_view timeUp = "Time is up, the answer was ";
+	char* end = std::copy(timeUp.begin(), timeUp.end(), message);
+	end = std::to_chars(end, message + sizeof(message), expired.answer).ptr;
+	for (const ClientId id : {expired.firstPlayerId, expired.secondPlayerId})
+	{
+		if (findClient(id) != nullptr)
+		{
+			sendMessage(std::string_view(message, end - message), id);
+		}
+	}
+}
+
+// Same scheme as the liveness timer: one loop timer for the earliest duel deadline
+void Server::armDuelTimer()
+{
+	const TimePoint next = duelsExtention.nextExpiry();
+	if (loop.isTimerPending(duelTimer))
+	{
+		if (duelTimerDeadline <= next)
+		{
+			return;
+		}
+		loop.cancelTimer(duelTimer);
+	}
+	if (next == TimePoint::max())
+	{
+		return;
+	}
+
+	duelTimerDeadline = next;
+	duelTimer = loop.addTimer(next,
+		[this]()
+		{
+			duelsExtention.expire(
+				Clock::now(), [this](const DuelsExtention::Expired& expired) { onDuelExpired(expired); });
+			armDuelTimer();
+		});
+}
+
+void Server::processDuelAnswer(ClientId client_id, std::string_view client_answer)
+{
+	int32_t answer = 0;
+	if (client_answer.empty())
 	{
 		std::cout << Log::msg(Log::Type::Error) << "Unvalid answer message in duel." << std::endl;
 		return;
 	}
 
-	if (std::to_string(answer).size() != client_answer.size())
+	if (!parse_number(client_answer, answer))
 	{
 		std::cout << Log::msg(Log::Type::Error)
 				  << "Answer message contains incorrect characters, only digits are possible." << std::endl;
 		return;
 	}
 
-	if (duelsExtention.isAnswerCorrect(client_port, answer))
+	if (duelsExtention.isAnswerCorrect(client_id, answer))
 	{
-		static const std::string winner = " is the winner!";
-		broadcast(std::to_string(client_port) + winner, 0);
+		static constexpr std::string_view winner = " is the winner!";
+		char message[16 + winner.size()];
+		char* end = std::to_chars(message, message + 16, client_id).ptr;
+		end = std::copy(winner.begin(), winner.end(), end);
+		broadcast(std::string_view(message, end - message), 0);
 	}
 }
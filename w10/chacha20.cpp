@@ -0,0 +1,252 @@
+#include "chacha20.h"
+
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CHACHA20_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(__AVX2__)
+#define CHACHA20_AVX2 1
+#include <immintrin.h>
+#endif
+
+static inline uint32_t load_le32(const uint8_t* ptr)
+{
+	uint32_t val;
+	memcpy(&val, ptr, sizeof(uint32_t)); // every platform we build for is little endian
+	return val;
+}
+
+static void init_state(uint32_t state[16], const uint8_t* key, const uint8_t* nonce, uint32_t counter)
+{
+	// "expand 32-byte k"
+	state[0] = 0x61707865;
+	state[1] = 0x3320646e;
+	state[2] = 0x79622d32;
+	state[3] = 0x6b206574;
+	for (int i = 0; i < 8; ++i)
+		state[4 + i] = load_le32(key + i * 4);
+	state[12] = counter;
+	for (int i = 0; i < 3; ++i)
+		state[13 + i] = load_le32(nonce + i * 4);
+}
+
+#ifndef CHACHA20_SSE2
+
+static inline uint32_t rotl32(uint32_t v, int n)
+{
+	return (v << n) | (v >> (32 - n));
+}
+
+static inline void quarter_round(uint32_t* x, int a, int b, int c, int d)
+{
+	x[a] += x[b];
+	x[d] = rotl32(x[d] ^ x[a], 16);
+	x[c] += x[d];
+	x[b] = rotl32(x[b] ^ x[c], 12);
+	x[a] += x[b];
+	x[d] = rotl32(x[d] ^ x[a], 8);
+	x[c] += x[d];
+	x[b] = rotl32(x[b] ^ x[c], 7);
+}
+
+static void block_scalar(const uint32_t state[16], uint8_t out[chacha20_block_size])
+{
+	uint32_t x[16];
+	memcpy(x, state, sizeof(x));
+	for (int i = 0; i < 10; ++i)
+	{
+		quarter_round(x, 0, 4, 8, 12);
+		quarter_round(x, 1, 5, 9, 13);
+		quarter_round(x, 2, 6, 10, 14);
+		quarter_round(x, 3, 7, 11, 15);
+		quarter_round(x, 0, 5, 10, 15);
+		quarter_round(x, 1, 6, 11, 12);
+		quarter_round(x, 2, 7, 8, 13);
+		quarter_round(x, 3, 4, 9, 14);
+	}
+	for (int i = 0; i < 16; ++i)
+		x[i] += state[i];
+	memcpy(out, x, chacha20_block_size);
+}
+
+static void xor_tail(uint8_t* data, const uint8_t* keystream, size_t size)
+{
+	for (size_t i = 0; i < size; ++i)
+		data[i] ^= keystream[i];
+}
+
+#endif
+
+#ifdef CHACHA20_SSE2
+
+// Row-wise layout: each register holds one row of the 4x4 state, diagonal rounds are done by rotating rows.
+template <int N>
+static inline __m128i rotl_sse2(__m128i v)
+{
+	return _mm_or_si128(_mm_slli_epi32(v, N), _mm_srli_epi32(v, 32 - N));
+}
+
+static inline void double_round_sse2(__m128i& a, __m128i& b, __m128i& c, __m128i& d)
+{
+	a = _mm_add_epi32(a, b); d = rotl_sse2<16>(_mm_xor_si128(d, a));
+	c = _mm_add_epi32(c, d); b = rotl_sse2<12>(_mm_xor_si128(b, c));
+	a = _mm_add_epi32(a, b); d = rotl_sse2<8>(_mm_xor_si128(d, a));
+	c = _mm_add_epi32(c, d); b = rotl_sse2<7>(_mm_xor_si128(b, c));
+
+	b = _mm_shuffle_epi32(b, 0x39);
+	c = _mm_shuffle_epi32(c, 0x4e);
+	d = _mm_shuffle_epi32(d, 0x93);
+
+	a = _mm_add_epi32(a, b); d = rotl_sse2<16>(_mm_xor_si128(d, a));
+	c = _mm_add_epi32(c, d); b = rotl_sse2<12>(_mm_xor_si128(b, c));
+	a = _mm_add_epi32(a, b); d = rotl_sse2<8>(_mm_xor_si128(d, a));
+	c = _mm_add_epi32(c, d); b = rotl_sse2<7>(_mm_xor_si128(b, c));
+
+	b = _mm_shuffle_epi32(b, 0x93);
+	c = _mm_shuffle_epi32(c, 0x4e);
+	d = _mm_shuffle_epi32(d, 0x39);
+}
+
+// Processes whole blocks, returns pointer past the last processed byte. state[12] is advanced.
+static uint8_t* blocks_sse2(uint32_t state[16], uint8_t* data, size_t num_blocks)
+{
+	const __m128i row0 = _mm_loadu_si128((const __m128i*)(state + 0));
+	const __m128i row1 = _mm_loadu_si128((const __m128i*)(state + 4));
+	const __m128i row2 = _mm_loadu_si128((const __m128i*)(state + 8));
+	__m128i row3 = _mm_loadu_si128((const __m128i*)(state + 12));
+	const __m128i one = _mm_set_epi32(0, 0, 0, 1);
+
+	for (size_t blk = 0; blk < num_blocks; ++blk, data += chacha20_block_size)
+	{
+		__m128i a = row0, b = row1, c = row2, d = row3;
+		for (int i = 0; i < 10; ++i)
+			double_round_sse2(a, b, c, d);
+		a = _mm_add_epi32(a, row0);
+		b = _mm_add_epi32(b, row1);
+		c = _mm_add_epi32(c, row2);
+		d = _mm_add_epi32(d, row3);
+
+		__m128i* out = (__m128i*)data;
+		_mm_storeu_si128(out + 0, _mm_xor_si128(_mm_loadu_si128(out + 0), a));
+		_mm_storeu_si128(out + 1, _mm_xor_si128(_mm_loadu_si128(out + 1), b));
+		_mm_storeu_si128(out + 2, _mm_xor_si128(_mm_loadu_si128(out + 2), c));
+		_mm_storeu_si128(out + 3, _mm_xor_si128(_mm_loadu_si128(out + 3), d));
+
+		row3 = _mm_add_epi32(row3, one);
+	}
+	state[12] += uint32_t(num_blocks);
+	return data;
+}
+
+#endif
+
+#ifdef CHACHA20_AVX2
+
+// Same row-wise layout, low lane holds block n and high lane block n + 1.
+template <int N>
+static inline __m256i rotl_avx2(__m256i v)
+{
+	return _mm256_or_si256(_mm256_slli_epi32(v, N), _mm256_srli_epi32(v, 32 - N));
+}
+
+static inline void double_round_avx2(__m256i& a, __m256i& b, __m256i& c, __m256i& d)
+{
+	a = _mm256_add_epi32(a, b); d = rotl_avx2<16>(_mm256_xor_si256(d, a));
+	c = _mm256_add_epi32(c, d); b = rotl_avx2<12>(_mm256_xor_si256(b, c));
+	a = _mm256_add_epi32(a, b); d = rotl_avx2<8>(_mm256_xor_si256(d, a));
+	c = _mm256_add_epi32(c, d); b = rotl_avx2<7>(_mm256_xor_si256(b, c));
+
+	b = _mm256_shuffle_epi32(b, 0x39);
+	c = _mm256_shuffle_epi32(c, 0x4e);
+	d = _mm256_shuffle_epi32(d, 0x93);
+
+	a = _mm256_add_epi32(a, b); d = rotl_avx2<16>(_mm256_xor_si256(d, a));
+	c = _mm256_add_epi32(c, d); b = rotl_avx2<12>(_mm256_xor_si256(b, c));
+	a = _mm256_add_epi32(a, b); d = rotl_avx2<8>(_mm256_xor_si256(d, a));
+	c = _mm256_add_epi32(c, d); b = rotl_avx2<7>(_mm256_xor_si256(b, c));
+
+	b = _mm256_shuffle_epi32(b, 0x93);
+	c = _mm256_shuffle_epi32(c, 0x4e);
+	d = _mm256_shuffle_epi32(d, 0x39);
+}
+
+static uint8_t* block_pairs_avx2(uint32_t state[16], uint8_t* data, size_t num_pairs)
+{
+	const __m256i row0 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(state + 0)));
+	const __m256i row1 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(state + 4)));
+	const __m256i row2 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(state + 8)));
+	__m256i row3 = _mm256_add_epi32(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(state + 12))),
+		_mm256_set_epi32(0, 0, 0, 1, 0, 0, 0, 0));
+	const __m256i two = _mm256_set_epi32(0, 0, 0, 2, 0, 0, 0, 2);
+
+	for (size_t pair = 0; pair < num_pairs; ++pair, data += 2 * chacha20_block_size)
+	{
+		__m256i a = row0, b = row1, c = row2, d = row3;
+		for (int i = 0; i < 10; ++i)
+			double_round_avx2(a, b, c, d);
+		a = _mm256_add_epi32(a, row0);
+		b = _mm256_add_epi32(b, row1);
+		c = _mm256_add_epi32(c, row2);
+		d = _mm256_add_epi32(d, row3);
+
+		// Regroup lanes so each 256-bit store covers half of one block
+		const __m256i first01 = _mm256_permute2x128_si256(a, b, 0x20);
+		const __m256i first23 = _mm256_permute2x128_si256(c, d, 0x20);
+		const __m256i second01 = _mm256_permute2x128_si256(a, b, 0x31);
+		const __m256i second23 = _mm256_permute2x128_si256(c, d, 0x31);
+
+		__m256i* out = (__m256i*)data;
+		_mm256_storeu_si256(out + 0, _mm256_xor_si256(_mm256_loadu_si256(out + 0), first01));
+		_mm256_storeu_si256(out + 1, _mm256_xor_si256(_mm256_loadu_si256(out + 1), first23));
+		_mm256_storeu_si256(out + 2, _mm256_xor_si256(_mm256_loadu_si256(out + 2), second01));
+		_mm256_storeu_si256(out + 3, _mm256_xor_si256(_mm256_loadu_si256(out + 3), second23));
+
+		row3 = _mm256_add_epi32(row3, two);
+	}
+	state[12] += uint32_t(num_pairs * 2);
+	return data;
+}
+
+#endif
+
+void chacha20_xor(const uint8_t* key, const uint8_t* nonce, uint32_t counter, uint8_t* data, size_t size)
+{
+	uint32_t state[16];
+	init_state(state, key, nonce, counter);
+
+	size_t numBlocks = size / chacha20_block_size;
+#ifdef CHACHA20_AVX2
+	data = block_pairs_avx2(state, data, numBlocks / 2);
+	numBlocks %= 2;
+#endif
+#ifdef CHACHA20_SSE2
+	data = blocks_sse2(state, data, numBlocks);
+#else
+	uint8_t keystream[chacha20_block_size];
+	for (size_t blk = 0; blk < numBlocks; ++blk, data += chacha20_block_size)
+	{
+		block_scalar(state, keystream);
+		xor_tail(data, keystream, chacha20_block_size);
+		++state[12];
+	}
+#endif
+
+	// Most of our packets are shorter than a block and only take this path
+	const size_t tail = size % chacha20_block_size;
+	if (tail != 0)
+	{
+		uint8_t lastBlock[chacha20_block_size] = {};
+		memcpy(lastBlock, data, tail);
+#ifdef CHACHA20_SSE2
+		blocks_sse2(state, lastBlock, 1);
+#else
+		uint8_t keystream[chacha20_block_size];
+		block_scalar(state, keystream);
+		xor_tail(lastBlock, keystream, tail);
+#endif
+		memcpy(data, lastBlock, tail);
+	}
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// ChaCha20 stream cipher (RFC 8439).
+// Keystream is generated with SSE2 (one block per step) or AVX2 (two blocks per step, enable W10_CIPHER_AVX2)
+// and falls back to plain C++ elsewhere, so whole packets and batched buffers are processed in place.
+
+constexpr size_t chacha20_key_size = 32;
+constexpr size_t chacha20_nonce_size = 12;
+constexpr size_t chacha20_block_size = 64;
+
+// XORs `size` bytes of `data` with the keystream for (key, nonce), starting from block `counter`.
+// Encryption and decryption are the same operation.
+void chacha20_xor(const uint8_t* key, const uint8_t* nonce, uint32_t counter, uint8_t* data, size_t size);
@@ -0,0 +1,57 @@
+// Throughput of the packet cipher against the byte-wise XOR it replaced.
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "chacha20.h"
+
+
+// Previous w10 cipher, kept here only as a baseline
+static void xor_bytewise(uint8_t* data, size_t size, const uint8_t* key_ptr)
+{
+	for (size_t i = 0; i < size; ++i)
+		data[i] ^= key_ptr[i % 4];
+}
+
+template <typename Callable>
+static double measure_ns_per_call(size_t iterations, Callable c)
+{
+	const auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < iterations; ++i)
+		c(i);
+	const auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+}
+
+int main()
+{
+	uint8_t key[chacha20_key_size];
+	for (size_t i = 0; i < chacha20_key_size; ++i)
+		key[i] = uint8_t(i * 7 + 1);
+	const uint32_t xorKey = 0xdeadbeef;
+
+	// snapshot, input, a batch of snapshots and a big blob
+	const size_t sizes[] = {7, 10, 1024, 64 * 1024};
+	for (size_t size : sizes)
+	{
+		std::vector<uint8_t> buffer(size, 0x5a);
+		const size_t iterations = size < 1024 ? 2000000 : (64 * 1024 * 1024) / size;
+
+		const double xorNs = measure_ns_per_call(
+			iterations, [&](size_t) { xor_bytewise(buffer.data(), buffer.size(), (const uint8_t*)&xorKey); });
+
+		uint8_t nonce[chacha20_nonce_size] = {};
+		const double chachaNs = measure_ns_per_call(iterations,
+			[&](size_t i)
+			{
+				memcpy(nonce + 4, &i, sizeof(uint32_t));
+				chacha20_xor(key, nonce, 0, buffer.data(), buffer.size());
+			});
+
+		printf("%6zu bytes: xor %9.1f ns (%7.1f MB/s)  chacha20 %9.1f ns (%7.1f MB/s)  checksum %u\n", size, xorNs,
+			size * 1e3 / xorNs, chachaNs, size * 1e3 / chachaNs, buffer[size / 2]);
+	}
+
+	return 0;
+}
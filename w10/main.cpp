@@ -13,42 +13,39 @@
 static std::vector<Entity> entities;
 static uint16_t my_entity = invalid_entity;
 
-void on_new_entity_packet(ENetPacket* packet)
+void on_new_entity_packet(const NewEntityView& msg)
 {
-	Entity newEntity;
-	deserialize_new_entity(packet, newEntity);
+	const uint16_t eid = msg.eid();
 	// TODO: Direct adressing, of course!
 	for (const Entity& e : entities)
-		if (e.eid == newEntity.eid)
+		if (e.eid == eid)
 			return; // don't need to do anything, we already have entity
-	entities.push_back(newEntity);
+	entities.push_back(msg.entity());
 }
 
-void on_set_controlled_entity(ENetPacket* packet)
+void on_set_controlled_entity(const SetControlledEntityView& msg)
 {
-	deserialize_set_controlled_entity(packet, my_entity);
+	my_entity = msg.eid();
 }
 
-void on_snapshot(ENetPacket* packet)
+void on_snapshot(const SnapshotView& msg)
 {
-	uint16_t eid = invalid_entity;
-	float x = 0.f;
-	float y = 0.f;
-	float ori = 0.f;
-	deserialize_snapshot(packet, eid, x, y, ori);
+	const uint16_t eid = msg.eid();
 	// TODO: Direct adressing, of course!
 	for (Entity& e : entities)
 		if (e.eid == eid)
 		{
-			e.x = x;
-			e.y = y;
-			e.ori = ori;
+			e.x = msg.x();
+			e.y = msg.y();
+			e.ori = msg.ori();
 		}
 }
 
-void on_key(ENetPacket* packet)
+void on_key(const KeyView& msg, ENetPeer* peer)
 {
-	deserialize_and_set_key(packet);
+	set_cipher_key(msg, peer);
+	// join is signed with the session, so it can't go out before the key arrives
+	send_join(peer);
 }
 
 int main(int argc, const char** argv)
@@ -111,23 +108,32 @@ int main(int argc, const char** argv)
 			{
 				case ENET_EVENT_TYPE_CONNECT:
 					printf("Connection with %x:%u established\n", event.peer->address.host, event.peer->address.port);
-					send_join(serverPeer);
 					connected = true;
 					break;
 				case ENET_EVENT_TYPE_RECEIVE:
+					if (get_packet_type(event.packet) != E_SERVER_TO_CLIENT_KEY &&
+						!decipher_data(event.packet, event.peer))
+					{
+						enet_packet_destroy(event.packet);
+						break;
+					}
 					switch (get_packet_type(event.packet))
 					{
 						case E_SERVER_TO_CLIENT_NEW_ENTITY:
-							on_new_entity_packet(event.packet);
+							if (NewEntityView msg; read_message(event.packet, msg))
+								on_new_entity_packet(msg);
 							break;
 						case E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY:
-							on_set_controlled_entity(event.packet);
+							if (SetControlledEntityView msg; read_message(event.packet, msg))
+								on_set_controlled_entity(msg);
 							break;
 						case E_SERVER_TO_CLIENT_SNAPSHOT:
-							on_snapshot(event.packet);
+							if (SnapshotView msg; read_message(event.packet, msg))
+								on_snapshot(msg);
 							break;
 						case E_SERVER_TO_CLIENT_KEY:
-							on_key(event.packet);
+							if (KeyView msg; read_message(event.packet, msg))
+								on_key(msg, event.peer);
 							break;
 					};
 					break;
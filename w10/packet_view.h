@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <enet/enet.h>
+#include <type_traits>
+
+
+// Read-only window over a received ENetPacket.
+// Message views check the packet size once when they are made, field accessors then load straight
+// from ENetPacket::data with memcpy, so unaligned fields are fine and nothing is copied up front.
+class PacketView
+{
+public:
+	PacketView() = default;
+	explicit PacketView(const ENetPacket* packet)
+		: data(packet->data)
+		, size(packet->dataLength)
+	{
+	}
+
+	size_t length() const { return size; }
+	const uint8_t* bytes(size_t offset) const { return data + offset; }
+
+	template <typename T>
+	T load(size_t offset) const
+	{
+		static_assert(std::is_trivially_copyable_v<T>, "only plain data can be loaded from a packet");
+		T val;
+		memcpy(&val, data + offset, sizeof(T));
+		return val;
+	}
+
+private:
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+};
+
+// View types describe their message with `type` and the exact packet `size`.
+template <typename View>
+bool read_message(const ENetPacket* packet, View& out)
+{
+	if (packet->dataLength != View::size || packet->data[0] != View::type)
+		return false;
+	out.view = PacketView(packet);
+	return true;
+}
@@ -2,64 +2,88 @@
 #include "quantisation.h"
 #include <cstring> // memcpy
 #include <iostream>
+#include <random>
 #include <stdlib.h>
 
-static uint32_t xorCipherKey = 0;
+static constexpr size_t auth_tag_size = sizeof(uint32_t);
+
+static PacketAuthStats authStats;
+
+void generate_cipher_key(CipherSession &session)
+{
+  std::random_device rd;
+  for (size_t i = 0; i < chacha20_key_size; i += sizeof(uint32_t))
+  {
+    uint32_t val = rd();
+    memcpy(session.key + i, &val, sizeof(uint32_t));
+  }
+  for (size_t i = 0; i < siphash_key_size; i += sizeof(uint32_t))
+  {
+    uint32_t val = rd();
+    memcpy(session.macKey + i, &val, sizeof(uint32_t));
+  }
+  session.sendSequence = 0;
+  session.receivedAny = false;
+  session.receiveWindow = 0;
+  session.joined = false;
+}
 
 void send_join(ENetPeer *peer)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t), ENET_PACKET_FLAG_RELIABLE);
+  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + auth_tag_size, ENET_PACKET_FLAG_RELIABLE);
   *packet->data = E_CLIENT_TO_SERVER_JOIN;
 
+  sign_packet(packet, peer);
+
   enet_peer_send(peer, 0, packet);
 }
 
 void send_new_entity(ENetPeer *peer, const Entity &ent)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(Entity),
+  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + cipher_header_size + sizeof(Entity),
                                                    ENET_PACKET_FLAG_RELIABLE);
   uint8_t *ptr = packet->data;
-  *ptr = E_SERVER_TO_CLIENT_NEW_ENTITY; ptr += sizeof(uint8_t);
+  *ptr = E_SERVER_TO_CLIENT_NEW_ENTITY; ptr += sizeof(uint8_t) + cipher_header_size;
   memcpy(ptr, &ent, sizeof(Entity)); ptr += sizeof(Entity);
 
+  cipher_data(packet, peer);
+
   enet_peer_send(peer, 0, packet);
 }
 
 void send_set_controlled_entity(ENetPeer *peer, uint16_t eid)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t),
+  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + cipher_header_size + sizeof(uint16_t),
                                                    ENET_PACKET_FLAG_RELIABLE);
   uint8_t *ptr = packet->data;
-  *ptr = E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY; ptr += sizeof(uint8_t);
+  *ptr = E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY; ptr += sizeof(uint8_t) + cipher_header_size;
   memcpy(ptr, &eid, sizeof(uint16_t)); ptr += sizeof(uint16_t);
 
+  cipher_data(packet, peer);
+
   enet_peer_send(peer, 0, packet);
 }
 
-void send_cipher_key(ENetPeer *peer, uint32_t key)
+void send_cipher_key(ENetPeer *peer, const CipherSession &session)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint32_t),
+  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + chacha20_key_size + siphash_key_size,
                                                    ENET_PACKET_FLAG_RELIABLE);
   uint8_t *ptr = packet->data;
   *ptr = E_SERVER_TO_CLIENT_KEY; ptr += sizeof(uint8_t);
-  memcpy(ptr, &key, sizeof(uint32_t)); ptr += sizeof(uint32_t);
+  memcpy(ptr, session.key, chacha20_key_size); ptr += chacha20_key_size;
+  memcpy(ptr, session.macKey, siphash_key_size); ptr += siphash_key_size;
 
   enet_peer_send(peer, 0, packet);
 }
 
-void fuzz_packet_data(ENetPacket *packet)
-{
-  packet->data[rand() % packet->dataLength] = (uint8_t)rand();
-}
-
 void send_entity_input(ENetPeer *peer, uint16_t eid, float thr, float ori)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t) +
-                                                   sizeof(float) * 2,
+  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + cipher_header_size + sizeof(uint16_t) +
+                                                   sizeof(float) * 2 + auth_tag_size,
                                                    //sizeof(uint8_t),
                                                    ENET_PACKET_FLAG_UNSEQUENCED);
   uint8_t *ptr = packet->data;
-  *ptr = E_CLIENT_TO_SERVER_INPUT; ptr += sizeof(uint8_t);
+  *ptr = E_CLIENT_TO_SERVER_INPUT; ptr += sizeof(uint8_t) + cipher_header_size;
   memcpy(ptr, &eid, sizeof(uint16_t)); ptr += sizeof(uint16_t);
   memcpy(ptr, &thr, sizeof(float)); ptr += sizeof(float);
   memcpy(ptr, &ori, sizeof(float)); ptr += sizeof(float);
@@ -74,21 +98,21 @@ void send_entity_input(ENetPeer *peer, uint16_t eid, float thr, float ori)
   memcpy(ptr, &oriPacked, sizeof(uint8_t)); ptr += sizeof(uint8_t);
   */
 
-  fuzz_packet_data(packet);
-  cipher_data(packet);
+  cipher_data(packet, peer);
+  sign_packet(packet, peer);
 
   enet_peer_send(peer, 1, packet);
 }
 
 void send_snapshot(ENetPeer *peer, uint16_t eid, float x, float y, float ori)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t) +
+  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + cipher_header_size + sizeof(uint16_t) +
                                                    sizeof(uint16_t) +
                                                    sizeof(uint16_t) +
                                                    sizeof(uint8_t),
                                                    ENET_PACKET_FLAG_UNSEQUENCED);
   uint8_t *ptr = packet->data;
-  *ptr = E_SERVER_TO_CLIENT_SNAPSHOT; ptr += sizeof(uint8_t);
+  *ptr = E_SERVER_TO_CLIENT_SNAPSHOT; ptr += sizeof(uint8_t) + cipher_header_size;
   memcpy(ptr, &eid, sizeof(uint16_t)); ptr += sizeof(uint16_t);
   uint16_t xPacked = pack_float<uint16_t>(x, -16.f, 16.f, 11);
   uint16_t yPacked = pack_float<uint16_t>(y, -8.f, 8.f, 10);
@@ -98,83 +122,162 @@ void send_snapshot(ENetPeer *peer, uint16_t eid, float x, float y, float ori)
   memcpy(ptr, &yPacked, sizeof(uint16_t)); ptr += sizeof(uint16_t);
   memcpy(ptr, &oriPacked, sizeof(uint8_t)); ptr += sizeof(uint8_t);
 
+  cipher_data(packet, peer);
+
   enet_peer_send(peer, 1, packet);
 }
 
-MessageType get_packet_type(ENetPacket *packet)
+MessageType get_packet_type(const ENetPacket *packet)
+{
+  return packet->dataLength > 0 ? (MessageType)*packet->data : E_INVALID_MESSAGE;
+}
+
+// Nonce is (message type, sequence), so client and server never reuse one under the shared session key
+static void xor_packet_data(ENetPacket *packet, const CipherSession &session, uint32_t sequence)
+{
+  uint8_t nonce[chacha20_nonce_size] = {};
+  nonce[0] = packet->data[0];
+  memcpy(nonce + 4, &sequence, sizeof(uint32_t));
+
+  const size_t headerSize = sizeof(uint8_t) + cipher_header_size;
+  chacha20_xor(session.key, nonce, 0, packet->data + headerSize, packet->dataLength - headerSize);
+}
+
+void cipher_data(ENetPacket *packet, ENetPeer *peer)
 {
-  return (MessageType)*packet->data;
+  CipherSession *session = (CipherSession*)peer->data;
+  uint32_t sequence = session->sendSequence++;
+  memcpy(packet->data + sizeof(uint8_t), &sequence, sizeof(uint32_t));
+  xor_packet_data(packet, *session, sequence);
 }
 
-void deserialize_new_entity(ENetPacket *packet, Entity &ent)
+bool decipher_data(ENetPacket *packet, ENetPeer *peer)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-  ent = *(Entity*)(ptr); ptr += sizeof(Entity);
+  const CipherSession *session = (const CipherSession*)peer->data;
+  if (!session || packet->dataLength < sizeof(uint8_t) + cipher_header_size)
+    return false;
+  uint32_t sequence = 0;
+  memcpy(&sequence, packet->data + sizeof(uint8_t), sizeof(uint32_t));
+  xor_packet_data(packet, *session, sequence);
+  return true;
 }
 
-void deserialize_set_controlled_entity(ENetPacket *packet, uint16_t &eid)
+static uint32_t compute_tag(const CipherSession &session, const uint8_t *data, size_t size)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-  eid = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
+  return uint32_t(siphash24(session.macKey, data, size));
 }
 
-void xor_packet_data(ENetPacket *packet, uint8_t *key_ptr)
+void sign_packet(ENetPacket *packet, ENetPeer *peer)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-  uint8_t *end = packet->data + packet->dataLength;
-  for (int i = 0; ptr < end; ++ptr, ++i)
+  const CipherSession *session = (const CipherSession*)peer->data;
+  const size_t signedSize = packet->dataLength - auth_tag_size;
+  uint32_t tag = compute_tag(*session, packet->data, signedSize);
+  memcpy(packet->data + signedSize, &tag, auth_tag_size);
+}
+
+// Sliding window over the last replay_window_size sequences: newer ones move it, older or already seen ones are replays
+static bool accept_sequence(CipherSession &session, uint32_t sequence)
+{
+  if (!session.receivedAny || sequence > session.receiveHighest)
   {
-    i = i % 4;
-    *ptr ^= key_ptr[i];
+    const uint32_t shift = session.receivedAny ? sequence - session.receiveHighest : replay_window_size;
+    session.receiveWindow = shift >= replay_window_size ? 0 : session.receiveWindow << shift;
+    session.receiveWindow |= 1;
+    session.receiveHighest = sequence;
+    session.receivedAny = true;
+    return true;
   }
+  const uint32_t age = session.receiveHighest - sequence;
+  if (age >= replay_window_size)
+    return false;
+  const uint64_t bit = uint64_t(1) << age;
+  if (session.receiveWindow & bit)
+    return false;
+  session.receiveWindow |= bit;
+  return true;
 }
 
-void cipher_data(ENetPacket *packet)
+bool authenticate_packet(ENetPacket *packet, ENetPeer *peer)
 {
-  xor_packet_data(packet, (uint8_t*)&xorCipherKey);
+  CipherSession *session = (CipherSession*)peer->data;
+  if (!session)
+  {
+    ++authStats.rejectedNoSession;
+    return false;
+  }
+  if (packet->dataLength < sizeof(uint8_t) + auth_tag_size)
+  {
+    ++authStats.rejectedShort;
+    return false;
+  }
+  const size_t signedSize = packet->dataLength - auth_tag_size;
+  uint32_t tag = 0;
+  memcpy(&tag, packet->data + signedSize, auth_tag_size);
+  if (tag != compute_tag(*session, packet->data, signedSize))
+  {
+    ++authStats.rejectedTag;
+    return false;
+  }
+  // the sequence is signed, so it is only looked at once the tag says it is the client's own;
+  // a join has none, but a session only ever joins once
+  if (get_packet_type(packet) == E_CLIENT_TO_SERVER_JOIN)
+  {
+    if (session->joined)
+    {
+      ++authStats.rejectedReplay;
+      return false;
+    }
+    session->joined = true;
+  }
+  else
+  {
+    uint32_t sequence = 0;
+    if (signedSize < sizeof(uint8_t) + cipher_header_size)
+    {
+      ++authStats.rejectedShort;
+      return false;
+    }
+    memcpy(&sequence, packet->data + sizeof(uint8_t), sizeof(uint32_t));
+    if (!accept_sequence(*session, sequence))
+    {
+      ++authStats.rejectedReplay;
+      return false;
+    }
+  }
+  ++authStats.accepted;
+  packet->dataLength = signedSize; // the rest of the pipeline never sees the tag
+  return true;
 }
 
-void decipher_data(ENetPacket *packet, ENetPeer *peer)
+const PacketAuthStats &get_packet_auth_stats()
 {
-  xor_packet_data(packet, (uint8_t*)peer->data);
+  return authStats;
 }
 
-void deserialize_entity_input(ENetPacket *packet, uint16_t &eid, float &thr, float &steer)
+float SnapshotView::x() const
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-
-  eid = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
-  thr = *(float*)(ptr); ptr += sizeof(float);
-  steer = *(float*)(ptr); ptr += sizeof(float);
-  //uint8_t thrSteerPacked = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
-  /*
-  uint8_t thrPacked = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
-  uint8_t oriPacked = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
-  */
-  /*
-  static uint8_t neutralPackedValue = pack_float<uint8_t>(0.f, -1.f, 1.f, 4);
-  float4bitsQuantized thrPacked(thrSteerPacked >> 4);
-  float4bitsQuantized steerPacked(thrSteerPacked & 0x0f);
-  thr = thrPacked.packedVal == neutralPackedValue ? 0.f : thrPacked.unpack(-1.f, 1.f);
-  steer = steerPacked.packedVal == neutralPackedValue ? 0.f : steerPacked.unpack(-1.f, 1.f);
-  */
+  return unpack_float<uint16_t>(view.load<uint16_t>(message_header_size + sizeof(uint16_t)), -16.f, 16.f, 11);
 }
 
-void deserialize_snapshot(ENetPacket *packet, uint16_t &eid, float &x, float &y, float &ori)
+float SnapshotView::y() const
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-  eid = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
-  uint16_t xPacked = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
-  uint16_t yPacked = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
-  uint8_t oriPacked = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
-  x = unpack_float<uint16_t>(xPacked, -16.f, 16.f, 11);
-  y = unpack_float<uint16_t>(yPacked, -8.f, 8.f, 10);
-  ori = unpack_float<uint8_t>(oriPacked, -PI, PI, 8);
+  return unpack_float<uint16_t>(view.load<uint16_t>(message_header_size + sizeof(uint16_t) * 2), -8.f, 8.f, 10);
 }
 
-void deserialize_and_set_key(ENetPacket *packet)
+float SnapshotView::ori() const
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-  xorCipherKey = *(uint32_t*)(ptr); ptr += sizeof(uint32_t);
+  return unpack_float<uint8_t>(view.load<uint8_t>(message_header_size + sizeof(uint16_t) * 3), -PI, PI, 8);
 }
 
+void set_cipher_key(const KeyView &key, ENetPeer *peer)
+{
+  CipherSession *session = (CipherSession*)peer->data;
+  if (!session)
+  {
+    session = new CipherSession;
+    peer->data = session;
+  }
+  memcpy(session->key, key.key(), chacha20_key_size);
+  memcpy(session->macKey, key.macKey(), siphash_key_size);
+  session->sendSequence = 0;
+}
@@ -1,7 +1,11 @@
 #pragma once
 #include <enet/enet.h>
+#include <cstddef>
 #include <cstdint>
+#include "chacha20.h"
 #include "entity.h"
+#include "packet_view.h"
+#include "siphash.h"
 
 enum MessageType : uint8_t
 {
@@ -10,24 +14,116 @@ enum MessageType : uint8_t
   E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY,
   E_CLIENT_TO_SERVER_INPUT,
   E_SERVER_TO_CLIENT_SNAPSHOT,
-  E_SERVER_TO_CLIENT_KEY
+  E_SERVER_TO_CLIENT_KEY,
+
+  E_INVALID_MESSAGE = 0xff // what get_packet_type() reports for an empty packet
+};
+
+constexpr size_t cipher_header_size = sizeof(uint32_t);
+constexpr size_t message_header_size = sizeof(uint8_t) + cipher_header_size;
+// How far back a late unsequenced packet is still accepted, in sequences
+constexpr uint32_t replay_window_size = 64;
+
+// Lives in ENetPeer::data on both sides once the key is known
+struct CipherSession
+{
+  uint8_t key[chacha20_key_size] = {};
+  uint8_t macKey[siphash_key_size] = {};
+  uint32_t sendSequence = 0; // part of the per-packet nonce, sent in clear
+  // replay window over the sequences received from the other side
+  uint32_t receiveHighest = 0;
+  uint64_t receiveWindow = 0; // bit i: receiveHighest - i was seen
+  bool receivedAny = false;
+  bool joined = false; // joins carry no sequence, any after the first is a replay
+};
+
+// Counts what authenticate_packet() let through and what it dropped
+struct PacketAuthStats
+{
+  uint64_t accepted = 0;
+  uint64_t rejectedNoSession = 0;
+  uint64_t rejectedShort = 0;
+  uint64_t rejectedTag = 0;
+  uint64_t rejectedReplay = 0;
+
+  uint64_t rejected() const { return rejectedNoSession + rejectedShort + rejectedTag + rejectedReplay; }
 };
 
+void generate_cipher_key(CipherSession &session);
+
 void send_join(ENetPeer *peer);
 void send_new_entity(ENetPeer *peer, const Entity &ent);
 void send_set_controlled_entity(ENetPeer *peer, uint16_t eid);
-void send_cipher_key(ENetPeer *peer, uint32_t key);
+void send_cipher_key(ENetPeer *peer, const CipherSession &session);
 void send_entity_input(ENetPeer *peer, uint16_t eid, float thr, float steer);
 void send_snapshot(ENetPeer *peer, uint16_t eid, float x, float y, float ori);
 
-MessageType get_packet_type(ENetPacket *packet);
+MessageType get_packet_type(const ENetPacket *packet);
+
+// Typed views over received (and already deciphered) messages, made with read_message().
+// It rejects packets of the wrong size, so accessors never check bounds.
+struct NewEntityView
+{
+  static constexpr MessageType type = E_SERVER_TO_CLIENT_NEW_ENTITY;
+  static constexpr size_t size = message_header_size + sizeof(Entity);
+  PacketView view;
+
+  uint16_t eid() const { return view.load<uint16_t>(message_header_size + offsetof(Entity, eid)); }
+  Entity entity() const { return view.load<Entity>(message_header_size); }
+};
+
+struct SetControlledEntityView
+{
+  static constexpr MessageType type = E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY;
+  static constexpr size_t size = message_header_size + sizeof(uint16_t);
+  PacketView view;
+
+  uint16_t eid() const { return view.load<uint16_t>(message_header_size); }
+};
+
+struct EntityInputView
+{
+  static constexpr MessageType type = E_CLIENT_TO_SERVER_INPUT;
+  static constexpr size_t size = message_header_size + sizeof(uint16_t) + sizeof(float) * 2;
+  PacketView view;
+
+  uint16_t eid() const { return view.load<uint16_t>(message_header_size); }
+  float thr() const { return view.load<float>(message_header_size + sizeof(uint16_t)); }
+  float steer() const { return view.load<float>(message_header_size + sizeof(uint16_t) + sizeof(float)); }
+};
+
+struct SnapshotView
+{
+  static constexpr MessageType type = E_SERVER_TO_CLIENT_SNAPSHOT;
+  static constexpr size_t size = message_header_size + sizeof(uint16_t) * 3 + sizeof(uint8_t);
+  PacketView view;
+
+  uint16_t eid() const { return view.load<uint16_t>(message_header_size); }
+  float x() const;
+  float y() const;
+  float ori() const;
+};
+
+struct KeyView
+{
+  static constexpr MessageType type = E_SERVER_TO_CLIENT_KEY;
+  static constexpr size_t size = sizeof(uint8_t) + chacha20_key_size + siphash_key_size;
+  PacketView view;
+
+  const uint8_t *key() const { return view.bytes(sizeof(uint8_t)); }
+  const uint8_t *macKey() const { return view.bytes(sizeof(uint8_t) + chacha20_key_size); }
+};
+
+void set_cipher_key(const KeyView &key, ENetPeer *peer);
 
-void deserialize_new_entity(ENetPacket *packet, Entity &ent);
-void deserialize_set_controlled_entity(ENetPacket *packet, uint16_t &eid);
-void deserialize_entity_input(ENetPacket *packet, uint16_t &eid, float &thr, float &steer);
-void deserialize_snapshot(ENetPacket *packet, uint16_t &eid, float &x, float &y, float &ori);
-void deserialize_and_set_key(ENetPacket *packet);
+// Everything but join and key messages is ciphered with the session of the peer it is sent to/received from
+void cipher_data(ENetPacket *packet, ENetPeer *peer);
+bool decipher_data(ENetPacket *packet, ENetPeer *peer);
 
-void cipher_data(ENetPacket *packet);
-void decipher_data(ENetPacket *packet, ENetPeer *peer);
+// Client packets end with a truncated SipHash-2-4 tag over everything before it.
+// Server checks it before touching the payload and strips it on success; a ciphered packet whose sequence was
+// already seen, or is older than the replay window, is dropped as a replay, and so is a second join.
+void sign_packet(ENetPacket *packet, ENetPeer *peer);
+bool authenticate_packet(ENetPacket *packet, ENetPeer *peer);
+const PacketAuthStats &get_packet_auth_stats();
 
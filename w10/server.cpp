@@ -6,11 +6,35 @@
 #include <stdlib.h>
 #include <vector>
 #include <map>
-#include <random>
+#include <cmath>
 
 static std::vector<Entity> entities;
 static std::map<uint16_t, ENetPeer*> controlledMap;
 
+// Peers get their cipher session on connect, anything without one can't be sent to
+static bool has_session(const ENetPeer *peer)
+{
+  return peer->data != nullptr;
+}
+
+static void report_auth_stats(uint32_t cur_time)
+{
+  static uint32_t lastReportTime = cur_time;
+  static uint64_t lastRejected = 0;
+  if (cur_time - lastReportTime < 5000)
+    return;
+  lastReportTime = cur_time;
+
+  const PacketAuthStats &stats = get_packet_auth_stats();
+  if (stats.rejected() == lastRejected)
+    return;
+  lastRejected = stats.rejected();
+  printf("Packets accepted %llu, rejected: no session %llu, too short %llu, bad tag %llu, replayed %llu\n",
+         (unsigned long long)stats.accepted, (unsigned long long)stats.rejectedNoSession,
+         (unsigned long long)stats.rejectedShort, (unsigned long long)stats.rejectedTag,
+         (unsigned long long)stats.rejectedReplay);
+}
+
 void on_join(ENetPacket *packet, ENetPeer *peer, ENetHost *host)
 {
   // send all entities
@@ -36,22 +60,22 @@ void on_join(ENetPacket *packet, ENetPeer *peer, ENetHost *host)
 
   // send info about new entity to everyone
   for (size_t i = 0; i < host->peerCount; ++i)
-    send_new_entity(&host->peers[i], ent);
+    if (has_session(&host->peers[i]))
+      send_new_entity(&host->peers[i], ent);
   // send info about controlled entity
   send_set_controlled_entity(peer, newEid);
-  uint32_t *keyPtr = (uint32_t*)peer->data;
-  std::random_device rd;  //Will be used to obtain a seed for the random number engine
-  std::mt19937 gen(rd()); //Standard mersenne_twister_engine seeded with rd()
-  std::uniform_int_distribution<uint32_t> distrib(0);
-  *keyPtr = distrib(gen);
-  send_cipher_key(peer, *keyPtr);
 }
 
-void on_input(ENetPacket *packet)
+void on_input(const EntityInputView &msg, ENetPeer *peer)
 {
-  uint16_t eid = invalid_entity;
-  float thr = 0.f; float steer = 0.f;
-  deserialize_entity_input(packet, eid, thr, steer);
+  uint16_t eid = msg.eid();
+  float thr = msg.thr(); float steer = msg.steer();
+  // tag proves who sent it, not that they only steer their own ship
+  auto itf = controlledMap.find(eid);
+  if (itf == controlledMap.end() || itf->second != peer || !std::isfinite(thr) || !std::isfinite(steer))
+    return;
+  thr = clamp(thr, -1.f, 1.f);
+  steer = clamp(steer, -1.f, 1.f);
   for (Entity &e : entities)
     if (e.eid == eid)
     {
@@ -93,22 +117,34 @@ int main(int argc, const char **argv)
       {
       case ENET_EVENT_TYPE_CONNECT:
         printf("Connection with %x:%u established\n", event.peer->address.host, event.peer->address.port);
-        event.peer->data = new uint32_t;
-        *(uint32_t*)event.peer->data = 0;
+        {
+          CipherSession *session = new CipherSession;
+          generate_cipher_key(*session);
+          event.peer->data = session;
+          // reliable channel 0 keeps it ahead of everything ciphered with it
+          send_cipher_key(event.peer, *session);
+        }
         break;
       case ENET_EVENT_TYPE_DISCONNECT:
         printf("Disconnected %x:%u \n", event.peer->address.host, event.peer->address.port);
-        delete event.peer->data;
+        delete (CipherSession*)event.peer->data;
+        event.peer->data = nullptr;
         break;
       case ENET_EVENT_TYPE_RECEIVE:
+        // junk never gets past this, not even to the type byte
+        if (!authenticate_packet(event.packet, event.peer))
+        {
+          enet_packet_destroy(event.packet);
+          break;
+        }
         switch (get_packet_type(event.packet))
         {
           case E_CLIENT_TO_SERVER_JOIN:
             on_join(event.packet, event.peer, server);
             break;
           case E_CLIENT_TO_SERVER_INPUT:
-            decipher_data(event.packet, event.peer);
-            on_input(event.packet);
+            if (EntityInputView msg; decipher_data(event.packet, event.peer) && read_message(event.packet, msg))
+              on_input(msg, event.peer);
             break;
         };
         enet_packet_destroy(event.packet);
@@ -126,11 +162,14 @@ int main(int argc, const char **argv)
       for (size_t i = 0; i < server->peerCount; ++i)
       {
         ENetPeer *peer = &server->peers[i];
+        if (!has_session(peer))
+          continue;
         // skip this here in this implementation
         //if (controlledMap[e.eid] != peer)
         send_snapshot(peer, e.eid, e.x, e.y, e.ori);
       }
     }
+    report_auth_stats(curTime);
     usleep(10000);
   }
 
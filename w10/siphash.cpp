@@ -0,0 +1,67 @@
+#include "siphash.h"
+
+#include <cstring>
+
+static inline uint64_t rotl64(uint64_t v, int n)
+{
+	return (v << n) | (v >> (64 - n));
+}
+
+static inline uint64_t load_le64(const uint8_t* ptr)
+{
+	uint64_t val;
+	memcpy(&val, ptr, sizeof(uint64_t)); // little endian only, same as the cipher
+	return val;
+}
+
+static inline void sip_round(uint64_t& v0, uint64_t& v1, uint64_t& v2, uint64_t& v3)
+{
+	v0 += v1;
+	v1 = rotl64(v1, 13);
+	v1 ^= v0;
+	v0 = rotl64(v0, 32);
+	v2 += v3;
+	v3 = rotl64(v3, 16);
+	v3 ^= v2;
+	v0 += v3;
+	v3 = rotl64(v3, 21);
+	v3 ^= v0;
+	v2 += v1;
+	v1 = rotl64(v1, 17);
+	v1 ^= v2;
+	v2 = rotl64(v2, 32);
+}
+
+uint64_t siphash24(const uint8_t* key, const uint8_t* data, size_t size)
+{
+	const uint64_t k0 = load_le64(key);
+	const uint64_t k1 = load_le64(key + 8);
+	uint64_t v0 = 0x736f6d6570736575ull ^ k0;
+	uint64_t v1 = 0x646f72616e646f6dull ^ k1;
+	uint64_t v2 = 0x6c7967656e657261ull ^ k0;
+	uint64_t v3 = 0x7465646279746573ull ^ k1;
+
+	const uint8_t* end = data + (size & ~size_t(7));
+	for (; data != end; data += 8)
+	{
+		const uint64_t m = load_le64(data);
+		v3 ^= m;
+		sip_round(v0, v1, v2, v3);
+		sip_round(v0, v1, v2, v3);
+		v0 ^= m;
+	}
+
+	uint64_t last = uint64_t(size) << 56;
+	for (size_t i = 0; i < (size & 7); ++i)
+		last |= uint64_t(data[i]) << (8 * i);
+
+	v3 ^= last;
+	sip_round(v0, v1, v2, v3);
+	sip_round(v0, v1, v2, v3);
+	v0 ^= last;
+
+	v2 ^= 0xff;
+	for (int i = 0; i < 4; ++i)
+		sip_round(v0, v1, v2, v3);
+	return v0 ^ v1 ^ v2 ^ v3;
+}
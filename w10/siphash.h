@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// SipHash-2-4 keyed hash, used as a short MAC on client packets.
+constexpr size_t siphash_key_size = 16;
+
+uint64_t siphash24(const uint8_t* key, const uint8_t* data, size_t size);
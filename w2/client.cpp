@@ -1,34 +1,152 @@
 #include <enet/enet.h>
 #include <iostream>
+#include <map>
+#include <string>
 
+#include "protocol.h"
 #include "raylib.h"
+#include "transfer.h"
 
-void send_fragmented_packet(ENetPeer* peer)
+void send_micro_packet(ENetPeer* peer)
 {
-	const char* baseMsg = "Stay awhile and listen. ";
-	const size_t msgLen = strlen(baseMsg);
+	const char* msg = "dv/dt";
+	ENetPacket* packet = enet_packet_create(msg, strlen(msg) + 1, ENET_PACKET_FLAG_UNSEQUENCED);
+	enet_peer_send(peer, 1, packet);
+}
 
-	const size_t sendSize = 2500;
-	char* hugeMessage = new char[sendSize];
-	for (size_t i = 0; i < sendSize; ++i)
-		hugeMessage[i] = baseMsg[i % msgLen];
-	hugeMessage[sendSize - 1] = '\0';
+// What the lobby told us so far, kept up to date by its deltas
+struct LobbyView
+{
+	uint32_t myId = 0;
+	uint32_t roomId = 0; // 0: looking at the room list
+	std::map<uint32_t, RoomInfo> rooms;
+	std::map<uint32_t, PlayerInfo> players; // of the room we're in
+	std::string status = "connecting";
+	std::string lastError;
+};
 
-	ENetPacket* packet = enet_packet_create(hugeMessage, sendSize, ENET_PACKET_FLAG_RELIABLE);
-	enet_peer_send(peer, 0, packet);
+void on_lobby_packet(ENetPacket* packet, LobbyView& lobby)
+{
+	MessageType type;
+	if (!get_packet_type(packet, type))
+		return;
+	switch (type)
+	{
+		case E_LOBBY_TO_CLIENT_WELCOME:
+			if (deserialize_id(packet, lobby.myId))
+				lobby.status = "in the lobby";
+			break;
+		case E_LOBBY_TO_CLIENT_ROOM_DELTA:
+		{
+			DeltaOp op;
+			RoomInfo room;
+			if (!deserialize_room_delta(packet, op, room))
+				break;
+			if (op == DeltaOp::Remove)
+				lobby.rooms.erase(room.id);
+			else
+				lobby.rooms[room.id] = room;
+			break;
+		}
+		case E_LOBBY_TO_CLIENT_JOINED_ROOM:
+		{
+			uint32_t roomId = 0;
+			if (!deserialize_id(packet, roomId))
+				break;
+			// both lists start over, the lobby sends whichever we look at now in full
+			lobby.roomId = roomId;
+			lobby.rooms.clear();
+			lobby.players.clear();
+			lobby.status = roomId != 0 ? TextFormat("in room %u", roomId) : "in the lobby";
+			break;
+		}
+		case E_LOBBY_TO_CLIENT_PLAYER_DELTA:
+		{
+			DeltaOp op;
+			PlayerInfo player;
+			if (!deserialize_player_delta(packet, op, player))
+				break;
+			if (op == DeltaOp::Remove)
+				lobby.players.erase(player.id);
+			else if (op == DeltaOp::Update)
+				lobby.players[player.id].ready = player.ready;
+			else
+				lobby.players[player.id] = player;
+			break;
+		}
+		case E_LOBBY_TO_CLIENT_START_GAME:
+		{
+			ENetAddress server;
+			if (deserialize_start_game(packet, server))
+				lobby.status = TextFormat("game started on %x:%u", server.host, server.port);
+			break;
+		}
+		case E_LOBBY_TO_CLIENT_ERROR:
+			deserialize_name(packet, lobby.lastError);
+			break;
+		default:
+			break;
+	}
+}
 
-	delete[] hugeMessage;
+// C creates a room, 1-9 (or J for the first one) joins one from the list, L leaves, R toggles ready
+void handle_lobby_keys(ENetPeer* peer, const LobbyView& lobby, const std::string& name)
+{
+	if (lobby.roomId == 0)
+	{
+		if (IsKeyPressed(KEY_C))
+			send_create_room(peer, name + "'s room");
+		int index = IsKeyPressed(KEY_J) ? 0 : -1;
+		for (int key = KEY_ONE; key <= KEY_NINE; ++key)
+			if (IsKeyPressed(key))
+				index = key - KEY_ONE;
+		if (index >= 0 && size_t(index) < lobby.rooms.size())
+			send_join_room(peer, std::next(lobby.rooms.begin(), index)->first);
+		return;
+	}
+	if (IsKeyPressed(KEY_L))
+		send_leave_room(peer);
+	if (IsKeyPressed(KEY_R))
+	{
+		auto me = lobby.players.find(lobby.myId);
+		if (me != lobby.players.end())
+			send_set_ready(peer, !me->second.ready);
+	}
 }
 
-void send_micro_packet(ENetPeer* peer)
+void draw_lobby(const LobbyView& lobby, int y)
 {
-	const char* msg = "dv/dt";
-	ENetPacket* packet = enet_packet_create(msg, strlen(msg) + 1, ENET_PACKET_FLAG_UNSEQUENCED);
-	enet_peer_send(peer, 1, packet);
+	static const char* stateNames[] = {"open", "starting", "in game"};
+	if (lobby.roomId == 0)
+	{
+		DrawText("Rooms (C create, 1-9 join):", 20, y, 20, WHITE);
+		int index = 1;
+		for (const auto& [id, room] : lobby.rooms)
+		{
+			y += 20;
+			DrawText(TextFormat("%d. %s  %u/%u  %s", index++, room.name.c_str(), room.players, room.maxPlayers,
+								stateNames[size_t(room.state)]),
+					 20, y, 20, WHITE);
+		}
+	}
+	else
+	{
+		DrawText("List of players (R ready, L leave):", 20, y, 20, WHITE);
+		for (const auto& [id, player] : lobby.players)
+		{
+			y += 20;
+			DrawText(TextFormat("%s%s", player.name.c_str(), player.ready ? "  [ready]" : ""), 20, y, 20,
+					 id == lobby.myId ? YELLOW : WHITE);
+		}
+	}
+	if (!lobby.lastError.empty())
+		DrawText(lobby.lastError.c_str(), 20, y + 30, 20, RED);
 }
 
 int main(int argc, const char** argv)
 {
+	const std::string name = argc > 1 ? argv[1] : "Player";
+
 	int width = 800;
 	int height = 600;
 	InitWindow(width, height, "w2 MIPT Network");
@@ -50,7 +168,7 @@ int main(int argc, const char** argv)
 		return 1;
 	}
 
-	ENetHost* client = enet_host_create(nullptr, 1, 2, 0, 0);
+	ENetHost* client = enet_host_create(nullptr, 1, 3, 0, 0);
 	if (!client)
 	{
 		printf("Cannot create ENet client\n");
@@ -61,7 +179,7 @@ int main(int argc, const char** argv)
 	enet_address_set_host(&address, "localhost");
 	address.port = 10887;
 
-	ENetPeer* lobbyPeer = enet_host_connect(client, &address, 2, 0);
+	ENetPeer* lobbyPeer = enet_host_connect(client, &address, 3, 0);
 	if (!lobbyPeer)
 	{
 		printf("Cannot connect to lobby");
@@ -69,9 +187,12 @@ int main(int argc, const char** argv)
 	}
 
 	uint32_t timeStart = enet_time_get();
-	uint32_t lastFragmentedSendTime = timeStart;
 	uint32_t lastMicroSendTime = timeStart;
 	bool connected = false;
+	LobbyView lobby;
+	// the map the lobby streams on connect, kept across reconnects until it is complete
+	TransferReceiver mapTransfer;
+	std::vector<uint8_t> mapData;
 	float posx = GetRandomValue(100, 1000);
 	float posy = GetRandomValue(100, 500);
 	float velx = 0.f;
@@ -87,29 +208,39 @@ int main(int argc, const char** argv)
 				case ENET_EVENT_TYPE_CONNECT:
 					printf("Connection with %x:%u established\n", event.peer->address.host, event.peer->address.port);
 					connected = true;
+					send_hello(lobbyPeer, name);
+					break;
+				case ENET_EVENT_TYPE_DISCONNECT:
+					printf("Lost the lobby\n");
+					connected = false;
+					lobby.status = "disconnected";
+					mapTransfer.onDisconnect();
 					break;
 				case ENET_EVENT_TYPE_RECEIVE:
-					printf("Packet received '%s'\n", event.packet->data);
+					if (event.channelID == transferChannel)
+						mapTransfer.onPacket(event.peer, event.packet);
+					else
+						on_lobby_packet(event.packet, lobby);
 					enet_packet_destroy(event.packet);
 					break;
 				default:
 					break;
 			};
 		}
+		uint64_t mapId = 0;
+		if (mapTransfer.takeCompleted(mapId, mapData))
+			printf("Map %016llx received, %zu bytes\n", (unsigned long long)mapId, mapData.size());
 		if (connected)
 		{
 			uint32_t curTime = enet_time_get();
-			if (curTime - lastFragmentedSendTime > 1000)
-			{
-				lastFragmentedSendTime = curTime;
-				send_fragmented_packet(lobbyPeer);
-			}
 			if (curTime - lastMicroSendTime > 100)
 			{
 				lastMicroSendTime = curTime;
 				send_micro_packet(lobbyPeer);
 			}
 		}
+		if (connected)
+			handle_lobby_keys(lobbyPeer, lobby, name);
 		bool left = IsKeyDown(KEY_LEFT);
 		bool right = IsKeyDown(KEY_RIGHT);
 		bool up = IsKeyDown(KEY_UP);
@@ -124,9 +255,15 @@ int main(int argc, const char** argv)
 
 		BeginDrawing();
 		ClearBackground(BLACK);
-		DrawText(TextFormat("Current status: %s", "unknown"), 20, 20, 20, WHITE);
+		DrawText(TextFormat("Current status: %s", lobby.status.c_str()), 20, 20, 20, WHITE);
 		DrawText(TextFormat("My position: (%d, %d)", (int)posx, (int)posy), 20, 40, 20, WHITE);
-		DrawText("List of players:", 20, 60, 20, WHITE);
+		draw_lobby(lobby, 60);
+		TransferReceiver::Progress mapProgress;
+		if (mapTransfer.progress(mapProgress))
+			DrawText(TextFormat("Loading map: %zu / %zu KiB", mapProgress.received / 1024, mapProgress.size / 1024), 20,
+					 height - 30, 20, WHITE);
+		else if (!mapData.empty())
+			DrawText(TextFormat("Map: %zu KiB", mapData.size() / 1024), 20, height - 30, 20, WHITE);
 		DrawCircleV(Vector2{posx, posy}, 10.f, WHITE);
 		EndDrawing();
 	}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <enet/enet.h>
+#include <vector>
+
+
+// Game server instances the lobby hands started rooms to. Every instance runs any number of rooms, a room goes to
+// the one running the fewest; the count goes down again when the room is gone.
+class GameServerPool
+{
+public:
+  static constexpr int none = -1;
+
+  void add(const ENetAddress &address) { servers.push_back({address, 0}); }
+  size_t size() const { return servers.size(); }
+
+  // none when there are no servers at all
+  int assign()
+  {
+    int best = none;
+    for (size_t i = 0; i < servers.size(); ++i)
+      if (best == none || servers[i].rooms < servers[best].rooms)
+        best = int(i);
+    if (best != none)
+      ++servers[best].rooms;
+    return best;
+  }
+
+  void release(int index)
+  {
+    if (index != none)
+      --servers[index].rooms;
+  }
+
+  const ENetAddress &address(int index) const { return servers[index].address; }
+
+private:
+  struct Server
+  {
+    ENetAddress address;
+    uint32_t rooms;
+  };
+
+  std::vector<Server> servers;
+};
@@ -1,5 +1,141 @@
 #include <enet/enet.h>
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <vector>
+
+#include "game_servers.h"
+#include "registry_client.h"
+#include "room_manager.h"
+#include "transfer.h"
+
+// Idle peers cost nothing, the limit is only there to bound ENet's peer array
+static constexpr size_t maxPeers = 4096;
+// Longest sleep, so that ENet still gets to resend and ping when nothing happens
+static constexpr uint32_t maxServiceTimeoutMs = 100;
+// The registry's answers arrive on a host of its own, it's looked at this often while one is due
+static constexpr uint32_t registryPollMs = 1;
+// While a transfer waits for its window or rate, so it doesn't stall until the next packet
+static constexpr uint32_t transferPollMs = 5;
+
+// The whole of arg, false on anything else or a value out of T's range
+template <typename T>
+static bool parse_number(const char *arg, T &value)
+{
+  const char *end = arg + strlen(arg);
+  auto [ptr, ec] = std::from_chars(arg, end, value);
+  return ec == std::errc() && ptr == end;
+}
+
+// host:port, or just host for the default port
+static bool parse_address(const char *arg, uint16_t defaultPort, ENetAddress &address)
+{
+  const char *colon = strrchr(arg, ':');
+  address.port = defaultPort;
+  if (colon && !parse_number(colon + 1, address.port))
+  {
+    printf("Bad port in %s\n", arg);
+    return false;
+  }
+  const std::string host = colon ? std::string(arg, colon) : std::string(arg);
+  if (enet_address_set_host(&address, host.c_str()) != 0)
+  {
+    printf("Cannot resolve %s\n", arg);
+    return false;
+  }
+  return true;
+}
+
+static void print_usage(const char *name)
+{
+  printf("Usage: %s [--registry host[:port]] [--game-server host[:port]]... [--map file]\n", name);
+}
+
+struct LobbyConfig
+{
+  GameServerPool servers;
+  std::unique_ptr<RegistryClient> registry;
+  std::shared_ptr<const Blob> map; // streamed to every client that connects
+};
+
+// lobby [--registry host:port] [--game-server host:port]... [--map file]
+// With a registry the game servers register there themselves and the --game-server list is unused
+static bool parse_args(int argc, const char **argv, LobbyConfig &config)
+{
+  for (int i = 1; i < argc; ++i)
+  {
+    ENetAddress address;
+    // every option takes a value
+    if (i + 1 == argc)
+    {
+      print_usage(argv[0]);
+      return false;
+    }
+    if (strcmp(argv[i], "--game-server") == 0)
+    {
+      if (!parse_address(argv[++i], 10131, address))
+        return false;
+      config.servers.add(address);
+    }
+    else if (strcmp(argv[i], "--registry") == 0)
+    {
+      if (!parse_address(argv[++i], registryPort, address))
+        return false;
+      config.registry = std::make_unique<RegistryClient>(address);
+    }
+    else if (strcmp(argv[i], "--map") == 0)
+    {
+      config.map = Blob::mapFile(argv[++i]);
+      if (!config.map)
+      {
+        printf("Cannot map %s\n", argv[i]);
+        return false;
+      }
+    }
+    else
+    {
+      print_usage(argv[0]);
+      return false;
+    }
+  }
+  if (config.servers.size() == 0)
+  {
+    ENetAddress address;
+    enet_address_set_host(&address, "localhost");
+    address.port = 10131;
+    config.servers.add(address);
+  }
+  return !config.registry || config.registry->start();
+}
+
+static void handle_event(const ENetEvent &event, const LobbyConfig &config, RoomManager &rooms,
+                         TransferSender &transfers)
+{
+  switch (event.type)
+  {
+  case ENET_EVENT_TYPE_CONNECT:
+    rooms.onConnect(event.peer);
+    if (config.map)
+      transfers.send(event.peer, config.map);
+    break;
+  case ENET_EVENT_TYPE_DISCONNECT:
+    rooms.onDisconnect(event.peer);
+    transfers.onDisconnect(event.peer);
+    break;
+  case ENET_EVENT_TYPE_RECEIVE:
+    if (event.channelID == transferChannel)
+      transfers.onPacket(event.peer, event.packet);
+    else
+      rooms.onPacket(event.peer, event.packet, RoomManager::Clock::now());
+    enet_packet_destroy(event.packet);
+    break;
+  default:
+    break;
+  };
+}
 
 int main(int argc, const char **argv)
 {
@@ -8,12 +144,22 @@ int main(int argc, const char **argv)
     printf("Cannot init ENet");
     return 1;
   }
+  atexit(enet_deinitialize);
+
+  LobbyConfig config;
+  if (!parse_args(argc, argv, config))
+    return 1;
+  RoomManager rooms(config.servers, config.registry.get());
+  std::vector<RegistryClient::Assignment> assignments;
+  // declared before the host, chunks still queued in it point into the sender's streams
+  TransferSender transfers;
+
   ENetAddress address;
 
   address.host = ENET_HOST_ANY;
   address.port = 10887;
 
-  ENetHost *server = enet_host_create(&address, 32, 2, 0, 0);
+  ENetHost *server = enet_host_create(&address, maxPeers, 3, 0, 0);
 
   if (!server)
   {
@@ -21,29 +167,45 @@ int main(int argc, const char **argv)
     return 1;
   }
 
+  // Sleeps until the next packet or the next countdown, whichever comes first; the registry is only looked at in
+  // between, unless an answer from it is due. Everything that already arrived is handled before anything is sent,
+  // the replies to a burst of requests go out together in one flush.
   while (true)
   {
+    if (config.registry)
+    {
+      assignments.clear();
+      config.registry->update(assignments);
+      for (const RegistryClient::Assignment &assignment : assignments)
+        rooms.onServerAssigned(assignment);
+    }
+
+    const auto now = RoomManager::Clock::now();
+    rooms.update(now);
+
+    uint32_t timeout = maxServiceTimeoutMs;
+    const auto deadline = rooms.nextDeadline();
+    if (deadline != RoomManager::Clock::time_point::max())
+    {
+      const auto untilDeadline = std::chrono::ceil<std::chrono::milliseconds>(deadline - now).count();
+      timeout = uint32_t(std::clamp<decltype(untilDeadline)>(untilDeadline, 0, maxServiceTimeoutMs));
+    }
+    if (config.registry && config.registry->hasPending())
+      timeout = std::min(timeout, registryPollMs);
+    if (transfers.busy())
+      timeout = std::min(timeout, transferPollMs);
+
     ENetEvent event;
-    while (enet_host_service(server, &event, 10) > 0)
+    if (enet_host_service(server, &event, timeout) > 0)
     {
-      switch (event.type)
-      {
-      case ENET_EVENT_TYPE_CONNECT:
-        printf("Connection with %x:%u established\n", event.peer->address.host, event.peer->address.port);
-        break;
-      case ENET_EVENT_TYPE_RECEIVE:
-        printf("Packet received '%s'\n", event.packet->data);
-        enet_packet_destroy(event.packet);
-        break;
-      default:
-        break;
-      };
+      handle_event(event, config, rooms, transfers);
+      while (enet_host_check_events(server, &event) > 0)
+        handle_event(event, config, rooms, transfers);
     }
+    transfers.update(enet_time_get());
+    enet_host_flush(server);
   }
 
   enet_host_destroy(server);
-
-  atexit(enet_deinitialize);
   return 0;
 }
-
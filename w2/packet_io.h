@@ -0,0 +1,51 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring> // memcpy
+#include <string>
+
+// Packets are sized up front and filled in place, no intermediate buffers
+struct PacketWriter
+{
+  uint8_t *ptr;
+
+  template <typename T>
+  void write(const T &value)
+  {
+    memcpy(ptr, &value, sizeof(T)); ptr += sizeof(T);
+  }
+
+  // longer names are cut to maxLength
+  void writeName(const std::string &name, size_t maxLength)
+  {
+    const uint8_t length = uint8_t(std::min(name.size(), maxLength));
+    write(length);
+    memcpy(ptr, name.data(), length); ptr += length;
+  }
+};
+
+// Every read checks what's left, a short packet fails instead of reading past its end
+struct PacketReader
+{
+  const uint8_t *ptr;
+  const uint8_t *end;
+
+  template <typename T>
+  bool read(T &value)
+  {
+    if (size_t(end - ptr) < sizeof(T))
+      return false;
+    memcpy(&value, ptr, sizeof(T)); ptr += sizeof(T);
+    return true;
+  }
+
+  // longer names are cut to maxLength, the whole name is still skipped
+  bool readName(std::string &name, size_t maxLength)
+  {
+    uint8_t length = 0;
+    if (!read(length) || size_t(end - ptr) < length)
+      return false;
+    name.assign((const char *)ptr, std::min<size_t>(length, maxLength)); ptr += length;
+    return true;
+  }
+};
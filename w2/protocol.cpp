@@ -0,0 +1,195 @@
+#include "protocol.h"
+#include "packet_io.h"
+
+static size_t name_size(const std::string &name)
+{
+  return sizeof(uint8_t) + std::min(name.size(), maxNameLength);
+}
+
+static ENetPacket *create_packet(MessageType type, size_t payloadSize, PacketWriter &writer)
+{
+  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + payloadSize, ENET_PACKET_FLAG_RELIABLE);
+  writer.ptr = packet->data;
+  writer.write(uint8_t(type));
+  return packet;
+}
+
+static PacketReader payload_reader(ENetPacket *packet)
+{
+  return PacketReader{packet->data + sizeof(uint8_t), packet->data + packet->dataLength};
+}
+
+static ENetPacket *create_name_packet(MessageType type, const std::string &name)
+{
+  PacketWriter writer;
+  ENetPacket *packet = create_packet(type, name_size(name), writer);
+  writer.writeName(name, maxNameLength);
+  return packet;
+}
+
+static ENetPacket *create_id_packet(MessageType type, uint32_t id)
+{
+  PacketWriter writer;
+  ENetPacket *packet = create_packet(type, sizeof(uint32_t), writer);
+  writer.write(id);
+  return packet;
+}
+
+void send_hello(ENetPeer *peer, const std::string &name)
+{
+  enet_peer_send(peer, 0, create_name_packet(E_CLIENT_TO_LOBBY_HELLO, name));
+}
+
+void send_create_room(ENetPeer *peer, const std::string &name)
+{
+  enet_peer_send(peer, 0, create_name_packet(E_CLIENT_TO_LOBBY_CREATE_ROOM, name));
+}
+
+void send_join_room(ENetPeer *peer, uint32_t roomId)
+{
+  enet_peer_send(peer, 0, create_id_packet(E_CLIENT_TO_LOBBY_JOIN_ROOM, roomId));
+}
+
+void send_leave_room(ENetPeer *peer)
+{
+  PacketWriter writer;
+  enet_peer_send(peer, 0, create_packet(E_CLIENT_TO_LOBBY_LEAVE_ROOM, 0, writer));
+}
+
+void send_set_ready(ENetPeer *peer, bool ready)
+{
+  PacketWriter writer;
+  ENetPacket *packet = create_packet(E_CLIENT_TO_LOBBY_SET_READY, sizeof(uint8_t), writer);
+  writer.write(uint8_t(ready));
+  enet_peer_send(peer, 0, packet);
+}
+
+ENetPacket *create_welcome_packet(uint32_t playerId)
+{
+  return create_id_packet(E_LOBBY_TO_CLIENT_WELCOME, playerId);
+}
+
+ENetPacket *create_room_delta_packet(DeltaOp op, const RoomInfo &room)
+{
+  PacketWriter writer;
+  if (op == DeltaOp::Remove)
+  {
+    ENetPacket *packet = create_packet(E_LOBBY_TO_CLIENT_ROOM_DELTA, sizeof(uint8_t) + sizeof(uint32_t), writer);
+    writer.write(op);
+    writer.write(room.id);
+    return packet;
+  }
+  ENetPacket *packet = create_packet(E_LOBBY_TO_CLIENT_ROOM_DELTA,
+                                     sizeof(uint8_t) + sizeof(uint32_t) + 3 * sizeof(uint8_t) + name_size(room.name),
+                                     writer);
+  writer.write(op);
+  writer.write(room.id);
+  writer.write(room.players);
+  writer.write(room.maxPlayers);
+  writer.write(room.state);
+  writer.writeName(room.name, maxNameLength);
+  return packet;
+}
+
+ENetPacket *create_joined_room_packet(uint32_t roomId)
+{
+  return create_id_packet(E_LOBBY_TO_CLIENT_JOINED_ROOM, roomId);
+}
+
+ENetPacket *create_player_delta_packet(DeltaOp op, const PlayerInfo &player)
+{
+  PacketWriter writer;
+  if (op == DeltaOp::Remove)
+  {
+    ENetPacket *packet = create_packet(E_LOBBY_TO_CLIENT_PLAYER_DELTA, sizeof(uint8_t) + sizeof(uint32_t), writer);
+    writer.write(op);
+    writer.write(player.id);
+    return packet;
+  }
+  // an update is only ever about the ready flag, the name goes with the add
+  const size_t nameSize = op == DeltaOp::Add ? name_size(player.name) : 0;
+  ENetPacket *packet = create_packet(E_LOBBY_TO_CLIENT_PLAYER_DELTA,
+                                     sizeof(uint8_t) + sizeof(uint32_t) + sizeof(uint8_t) + nameSize, writer);
+  writer.write(op);
+  writer.write(player.id);
+  writer.write(uint8_t(player.ready));
+  if (op == DeltaOp::Add)
+    writer.writeName(player.name, maxNameLength);
+  return packet;
+}
+
+ENetPacket *create_start_game_packet(const ENetAddress &server)
+{
+  PacketWriter writer;
+  ENetPacket *packet = create_packet(E_LOBBY_TO_CLIENT_START_GAME, sizeof(uint32_t) + sizeof(uint16_t), writer);
+  writer.write(server.host);
+  writer.write(server.port);
+  return packet;
+}
+
+ENetPacket *create_error_packet(const std::string &text)
+{
+  return create_name_packet(E_LOBBY_TO_CLIENT_ERROR, text);
+}
+
+bool get_packet_type(ENetPacket *packet, MessageType &type)
+{
+  if (packet->dataLength == 0)
+    return false;
+  type = (MessageType)*packet->data;
+  return true;
+}
+
+bool deserialize_name(ENetPacket *packet, std::string &name)
+{
+  PacketReader reader = payload_reader(packet);
+  return reader.readName(name, maxNameLength);
+}
+
+bool deserialize_id(ENetPacket *packet, uint32_t &id)
+{
+  PacketReader reader = payload_reader(packet);
+  return reader.read(id);
+}
+
+bool deserialize_set_ready(ENetPacket *packet, bool &ready)
+{
+  PacketReader reader = payload_reader(packet);
+  uint8_t value = 0;
+  if (!reader.read(value))
+    return false;
+  ready = value != 0;
+  return true;
+}
+
+bool deserialize_room_delta(ENetPacket *packet, DeltaOp &op, RoomInfo &room)
+{
+  PacketReader reader = payload_reader(packet);
+  if (!reader.read(op) || op > DeltaOp::Remove || !reader.read(room.id))
+    return false;
+  if (op == DeltaOp::Remove)
+    return true;
+  // the state indexes tables on the client, one out of range rejects the whole packet
+  return reader.read(room.players) && reader.read(room.maxPlayers) && reader.read(room.state) &&
+         room.state <= RoomState::InGame && reader.readName(room.name, maxNameLength);
+}
+
+bool deserialize_player_delta(ENetPacket *packet, DeltaOp &op, PlayerInfo &player)
+{
+  PacketReader reader = payload_reader(packet);
+  if (!reader.read(op) || op > DeltaOp::Remove || !reader.read(player.id))
+    return false;
+  if (op == DeltaOp::Remove)
+    return true;
+  uint8_t ready = 0;
+  if (!reader.read(ready))
+    return false;
+  player.ready = ready != 0;
+  return op != DeltaOp::Add || reader.readName(player.name, maxNameLength);
+}
+
+bool deserialize_start_game(ENetPacket *packet, ENetAddress &server)
+{
+  PacketReader reader = payload_reader(packet);
+  return reader.read(server.host) && reader.read(server.port);
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <cstdint>
+#include <enet/enet.h>
+#include <string>
+
+// Lobby protocol. Everything is reliable on channel 0, so deltas are applied in the order they were made.
+enum MessageType : uint8_t
+{
+  E_CLIENT_TO_LOBBY_HELLO = 0,
+  E_CLIENT_TO_LOBBY_CREATE_ROOM,
+  E_CLIENT_TO_LOBBY_JOIN_ROOM,
+  E_CLIENT_TO_LOBBY_LEAVE_ROOM,
+  E_CLIENT_TO_LOBBY_SET_READY,
+  E_LOBBY_TO_CLIENT_WELCOME,
+  E_LOBBY_TO_CLIENT_ROOM_DELTA,
+  E_LOBBY_TO_CLIENT_JOINED_ROOM,
+  E_LOBBY_TO_CLIENT_PLAYER_DELTA,
+  E_LOBBY_TO_CLIENT_START_GAME,
+  E_LOBBY_TO_CLIENT_ERROR
+};
+
+// Lists are replicated as a stream of these, a full list is only ever sent as adds when a client starts watching it
+enum class DeltaOp : uint8_t
+{
+  Add,
+  Update,
+  Remove
+};
+
+enum class RoomState : uint8_t
+{
+  Open,
+  Starting, // everybody is ready, counting down
+  InGame
+};
+
+constexpr size_t maxNameLength = 32; // longer names are cut, on the way out and on the way in
+
+struct RoomInfo
+{
+  uint32_t id = 0;
+  uint8_t players = 0;
+  uint8_t maxPlayers = 0;
+  RoomState state = RoomState::Open;
+  std::string name;
+};
+
+struct PlayerInfo
+{
+  uint32_t id = 0;
+  bool ready = false;
+  std::string name;
+};
+
+void send_hello(ENetPeer *peer, const std::string &name);
+void send_create_room(ENetPeer *peer, const std::string &name);
+void send_join_room(ENetPeer *peer, uint32_t roomId);
+void send_leave_room(ENetPeer *peer);
+void send_set_ready(ENetPeer *peer, bool ready);
+
+// Built without sending, one packet can go to many peers
+ENetPacket *create_welcome_packet(uint32_t playerId);
+// Remove only carries the id
+ENetPacket *create_room_delta_packet(DeltaOp op, const RoomInfo &room);
+// roomId 0: the client is back in the room list; the members follow as player adds
+ENetPacket *create_joined_room_packet(uint32_t roomId);
+ENetPacket *create_player_delta_packet(DeltaOp op, const PlayerInfo &player);
+ENetPacket *create_start_game_packet(const ENetAddress &server);
+ENetPacket *create_error_packet(const std::string &text);
+
+// false for an empty packet
+bool get_packet_type(ENetPacket *packet, MessageType &type);
+
+// All of them check the length, false for a malformed packet
+bool deserialize_name(ENetPacket *packet, std::string &name); // hello, create room and error
+bool deserialize_id(ENetPacket *packet, uint32_t &id); // join room, welcome and joined room
+bool deserialize_set_ready(ENetPacket *packet, bool &ready);
+bool deserialize_room_delta(ENetPacket *packet, DeltaOp &op, RoomInfo &room);
+bool deserialize_player_delta(ENetPacket *packet, DeltaOp &op, PlayerInfo &player);
+bool deserialize_start_game(ENetPacket *packet, ENetAddress &server);
@@ -0,0 +1,136 @@
+#include <enet/enet.h>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "registry_protocol.h"
+#include "server_registry.h"
+
+// Game servers and lobbies together, far less than the lobby's players
+static constexpr size_t maxPeers = 1024;
+// Expiry doesn't need to be any more precise than this
+static constexpr uint32_t serviceTimeoutMs = 100;
+
+// A registered game server's peer->data holds its id + 1, lobbies and servers that haven't registered yet have none
+static void on_packet(ENetPeer *peer, ENetPacket *packet, ServerRegistry &registry)
+{
+  const auto now = ServerRegistry::Clock::now();
+  RegistryMessageType type;
+  if (!get_registry_packet_type(packet, type))
+    return;
+  switch (type)
+  {
+  case E_SERVER_TO_REGISTRY_REGISTER:
+  {
+    uint16_t clientPort = 0;
+    uint16_t capacity = 0;
+    if (peer->data || !deserialize_register(packet, clientPort, capacity))
+      break;
+    ENetAddress address = peer->address;
+    address.port = clientPort;
+    peer->data = (void *)uintptr_t(registry.add(address, capacity, now) + 1);
+    printf("Game server %x:%u registered, up to %u players, %zu servers\n", address.host, address.port, capacity,
+           registry.size());
+    break;
+  }
+  case E_SERVER_TO_REGISTRY_LOAD:
+  {
+    ServerLoad load;
+    if (peer->data && deserialize_load(packet, load))
+      registry.report(ServerRegistry::ServerId(uintptr_t(peer->data) - 1), load, now);
+    break;
+  }
+  case E_LOBBY_TO_REGISTRY_ASSIGN:
+  {
+    uint32_t requestId = 0;
+    uint16_t players = 0;
+    if (!deserialize_assign(packet, requestId, players))
+      break;
+    ENetAddress address = {};
+    const bool found = registry.assign(players, now, address);
+    send_assigned(peer, requestId, found, address);
+    break;
+  }
+  default:
+    break;
+  };
+}
+
+int main()
+{
+  if (enet_initialize() != 0)
+  {
+    printf("Cannot init ENet");
+    return 1;
+  }
+  atexit(enet_deinitialize);
+
+  ENetAddress address;
+
+  address.host = ENET_HOST_ANY;
+  address.port = registryPort;
+
+  ENetHost *host = enet_host_create(&address, maxPeers, 2, 0, 0);
+
+  if (!host)
+  {
+    printf("Cannot create ENet server\n");
+    return 1;
+  }
+
+  ServerRegistry registry;
+  std::vector<ServerRegistry::ServerId> expired;
+  while (true)
+  {
+    ENetEvent event;
+    if (enet_host_service(host, &event, serviceTimeoutMs) > 0)
+    {
+      do
+      {
+        switch (event.type)
+        {
+        case ENET_EVENT_TYPE_DISCONNECT:
+          if (event.peer->data)
+          {
+            registry.remove(ServerRegistry::ServerId(uintptr_t(event.peer->data) - 1));
+            event.peer->data = nullptr;
+            printf("Game server %x:%u is gone, %zu servers\n", event.peer->address.host, event.peer->address.port,
+                   registry.size());
+          }
+          break;
+        case ENET_EVENT_TYPE_RECEIVE:
+          on_packet(event.peer, event.packet, registry);
+          enet_packet_destroy(event.packet);
+          break;
+        default:
+          break;
+        };
+      } while (enet_host_check_events(host, &event) > 0);
+    }
+
+    // a server that went quiet but still holds its connection is dropped, it registers again if it comes back
+    expired.clear();
+    registry.expire(ServerRegistry::Clock::now(), expired);
+    for (size_t i = 0; i < host->peerCount; ++i)
+    {
+      if (expired.empty())
+        break;
+      ENetPeer *peer = &host->peers[i];
+      if (!peer->data)
+        continue;
+      const auto id = ServerRegistry::ServerId(uintptr_t(peer->data) - 1);
+      auto itf = std::find(expired.begin(), expired.end(), id);
+      if (itf == expired.end())
+        continue;
+      expired.erase(itf);
+      peer->data = nullptr;
+      enet_peer_disconnect(peer, 0);
+      printf("Game server %x:%u stopped reporting, %zu servers\n", peer->address.host, peer->address.port,
+             registry.size());
+    }
+    enet_host_flush(host);
+  }
+
+  enet_host_destroy(host);
+  return 0;
+}
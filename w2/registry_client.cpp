@@ -0,0 +1,83 @@
+#include "registry_client.h"
+#include <cstdio>
+
+RegistryClient::RegistryClient(const ENetAddress &registry) : address(registry)
+{
+}
+
+RegistryClient::~RegistryClient()
+{
+  if (host)
+    enet_host_destroy(host);
+}
+
+bool RegistryClient::start()
+{
+  host = enet_host_create(nullptr, 1, 2, 0, 0);
+  if (!host)
+  {
+    printf("Cannot create ENet client for the registry\n");
+    return false;
+  }
+  connect();
+  return true;
+}
+
+void RegistryClient::connect()
+{
+  const auto now = std::chrono::steady_clock::now();
+  if (peer || now - lastConnectAttempt < reconnectDelay)
+    return;
+  lastConnectAttempt = now;
+  // a failed attempt ends in a DISCONNECT event that clears it again
+  peer = enet_host_connect(host, &address, 2, 0);
+}
+
+bool RegistryClient::request(uint32_t roomId, uint16_t players)
+{
+  if (!connected)
+    return false;
+  send_assign(peer, roomId, players);
+  pending.insert(roomId);
+  return true;
+}
+
+void RegistryClient::update(std::vector<Assignment> &answers)
+{
+  connect();
+
+  ENetEvent event;
+  while (enet_host_service(host, &event, 0) > 0)
+  {
+    switch (event.type)
+    {
+    case ENET_EVENT_TYPE_CONNECT:
+      printf("Connected to the server registry %x:%u\n", address.host, address.port);
+      connected = true;
+      break;
+    case ENET_EVENT_TYPE_DISCONNECT:
+      if (connected)
+        printf("Lost the server registry\n");
+      peer = nullptr;
+      connected = false;
+      for (uint32_t roomId : pending)
+        answers.push_back(Assignment{roomId, false, {}});
+      pending.clear();
+      break;
+    case ENET_EVENT_TYPE_RECEIVE:
+    {
+      RegistryMessageType type;
+      Assignment answer;
+      if (get_registry_packet_type(event.packet, type) && type == E_REGISTRY_TO_LOBBY_ASSIGNED &&
+          deserialize_assigned(event.packet, answer.roomId, answer.found, answer.server) &&
+          pending.erase(answer.roomId) > 0)
+        answers.push_back(answer);
+      enet_packet_destroy(event.packet);
+      break;
+    }
+    default:
+      break;
+    };
+  }
+  enet_host_flush(host);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <enet/enet.h>
+#include <unordered_set>
+#include <vector>
+
+#include "registry_protocol.h"
+
+
+// The lobby's connection to the server registry, on an ENet host of its own. Requests are answered
+// asynchronously; while the registry is away they fail right away and the connection is retried.
+class RegistryClient
+{
+public:
+  struct Assignment
+  {
+    uint32_t roomId = 0;
+    bool found = false;
+    ENetAddress server = {};
+  };
+
+  explicit RegistryClient(const ENetAddress &registry);
+  ~RegistryClient();
+
+  RegistryClient(const RegistryClient &) = delete;
+  RegistryClient &operator=(const RegistryClient &) = delete;
+
+  bool start();
+
+  // false when the registry isn't connected, no answer comes then
+  bool request(uint32_t roomId, uint16_t players);
+  // Services the host without waiting and appends the answers, the pending requests fail if the registry is gone
+  void update(std::vector<Assignment> &answers);
+
+  bool hasPending() const { return !pending.empty(); }
+
+private:
+  void connect();
+
+private:
+  static constexpr std::chrono::seconds reconnectDelay{1};
+
+  ENetAddress address;
+  ENetHost *host = nullptr;
+  ENetPeer *peer = nullptr; // set while connecting or connected
+  bool connected = false;
+  std::chrono::steady_clock::time_point lastConnectAttempt;
+  std::unordered_set<uint32_t> pending;
+};
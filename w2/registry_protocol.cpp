@@ -0,0 +1,98 @@
+#include "registry_protocol.h"
+#include "packet_io.h"
+
+static ENetPacket *create_packet(RegistryMessageType type, size_t payloadSize, enet_uint32 flags,
+                                 PacketWriter &writer)
+{
+  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + payloadSize, flags);
+  writer.ptr = packet->data;
+  writer.write(uint8_t(type));
+  return packet;
+}
+
+static PacketReader payload_reader(ENetPacket *packet)
+{
+  return PacketReader{packet->data + sizeof(uint8_t), packet->data + packet->dataLength};
+}
+
+void send_register(ENetPeer *peer, uint16_t clientPort, uint16_t capacity)
+{
+  PacketWriter writer;
+  ENetPacket *packet = create_packet(E_SERVER_TO_REGISTRY_REGISTER, 2 * sizeof(uint16_t), ENET_PACKET_FLAG_RELIABLE,
+                                     writer);
+  writer.write(clientPort);
+  writer.write(capacity);
+  enet_peer_send(peer, 0, packet);
+}
+
+void send_load(ENetPeer *peer, const ServerLoad &load)
+{
+  PacketWriter writer;
+  ENetPacket *packet = create_packet(E_SERVER_TO_REGISTRY_LOAD, 2 * sizeof(uint16_t) + 3 * sizeof(float), 0, writer);
+  writer.write(load.peers);
+  writer.write(load.entities);
+  writer.write(load.tickP50Ms);
+  writer.write(load.tickP95Ms);
+  writer.write(load.tickP99Ms);
+  enet_peer_send(peer, 1, packet);
+}
+
+void send_assign(ENetPeer *peer, uint32_t requestId, uint16_t players)
+{
+  PacketWriter writer;
+  ENetPacket *packet = create_packet(E_LOBBY_TO_REGISTRY_ASSIGN, sizeof(uint32_t) + sizeof(uint16_t),
+                                     ENET_PACKET_FLAG_RELIABLE, writer);
+  writer.write(requestId);
+  writer.write(players);
+  enet_peer_send(peer, 0, packet);
+}
+
+void send_assigned(ENetPeer *peer, uint32_t requestId, bool found, const ENetAddress &server)
+{
+  PacketWriter writer;
+  ENetPacket *packet = create_packet(E_REGISTRY_TO_LOBBY_ASSIGNED,
+                                     sizeof(uint32_t) + sizeof(uint8_t) + sizeof(uint32_t) + sizeof(uint16_t),
+                                     ENET_PACKET_FLAG_RELIABLE, writer);
+  writer.write(requestId);
+  writer.write(uint8_t(found));
+  writer.write(found ? server.host : 0u);
+  writer.write(found ? server.port : uint16_t(0));
+  enet_peer_send(peer, 0, packet);
+}
+
+bool get_registry_packet_type(ENetPacket *packet, RegistryMessageType &type)
+{
+  if (packet->dataLength == 0)
+    return false;
+  type = (RegistryMessageType)*packet->data;
+  return true;
+}
+
+bool deserialize_register(ENetPacket *packet, uint16_t &clientPort, uint16_t &capacity)
+{
+  PacketReader reader = payload_reader(packet);
+  return reader.read(clientPort) && reader.read(capacity);
+}
+
+bool deserialize_load(ENetPacket *packet, ServerLoad &load)
+{
+  PacketReader reader = payload_reader(packet);
+  return reader.read(load.peers) && reader.read(load.entities) && reader.read(load.tickP50Ms) &&
+         reader.read(load.tickP95Ms) && reader.read(load.tickP99Ms);
+}
+
+bool deserialize_assign(ENetPacket *packet, uint32_t &requestId, uint16_t &players)
+{
+  PacketReader reader = payload_reader(packet);
+  return reader.read(requestId) && reader.read(players);
+}
+
+bool deserialize_assigned(ENetPacket *packet, uint32_t &requestId, bool &found, ENetAddress &server)
+{
+  PacketReader reader = payload_reader(packet);
+  uint8_t value = 0;
+  if (!reader.read(requestId) || !reader.read(value) || !reader.read(server.host) || !reader.read(server.port))
+    return false;
+  found = value != 0;
+  return true;
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <cstdint>
+#include <enet/enet.h>
+
+// Server registry protocol. Game servers register and then keep reporting their load, the lobby asks for a server
+// to start a room on. Shared with the game servers of w7, so nothing in here depends on the lobby protocol.
+enum RegistryMessageType : uint8_t
+{
+  E_SERVER_TO_REGISTRY_REGISTER = 0,
+  E_SERVER_TO_REGISTRY_LOAD,
+  E_LOBBY_TO_REGISTRY_ASSIGN,
+  E_REGISTRY_TO_LOBBY_ASSIGNED
+};
+
+constexpr uint16_t registryPort = 10900;
+
+struct ServerLoad
+{
+  uint16_t peers = 0;
+  uint16_t entities = 0;
+  // tick times over the last report period
+  float tickP50Ms = 0.f;
+  float tickP95Ms = 0.f;
+  float tickP99Ms = 0.f;
+};
+
+// The registry takes the host from the connection, only the port clients connect to is sent
+void send_register(ENetPeer *peer, uint16_t clientPort, uint16_t capacity);
+// Unreliable and sequenced on channel 1, only the latest load matters
+void send_load(ENetPeer *peer, const ServerLoad &load);
+void send_assign(ENetPeer *peer, uint32_t requestId, uint16_t players);
+// found false: no server has room, server is not set then
+void send_assigned(ENetPeer *peer, uint32_t requestId, bool found, const ENetAddress &server);
+
+// false for an empty packet
+bool get_registry_packet_type(ENetPacket *packet, RegistryMessageType &type);
+
+// All of them check the length, false for a malformed packet
+bool deserialize_register(ENetPacket *packet, uint16_t &clientPort, uint16_t &capacity);
+bool deserialize_load(ENetPacket *packet, ServerLoad &load);
+bool deserialize_assign(ENetPacket *packet, uint32_t &requestId, uint16_t &players);
+bool deserialize_assigned(ENetPacket *packet, uint32_t &requestId, bool &found, ENetAddress &server);
@@ -0,0 +1,325 @@
+#include "room_manager.h"
+#include <algorithm>
+#include <cstdio>
+
+// One packet for any number of peers; it's gone once the last of them has sent it, or right away if none took it
+template <typename Range, typename PeerOf>
+static void send_to_all(const Range &range, PeerOf peer_of, ENetPacket *packet)
+{
+  for (const auto &item : range)
+    enet_peer_send(peer_of(item), 0, packet);
+  if (packet->referenceCount == 0)
+    enet_packet_destroy(packet);
+}
+
+RoomManager::RoomManager(GameServerPool &servers, RegistryClient *registry) : servers(servers), registry(registry)
+{
+}
+
+void RoomManager::onConnect(ENetPeer *peer)
+{
+  const uint32_t id = nextPlayerId++;
+  Player &player = players[id];
+  player.id = id;
+  player.peer = peer;
+  peer->data = &player;
+}
+
+void RoomManager::onDisconnect(ENetPeer *peer)
+{
+  Player *player = (Player *)peer->data;
+  if (!player)
+    return;
+  peer->data = nullptr;
+  if (player->roomId != 0)
+    leaveRoom(*player, false, Clock::now());
+  browsing.erase(player);
+  players.erase(player->id);
+}
+
+void RoomManager::onPacket(ENetPeer *peer, ENetPacket *packet, Clock::time_point now)
+{
+  Player *player = (Player *)peer->data;
+  MessageType type;
+  if (!player || !get_packet_type(packet, type))
+    return;
+
+  if (!player->greeted)
+  {
+    if (type != E_CLIENT_TO_LOBBY_HELLO || !deserialize_name(packet, player->name))
+      return;
+    if (player->name.empty())
+      player->name = "Player " + std::to_string(player->id);
+    player->greeted = true;
+    enet_peer_send(peer, 0, create_welcome_packet(player->id));
+    sendRoomList(*player);
+    browsing.insert(player);
+    return;
+  }
+
+  switch (type)
+  {
+  case E_CLIENT_TO_LOBBY_CREATE_ROOM:
+  {
+    std::string name;
+    if (deserialize_name(packet, name))
+      createRoom(*player, std::move(name), now);
+    break;
+  }
+  case E_CLIENT_TO_LOBBY_JOIN_ROOM:
+  {
+    uint32_t roomId = 0;
+    if (deserialize_id(packet, roomId))
+      joinRoom(*player, roomId, now);
+    break;
+  }
+  case E_CLIENT_TO_LOBBY_LEAVE_ROOM:
+    if (player->roomId != 0)
+      leaveRoom(*player, true, now);
+    break;
+  case E_CLIENT_TO_LOBBY_SET_READY:
+  {
+    bool ready = false;
+    if (deserialize_set_ready(packet, ready))
+      setReady(*player, ready, now);
+    break;
+  }
+  default:
+    break;
+  };
+}
+
+void RoomManager::update(Clock::time_point now)
+{
+  while (!countdowns.empty() && countdowns.begin()->first <= now)
+  {
+    const uint32_t roomId = countdowns.begin()->second;
+    countdowns.erase(countdowns.begin());
+    startGame(rooms.at(roomId));
+  }
+}
+
+RoomManager::Clock::time_point RoomManager::nextDeadline() const
+{
+  return countdowns.empty() ? Clock::time_point::max() : countdowns.begin()->first;
+}
+
+void RoomManager::createRoom(Player &player, std::string name, Clock::time_point now)
+{
+  if (player.roomId != 0)
+    leaveRoom(player, false, now);
+
+  const uint32_t id = nextRoomId++;
+  Room &room = rooms[id];
+  room.id = id;
+  room.name = name.empty() ? "Room " + std::to_string(id) : std::move(name);
+  printf("%s created room %u '%s'\n", player.name.c_str(), id, room.name.c_str());
+
+  // the creator goes straight in, it doesn't need to hear about the room on its own
+  browsing.erase(&player);
+  publishRoom(room, DeltaOp::Add);
+  joinRoom(player, id, now);
+}
+
+void RoomManager::joinRoom(Player &player, uint32_t roomId, Clock::time_point now)
+{
+  auto found = rooms.find(roomId);
+  if (found == rooms.end())
+  {
+    sendError(player, "No such room");
+    return;
+  }
+  Room &room = found->second;
+  if (player.roomId == roomId)
+    return;
+  if (room.state == RoomState::InGame)
+  {
+    sendError(player, "The game has already started");
+    return;
+  }
+  if (room.members.size() >= maxPlayersPerRoom)
+  {
+    sendError(player, "The room is full");
+    return;
+  }
+
+  if (player.roomId != 0)
+    leaveRoom(player, false, now);
+  browsing.erase(&player);
+
+  player.roomId = roomId;
+  player.ready = false;
+  enet_peer_send(player.peer, 0, create_joined_room_packet(roomId));
+  for (const Player *member : room.members)
+    enet_peer_send(player.peer, 0, create_player_delta_packet(DeltaOp::Add, infoOf(*member)));
+  room.members.push_back(&player);
+  sendToRoom(room, create_player_delta_packet(DeltaOp::Add, infoOf(player)));
+
+  publishRoom(room, DeltaOp::Update);
+  // a newcomer isn't ready, a running countdown stops
+  updateCountdown(room, now);
+}
+
+void RoomManager::leaveRoom(Player &player, bool backToList, Clock::time_point now)
+{
+  Room &room = rooms.at(player.roomId);
+  room.members.erase(std::find(room.members.begin(), room.members.end(), &player));
+  player.roomId = 0;
+  player.ready = false;
+
+  if (room.members.empty())
+  {
+    printf("Room %u '%s' is closed\n", room.id, room.name.c_str());
+    servers.release(room.server);
+    if (room.state == RoomState::Starting)
+      countdowns.erase({room.startAt, room.id});
+    publishRoom(room, DeltaOp::Remove);
+    rooms.erase(room.id);
+  }
+  else
+  {
+    sendToRoom(room, create_player_delta_packet(DeltaOp::Remove, infoOf(player)));
+    publishRoom(room, DeltaOp::Update);
+    // the one who wasn't ready may have left
+    updateCountdown(room, now);
+  }
+
+  if (backToList)
+  {
+    enet_peer_send(player.peer, 0, create_joined_room_packet(0));
+    sendRoomList(player);
+    browsing.insert(&player);
+  }
+}
+
+void RoomManager::setReady(Player &player, bool ready, Clock::time_point now)
+{
+  if (player.roomId == 0 || player.ready == ready)
+    return;
+  Room &room = rooms.at(player.roomId);
+  if (room.state == RoomState::InGame)
+    return;
+  player.ready = ready;
+  sendToRoom(room, create_player_delta_packet(DeltaOp::Update, infoOf(player)));
+  updateCountdown(room, now);
+}
+
+void RoomManager::updateCountdown(Room &room, Clock::time_point now)
+{
+  if (room.state == RoomState::InGame)
+    return;
+  const bool allReady = std::all_of(room.members.begin(), room.members.end(),
+                                    [](const Player *member) { return member->ready; });
+  if (allReady && room.state == RoomState::Open)
+  {
+    room.state = RoomState::Starting;
+    room.startAt = now + countdown;
+    countdowns.insert({room.startAt, room.id});
+    publishRoom(room, DeltaOp::Update);
+  }
+  else if (!allReady && room.state == RoomState::Starting)
+  {
+    room.state = RoomState::Open;
+    room.awaitingServer = false;
+    countdowns.erase({room.startAt, room.id});
+    publishRoom(room, DeltaOp::Update);
+  }
+}
+
+void RoomManager::startGame(Room &room)
+{
+  if (registry)
+  {
+    room.awaitingServer = registry->request(room.id, uint16_t(room.members.size()));
+    if (!room.awaitingServer)
+      failStart(room);
+    return;
+  }
+
+  room.server = servers.assign();
+  if (room.server == GameServerPool::none)
+    failStart(room);
+  else
+    launchGame(room, servers.address(room.server));
+}
+
+void RoomManager::onServerAssigned(const RegistryClient::Assignment &assignment)
+{
+  // the room may be gone, or be Open again with a countdown of its own to come
+  auto found = rooms.find(assignment.roomId);
+  if (found == rooms.end() || !found->second.awaitingServer)
+    return;
+  Room &room = found->second;
+  room.awaitingServer = false;
+  if (assignment.found)
+    launchGame(room, assignment.server);
+  else
+    failStart(room);
+}
+
+void RoomManager::launchGame(Room &room, const ENetAddress &address)
+{
+  printf("Room %u '%s' starts on %x:%u\n", room.id, room.name.c_str(), address.host, address.port);
+  room.state = RoomState::InGame;
+  sendToRoom(room, create_start_game_packet(address));
+  publishRoom(room, DeltaOp::Update);
+}
+
+void RoomManager::failStart(Room &room)
+{
+  room.state = RoomState::Open;
+  for (Player *member : room.members)
+  {
+    member->ready = false;
+    sendError(*member, "No game server available");
+  }
+  for (const Player *member : room.members)
+    sendToRoom(room, create_player_delta_packet(DeltaOp::Update, infoOf(*member)));
+  publishRoom(room, DeltaOp::Update);
+}
+
+void RoomManager::sendRoomList(Player &player)
+{
+  for (const auto &[id, room] : rooms)
+    enet_peer_send(player.peer, 0, create_room_delta_packet(DeltaOp::Add, infoOf(room)));
+}
+
+void RoomManager::sendError(Player &player, const std::string &text)
+{
+  enet_peer_send(player.peer, 0, create_error_packet(text));
+}
+
+void RoomManager::publishRoom(const Room &room, DeltaOp op)
+{
+  sendToBrowsers(create_room_delta_packet(op, infoOf(room)));
+}
+
+void RoomManager::sendToRoom(const Room &room, ENetPacket *packet)
+{
+  send_to_all(room.members, [](const Player *member) { return member->peer; }, packet);
+}
+
+void RoomManager::sendToBrowsers(ENetPacket *packet)
+{
+  send_to_all(browsing, [](const Player *player) { return player->peer; }, packet);
+}
+
+RoomInfo RoomManager::infoOf(const Room &room)
+{
+  RoomInfo info;
+  info.id = room.id;
+  info.players = uint8_t(room.members.size());
+  info.maxPlayers = maxPlayersPerRoom;
+  info.state = room.state;
+  info.name = room.name;
+  return info;
+}
+
+PlayerInfo RoomManager::infoOf(const Player &player)
+{
+  PlayerInfo info;
+  info.id = player.id;
+  info.ready = player.ready;
+  info.name = player.name;
+  return info;
+}
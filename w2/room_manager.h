@@ -0,0 +1,104 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <enet/enet.h>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "game_servers.h"
+#include "protocol.h"
+#include "registry_client.h"
+
+
+// Lobby state: the connected players, the rooms and who is in which. Only changes go out: players browsing the
+// room list get room deltas, members of a room get player deltas of that room, and nobody gets a whole list
+// again except once, when they start watching it. Nothing runs per player unless that player does something, an
+// idle connection costs the lobby nothing but ENet's keepalives.
+// Once every member of a room is ready a countdown starts; when it's over, the room is handed to a game server
+// and its members get the server's address. The server comes from the registry when there is one, its answer
+// arrives later and the room keeps Starting until then; without a registry it comes from the fixed pool.
+class RoomManager
+{
+public:
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr uint8_t maxPlayersPerRoom = 8;
+  static constexpr std::chrono::milliseconds countdown{3000};
+
+  // registry may be null
+  RoomManager(GameServerPool &servers, RegistryClient *registry);
+
+  RoomManager(const RoomManager &) = delete;
+  RoomManager &operator=(const RoomManager &) = delete;
+
+  void onConnect(ENetPeer *peer);
+  void onDisconnect(ENetPeer *peer);
+  void onPacket(ENetPeer *peer, ENetPacket *packet, Clock::time_point now);
+
+  // Starts the games whose countdown is over
+  void update(Clock::time_point now);
+  void onServerAssigned(const RegistryClient::Assignment &assignment);
+  // max() when no countdown is running
+  Clock::time_point nextDeadline() const;
+
+  size_t playerCount() const { return players.size(); }
+  size_t roomCount() const { return rooms.size(); }
+
+private:
+  struct Player
+  {
+    uint32_t id = 0;
+    ENetPeer *peer = nullptr;
+    std::string name;
+    bool greeted = false; // sent its hello, nothing else is accepted before
+    uint32_t roomId = 0; // 0: browsing the room list
+    bool ready = false;
+  };
+
+  struct Room
+  {
+    uint32_t id = 0;
+    std::string name;
+    RoomState state = RoomState::Open;
+    std::vector<Player *> members;
+    Clock::time_point startAt; // while Starting
+    int server = GameServerPool::none; // while InGame
+    bool awaitingServer = false; // asked the registry, a change of mind makes its answer moot
+  };
+
+  void createRoom(Player &player, std::string name, Clock::time_point now);
+  void joinRoom(Player &player, uint32_t roomId, Clock::time_point now);
+  // backToList: the player gets the room list again, not when it goes straight into another room
+  void leaveRoom(Player &player, bool backToList, Clock::time_point now);
+  void setReady(Player &player, bool ready, Clock::time_point now);
+  void updateCountdown(Room &room, Clock::time_point now);
+  void startGame(Room &room);
+  void launchGame(Room &room, const ENetAddress &address);
+  // the members ready up again to retry
+  void failStart(Room &room);
+
+  void sendRoomList(Player &player);
+  void sendError(Player &player, const std::string &text);
+  void publishRoom(const Room &room, DeltaOp op);
+  void sendToRoom(const Room &room, ENetPacket *packet);
+  void sendToBrowsers(ENetPacket *packet);
+
+  static RoomInfo infoOf(const Room &room);
+  static PlayerInfo infoOf(const Player &player);
+
+private:
+  GameServerPool &servers;
+  RegistryClient *registry;
+
+  std::unordered_map<uint32_t, Player> players; // a player's peer->data points at its entry
+  std::unordered_map<uint32_t, Room> rooms;
+  std::unordered_set<Player *> browsing; // greeted and not in a room, they get the room deltas
+  std::set<std::pair<Clock::time_point, uint32_t>> countdowns; // start time, room id
+  uint32_t nextPlayerId = 1;
+  uint32_t nextRoomId = 1;
+};
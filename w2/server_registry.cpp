@@ -0,0 +1,145 @@
+#include "server_registry.h"
+#include <algorithm>
+#include <queue>
+
+ServerRegistry::ServerId ServerRegistry::add(const ENetAddress &address, uint16_t capacity, Clock::time_point now)
+{
+  ServerId id;
+  if (freeIds.empty())
+  {
+    id = ServerId(servers.size());
+    servers.emplace_back();
+  }
+  else
+  {
+    id = freeIds.back();
+    freeIds.pop_back();
+    servers[id] = Server();
+  }
+  Server &server = servers[id];
+  server.address = address;
+  server.capacity = capacity;
+  server.reservedUntil = now;
+  server.lastReport = now;
+  server.reportOrder = byLastReport.insert(byLastReport.end(), id);
+
+  server.heapIndex = heap.size();
+  heap.push_back(id);
+  siftUp(server.heapIndex);
+  return id;
+}
+
+void ServerRegistry::remove(ServerId id)
+{
+  Server &server = servers[id];
+  byLastReport.erase(server.reportOrder);
+  const size_t index = server.heapIndex;
+  swapNodes(index, heap.size() - 1);
+  heap.pop_back();
+  if (index < heap.size())
+  {
+    siftUp(index);
+    siftDown(index);
+  }
+  freeIds.push_back(id);
+}
+
+void ServerRegistry::report(ServerId id, const ServerLoad &load, Clock::time_point now)
+{
+  Server &server = servers[id];
+  server.load = load;
+  if (now >= server.reservedUntil)
+    server.reserved = 0;
+  byLastReport.splice(byLastReport.end(), byLastReport, server.reportOrder);
+  server.lastReport = now;
+  rescore(id);
+}
+
+bool ServerRegistry::hasRoom(const Server &server, uint16_t players) const
+{
+  return uint32_t(server.load.peers) + server.reserved + players <= server.capacity;
+}
+
+bool ServerRegistry::assign(uint16_t players, Clock::time_point now, ENetAddress &address)
+{
+  // Best first walk down the heap: the candidates are the children of what was looked at, so servers come up in
+  // order of load and a full one doesn't hide the ones under it
+  auto heavier = [this](size_t a, size_t b) { return servers[heap[a]].score > servers[heap[b]].score; };
+  std::priority_queue<size_t, std::vector<size_t>, decltype(heavier)> candidates(heavier);
+  if (!heap.empty())
+    candidates.push(0);
+  while (!candidates.empty())
+  {
+    const size_t index = candidates.top();
+    candidates.pop();
+    Server &server = servers[heap[index]];
+    if (hasRoom(server, players))
+    {
+      server.reserved += players;
+      server.reservedUntil = now + reservationTime;
+      address = server.address;
+      rescore(heap[index]);
+      return true;
+    }
+    for (size_t child = 2 * index + 1; child <= 2 * index + 2 && child < heap.size(); ++child)
+      candidates.push(child);
+  }
+  return false;
+}
+
+void ServerRegistry::expire(Clock::time_point now, std::vector<ServerId> &expired)
+{
+  while (!byLastReport.empty() && now - servers[byLastReport.front()].lastReport >= staleAfter)
+  {
+    const ServerId id = byLastReport.front();
+    remove(id);
+    expired.push_back(id);
+  }
+}
+
+void ServerRegistry::rescore(ServerId id)
+{
+  Server &server = servers[id];
+  const float fullness = server.capacity ? float(server.load.peers + server.reserved) / server.capacity : 1.f;
+  const float score = std::max(fullness, server.load.tickP95Ms / tickBudgetMs);
+  const bool up = score < server.score;
+  server.score = score;
+  if (up)
+    siftUp(server.heapIndex);
+  else
+    siftDown(server.heapIndex);
+}
+
+void ServerRegistry::siftUp(size_t index)
+{
+  while (index > 0)
+  {
+    const size_t parent = (index - 1) / 2;
+    if (servers[heap[parent]].score <= servers[heap[index]].score)
+      return;
+    swapNodes(index, parent);
+    index = parent;
+  }
+}
+
+void ServerRegistry::siftDown(size_t index)
+{
+  while (true)
+  {
+    size_t lightest = index;
+    for (size_t child = 2 * index + 1; child <= 2 * index + 2 && child < heap.size(); ++child)
+      if (servers[heap[child]].score < servers[heap[lightest]].score)
+        lightest = child;
+    if (lightest == index)
+      return;
+    swapNodes(index, lightest);
+    index = lightest;
+  }
+}
+
+void ServerRegistry::swapNodes(size_t a, size_t b)
+{
+  std::swap(heap[a], heap[b]);
+  servers[heap[a]].heapIndex = a;
+  servers[heap[b]].heapIndex = b;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <enet/enet.h>
+#include <list>
+#include <vector>
+
+#include "registry_protocol.h"
+
+
+// Game servers the registry knows about, kept in a binary min-heap by load so the least loaded one is always on
+// top: a report or an assignment moves one server up or down in O(log n), placing a room is O(log n) as long as
+// the least loaded servers have room, which they do unless the whole fleet is full.
+// A server's load is the larger of how full it is and how much of the tick budget its slow ticks take, so a box
+// that is struggling gets nothing new even with few players on it.
+// Servers that stop reporting expire; they are kept in order of their last report, the oldest is checked first.
+class ServerRegistry
+{
+public:
+  using Clock = std::chrono::steady_clock;
+  using ServerId = uint32_t;
+
+  // game servers sleep 10 ms between ticks, a p95 tick as long as that counts as fully loaded
+  static constexpr float tickBudgetMs = 10.f;
+  static constexpr std::chrono::seconds staleAfter{5};
+  // assigned players count towards a server until it has reported them itself
+  static constexpr std::chrono::seconds reservationTime{5};
+
+  ServerId add(const ENetAddress &address, uint16_t capacity, Clock::time_point now);
+  void remove(ServerId id);
+  void report(ServerId id, const ServerLoad &load, Clock::time_point now);
+
+  // Least loaded server with room for players, false when there is none
+  bool assign(uint16_t players, Clock::time_point now, ENetAddress &address);
+
+  // Removes the servers that haven't reported for staleAfter and appends their ids
+  void expire(Clock::time_point now, std::vector<ServerId> &expired);
+
+  size_t size() const { return heap.size(); }
+
+private:
+  struct Server
+  {
+    ENetAddress address = {};
+    uint16_t capacity = 0;
+    ServerLoad load;
+    uint16_t reserved = 0;
+    Clock::time_point reservedUntil;
+    Clock::time_point lastReport; // or registration
+    float score = 0.f;
+    size_t heapIndex = 0;
+    std::list<ServerId>::iterator reportOrder;
+  };
+
+  bool hasRoom(const Server &server, uint16_t players) const;
+  void rescore(ServerId id);
+  void siftUp(size_t index);
+  void siftDown(size_t index);
+  void swapNodes(size_t a, size_t b);
+
+private:
+  std::vector<Server> servers; // by id, ids of removed servers are reused
+  std::vector<ServerId> freeIds;
+  std::vector<ServerId> heap;
+  std::list<ServerId> byLastReport; // oldest first
+};
@@ -0,0 +1,342 @@
+#include "transfer.h"
+#include "packet_io.h"
+#include <algorithm>
+#include <cstdio>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// 64 bits, so that a resumed transfer doesn't run into another blob's id
+static uint64_t fnv1a(const uint8_t *data, size_t size)
+{
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < size; ++i)
+    hash = (hash ^ data[i]) * 1099511628211ull;
+  return hash;
+}
+
+#ifdef _WIN32
+
+std::shared_ptr<const Blob> Blob::mapFile(const std::string &path)
+{
+  HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (handle == INVALID_HANDLE_VALUE)
+    return nullptr;
+  LARGE_INTEGER fileSize = {};
+  GetFileSizeEx(handle, &fileSize);
+  // an empty file can't be mapped, there is nothing to send either
+  HANDLE handleMapping =
+    fileSize.QuadPart ? CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+  const void *view = handleMapping ? MapViewOfFile(handleMapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+  if (!view)
+  {
+    if (handleMapping)
+      CloseHandle(handleMapping);
+    CloseHandle(handle);
+    return nullptr;
+  }
+  std::shared_ptr<Blob> blob(new Blob());
+  blob->file = handle;
+  blob->fileMapping = handleMapping;
+  blob->bytes = (const uint8_t *)view;
+  blob->length = size_t(fileSize.QuadPart);
+  blob->id = fnv1a(blob->bytes, blob->length);
+  return blob;
+}
+
+Blob::~Blob()
+{
+  if (fileMapping)
+  {
+    UnmapViewOfFile(bytes);
+    CloseHandle(fileMapping);
+    CloseHandle(file);
+  }
+}
+
+#else
+
+std::shared_ptr<const Blob> Blob::mapFile(const std::string &path)
+{
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return nullptr;
+  struct stat st = {};
+  // an empty file can't be mapped, there is nothing to send either
+  void *view = fstat(fd, &st) == 0 && st.st_size > 0
+                 ? mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0)
+                 : MAP_FAILED;
+  // the mapping keeps the file open by itself
+  ::close(fd);
+  if (view == MAP_FAILED)
+    return nullptr;
+  // read front to back, once per receiver
+  madvise(view, size_t(st.st_size), MADV_SEQUENTIAL);
+  std::shared_ptr<Blob> blob(new Blob());
+  blob->mapped = true;
+  blob->bytes = (const uint8_t *)view;
+  blob->length = size_t(st.st_size);
+  blob->id = fnv1a(blob->bytes, blob->length);
+  return blob;
+}
+
+Blob::~Blob()
+{
+  if (mapped)
+    munmap((void *)bytes, length);
+}
+
+#endif
+
+std::shared_ptr<const Blob> Blob::fromBytes(std::vector<uint8_t> bytes)
+{
+  std::shared_ptr<Blob> blob(new Blob());
+  blob->owned = std::move(bytes);
+  blob->bytes = blob->owned.data();
+  blob->length = blob->owned.size();
+  blob->id = fnv1a(blob->bytes, blob->length);
+  return blob;
+}
+
+static void send_control(ENetPeer *peer, TransferMessageType type, uint64_t id, uint32_t value)
+{
+  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint64_t) + sizeof(uint32_t),
+                                          ENET_PACKET_FLAG_RELIABLE);
+  PacketWriter writer{packet->data};
+  writer.write(uint8_t(type));
+  writer.write(id);
+  writer.write(value);
+  enet_peer_send(peer, transferChannel, packet);
+}
+
+static bool deserialize_control(ENetPacket *packet, TransferMessageType &type, uint64_t &id, uint32_t &value)
+{
+  PacketReader reader{packet->data, packet->data + packet->dataLength};
+  return reader.read(type) && reader.read(id) && reader.read(value);
+}
+
+TransferSender::TransferSender(TransferLimits limits) : limits(limits)
+{
+}
+
+void TransferSender::send(ENetPeer *peer, std::shared_ptr<const Blob> blob)
+{
+  Stream &s = streams.emplace_back();
+  s.peer = peer;
+  s.blob = std::move(blob);
+  offerNext(peer);
+}
+
+void TransferSender::offerNext(ENetPeer *peer)
+{
+  Stream *next = nullptr;
+  for (Stream &s : streams)
+  {
+    if (s.peer != peer)
+      continue;
+    if (s.state == State::Offered || s.state == State::Streaming)
+      return;
+    if (s.state == State::Queued && !next)
+      next = &s;
+  }
+  if (!next)
+    return;
+  next->state = State::Offered;
+  send_control(peer, E_TRANSFER_OFFER, next->blob->contentId(), uint32_t(next->blob->size()));
+}
+
+void TransferSender::onPacket(ENetPeer *peer, ENetPacket *packet)
+{
+  TransferMessageType type;
+  uint64_t id = 0;
+  uint32_t offset = 0;
+  if (!deserialize_control(packet, type, id, offset) || (type != E_TRANSFER_ACCEPT && type != E_TRANSFER_REFUSE))
+    return;
+  for (Stream &s : streams)
+  {
+    if (s.peer != peer || s.state != State::Offered || s.blob->contentId() != id)
+      continue;
+    if (type == E_TRANSFER_REFUSE)
+    {
+      printf("Peer %x:%u refused a blob of %zu bytes\n", peer->address.host, peer->address.port, s.blob->size());
+      s.state = State::Done;
+      offerNext(peer);
+      return;
+    }
+    s.offset = std::min(size_t(offset), s.blob->size());
+    s.refilledAt = enet_time_get();
+    s.tokens = 0.f;
+    if (s.offset < s.blob->size())
+    {
+      s.state = State::Streaming;
+      return;
+    }
+    // it has all of it already
+    s.state = State::Done;
+    offerNext(peer);
+    return;
+  }
+}
+
+void TransferSender::onDisconnect(ENetPeer *peer)
+{
+  for (Stream &s : streams)
+    if (s.peer == peer)
+      s.state = State::Done;
+}
+
+bool TransferSender::fitsWindow(const Stream &s, size_t length) const
+{
+  // ours counts what is still queued in ENet too; ENet's own reliable window has everything else sent reliably to
+  // the peer in it, a full one means the chunk would only wait in the queue
+  return s.inFlight + length <= limits.windowBytes &&
+         (s.peer->windowSize == 0 || s.peer->reliableDataInTransit + length <= s.peer->windowSize);
+}
+
+uint32_t TransferSender::rateOf(const ENetPeer *peer) const
+{
+  // 0 is unlimited
+  return peer->incomingBandwidth ? std::min(limits.bytesPerSecond, peer->incomingBandwidth) : limits.bytesPerSecond;
+}
+
+void TransferSender::on_chunk_released(ENetPacket *packet)
+{
+  // acknowledged, or thrown away with the peer
+  ((Stream *)packet->userData)->inFlight -= packet->dataLength;
+}
+
+void TransferSender::stream(Stream &s, uint32_t curTime)
+{
+  // a short burst on top of the rate, so a chunk goes out as soon as it fits instead of on the next refill
+  const float burst = float(transferChunkSize * 4);
+  s.tokens = std::min(burst, s.tokens + rateOf(s.peer) * (curTime - s.refilledAt) * 0.001f);
+  s.refilledAt = curTime;
+
+  const uint8_t *data = s.blob->data();
+  while (s.offset < s.blob->size())
+  {
+    const size_t length = std::min(transferChunkSize, s.blob->size() - s.offset);
+    if (!fitsWindow(s, length) || s.tokens < float(length))
+      return;
+    // points into the blob, ENet copies nothing and releases it through the callback
+    ENetPacket *packet = enet_packet_create(data + s.offset, length,
+                                            ENET_PACKET_FLAG_RELIABLE | ENET_PACKET_FLAG_NO_ALLOCATE);
+    packet->freeCallback = on_chunk_released;
+    packet->userData = &s;
+    s.inFlight += length;
+    if (enet_peer_send(s.peer, transferChannel, packet) < 0)
+    {
+      enet_packet_destroy(packet);
+      return;
+    }
+    s.offset += length;
+    s.tokens -= float(length);
+  }
+  s.state = State::Done;
+  offerNext(s.peer);
+}
+
+void TransferSender::update(uint32_t curTime)
+{
+  for (Stream &s : streams)
+    if (s.state == State::Streaming && s.peer->state == ENET_PEER_STATE_CONNECTED)
+      stream(s, curTime);
+  streams.remove_if([](const Stream &s) { return s.state == State::Done && s.inFlight == 0; });
+}
+
+bool TransferSender::busy() const
+{
+  return std::any_of(streams.begin(), streams.end(), [](const Stream &s) { return s.state == State::Streaming; });
+}
+
+void TransferReceiver::onPacket(ENetPeer *peer, ENetPacket *packet)
+{
+  if (receiving)
+  {
+    // the channel carries nothing but chunks until the blob is complete
+    Partial &partial = partials[currentId];
+    const size_t length = std::min(packet->dataLength, partial.size - partial.data.size());
+    partial.data.insert(partial.data.end(), packet->data, packet->data + length);
+    if (partial.data.size() < partial.size)
+      return;
+    completed[currentId] = std::move(partial.data);
+    partials.erase(currentId);
+    receiving = false;
+    return;
+  }
+
+  TransferMessageType type;
+  uint64_t id = 0;
+  uint32_t size = 0;
+  if (!deserialize_control(packet, type, id, size) || type != E_TRANSFER_OFFER)
+    return;
+  // checked before anything is looked up or reserved, the size is the sender's word
+  if (size > limits.maxBlobBytes)
+  {
+    send_control(peer, E_TRANSFER_REFUSE, id, 0);
+    return;
+  }
+  auto done = completed.find(id);
+  if (done != completed.end() && done->second.size() == size)
+  {
+    send_control(peer, E_TRANSFER_ACCEPT, id, size);
+    return;
+  }
+  // only the same content of the same size resumes, anything else starts over
+  Partial &partial = partials[id];
+  if (partial.size != size)
+  {
+    partial.size = size;
+    partial.data.clear();
+    partial.data.shrink_to_fit();
+  }
+  partial.data.reserve(size);
+  send_control(peer, E_TRANSFER_ACCEPT, id, uint32_t(partial.data.size()));
+  if (partial.data.size() < size)
+  {
+    currentId = id;
+    receiving = true;
+    return;
+  }
+  completed[id] = std::move(partial.data);
+  partials.erase(id);
+}
+
+TransferReceiver::TransferReceiver(TransferLimits limits) : limits(limits)
+{
+}
+
+void TransferReceiver::onDisconnect()
+{
+  receiving = false;
+}
+
+bool TransferReceiver::progress(Progress &out) const
+{
+  if (!receiving)
+    return false;
+  const Partial &partial = partials.at(currentId);
+  out.id = currentId;
+  out.received = partial.data.size();
+  out.size = partial.size;
+  return true;
+}
+
+bool TransferReceiver::takeCompleted(uint64_t &id, std::vector<uint8_t> &data)
+{
+  if (completed.empty())
+    return false;
+  id = completed.begin()->first;
+  data = std::move(completed.begin()->second);
+  completed.erase(completed.begin());
+  return true;
+}
@@ -0,0 +1,159 @@
+#pragma once
+#include <cstdint>
+#include <enet/enet.h>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Streaming of large blobs (map data, replays, initial world state) on a channel of their own, in chunks small
+// enough for ENet to send each one as a single command instead of fragmenting it.
+//
+// The sender offers a blob, the receiver answers with how much of it it already has, and the sender streams the
+// rest. The channel is reliable and ordered and only one blob streams per peer at a time, so chunks carry no header
+// at all and are sent straight from the blob's memory: a mapped file is never copied. A receiver that lost the
+// connection halfway keeps what it got, an offer of the same blob later on resumes from there. Blobs are told
+// apart by a 64-bit hash of their content and their size, and a receiver refuses any larger than it is set to take.
+//
+// Chunks in flight, queued in ENet or sent and not yet acknowledged, are capped per peer by a window, and a peer is
+// fed no faster than the sender's rate limit and the bandwidth the peer announced.
+
+constexpr uint8_t transferChannel = 2;
+constexpr size_t transferChunkSize = 1024; // fits a default ENet MTU with the headers
+
+enum TransferMessageType : uint8_t
+{
+  E_TRANSFER_OFFER = 0, // id, size
+  E_TRANSFER_ACCEPT, // id, offset to start from; the size if the receiver has it all
+  E_TRANSFER_REFUSE // id; too large for the receiver, the sender goes on with its next blob
+};
+
+// Read-only bytes to send, either a file mapped into memory or a buffer of its own
+class Blob
+{
+public:
+  // nullptr if the file can't be mapped
+  static std::shared_ptr<const Blob> mapFile(const std::string &path);
+  static std::shared_ptr<const Blob> fromBytes(std::vector<uint8_t> bytes);
+
+  ~Blob();
+
+  Blob(const Blob &) = delete;
+  Blob &operator=(const Blob &) = delete;
+
+  const uint8_t *data() const { return bytes; }
+  size_t size() const { return length; }
+  // 64-bit FNV-1a of the content, what a receiver keeps partial transfers by
+  uint64_t contentId() const { return id; }
+
+private:
+  Blob() = default;
+
+private:
+  const uint8_t *bytes = nullptr;
+  size_t length = 0;
+  uint64_t id = 0;
+  std::vector<uint8_t> owned;
+#ifdef _WIN32
+  void *file = nullptr; // HANDLE, windows.h stays out of the header
+  void *fileMapping = nullptr;
+#else
+  bool mapped = false;
+#endif
+};
+
+struct TransferLimits
+{
+  size_t windowBytes = 64 * 1024; // per peer, in flight
+  uint32_t bytesPerSecond = 256 * 1024; // per peer, the peer's own incoming bandwidth if it is lower
+  uint32_t maxBlobBytes = 64 * 1024 * 1024; // receiving side, larger offers are refused before allocating
+};
+
+class TransferSender
+{
+public:
+  explicit TransferSender(TransferLimits limits = TransferLimits());
+  // Chunks still in ENet point into the streams, the sender has to outlive the host
+  ~TransferSender() = default;
+
+  TransferSender(const TransferSender &) = delete;
+  TransferSender &operator=(const TransferSender &) = delete;
+
+  // Streamed after the blobs already queued for the peer
+  void send(ENetPeer *peer, std::shared_ptr<const Blob> blob);
+  // A packet from the peer on transferChannel
+  void onPacket(ENetPeer *peer, ENetPacket *packet);
+  void onDisconnect(ENetPeer *peer);
+
+  // Sends what the windows and rates allow, call it every loop iteration
+  void update(uint32_t curTime);
+  // Something is waiting for its window or rate, update needs calling soon
+  bool busy() const;
+
+private:
+  enum class State : uint8_t
+  {
+    Queued,
+    Offered,
+    Streaming,
+    Done // sent, or the peer is gone; dropped once the last of its chunks is released
+  };
+
+  struct Stream
+  {
+    ENetPeer *peer = nullptr;
+    std::shared_ptr<const Blob> blob;
+    State state = State::Queued;
+    size_t offset = 0; // next byte to send
+    size_t inFlight = 0; // bytes of chunks ENet hasn't released yet
+    float tokens = 0.f; // bytes it may send right now
+    uint32_t refilledAt = 0;
+  };
+
+  static void on_chunk_released(ENetPacket *packet);
+  void offerNext(ENetPeer *peer);
+  void stream(Stream &s, uint32_t curTime);
+  bool fitsWindow(const Stream &s, size_t length) const;
+  uint32_t rateOf(const ENetPeer *peer) const;
+
+private:
+  TransferLimits limits;
+  std::list<Stream> streams; // chunks point at their stream, the addresses have to stay put
+};
+
+class TransferReceiver
+{
+public:
+  struct Progress
+  {
+    uint64_t id = 0;
+    size_t received = 0;
+    size_t size = 0;
+  };
+
+  explicit TransferReceiver(TransferLimits limits = TransferLimits());
+
+  // A packet from the peer on transferChannel
+  void onPacket(ENetPeer *peer, ENetPacket *packet);
+  // What arrived is kept, the next offer of the same blob resumes it
+  void onDisconnect();
+
+  // false while nothing is being received
+  bool progress(Progress &out) const;
+  // A blob received in full, false when there is none left
+  bool takeCompleted(uint64_t &id, std::vector<uint8_t> &data);
+
+private:
+  struct Partial
+  {
+    uint32_t size = 0;
+    std::vector<uint8_t> data;
+  };
+
+  TransferLimits limits;
+  std::map<uint64_t, Partial> partials; // by content id
+  std::map<uint64_t, std::vector<uint8_t>> completed;
+  uint64_t currentId = 0;
+  bool receiving = false;
+};
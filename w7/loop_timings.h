@@ -0,0 +1,53 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+
+// Per-thread busy time of a loop iteration, printed and reset every reportPeriod.
+class LoopTimings
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	explicit LoopTimings(const char* name)
+		: name(name)
+		, lastReport(Clock::now())
+	{
+	}
+
+	void begin() { iterationStart = Clock::now(); }
+	double lastIterationMs() const { return lastMs; }
+
+	void end()
+	{
+		const Clock::time_point now = Clock::now();
+		const double ms = std::chrono::duration<double, std::milli>(now - iterationStart).count();
+		lastMs = ms;
+		++count;
+		totalMs += ms;
+		maxMs = std::max(maxMs, ms);
+
+		if (now - lastReport < reportPeriod)
+			return;
+		printf("%s: %llu iterations, avg %.3f ms, max %.3f ms\n", name, (unsigned long long)count,
+			count ? totalMs / count : 0.0, maxMs);
+		lastReport = now;
+		count = 0;
+		totalMs = 0.0;
+		maxMs = 0.0;
+	}
+
+private:
+	static constexpr std::chrono::seconds reportPeriod{5};
+
+	const char* name;
+	Clock::time_point lastReport;
+	Clock::time_point iterationStart;
+	uint64_t count = 0;
+	double totalMs = 0.0;
+	double maxMs = 0.0;
+	double lastMs = 0.0;
+};
@@ -8,11 +8,14 @@
 #include "entity.h"
 #include "protocol.h"
 #include "raylib.h"
+#include "trace.h"
 
 
 static std::vector<Entity> entities;
 static std::unordered_map<uint16_t, size_t> indexMap;
 static uint16_t my_entity = invalid_entity;
+static uint16_t redirect_port = 0;
+static uint32_t join_token = 0; // lets us take our ship over in the zone it was handed off to
 
 struct BandwidthAccumulator
 {
@@ -39,6 +42,24 @@ void on_new_entity_packet(ENetPacket* packet)
 	entities.push_back(newEntity);
 }
 
+static void on_remove_entity(ENetPacket* packet)
+{
+	uint16_t eid = invalid_entity;
+	if (!deserialize_remove_entity(packet, eid))
+		return;
+	auto itf = indexMap.find(eid);
+	if (itf == indexMap.end())
+		return;
+	const size_t index = itf->second;
+	indexMap.erase(itf);
+	if (index + 1 != entities.size())
+	{
+		entities[index] = entities.back();
+		indexMap[entities[index].eid] = index;
+	}
+	entities.pop_back();
+}
+
 void on_set_controlled_entity(ENetPacket* packet)
 {
 	deserialize_set_controlled_entity(packet, my_entity);
@@ -68,6 +89,19 @@ void on_snapshot(ENetPacket* packet)
 		});
 }
 
+static void on_redirect(ENetPacket* packet)
+{
+	uint16_t eid = invalid_entity;
+	uint32_t token = 0;
+	deserialize_redirect(packet, redirect_port, eid, token);
+	// our ship moved to another zone, we take it over there; a load balancing redirect on the way keeps the claim
+	if (eid != invalid_entity)
+	{
+		my_entity = eid;
+		join_token = token;
+	}
+}
+
 static void on_time(ENetPacket* packet, ENetPeer* peer)
 {
 	uint32_t timeMsec;
@@ -97,16 +131,41 @@ static void draw_entity(const Entity& e)
 	draw_ship(shipLen, shipWidth, e.x, e.y, fwd, left, ColorFromHSV(hsv.x, hsv.y, hsv.z)); //GetColor(e.color));
 }
 
-static void update_net(ENetHost* client, ENetPeer* serverPeer)
+// The server's first network thread may hand us over to a less loaded one, or our ship crossed into
+// a zone simulated by another server process. false when the new server can't be connected to
+static bool follow_redirect(ENetHost* client, ENetPeer*& serverPeer)
 {
+	ENetAddress address = serverPeer->address;
+	address.port = redirect_port;
+	redirect_port = 0;
+	printf("Redirected to port %u\n", address.port);
+	// tell the old thread right away so it doesn't hold the slot until a timeout
+	enet_peer_disconnect_now(serverPeer, 0);
+	// the old server won't tell us what it removes any more, the new one sends everything it has on join
+	entities.clear();
+	indexMap.clear();
+	serverPeer = enet_host_connect(client, &address, 2, 0);
+	if (!serverPeer)
+	{
+		printf("Cannot connect to server\n");
+		return false;
+	}
+	return true;
+}
+
+// false once the client has no server left to talk to
+static bool update_net(ENetHost* client, ENetPeer*& serverPeer)
+{
+	TRACE_SCOPE("update_net");
 	ENetEvent event;
 	while (enet_host_service(client, &event, 0) > 0)
 	{
 		switch (event.type)
 		{
 			case ENET_EVENT_TYPE_CONNECT:
+				TRACE_INSTANT("connect");
 				printf("Connection with %x:%u established\n", event.peer->address.host, event.peer->address.port);
-				send_join(serverPeer);
+				send_join(event.peer, my_entity, join_token);
 				break;
 			case ENET_EVENT_TYPE_RECEIVE:
 				switch (get_packet_type(event.packet))
@@ -123,17 +182,27 @@ static void update_net(ENetHost* client, ENetPeer* serverPeer)
 					case E_SERVER_TO_CLIENT_TIME_MSEC:
 						on_time(event.packet, event.peer);
 						break;
+					case E_SERVER_TO_CLIENT_REDIRECT:
+						on_redirect(event.packet);
+						break;
+					case E_SERVER_TO_CLIENT_REMOVE_ENTITY:
+						on_remove_entity(event.packet);
+						break;
 				};
 				enet_packet_destroy(event.packet);
 				break;
 			default:
 				break;
 		};
+		if (redirect_port != 0)
+			return follow_redirect(client, serverPeer);
 	}
+	return true;
 }
 
 static void simulate_world(ENetPeer* serverPeer)
 {
+	TRACE_SCOPE("simulate_world");
 	if (my_entity != invalid_entity)
 	{
 		bool left = IsKeyDown(KEY_LEFT);
@@ -155,6 +224,7 @@ static void simulate_world(ENetPeer* serverPeer)
 
 static void draw_world(const Camera2D& camera, const BandwidthAccumulator& bw)
 {
+	TRACE_SCOPE("draw_world");
 	BeginDrawing();
 	ClearBackground(DARKGRAY);
 	BeginMode2D(camera);
@@ -181,6 +251,7 @@ static void draw_world(const Camera2D& camera, const BandwidthAccumulator& bw)
 
 static void update_camera(Camera2D& camera)
 {
+	TRACE_SCOPE("update_camera");
 	if (my_entity != invalid_entity)
 	{
 		get_entity(my_entity,
@@ -196,6 +267,7 @@ static void update_camera(Camera2D& camera)
 
 void update_bandwidth(float dt, ENetHost* host, BandwidthAccumulator& accum)
 {
+	TRACE_SCOPE("update_bandwidth");
 	constexpr float windowSize = 1.f; // 1 sec
 	accum.curTime += dt;
 	accum.inData.emplace_back(host->totalReceivedData, accum.curTime);
@@ -212,6 +284,8 @@ void update_bandwidth(float dt, ENetHost* host, BandwidthAccumulator& accum)
 
 int main(int argc, const char** argv)
 {
+	TRACE_INIT("w7_client_trace.json", "main");
+
 	if (enet_initialize() != 0)
 	{
 		printf("Cannot init ENet");
@@ -259,11 +333,15 @@ int main(int argc, const char** argv)
 	SetTargetFPS(60); // Set our game to run at 60 frames-per-second
 
 	BandwidthAccumulator bandwidthAccumulator;
+	bool connected = true;
 	while (!WindowShouldClose())
 	{
+		TRACE_SCOPE("frame");
 		float dt = GetFrameTime();
 
-		update_net(client, serverPeer);
+		connected = update_net(client, serverPeer);
+		if (!connected)
+			break;
 		update_bandwidth(dt, client, bandwidthAccumulator);
 		simulate_world(serverPeer);
 		update_camera(camera);
@@ -271,5 +349,6 @@ int main(int argc, const char** argv)
 	}
 
 	CloseWindow();
-	return 0;
+	TRACE_SHUTDOWN();
+	return connected ? 0 : 1;
 }
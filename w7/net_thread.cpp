@@ -0,0 +1,330 @@
+#include "net_thread.h"
+
+#include <cstdio>
+#include <string>
+
+#include "loop_timings.h"
+#include "protocol.h"
+#include "trace.h"
+
+// Upper bound on how long an outgoing packet waits in the queue while the thread sleeps in ENet
+static constexpr enet_uint32 serviceTimeoutMs = 1;
+// By address only, a client reconnecting from another port is still banned
+static constexpr std::chrono::seconds banDuration{60};
+
+WorkerLoads::WorkerLoads(size_t num_workers, uint16_t base_port)
+	: numWorkers(num_workers)
+	, basePort(base_port)
+	, loads(new Load[num_workers])
+{
+}
+
+size_t WorkerLoads::pickWorker(Clock::time_point now)
+{
+	size_t best = 0;
+	uint32_t bestLoad = UINT32_MAX;
+	for (size_t i = 0; i < numWorkers; ++i)
+	{
+		uint32_t expected = 0;
+		{
+			std::lock_guard<std::mutex> lock(loads[i].pendingMutex);
+			std::deque<Clock::time_point>& pending = loads[i].pending;
+			while (!pending.empty() && pending.front() <= now)
+				pending.pop_front();
+			expected = uint32_t(pending.size());
+		}
+		const uint32_t load = loads[i].connected.load(std::memory_order_relaxed) + expected;
+		if (load < bestLoad)
+		{
+			best = i;
+			bestLoad = load;
+		}
+	}
+	return best;
+}
+
+uint32_t WorkerLoads::totalConnected() const
+{
+	uint32_t total = 0;
+	for (size_t i = 0; i < numWorkers; ++i)
+		total += loads[i].connected.load(std::memory_order_relaxed);
+	return total;
+}
+
+void WorkerLoads::expectPeer(size_t worker, Clock::time_point now)
+{
+	std::lock_guard<std::mutex> lock(loads[worker].pendingMutex);
+	loads[worker].pending.push_back(now + redirectTimeout);
+}
+
+void WorkerLoads::onPeerConnected(size_t worker)
+{
+	// settle one expected peer if there is any, direct connections just count as connected
+	{
+		std::lock_guard<std::mutex> lock(loads[worker].pendingMutex);
+		if (!loads[worker].pending.empty())
+			loads[worker].pending.pop_front();
+	}
+	loads[worker].connected.fetch_add(1, std::memory_order_relaxed);
+}
+
+void WorkerLoads::onPeerDisconnected(size_t worker)
+{
+	loads[worker].connected.fetch_sub(1, std::memory_order_relaxed);
+}
+
+NetThread::NetThread(ENetHost* host, size_t index, WorkerLoads& loads, const WorldState& world)
+	: host(host)
+	, index(index)
+	, loads(loads)
+	, world(world)
+	, redirected(host->peerCount, false)
+	, limiters(host->peerCount)
+	, banned(host->peerCount, false)
+{
+}
+
+NetThread::~NetThread()
+{
+	stop();
+}
+
+void NetThread::start()
+{
+	running = true;
+	thread = std::thread(&NetThread::run, this);
+}
+
+void NetThread::stop()
+{
+	running = false;
+	if (thread.joinable())
+		thread.join();
+
+	// Whatever the simulation queued after the thread stopped is never going to be sent
+	OutgoingPacket out;
+	while (outbound.pop(out))
+		enet_packet_destroy(out.packet);
+}
+
+void NetThread::send(uint16_t peer_id, uint8_t channel, ENetPacket* packet)
+{
+	if (!outbound.push(OutgoingPacket{packet, peer_id, channel}))
+	{
+		// Network thread is that far behind, dropping is better than stalling the tick
+		numDroppedOutgoing.fetch_add(1, std::memory_order_relaxed);
+		enet_packet_destroy(packet);
+	}
+}
+
+void NetThread::run()
+{
+	const std::string name = "network thread " + std::to_string(index);
+	TRACE_THREAD_NAME(name.c_str());
+	LoopTimings timings(name.c_str());
+	while (running)
+	{
+		flushOverflow();
+		flushOutgoing();
+
+		// Waiting happens inside ENet, the timed part is only what we do with the events
+		ENetEvent event;
+		int res = enet_host_service(host, &event, serviceTimeoutMs);
+		timings.begin();
+		{
+			TRACE_SCOPE("service");
+			while (res > 0)
+			{
+				handleEvent(event);
+				res = enet_host_check_events(host, &event);
+			}
+			flushOutgoing();
+			sendWorld();
+			enet_host_flush(host);
+		}
+		timings.end();
+	}
+}
+
+void NetThread::flushOutgoing()
+{
+	OutgoingPacket out;
+	while (outbound.pop(out))
+	{
+		if (out.peerId == OutgoingPacket::broadcast)
+		{
+			// one packet shared by every connected peer, ENet refcounts it
+			enet_host_broadcast(host, out.channel, out.packet);
+			continue;
+		}
+
+		ENetPeer* peer = out.peerId < host->peerCount ? &host->peers[out.peerId] : nullptr;
+		if (!peer || peer->state != ENET_PEER_STATE_CONNECTED || enet_peer_send(peer, out.channel, out.packet) < 0)
+			enet_packet_destroy(out.packet);
+	}
+}
+
+// Serialized once per thread for all of its peers, in parallel with the other threads
+void NetThread::sendWorld()
+{
+	std::shared_ptr<const WorldSnapshot> snapshot = world.acquire();
+	if (!snapshot || snapshot->version == sentWorldVersion)
+		return;
+	sentWorldVersion = snapshot->version;
+	if (host->connectedPeers == 0)
+		return;
+
+	TRACE_SCOPE("send_world");
+	for (const EntitySnapshot& e : snapshot->entities)
+		enet_host_broadcast(host, 1, create_snapshot_packet(e.eid, e.x, e.y, e.ori));
+	// We can send it less often too
+	enet_host_broadcast(host, 0, create_time_msec_packet(snapshot->timeMsec));
+}
+
+bool NetThread::redirect(ENetPeer* peer)
+{
+	if (index != 0 || loads.size() < 2)
+		return false;
+	const auto now = WorkerLoads::Clock::now();
+	const size_t target = loads.pickWorker(now);
+	if (target == index)
+		return false;
+
+	loads.expectPeer(target, now);
+	redirected[peer - host->peers] = true;
+	enet_peer_send(peer, 0, create_redirect_packet(loads.port(target), invalid_entity, 0));
+	enet_peer_disconnect_later(peer, 0);
+	return true;
+}
+
+bool NetThread::isBanned(const ENetAddress& address, RateLimiter::Clock::time_point now)
+{
+	auto itf = bannedHosts.find(address.host);
+	if (itf == bannedHosts.end())
+		return false;
+	if (now < itf->second)
+		return true;
+	bannedHosts.erase(itf);
+	return false;
+}
+
+bool NetThread::admit(ENetPeer* peer, const ENetPacket* packet)
+{
+	const uint16_t peerId = uint16_t(peer - host->peers);
+	if (banned[peerId] || packet->dataLength == 0)
+		return false;
+
+	const auto now = RateLimiter::Clock::now();
+	const MessageType type = MessageType(packet->data[0]);
+	switch (limiters[peerId].admit(traffic_class(type), now))
+	{
+		case RateLimiter::Verdict::Pass:
+			return true;
+		case RateLimiter::Verdict::Drop:
+			break;
+		case RateLimiter::Verdict::Ban:
+			// the disconnect event reaches the simulation as usual
+			TRACE_INSTANT("peer_banned");
+			printf("Banning %x:%u for flooding\n", peer->address.host, peer->address.port);
+			banned[peerId] = true;
+			bannedHosts[peer->address.host] = now + banDuration;
+			numBans.fetch_add(1, std::memory_order_relaxed);
+			enet_peer_disconnect(peer, 0);
+			break;
+	}
+	numShedIncoming.fetch_add(1, std::memory_order_relaxed);
+	return false;
+}
+
+void NetThread::handleEvent(const ENetEvent& event)
+{
+	const uint16_t peerId = uint16_t(event.peer - host->peers);
+	switch (event.type)
+	{
+		case ENET_EVENT_TYPE_CONNECT:
+			if (isBanned(event.peer->address, RateLimiter::Clock::now()))
+			{
+				// never counted nor seen by the simulation, and no disconnect event follows
+				enet_peer_disconnect_now(event.peer, 0);
+				break;
+			}
+			limiters[peerId] = RateLimiter();
+			banned[peerId] = false;
+			if (redirect(event.peer))
+				break;
+			TRACE_INSTANT("peer_connect");
+			printf("Connection with %x:%u established\n", event.peer->address.host, event.peer->address.port);
+			loads.onPeerConnected(index);
+			pushInbound(NetEvent{.type = NetEvent::Type::Connect, .peerId = peerId});
+			break;
+		case ENET_EVENT_TYPE_DISCONNECT:
+			if (redirected[peerId])
+			{
+				redirected[peerId] = false;
+				break;
+			}
+			TRACE_INSTANT("peer_disconnect");
+			pushInbound(NetEvent{.type = NetEvent::Type::Disconnect, .peerId = peerId});
+			break;
+		case ENET_EVENT_TYPE_RECEIVE:
+			if (redirected[peerId])
+			{
+				// the join it sent right after connecting, it is going to join elsewhere
+				enet_packet_destroy(event.packet);
+				break;
+			}
+			if (!admit(event.peer, event.packet))
+			{
+				enet_packet_destroy(event.packet);
+				break;
+			}
+			switch (get_packet_type(event.packet))
+			{
+				case E_CLIENT_TO_SERVER_JOIN:
+				{
+					NetEvent join{.type = NetEvent::Type::Join, .peerId = peerId};
+					deserialize_join(event.packet, join.eid, join.token);
+					pushInbound(join);
+					break;
+				}
+				case E_CLIENT_TO_SERVER_INPUT:
+				{
+					NetEvent input{.type = NetEvent::Type::Input, .peerId = peerId};
+					if (deserialize_entity_input(event.packet, input.eid, input.thr, input.steer))
+						pushInbound(input);
+					break;
+				}
+				default:
+					break;
+			};
+			enet_packet_destroy(event.packet);
+			break;
+		default:
+			break;
+	};
+}
+
+void NetThread::pushInbound(const NetEvent& event)
+{
+	// only inputs are shed when the simulation is that far behind, the next one carries the same controls;
+	// one can't overtake a connect or join still waiting either
+	if (event.type == NetEvent::Type::Input)
+	{
+		if (!overflow.empty() || !inbound.push(event))
+			numDroppedIncoming.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	overflow.push_back(event);
+	flushOverflow();
+}
+
+void NetThread::flushOverflow()
+{
+	while (!overflow.empty() && inbound.push(overflow.front()))
+	{
+		// the peer stops counting only once the simulation is sure to release its ships
+		if (overflow.front().type == NetEvent::Type::Disconnect)
+			loads.onPeerDisconnected(index);
+		overflow.pop_front();
+	}
+}
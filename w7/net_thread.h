@@ -0,0 +1,153 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <enet/enet.h>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "entity.h"
+#include "rate_limiter.h"
+#include "spsc_queue.h"
+#include "world_state.h"
+
+
+// Already decoded client messages, handed from the network thread to the simulation.
+struct NetEvent
+{
+	enum class Type : uint8_t
+	{
+		Connect,
+		Disconnect,
+		Join,
+		Input,
+	};
+
+	Type type = Type::Connect;
+	uint16_t peerId = 0; // index into ENetHost::peers of the thread the event came from
+	uint16_t eid = invalid_entity; // input target, or the handed off entity a join takes over
+	uint32_t token = 0; // a join's proof it was redirected along with the handed off entity
+	float thr = 0.f;
+	float steer = 0.f;
+};
+
+// Serialized packet on its way from the simulation to the network thread.
+struct OutgoingPacket
+{
+	static constexpr uint16_t broadcast = 0xffff;
+
+	ENetPacket* packet = nullptr;
+	uint16_t peerId = broadcast;
+	uint8_t channel = 0;
+};
+
+// Connected peer counts of every network thread, used to spread new connections.
+class WorkerLoads
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	// A redirected client that hasn't shown up by then isn't coming
+	static constexpr std::chrono::seconds redirectTimeout{5};
+
+	WorkerLoads(size_t num_workers, uint16_t base_port);
+
+	size_t size() const { return numWorkers; }
+	uint16_t port(size_t worker) const { return uint16_t(basePort + worker); }
+
+	// Least loaded worker, ties go to the lowest index; redirects past their timeout stop counting
+	size_t pickWorker(Clock::time_point now);
+	uint32_t totalConnected() const;
+
+	// Counted right away by the router so a burst of connects doesn't all land on the same worker
+	// before the redirected clients show up there.
+	void expectPeer(size_t worker, Clock::time_point now);
+	void onPeerConnected(size_t worker);
+	void onPeerDisconnected(size_t worker);
+
+private:
+	struct alignas(64) Load
+	{
+		std::atomic<uint32_t> connected{0};
+		// expiry of every redirect to this worker not settled yet, oldest first;
+		// pushed and expired by the router, settled by the worker itself
+		std::mutex pendingMutex;
+		std::deque<Clock::time_point> pending;
+	};
+
+	size_t numWorkers;
+	uint16_t basePort;
+	std::unique_ptr<Load[]> loads;
+};
+
+// Owns an ENetHost and services it on its own thread, so packet latency doesn't depend on tick cost.
+// ENet is only ever touched from that thread; the simulation talks to it through the two queues
+// and the published world, which the thread turns into snapshot packets for its own peers.
+// Thread 0 listens on the base port and redirects new clients to the least loaded thread.
+// Packets over their peer's rate limits are dropped here, before they are deserialized; a peer that keeps
+// flooding is disconnected and its address can't connect to this thread for a while.
+class NetThread
+{
+public:
+	NetThread(ENetHost* host, size_t index, WorkerLoads& loads, const WorldState& world);
+	~NetThread();
+
+	NetThread(const NetThread&) = delete;
+	NetThread& operator=(const NetThread&) = delete;
+
+	void start();
+	void stop();
+
+	// Simulation side
+	bool poll(NetEvent& event) { return inbound.pop(event); }
+	void send(uint16_t peer_id, uint8_t channel, ENetPacket* packet);
+	void broadcast(uint8_t channel, ENetPacket* packet) { send(OutgoingPacket::broadcast, channel, packet); }
+
+	uint64_t droppedOutgoing() const { return numDroppedOutgoing.load(std::memory_order_relaxed); }
+	uint64_t droppedIncoming() const { return numDroppedIncoming.load(std::memory_order_relaxed); }
+	uint64_t shedIncoming() const { return numShedIncoming.load(std::memory_order_relaxed); }
+	uint64_t bans() const { return numBans.load(std::memory_order_relaxed); }
+
+private:
+	void run();
+	void flushOutgoing();
+	void sendWorld();
+	void handleEvent(const ENetEvent& event);
+	bool redirect(ENetPeer* peer);
+	bool isBanned(const ENetAddress& address, RateLimiter::Clock::time_point now);
+	// false when the packet has to be dropped
+	bool admit(ENetPeer* peer, const ENetPacket* packet);
+	void pushInbound(const NetEvent& event);
+	// Moves the lifecycle events that found inbound full into it, in order
+	void flushOverflow();
+
+private:
+	ENetHost* host;
+	size_t index;
+	WorkerLoads& loads;
+	const WorldState& world;
+	uint32_t sentWorldVersion = 0;
+	std::vector<bool> redirected; // per peer, they are on their way out and never reach the simulation
+	std::vector<RateLimiter> limiters; // per peer, reset on connect
+	std::vector<bool> banned; // per peer, being disconnected, nothing they send is looked at any more
+	std::unordered_map<enet_uint32, RateLimiter::Clock::time_point> bannedHosts; // until when
+
+	std::thread thread;
+	std::atomic<bool> running{false};
+
+	SpscQueue<NetEvent, 4096> inbound;
+	// connects, joins and disconnects are never dropped, they wait here while inbound is full; joins are rate
+	// limited like any packet, so it stays short
+	std::deque<NetEvent> overflow;
+	SpscQueue<OutgoingPacket, 16384> outbound;
+
+	std::atomic<uint64_t> numDroppedOutgoing{0};
+	std::atomic<uint64_t> numDroppedIncoming{0};
+	std::atomic<uint64_t> numShedIncoming{0};
+	std::atomic<uint64_t> numBans{0};
+};
@@ -0,0 +1,207 @@
+#include "packet_pool.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <enet/enet.h>
+#include <mutex>
+
+namespace
+{
+	// Block header keeps the size class so free() knows where the block goes back to.
+	// 16 bytes so the payload stays aligned like malloc's.
+	constexpr size_t headerSize = 16;
+	constexpr uint32_t largeClass = ~0u;
+
+	constexpr size_t classSizes[] = {32, 64, 128, 256, 512, 1024, 2048};
+	constexpr size_t numClasses = sizeof(classSizes) / sizeof(classSizes[0]);
+
+	constexpr size_t slabSize = 64 * 1024;
+	constexpr size_t localCacheLimit = 512; // blocks per class before a thread gives half back
+	constexpr size_t refillBatch = 64;
+
+	struct FreeBlock
+	{
+		FreeBlock* next;
+	};
+
+	struct FreeList
+	{
+		FreeBlock* head = nullptr;
+		size_t count = 0;
+
+		void push(FreeBlock* block)
+		{
+			block->next = head;
+			head = block;
+			++count;
+		}
+
+		FreeBlock* pop()
+		{
+			FreeBlock* block = head;
+			head = block->next;
+			--count;
+			return block;
+		}
+	};
+
+	struct GlobalClass
+	{
+		std::mutex mutex;
+		FreeList blocks;
+	};
+
+	GlobalClass globalClasses[numClasses];
+
+	std::atomic<uint64_t> allocations{0};
+	std::atomic<uint64_t> frees{0};
+	std::atomic<uint64_t> cacheHits{0};
+	std::atomic<uint64_t> globalRefills{0};
+	std::atomic<uint64_t> slabsAllocated{0};
+	std::atomic<uint64_t> largeAllocations{0};
+	std::atomic<int64_t> bytesInUse{0};
+	std::atomic<uint64_t> bytesReserved{0};
+
+	size_t block_size(uint32_t size_class)
+	{
+		return headerSize + classSizes[size_class];
+	}
+
+	uint32_t find_class(size_t size)
+	{
+		for (uint32_t i = 0; i < numClasses; ++i)
+			if (size <= classSizes[i])
+				return i;
+		return largeClass;
+	}
+
+	void carve_slab(uint32_t size_class, FreeList& into)
+	{
+		uint8_t* slab = (uint8_t*)malloc(slabSize);
+		if (!slab)
+			return;
+		// Slabs are never returned, the pool only grows to the peak working set
+		const size_t stride = block_size(size_class);
+		for (size_t offset = 0; offset + stride <= slabSize; offset += stride)
+			into.push((FreeBlock*)(slab + offset));
+		slabsAllocated.fetch_add(1, std::memory_order_relaxed);
+		bytesReserved.fetch_add(slabSize, std::memory_order_relaxed);
+	}
+
+	struct LocalCache
+	{
+		FreeList classes[numClasses];
+
+		~LocalCache()
+		{
+			// Thread is going away, everything it cached goes back to the shared lists
+			for (uint32_t i = 0; i < numClasses; ++i)
+			{
+				std::lock_guard<std::mutex> lock(globalClasses[i].mutex);
+				while (classes[i].head)
+					globalClasses[i].blocks.push(classes[i].pop());
+			}
+		}
+
+		void refill(uint32_t size_class)
+		{
+			FreeList& local = classes[size_class];
+			{
+				GlobalClass& global = globalClasses[size_class];
+				std::lock_guard<std::mutex> lock(global.mutex);
+				for (size_t i = 0; i < refillBatch && global.blocks.head; ++i)
+					local.push(global.blocks.pop());
+			}
+			if (local.head)
+			{
+				globalRefills.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			carve_slab(size_class, local);
+		}
+
+		void release_half(uint32_t size_class)
+		{
+			FreeList& local = classes[size_class];
+			GlobalClass& global = globalClasses[size_class];
+			std::lock_guard<std::mutex> lock(global.mutex);
+			for (size_t i = localCacheLimit / 2; i > 0; --i)
+				global.blocks.push(local.pop());
+		}
+	};
+
+	thread_local LocalCache localCache;
+} // namespace
+
+void* packet_pool_malloc(size_t size)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+
+	const uint32_t sizeClass = find_class(size);
+	uint8_t* block = nullptr;
+	if (sizeClass == largeClass)
+	{
+		largeAllocations.fetch_add(1, std::memory_order_relaxed);
+		block = (uint8_t*)malloc(headerSize + size);
+		if (!block)
+			return nullptr;
+	}
+	else
+	{
+		FreeList& local = localCache.classes[sizeClass];
+		if (local.head)
+			cacheHits.fetch_add(1, std::memory_order_relaxed);
+		else
+			localCache.refill(sizeClass);
+		if (!local.head)
+			return nullptr; // ENet calls its no_memory callback
+		block = (uint8_t*)local.pop();
+		bytesInUse.fetch_add(classSizes[sizeClass], std::memory_order_relaxed);
+	}
+
+	*(uint32_t*)block = sizeClass;
+	return block + headerSize;
+}
+
+void packet_pool_free(void* memory)
+{
+	if (!memory)
+		return;
+	frees.fetch_add(1, std::memory_order_relaxed);
+
+	uint8_t* block = (uint8_t*)memory - headerSize;
+	const uint32_t sizeClass = *(uint32_t*)block;
+	if (sizeClass == largeClass)
+	{
+		free(block);
+		return;
+	}
+
+	bytesInUse.fetch_sub(classSizes[sizeClass], std::memory_order_relaxed);
+	FreeList& local = localCache.classes[sizeClass];
+	local.push((FreeBlock*)block);
+	if (local.count > localCacheLimit)
+		localCache.release_half(sizeClass);
+}
+
+int enet_initialize_with_packet_pool()
+{
+	ENetCallbacks callbacks = {};
+	callbacks.malloc = packet_pool_malloc;
+	callbacks.free = packet_pool_free;
+	return enet_initialize_with_callbacks(ENET_VERSION, &callbacks);
+}
+
+PacketPoolStats get_packet_pool_stats()
+{
+	PacketPoolStats stats;
+	stats.allocations = allocations.load(std::memory_order_relaxed);
+	stats.frees = frees.load(std::memory_order_relaxed);
+	stats.cacheHits = cacheHits.load(std::memory_order_relaxed);
+	stats.globalRefills = globalRefills.load(std::memory_order_relaxed);
+	stats.slabsAllocated = slabsAllocated.load(std::memory_order_relaxed);
+	stats.largeAllocations = largeAllocations.load(std::memory_order_relaxed);
+	stats.bytesInUse = uint64_t(bytesInUse.load(std::memory_order_relaxed));
+	stats.bytesReserved = bytesReserved.load(std::memory_order_relaxed);
+	return stats;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Size-class pool behind ENet's allocator callbacks.
+// Every ENet allocation (packets, their data, outgoing commands, ...) comes from per-thread free lists of
+// fixed size blocks carved out of big slabs, so the per-tick packet churn never reaches malloc.
+// Anything bigger than the largest class goes to malloc directly.
+
+struct PacketPoolStats
+{
+	uint64_t allocations = 0;
+	uint64_t frees = 0;
+	uint64_t cacheHits = 0;      // served from the calling thread's free list
+	uint64_t globalRefills = 0;  // batches taken from the shared free lists
+	uint64_t slabsAllocated = 0; // batches carved from a fresh slab
+	uint64_t largeAllocations = 0;
+	uint64_t bytesInUse = 0; // pooled blocks handed out and not freed yet, in block sizes
+	uint64_t bytesReserved = 0;
+};
+
+// Use instead of enet_initialize(), same return value.
+int enet_initialize_with_packet_pool();
+
+void* packet_pool_malloc(size_t size);
+void packet_pool_free(void* memory);
+
+PacketPoolStats get_packet_pool_stats();
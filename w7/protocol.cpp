@@ -3,34 +3,46 @@
 #include <cstring> // memcpy
 #include <iostream>
 
-void send_join(ENetPeer *peer)
+void send_join(ENetPeer *peer, uint16_t eid, uint32_t token)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t), ENET_PACKET_FLAG_RELIABLE);
-  *packet->data = E_CLIENT_TO_SERVER_JOIN;
+  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t) + sizeof(uint32_t),
+                                                   ENET_PACKET_FLAG_RELIABLE);
+  uint8_t *ptr = packet->data;
+  *ptr = E_CLIENT_TO_SERVER_JOIN; ptr += sizeof(uint8_t);
+  memcpy(ptr, &eid, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+  memcpy(ptr, &token, sizeof(uint32_t)); ptr += sizeof(uint32_t);
 
   enet_peer_send(peer, 0, packet);
 }
 
-void send_new_entity(ENetPeer *peer, const Entity &ent)
+ENetPacket *create_new_entity_packet(const Entity &ent)
 {
   ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(Entity),
                                                    ENET_PACKET_FLAG_RELIABLE);
   uint8_t *ptr = packet->data;
   *ptr = E_SERVER_TO_CLIENT_NEW_ENTITY; ptr += sizeof(uint8_t);
   memcpy(ptr, &ent, sizeof(Entity)); ptr += sizeof(Entity);
+  return packet;
+}
 
-  enet_peer_send(peer, 0, packet);
+void send_new_entity(ENetPeer *peer, const Entity &ent)
+{
+  enet_peer_send(peer, 0, create_new_entity_packet(ent));
 }
 
-void send_set_controlled_entity(ENetPeer *peer, uint16_t eid)
+ENetPacket *create_set_controlled_entity_packet(uint16_t eid)
 {
   ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t),
                                                    ENET_PACKET_FLAG_RELIABLE);
   uint8_t *ptr = packet->data;
   *ptr = E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY; ptr += sizeof(uint8_t);
   memcpy(ptr, &eid, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+  return packet;
+}
 
-  enet_peer_send(peer, 0, packet);
+void send_set_controlled_entity(ENetPeer *peer, uint16_t eid)
+{
+  enet_peer_send(peer, 0, create_set_controlled_entity_packet(eid));
 }
 
 void send_entity_input(ENetPeer *peer, uint16_t eid, float thr, float steer)
@@ -56,7 +68,7 @@ void send_entity_input(ENetPeer *peer, uint16_t eid, float thr, float steer)
 typedef PackedFloat<uint16_t, 11> PositionXQuantized;
 typedef PackedFloat<uint16_t, 10> PositionYQuantized;
 
-void send_snapshot(ENetPeer *peer, uint16_t eid, float x, float y, float ori)
+ENetPacket *create_snapshot_packet(uint16_t eid, float x, float y, float ori)
 {
   ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t) +
                                                    sizeof(uint16_t) +
@@ -73,19 +85,72 @@ void send_snapshot(ENetPeer *peer, uint16_t eid, float x, float y, float ori)
   memcpy(ptr, &xPacked.packedVal, sizeof(uint16_t)); ptr += sizeof(uint16_t);
   memcpy(ptr, &yPacked.packedVal, sizeof(uint16_t)); ptr += sizeof(uint16_t);
   memcpy(ptr, &oriPacked, sizeof(uint8_t)); ptr += sizeof(uint8_t);
+  return packet;
+}
 
-  enet_peer_send(peer, 1, packet);
+void send_snapshot(ENetPeer *peer, uint16_t eid, float x, float y, float ori)
+{
+  enet_peer_send(peer, 1, create_snapshot_packet(eid, x, y, ori));
 }
 
-void send_time_msec(ENetPeer *peer, uint32_t timeMsec)
+ENetPacket *create_time_msec_packet(uint32_t timeMsec)
 {
   ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint32_t),
                                                    ENET_PACKET_FLAG_RELIABLE);
   uint8_t *ptr = packet->data;
   *ptr = E_SERVER_TO_CLIENT_TIME_MSEC; ptr += sizeof(uint8_t);
   memcpy(ptr, &timeMsec, sizeof(uint32_t)); ptr += sizeof(uint32_t);
+  return packet;
+}
 
-  enet_peer_send(peer, 0, packet);
+void send_time_msec(ENetPeer *peer, uint32_t timeMsec)
+{
+  enet_peer_send(peer, 0, create_time_msec_packet(timeMsec));
+}
+
+ENetPacket *create_redirect_packet(uint16_t port, uint16_t eid, uint32_t token)
+{
+  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t) + sizeof(uint16_t) +
+                                                   sizeof(uint32_t),
+                                                   ENET_PACKET_FLAG_RELIABLE);
+  uint8_t *ptr = packet->data;
+  *ptr = E_SERVER_TO_CLIENT_REDIRECT; ptr += sizeof(uint8_t);
+  memcpy(ptr, &port, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+  memcpy(ptr, &eid, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+  memcpy(ptr, &token, sizeof(uint32_t)); ptr += sizeof(uint32_t);
+  return packet;
+}
+
+ENetPacket *create_remove_entity_packet(uint16_t eid)
+{
+  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t),
+                                                   ENET_PACKET_FLAG_RELIABLE);
+  uint8_t *ptr = packet->data;
+  *ptr = E_SERVER_TO_CLIENT_REMOVE_ENTITY; ptr += sizeof(uint8_t);
+  memcpy(ptr, &eid, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+  return packet;
+}
+
+ENetPacket *create_zone_handoff_packet(const Entity &ent, uint32_t token)
+{
+  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(Entity) + sizeof(uint32_t),
+                                                   ENET_PACKET_FLAG_RELIABLE);
+  uint8_t *ptr = packet->data;
+  *ptr = E_ZONE_TO_ZONE_HANDOFF; ptr += sizeof(uint8_t);
+  memcpy(ptr, &ent, sizeof(Entity)); ptr += sizeof(Entity);
+  memcpy(ptr, &token, sizeof(uint32_t)); ptr += sizeof(uint32_t);
+  return packet;
+}
+
+ENetPacket *create_zone_ghosts_packet(const Entity *ents, uint16_t count)
+{
+  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t) + count * sizeof(Entity),
+                                                   0);
+  uint8_t *ptr = packet->data;
+  *ptr = E_ZONE_TO_ZONE_GHOSTS; ptr += sizeof(uint8_t);
+  memcpy(ptr, &count, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+  memcpy(ptr, ents, count * sizeof(Entity)); ptr += count * sizeof(Entity);
+  return packet;
 }
 
 MessageType get_packet_type(ENetPacket *packet)
@@ -105,8 +170,10 @@ void deserialize_set_controlled_entity(ENetPacket *packet, uint16_t &eid)
   eid = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
 }
 
-void deserialize_entity_input(ENetPacket *packet, uint16_t &eid, float &thr, float &steer)
+bool deserialize_entity_input(ENetPacket *packet, uint16_t &eid, float &thr, float &steer)
 {
+  if (packet->dataLength < sizeof(uint8_t) + sizeof(uint16_t) + sizeof(uint8_t))
+    return false;
   uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
   eid = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
   uint8_t thrSteerPacked = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
@@ -120,6 +187,7 @@ void deserialize_entity_input(ENetPacket *packet, uint16_t &eid, float &thr, flo
   float4bitsQuantized steerPacked(thrSteerPacked & 0x0f);
   thr = thrPacked.packedVal == neutralPackedValue ? 0.f : thrPacked.unpack(-1.f, 1.f);
   steer = steerPacked.packedVal == neutralPackedValue ? 0.f : steerPacked.unpack(-1.f, 1.f);
+  return true;
 }
 
 void deserialize_snapshot(ENetPacket *packet, uint16_t &eid, float &x, float &y, float &ori)
@@ -142,3 +210,55 @@ void deserialize_time_msec(ENetPacket *packet, uint32_t &timeMsec)
   timeMsec = *(uint32_t*)(ptr); ptr += sizeof(uint32_t);
 }
 
+void deserialize_join(ENetPacket *packet, uint16_t &eid, uint32_t &token)
+{
+  eid = invalid_entity;
+  token = 0;
+  if (packet->dataLength < sizeof(uint8_t) + sizeof(uint16_t) + sizeof(uint32_t))
+    return;
+  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
+  memcpy(&eid, ptr, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+  memcpy(&token, ptr, sizeof(uint32_t)); ptr += sizeof(uint32_t);
+}
+
+void deserialize_redirect(ENetPacket *packet, uint16_t &port, uint16_t &eid, uint32_t &token)
+{
+  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
+  port = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
+  eid = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
+  memcpy(&token, ptr, sizeof(uint32_t)); ptr += sizeof(uint32_t);
+}
+
+bool deserialize_remove_entity(ENetPacket *packet, uint16_t &eid)
+{
+  if (packet->dataLength < sizeof(uint8_t) + sizeof(uint16_t))
+    return false;
+  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
+  memcpy(&eid, ptr, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+  return true;
+}
+
+bool deserialize_zone_handoff(ENetPacket *packet, Entity &ent, uint32_t &token)
+{
+  if (packet->dataLength != sizeof(uint8_t) + sizeof(Entity) + sizeof(uint32_t))
+    return false;
+  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
+  memcpy(&ent, ptr, sizeof(Entity)); ptr += sizeof(Entity);
+  memcpy(&token, ptr, sizeof(uint32_t)); ptr += sizeof(uint32_t);
+  return true;
+}
+
+bool deserialize_zone_ghosts(ENetPacket *packet, std::vector<Entity> &ents)
+{
+  if (packet->dataLength < sizeof(uint8_t) + sizeof(uint16_t))
+    return false;
+  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
+  uint16_t count = 0;
+  memcpy(&count, ptr, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+  if (packet->dataLength != sizeof(uint8_t) + sizeof(uint16_t) + count * sizeof(Entity))
+    return false;
+  const size_t first = ents.size();
+  ents.resize(first + count);
+  memcpy(ents.data() + first, ptr, count * sizeof(Entity)); ptr += count * sizeof(Entity);
+  return true;
+}
@@ -1,6 +1,7 @@
 #pragma once
 #include <enet/enet.h>
 #include <cstdint>
+#include <vector>
 #include "entity.h"
 
 enum MessageType : uint8_t
@@ -10,21 +11,53 @@ enum MessageType : uint8_t
   E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY,
   E_CLIENT_TO_SERVER_INPUT,
   E_SERVER_TO_CLIENT_SNAPSHOT,
-  E_SERVER_TO_CLIENT_TIME_MSEC
+  E_SERVER_TO_CLIENT_TIME_MSEC,
+  E_SERVER_TO_CLIENT_REDIRECT,
+  E_SERVER_TO_CLIENT_REMOVE_ENTITY,
+
+  // between neighbouring zone servers
+  E_ZONE_TO_ZONE_HANDOFF,
+  E_ZONE_TO_ZONE_GHOSTS
 };
 
-void send_join(ENetPeer *peer);
+// eid is the entity to take over after a zone redirect, with the token that came in the redirect;
+// invalid_entity asks for a new one
+void send_join(ENetPeer *peer, uint16_t eid = invalid_entity, uint32_t token = 0);
 void send_new_entity(ENetPeer *peer, const Entity &ent);
 void send_set_controlled_entity(ENetPeer *peer, uint16_t eid);
 void send_entity_input(ENetPeer *peer, uint16_t eid, float thr, float steer);
 void send_snapshot(ENetPeer *peer, uint16_t eid, float x, float y, float ori);
 void send_time_msec(ENetPeer *peer, uint32_t timeMsec);
 
+// Same messages built without sending, for code that hands packets over to another thread.
+// Channels: snapshots go on channel 1, the rest on 0.
+ENetPacket *create_new_entity_packet(const Entity &ent);
+ENetPacket *create_set_controlled_entity_packet(uint16_t eid);
+ENetPacket *create_snapshot_packet(uint16_t eid, float x, float y, float ori);
+ENetPacket *create_time_msec_packet(uint32_t timeMsec);
+// Reconnect to the same host on another port. Load balancing sends it right after connecting with
+// invalid_entity; a zone sends it with the client's entity once the ship was handed off to the zone on that port,
+// and with the token the join there has to show to take the ship over.
+ENetPacket *create_redirect_packet(uint16_t port, uint16_t eid, uint32_t token);
+// The entity is gone, a ghost that wasn't mirrored any more
+ENetPacket *create_remove_entity_packet(uint16_t eid);
+// Full entity state, the receiving zone takes over its simulation. token is 0 for a ship nobody controls,
+// otherwise the client redirected along with it joins with it.
+ENetPacket *create_zone_handoff_packet(const Entity &ent, uint32_t token);
+// Entities in the border band, the receiving zone only mirrors them to its clients
+ENetPacket *create_zone_ghosts_packet(const Entity *ents, uint16_t count);
+
 MessageType get_packet_type(ENetPacket *packet);
 
 void deserialize_new_entity(ENetPacket *packet, Entity &ent);
 void deserialize_set_controlled_entity(ENetPacket *packet, uint16_t &eid);
-void deserialize_entity_input(ENetPacket *packet, uint16_t &eid, float &thr, float &steer);
+// false if the packet is too short to hold an input
+bool deserialize_entity_input(ENetPacket *packet, uint16_t &eid, float &thr, float &steer);
 void deserialize_snapshot(ENetPacket *packet, uint16_t &eid, float &x, float &y, float &ori);
 void deserialize_time_msec(ENetPacket *packet, uint32_t &timeMsec);
+void deserialize_join(ENetPacket *packet, uint16_t &eid, uint32_t &token);
+void deserialize_redirect(ENetPacket *packet, uint16_t &port, uint16_t &eid, uint32_t &token);
+bool deserialize_remove_entity(ENetPacket *packet, uint16_t &eid);
+bool deserialize_zone_handoff(ENetPacket *packet, Entity &ent, uint32_t &token);
+bool deserialize_zone_ghosts(ENetPacket *packet, std::vector<Entity> &ents);
 
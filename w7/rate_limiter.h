@@ -0,0 +1,96 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+#include "protocol.h"
+
+
+// Packet classes with a budget of their own: inputs come every frame, joins once per connection
+enum class TrafficClass : uint8_t
+{
+	Join,
+	Input,
+	Other,
+	Count,
+};
+
+inline TrafficClass traffic_class(MessageType type)
+{
+	switch (type)
+	{
+		case E_CLIENT_TO_SERVER_JOIN:
+			return TrafficClass::Join;
+		case E_CLIENT_TO_SERVER_INPUT:
+			return TrafficClass::Input;
+		default:
+			return TrafficClass::Other;
+	}
+}
+
+// Token buckets of one peer, checked by the network thread before a packet is deserialized, so a flooding client
+// costs a few float operations per packet and never reaches the simulation. Every drop is a strike; too many of
+// them within strikeWindow ban the peer.
+class RateLimiter
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	enum class Verdict : uint8_t
+	{
+		Pass,
+		Drop,
+		Ban, // dropped, and the peer has to go
+	};
+
+	static constexpr uint32_t strikesBeforeBan = 200;
+	static constexpr std::chrono::seconds strikeWindow{5};
+
+	// The client sends an input every frame at 60 fps
+	Verdict admit(TrafficClass traffic_class, Clock::time_point now)
+	{
+		static constexpr std::array<Limit, size_t(TrafficClass::Count)> limits = {{
+			{1.f, 3.f}, // Join
+			{90.f, 30.f}, // Input
+			{5.f, 10.f}, // Other
+		}};
+
+		Bucket& bucket = buckets[size_t(traffic_class)];
+		const Limit& limit = limits[size_t(traffic_class)];
+		const float elapsed = std::chrono::duration<float>(now - bucket.refilledAt).count();
+		bucket.tokens = std::min(limit.burst, bucket.tokens + elapsed * limit.perSecond);
+		bucket.refilledAt = now;
+		if (bucket.tokens >= 1.f)
+		{
+			bucket.tokens -= 1.f;
+			return Verdict::Pass;
+		}
+
+		if (now - strikesSince >= strikeWindow)
+		{
+			strikesSince = now;
+			strikes = 0;
+		}
+		return ++strikes >= strikesBeforeBan ? Verdict::Ban : Verdict::Drop;
+	}
+
+private:
+	struct Limit
+	{
+		float perSecond;
+		float burst;
+	};
+
+	// starts full, the first refill tops it up
+	struct Bucket
+	{
+		float tokens = 0.f;
+		Clock::time_point refilledAt;
+	};
+
+	std::array<Bucket, size_t(TrafficClass::Count)> buckets;
+	uint32_t strikes = 0;
+	Clock::time_point strikesSince;
+};
@@ -0,0 +1,93 @@
+#include "registry_link.h"
+
+#include <algorithm>
+#include <cstdio>
+
+
+RegistryLink::RegistryLink(const ENetAddress& registry, uint16_t client_port, uint16_t capacity)
+	: address(registry)
+	, clientPort(client_port)
+	, capacity(capacity)
+{
+}
+
+RegistryLink::~RegistryLink()
+{
+	if (host)
+		enet_host_destroy(host);
+}
+
+bool RegistryLink::start()
+{
+	host = enet_host_create(nullptr, 1, 2, 0, 0);
+	if (!host)
+	{
+		printf("Cannot create registry link\n");
+		return false;
+	}
+	return true;
+}
+
+void RegistryLink::connect(uint32_t cur_time)
+{
+	if (peer)
+		return;
+	if (lastConnectAttempt != 0 && cur_time - lastConnectAttempt < reconnectDelayMs)
+		return;
+	lastConnectAttempt = cur_time;
+	// a failed attempt ends in a DISCONNECT event that clears it again
+	peer = enet_host_connect(host, &address, 2, 0);
+}
+
+float RegistryLink::percentile(float q)
+{
+	const size_t index = std::min(ticks.size() - 1, size_t(ticks.size() * q));
+	std::nth_element(ticks.begin(), ticks.begin() + index, ticks.end());
+	return ticks[index];
+}
+
+void RegistryLink::update(uint32_t cur_time, uint16_t peers, uint16_t entities)
+{
+	connect(cur_time);
+
+	ENetEvent event;
+	while (enet_host_service(host, &event, 0) > 0)
+	{
+		switch (event.type)
+		{
+			case ENET_EVENT_TYPE_CONNECT:
+				printf("Registered with the server registry %x:%u\n", address.host, address.port);
+				connected = true;
+				send_register(peer, clientPort, capacity);
+				break;
+			case ENET_EVENT_TYPE_DISCONNECT:
+				if (connected)
+					printf("Lost the server registry\n");
+				peer = nullptr;
+				connected = false;
+				break;
+			case ENET_EVENT_TYPE_RECEIVE:
+				enet_packet_destroy(event.packet);
+				break;
+			default:
+				break;
+		};
+	}
+
+	if (connected && cur_time - lastReport >= reportPeriodMs && !ticks.empty())
+	{
+		lastReport = cur_time;
+		ServerLoad load;
+		load.peers = peers;
+		load.entities = entities;
+		load.tickP50Ms = percentile(0.5f);
+		load.tickP95Ms = percentile(0.95f);
+		load.tickP99Ms = percentile(0.99f);
+		send_load(peer, load);
+		ticks.clear();
+	}
+	// ticks aren't kept while nobody is listening
+	if (!connected)
+		ticks.clear();
+	enet_host_flush(host);
+}
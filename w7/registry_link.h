@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <enet/enet.h>
+#include <vector>
+
+#include "../w2/registry_protocol.h"
+
+
+// Keeps this zone server registered with the server registry of the w2 lobby, on an ENet host of its own serviced
+// from the simulation thread: registers once connected, then reports its load every reportPeriodMs. Tick times are
+// collected in between and go out as percentiles. Reconnects and registers again when the registry goes away.
+class RegistryLink
+{
+public:
+	RegistryLink(const ENetAddress& registry, uint16_t client_port, uint16_t capacity);
+	~RegistryLink();
+
+	RegistryLink(const RegistryLink&) = delete;
+	RegistryLink& operator=(const RegistryLink&) = delete;
+
+	bool start();
+
+	void addTick(float ms) { ticks.push_back(ms); }
+	void update(uint32_t cur_time, uint16_t peers, uint16_t entities);
+
+private:
+	void connect(uint32_t cur_time);
+	float percentile(float q);
+
+private:
+	static constexpr uint32_t reportPeriodMs = 1000;
+	static constexpr uint32_t reconnectDelayMs = 1000;
+
+	ENetAddress address;
+	uint16_t clientPort;
+	uint16_t capacity;
+	ENetHost* host = nullptr;
+	ENetPeer* peer = nullptr; // set while connecting or connected
+	bool connected = false;
+	uint32_t lastConnectAttempt = 0;
+	uint32_t lastReport = 0;
+	std::vector<float> ticks; // since the last report
+};
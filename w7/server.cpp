@@ -1,31 +1,132 @@
 #include <enet/enet.h>
+#include <algorithm>
 #include <iostream>
 #include "entity.h"
 #include "protocol.h"
 #include "mathUtils.h"
+#include "loop_timings.h"
+#include "net_thread.h"
+#include "packet_pool.h"
+#include "registry_link.h"
+#include "trace.h"
+#include "world_state.h"
+#include "zone_link.h"
+#include <charconv>
+#include <csignal>
+#include <memory>
+#include <random>
 #include <stdlib.h>
+#include <string>
+#include <thread>
 #include <vector>
 #include <map>
 
+// A peer is identified by the network thread that owns it and its index in that thread's host
+struct PeerRef
+{
+  size_t worker;
+  uint16_t peerId;
+
+  bool operator==(const PeerRef &other) const { return worker == other.worker && peerId == other.peerId; }
+};
+
 static std::vector<Entity> entities;
-static std::map<uint16_t, ENetPeer*> controlledMap;
+static std::map<uint16_t, PeerRef> controlledMap;
+static std::vector<std::unique_ptr<NetThread>> workers;
+static WorldState world;
+static volatile sig_atomic_t running = 1;
+
+// This process simulates one zone of the world, with a single zone it is the whole world
+static size_t zone = 0;
+static size_t numZones = 1;
+static std::unique_ptr<ZoneLink> zoneLink;
+// Set when started with --registry, the lobby then places rooms on the least loaded server
+static std::unique_ptr<RegistryLink> registryLink;
+static std::unique_ptr<WorkerLoads> workerLoads;
+
+// Border band entities of neighbouring zones, only shown to our clients
+struct Ghost
+{
+  Entity ent;
+  uint32_t lastSeen;
+};
+static std::map<uint16_t, Ghost> ghosts;
+constexpr uint32_t ghostTimeoutMs = 500;
+
+// Ships a neighbour handed over along with their client, by the token that client got with its redirect;
+// until it joins with it nobody controls them
+static std::map<uint16_t, uint32_t> handoffTokens;
+
+// A join for a ship whose handoff is still on its way from the neighbour
+struct HeldJoin
+{
+  PeerRef peer;
+  uint16_t eid;
+  uint32_t token;
+  uint32_t since;
+};
+static std::vector<HeldJoin> heldJoins;
+// Past it the ship isn't coming, the client gets a new one
+constexpr uint32_t heldJoinTimeoutMs = 2000;
+
+static uint16_t allocate_eid()
+{
+  static uint16_t nextEid = zone_first_eid(zone, numZones);
+  return nextEid++;
+}
+
+// Packets can't be shared between hosts, every network thread gets its own copy
+template <typename Create>
+static void broadcast_all(uint8_t channel, Create create)
+{
+  for (std::unique_ptr<NetThread> &worker : workers)
+    worker->broadcast(channel, create());
+}
+
+// Tokens are what keeps a client from taking over somebody else's ship, they must not be guessable
+static uint32_t issue_token()
+{
+  static std::mt19937 gen{std::random_device{}()};
+  uint32_t token = 0;
+  while (token == 0)
+    token = gen();
+  return token;
+}
 
-void on_join(ENetPacket *packet, ENetPeer *peer, ENetHost *host)
+static bool has_entity(uint16_t eid)
 {
+  for (const Entity &e : entities)
+    if (e.eid == eid)
+      return true;
+  return false;
+}
+
+static void finish_join(PeerRef peer, uint16_t eid, uint32_t token)
+{
+  NetThread &net = *workers[peer.worker];
   // send all entities
   for (const Entity &ent : entities)
-    send_new_entity(peer, ent);
+    net.send(peer.peerId, 0, create_new_entity_packet(ent));
+  for (const auto &[ghostEid, ghost] : ghosts)
+    net.send(peer.peerId, 0, create_new_entity_packet(ghost.ent));
 
-  // find max eid
-  uint16_t maxEid = entities.empty() ? invalid_entity : entities[0].eid;
-  for (const Entity &e : entities)
-    maxEid = std::max(maxEid, e.eid);
-  uint16_t newEid = maxEid + 1;
+  // a client following its ship from another zone takes it over again, if it was the one redirected with it
+  auto itf = handoffTokens.find(eid);
+  if (eid != invalid_entity && itf != handoffTokens.end() && itf->second == token)
+  {
+    handoffTokens.erase(itf);
+    controlledMap[eid] = peer;
+    net.send(peer.peerId, 0, create_set_controlled_entity_packet(eid));
+    return;
+  }
+
+  uint16_t newEid = allocate_eid();
+  const float zoneCenter = (zone_min_x(zone, numZones) + zone_max_x(zone, numZones)) * 0.5f;
   uint32_t color = 0x000000ff +
                    0x44000000 * (rand() % 4 + 1) +
                    0x00440000 * (rand() % 4 + 1) +
                    0x00004400 * (rand() % 4 + 1);
-  float x = (rand() % 4) * 5.f;
+  float x = zoneCenter + (rand() % 4) * 5.f;
   float y = (rand() % 4) * 5.f;
   Entity ent = {color, false, x, y, 0.f, (rand() / RAND_MAX) * 3.141592654f, 0.f, 0.f, 0.f, 0.f, newEid};
   entities.push_back(ent);
@@ -34,73 +135,124 @@ void on_join(ENetPacket *packet, ENetPeer *peer, ENetHost *host)
 
 
   // send info about new entity to everyone
-  for (size_t i = 0; i < host->peerCount; ++i)
-    send_new_entity(&host->peers[i], ent);
+  broadcast_all(0, [&]() { return create_new_entity_packet(ent); });
   // send info about controlled entity
-  send_set_controlled_entity(peer, newEid);
+  net.send(peer.peerId, 0, create_set_controlled_entity_packet(newEid));
 }
 
-void create_server_entity(ENetHost *host)
+void on_join(PeerRef peer, uint16_t eid, uint32_t token, uint32_t curTime)
 {
-  // find max eid
-  uint16_t maxEid = entities.empty() ? invalid_entity : entities[0].eid;
-  for (const Entity &e : entities)
-    maxEid = std::max(maxEid, e.eid);
-  uint16_t newEid = maxEid + 1;
+  // the redirect may overtake the handoff, the join waits for the ship instead of spawning another one
+  if (eid != invalid_entity && !has_entity(eid))
+  {
+    heldJoins.push_back(HeldJoin{peer, eid, token, curTime});
+    return;
+  }
+  finish_join(peer, eid, token);
+}
+
+static void expire_held_joins(uint32_t curTime)
+{
+  for (size_t i = 0; i < heldJoins.size();)
+  {
+    if (curTime - heldJoins[i].since <= heldJoinTimeoutMs)
+    {
+      ++i;
+      continue;
+    }
+    const HeldJoin join = heldJoins[i];
+    heldJoins.erase(heldJoins.begin() + i);
+    finish_join(join.peer, join.eid, join.token);
+  }
+}
+
+void create_server_entity()
+{
+  uint16_t newEid = allocate_eid();
+  const float zoneMinX = zone_min_x(zone, numZones);
+  const float zoneWidth = zone_max_x(zone, numZones) - zoneMinX;
   uint32_t color = 0xff000000 +
                    0x00440000 * (rand() % 5) +
                    0x00004400 * (rand() % 5) +
                    0x00000044 * (rand() % 5);
-  float x = rand() % int(worldSize * 2) - worldSize;
+  float x = rand() % int(zoneWidth) + zoneMinX;
   float y = rand() % int(worldSize * 2) - worldSize;
   Entity ent = {color, true, x, y, 0.f, (rand() / RAND_MAX) * 3.141592654f, 0.f, 0.f, 0.f, 0.f, newEid};
   entities.push_back(ent);
 
   // send info about new entity to everyone
-  for (size_t i = 0; i < host->peerCount; ++i)
-    send_new_entity(&host->peers[i], ent);
+  broadcast_all(0, [&]() { return create_new_entity_packet(ent); });
 }
 
 
-void on_input(ENetPacket *packet)
+// Its ships fly on under server control; ENet reuses the slot, so nothing of it may stay in controlledMap
+static void release_peer(PeerRef peer)
 {
-  uint16_t eid = invalid_entity;
-  float thr = 0.f; float steer = 0.f;
-  deserialize_entity_input(packet, eid, thr, steer);
+  for (auto itf = controlledMap.begin(); itf != controlledMap.end();)
+  {
+    if (!(itf->second == peer))
+    {
+      ++itf;
+      continue;
+    }
+    for (Entity &e : entities)
+      if (e.eid == itf->first)
+        e.serverControlled = true;
+    itf = controlledMap.erase(itf);
+  }
+  heldJoins.erase(std::remove_if(heldJoins.begin(), heldJoins.end(),
+                                 [&](const HeldJoin &join) { return join.peer == peer; }),
+                  heldJoins.end());
+}
+
+void on_input(PeerRef peer, const NetEvent &input)
+{
+  // only the peer controlling a ship steers it
+  auto itf = controlledMap.find(input.eid);
+  if (itf == controlledMap.end() || !(itf->second == peer))
+    return;
   for (Entity &e : entities)
-    if (e.eid == eid)
+    if (e.eid == input.eid)
     {
-      e.thr = thr;
-      e.steer = steer;
+      e.thr = input.thr;
+      e.steer = input.steer;
     }
 }
 
-static void update_net(ENetHost* server)
+// Packets were already received and decoded by the network thread
+static void update_net(uint32_t curTime)
 {
-  ENetEvent event;
-  while (enet_host_service(server, &event, 0) > 0)
+  TRACE_SCOPE("update_net");
+  int64_t numEvents = 0;
+  NetEvent event;
+  for (size_t worker = 0; worker < workers.size(); ++worker)
   {
-    switch (event.type)
+    NetThread &net = *workers[worker];
+    while (net.poll(event))
     {
-    case ENET_EVENT_TYPE_CONNECT:
-      printf("Connection with %x:%u established\n", event.peer->address.host, event.peer->address.port);
-      break;
-    case ENET_EVENT_TYPE_RECEIVE:
-      switch (get_packet_type(event.packet))
+      ++numEvents;
+      const PeerRef peer{worker, event.peerId};
+      switch (event.type)
       {
-        case E_CLIENT_TO_SERVER_JOIN:
-          on_join(event.packet, event.peer, server);
-          break;
-        case E_CLIENT_TO_SERVER_INPUT:
-          on_input(event.packet);
-          break;
+      case NetEvent::Type::Connect:
+        // nothing to do before it joins, its slot was released by the previous peer's disconnect
+        break;
+      case NetEvent::Type::Disconnect:
+        release_peer(peer);
+        break;
+      case NetEvent::Type::Join:
+        on_join(peer, event.eid, event.token, curTime);
+        break;
+      case NetEvent::Type::Input:
+        on_input(peer, event);
+        break;
+      default:
+        break;
       };
-      enet_packet_destroy(event.packet);
-      break;
-    default:
-      break;
-    };
+    }
   }
+  TRACE_COUNTER("net_events", numEvents);
+  expire_held_joins(curTime);
 }
 
 static void update_ai(Entity& e, float dt)
@@ -113,73 +265,363 @@ static void update_ai(Entity& e, float dt)
     e.steer = e.steer != 0.f ? 0.f : ((rand() % 2) * 2.f - 1.f);
 }
 
-static void simulate_world(ENetHost* server, float dt)
+static void simulate_world(float dt)
 {
+  TRACE_SCOPE("simulate_world");
   for (Entity &e : entities)
   {
     if (e.serverControlled)
       update_ai(e, dt);
     // simulate
     simulate_entity(e, dt);
-    // send
-    for (size_t i = 0; i < server->peerCount; ++i)
+  }
+}
+
+static void on_handoff(const ZoneHandoff &handoff)
+{
+  const Entity &ent = handoff.ent;
+  ghosts.erase(ent.eid);
+  if (has_entity(ent.eid))
+    return;
+  entities.push_back(ent);
+  if (handoff.token != 0)
+    handoffTokens[ent.eid] = handoff.token;
+  // clients usually know it as a ghost already, they ignore entities they have
+  broadcast_all(0, [&]() { return create_new_entity_packet(ent); });
+
+  // its client may be waiting for it already
+  for (size_t i = 0; i < heldJoins.size();)
+  {
+    if (heldJoins[i].eid != ent.eid)
+    {
+      ++i;
+      continue;
+    }
+    const HeldJoin join = heldJoins[i];
+    heldJoins.erase(heldJoins.begin() + i);
+    finish_join(join.peer, join.eid, join.token);
+  }
+}
+
+static void on_ghost(const Entity &ent, uint32_t curTime)
+{
+  for (const Entity &e : entities)
+    if (e.eid == ent.eid)
+      return;
+  auto [itf, inserted] = ghosts.try_emplace(ent.eid);
+  itf->second = Ghost{ent, curTime};
+  if (inserted)
+    broadcast_all(0, [&]() { return create_new_entity_packet(ent); });
+}
+
+// Ships that crossed into a neighbouring zone go there with their full state, their clients follow them
+static void hand_off_entities(uint32_t curTime)
+{
+  for (size_t i = 0; i < entities.size();)
+  {
+    const Entity &e = entities[i];
+    const size_t target = zone_of(e.x, numZones);
+    const bool pastMargin = zone_of(e.x - handoff_margin, numZones) == target &&
+                            zone_of(e.x + handoff_margin, numZones) == target;
+    // a ship that skipped a whole zone or whose neighbour is down stays here until it can go
+    if (target == zone || !pastMargin ||
+        (target != zoneLink->leftNeighbour() && target != zoneLink->rightNeighbour()))
+    {
+      ++i;
+      continue;
+    }
+    auto itf = controlledMap.find(e.eid);
+    const uint32_t token = itf != controlledMap.end() ? issue_token() : 0;
+    if (!zoneLink->handoff(target, e, token))
     {
-      ENetPeer *peer = &server->peers[i];
-      // skip this here in this implementation
-      //if (controlledMap[e.eid] != peer)
-      send_snapshot(peer, e.eid, e.x, e.y, e.ori);
+      ++i;
+      continue;
     }
+
+    if (itf != controlledMap.end())
+    {
+      workers[itf->second.worker]->send(itf->second.peerId, 0,
+                                        create_redirect_packet(zone_client_port(target), e.eid, token));
+      controlledMap.erase(itf);
+    }
+    // a client that never followed it here loses its claim
+    handoffTokens.erase(e.eid);
+    // our clients keep seeing it near the border while the neighbour mirrors it back, and are told to drop it
+    // when it expires
+    ghosts[e.eid] = Ghost{e, curTime};
+    entities[i] = entities.back();
+    entities.pop_back();
+  }
+}
+
+static void send_ghosts()
+{
+  const float minX = zone_min_x(zone, numZones);
+  const float maxX = zone_max_x(zone, numZones);
+  static std::vector<Entity> toLeft;
+  static std::vector<Entity> toRight;
+  toLeft.clear();
+  toRight.clear();
+  for (const Entity &e : entities)
+  {
+    if (e.x - minX < ghost_band)
+      toLeft.push_back(e);
+    else if (maxX - e.x < ghost_band)
+      toRight.push_back(e);
   }
+  // with two zones both borders face the same neighbour
+  if (zoneLink->leftNeighbour() == zoneLink->rightNeighbour())
+  {
+    toLeft.insert(toLeft.end(), toRight.begin(), toRight.end());
+    toRight.clear();
+  }
+  zoneLink->sendGhosts(zoneLink->leftNeighbour(), toLeft);
+  zoneLink->sendGhosts(zoneLink->rightNeighbour(), toRight);
 }
 
-static void update_time(ENetHost* server, uint32_t curTime)
+static void update_zones(uint32_t curTime)
 {
-  // We can send it less often too
-  for (size_t i = 0; i < server->peerCount; ++i)
-    send_time_msec(&server->peers[i], curTime);
+  if (!zoneLink)
+    return;
+  TRACE_SCOPE("update_zones");
+  static std::vector<ZoneHandoff> arrived;
+  static std::vector<Entity> mirrored;
+  arrived.clear();
+  mirrored.clear();
+  zoneLink->update(curTime, arrived, mirrored);
+  for (const ZoneHandoff &handoff : arrived)
+    on_handoff(handoff);
+  for (const Entity &ent : mirrored)
+    on_ghost(ent, curTime);
+
+  for (auto itf = ghosts.begin(); itf != ghosts.end();)
+  {
+    if (curTime - itf->second.lastSeen <= ghostTimeoutMs)
+    {
+      ++itf;
+      continue;
+    }
+    const uint16_t eid = itf->first;
+    broadcast_all(0, [&]() { return create_remove_entity_packet(eid); });
+    itf = ghosts.erase(itf);
+  }
+
+  hand_off_entities(curTime);
+  send_ghosts();
+}
+
+// Network threads serialize snapshots and time for their own peers from this
+static void publish_world(uint32_t curTime)
+{
+  TRACE_SCOPE("publish_world");
+  static uint32_t version = 0;
+  auto snapshot = std::make_shared<WorldSnapshot>();
+  snapshot->version = ++version;
+  snapshot->timeMsec = curTime;
+  snapshot->entities.reserve(entities.size() + ghosts.size());
+  for (const Entity &e : entities)
+    snapshot->entities.push_back(EntitySnapshot{e.eid, e.x, e.y, e.ori});
+  for (const auto &[eid, ghost] : ghosts)
+    snapshot->entities.push_back(EntitySnapshot{eid, ghost.ent.x, ghost.ent.y, ghost.ent.ori});
+  world.publish(std::move(snapshot));
+}
+
+static void report_pool_stats(uint32_t curTime)
+{
+  static uint32_t lastReportTime = curTime;
+  const PacketPoolStats stats = get_packet_pool_stats();
+  TRACE_COUNTER("pool_bytes_in_use", int64_t(stats.bytesInUse));
+  if (curTime - lastReportTime < 5000)
+    return;
+  lastReportTime = curTime;
+  printf("Packet pool: %llu allocs (%llu cached, %llu refills, %llu slabs, %llu large), %llu KiB in use of %llu KiB\n",
+         (unsigned long long)stats.allocations, (unsigned long long)stats.cacheHits,
+         (unsigned long long)stats.globalRefills, (unsigned long long)stats.slabsAllocated,
+         (unsigned long long)stats.largeAllocations, (unsigned long long)stats.bytesInUse / 1024,
+         (unsigned long long)stats.bytesReserved / 1024);
+}
+
+static void update_registry(uint32_t curTime)
+{
+  if (!registryLink)
+    return;
+  TRACE_SCOPE("update_registry");
+  registryLink->update(curTime, uint16_t(std::min<uint32_t>(workerLoads->totalConnected(), UINT16_MAX)),
+                       uint16_t(std::min<size_t>(entities.size(), UINT16_MAX)));
+}
+
+static void on_signal(int)
+{
+  running = 0;
+}
+
+// The whole string has to be a number that fits
+template <typename T>
+static bool parse_number(const std::string &arg, T &value)
+{
+  const char *end = arg.data() + arg.size();
+  auto [ptr, ec] = std::from_chars(arg.data(), end, value);
+  return ec == std::errc() && ptr == end;
+}
+
+static void print_usage(const char *name)
+{
+  printf("Usage: %s [num_threads] [--zone index --zones count] [--registry host[:port]]\n", name);
 }
 
 int main(int argc, const char **argv)
 {
-  if (enet_initialize() != 0)
+  TRACE_INIT("w7_server_trace.json", "simulation");
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+
+  // one core is left for the simulation
+  const unsigned numCores = std::thread::hardware_concurrency();
+  size_t numWorkers = numCores > 1 ? numCores - 1 : 1;
+  std::string registryHost;
+  uint16_t registryPortArg = registryPort;
+  for (int i = 1; i < argc; ++i)
+  {
+    const std::string arg = argv[i];
+    bool valid = true;
+    if (arg == "--zone" && i + 1 < argc)
+      valid = parse_number(argv[++i], zone);
+    else if (arg == "--zones" && i + 1 < argc)
+      valid = parse_number(argv[++i], numZones);
+    else if (arg == "--registry" && i + 1 < argc)
+    {
+      registryHost = argv[++i];
+      const size_t colon = registryHost.rfind(':');
+      if (colon != std::string::npos)
+      {
+        valid = parse_number(registryHost.substr(colon + 1), registryPortArg);
+        registryHost.resize(colon);
+      }
+    }
+    else
+      valid = parse_number(arg, numWorkers);
+    if (!valid)
+    {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  numWorkers = std::max<size_t>(1, std::min<size_t>(numWorkers, max_workers_per_zone));
+  numZones = std::max<size_t>(1, std::min<size_t>(numZones, max_zones));
+  if (zone >= numZones)
+  {
+    printf("Zone %zu is out of %zu zones\n", zone, numZones);
+    return 1;
+  }
+  const uint16_t basePort = zone_client_port(zone);
+  constexpr size_t peersPerWorker = 1024;
+
+  if (enet_initialize_with_packet_pool() != 0)
   {
     printf("Cannot init ENet");
     return 1;
   }
-  ENetAddress address;
 
-  address.host = ENET_HOST_ANY;
-  address.port = 10131;
+  std::vector<ENetHost*> hosts;
+  for (size_t i = 0; i < numWorkers; ++i)
+  {
+    ENetAddress address;
+
+    address.host = ENET_HOST_ANY;
+    address.port = uint16_t(basePort + i);
+
+    ENetHost *server = enet_host_create(&address, peersPerWorker, 2, 0, 0);
+
+    if (!server)
+    {
+      printf("Cannot create ENet server on port %u\n", address.port);
+      return 1;
+    }
+    hosts.push_back(server);
+  }
+  printf("Listening on port %u, %zu network threads on ports %u..%zu, up to %zu peers\n", basePort, numWorkers,
+         basePort, basePort + numWorkers - 1, numWorkers * peersPerWorker);
 
-  ENetHost *server = enet_host_create(&address, 32, 2, 0, 0);
+  if (numZones > 1)
+  {
+    zoneLink = std::make_unique<ZoneLink>(zone, numZones);
+    if (!zoneLink->start())
+      return 1;
+    printf("Simulating zone %zu of %zu, x in [%.1f, %.1f)\n", zone, numZones, zone_min_x(zone, numZones),
+           zone_max_x(zone, numZones));
+  }
 
-  if (!server)
+  if (!registryHost.empty())
   {
-    printf("Cannot create ENet server\n");
-    return 1;
+    ENetAddress registryAddress;
+    if (enet_address_set_host(&registryAddress, registryHost.c_str()) != 0)
+    {
+      printf("Cannot resolve registry %s\n", registryHost.c_str());
+      return 1;
+    }
+    registryAddress.port = registryPortArg;
+    const size_t capacity = std::min<size_t>(numWorkers * peersPerWorker, UINT16_MAX);
+    registryLink = std::make_unique<RegistryLink>(registryAddress, basePort, uint16_t(capacity));
+    if (!registryLink->start())
+      return 1;
   }
 
-  constexpr size_t numShips = 100;
+  workerLoads = std::make_unique<WorkerLoads>(numWorkers, basePort);
+  for (size_t i = 0; i < numWorkers; ++i)
+    workers.push_back(std::make_unique<NetThread>(hosts[i], i, *workerLoads, world));
+
+  // ships are spread over the zones
+  const size_t numShips = 100 / numZones;
   for (size_t i = 0; i < numShips; ++i)
-    create_server_entity(server);
+    create_server_entity();
 
+  for (std::unique_ptr<NetThread> &worker : workers)
+    worker->start();
+
+  LoopTimings timings("simulation thread");
   uint32_t lastTime = enet_time_get();
-  while (true)
+  while (running)
   {
-    uint32_t curTime = enet_time_get();
-    float dt = (curTime - lastTime) * 0.001f;
-    lastTime = curTime;
+    timings.begin();
+    {
+      TRACE_SCOPE("tick");
+      uint32_t curTime = enet_time_get();
+      float dt = (curTime - lastTime) * 0.001f;
+      lastTime = curTime;
 
-    update_net(server);
-    simulate_world(server, dt);
-    update_time(server, curTime);
+      update_net(curTime);
+      simulate_world(dt);
+      update_zones(curTime);
+      publish_world(curTime);
+      report_pool_stats(curTime);
+      update_registry(curTime);
+    }
+    timings.end();
+    if (registryLink)
+      registryLink->addTick(float(timings.lastIterationMs()));
     usleep(10000);
   }
 
-  enet_host_destroy(server);
+  for (size_t i = 0; i < numWorkers; ++i)
+  {
+    NetThread &net = *workers[i];
+    net.stop();
+    if (net.droppedOutgoing() || net.droppedIncoming())
+      printf("Network thread %zu dropped %llu outgoing messages and %llu inputs on full queues\n", i,
+             (unsigned long long)net.droppedOutgoing(), (unsigned long long)net.droppedIncoming());
+    if (net.shedIncoming())
+      printf("Network thread %zu shed %llu packets over the rate limits and banned %llu peers\n", i,
+             (unsigned long long)net.shedIncoming(), (unsigned long long)net.bans());
+  }
+  workers.clear();
+  workerLoads.reset();
+  zoneLink.reset();
+  registryLink.reset();
+
+  TRACE_SHUTDOWN();
+  for (ENetHost *server : hosts)
+    enet_host_destroy(server);
 
   atexit(enet_deinitialize);
   return 0;
 }
-
-
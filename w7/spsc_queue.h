@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+
+// Bounded lock-free queue for exactly one producer thread and one consumer thread.
+// Each side caches the other's index and only touches the shared one when it looks full/empty.
+template <typename T, size_t Capacity>
+class SpscQueue
+{
+	static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+	SpscQueue() = default;
+	SpscQueue(const SpscQueue&) = delete;
+	SpscQueue& operator=(const SpscQueue&) = delete;
+
+	// Producer side, false when full
+	bool push(const T& value)
+	{
+		const size_t tail = tailIndex.load(std::memory_order_relaxed);
+		if (tail - cachedHead == Capacity)
+		{
+			cachedHead = headIndex.load(std::memory_order_acquire);
+			if (tail - cachedHead == Capacity)
+				return false;
+		}
+		slots[tail & mask] = value;
+		tailIndex.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer side, false when empty
+	bool pop(T& value)
+	{
+		const size_t head = headIndex.load(std::memory_order_relaxed);
+		if (head == cachedTail)
+		{
+			cachedTail = tailIndex.load(std::memory_order_acquire);
+			if (head == cachedTail)
+				return false;
+		}
+		value = slots[head & mask];
+		headIndex.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Only a hint when called while the other side is running
+	size_t size() const
+	{
+		return tailIndex.load(std::memory_order_acquire) - headIndex.load(std::memory_order_acquire);
+	}
+
+private:
+	static constexpr size_t mask = Capacity - 1;
+
+	// consumer
+	alignas(64) std::atomic<size_t> headIndex{0};
+	size_t cachedTail = 0;
+
+	// producer
+	alignas(64) std::atomic<size_t> tailIndex{0};
+	size_t cachedHead = 0;
+
+	alignas(64) T slots[Capacity];
+};
@@ -0,0 +1,178 @@
+#include "trace.h"
+
+#ifdef W7_TRACING
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace trace
+{
+	namespace
+	{
+		enum class EventKind : uint8_t
+		{
+			Complete,
+			Instant,
+			Counter,
+		};
+
+		struct Event
+		{
+			const char* name = nullptr;
+			uint64_t tsUs = 0;
+			uint64_t durUs = 0;
+			int64_t value = 0;
+			EventKind kind = EventKind::Complete;
+		};
+
+		constexpr size_t bufferCapacity = 1 << 16; // per thread, power of two
+		constexpr size_t bufferMask = bufferCapacity - 1;
+
+		struct ThreadBuffer
+		{
+			std::unique_ptr<Event[]> events = std::make_unique<Event[]>(bufferCapacity);
+			// Only the owning thread writes, shutdown() reads
+			std::atomic<uint64_t> written{0};
+			uint32_t tid = 0;
+			std::string name;
+		};
+
+		using Clock = std::chrono::steady_clock;
+
+		// Buffers are owned here so they outlive the threads that recorded into them
+		std::mutex registryMutex;
+		std::vector<std::unique_ptr<ThreadBuffer>> registry;
+		std::string outputPath;
+		const Clock::time_point startTime = Clock::now();
+
+		thread_local ThreadBuffer* localBuffer = nullptr;
+
+		uint64_t now_us()
+		{
+			return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - startTime).count();
+		}
+
+		ThreadBuffer& get_buffer()
+		{
+			if (!localBuffer)
+			{
+				std::lock_guard<std::mutex> lock(registryMutex);
+				registry.push_back(std::make_unique<ThreadBuffer>());
+				localBuffer = registry.back().get();
+				localBuffer->tid = uint32_t(registry.size());
+				localBuffer->name = "thread " + std::to_string(localBuffer->tid);
+			}
+			return *localBuffer;
+		}
+
+		void push(const Event& event)
+		{
+			ThreadBuffer& buffer = get_buffer();
+			const uint64_t index = buffer.written.load(std::memory_order_relaxed);
+			buffer.events[index & bufferMask] = event;
+			buffer.written.store(index + 1, std::memory_order_release);
+		}
+
+		void write_event(FILE* file, const ThreadBuffer& buffer, const Event& event, bool& first)
+		{
+			fprintf(file, first ? "\n" : ",\n");
+			first = false;
+			switch (event.kind)
+			{
+				case EventKind::Complete:
+					fprintf(file, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":1,\"tid\":%u}", event.name,
+						(unsigned long long)event.tsUs, (unsigned long long)event.durUs, buffer.tid);
+					break;
+				case EventKind::Instant:
+					fprintf(file, "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%llu,\"pid\":1,\"tid\":%u}", event.name,
+						(unsigned long long)event.tsUs, buffer.tid);
+					break;
+				case EventKind::Counter:
+					fprintf(file, "{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%llu,\"pid\":1,\"tid\":%u,\"args\":{\"value\":%lld}}",
+						event.name, (unsigned long long)event.tsUs, buffer.tid, (long long)event.value);
+					break;
+			}
+		}
+	} // namespace
+
+	void init(const char* path, const char* thread_name)
+	{
+		{
+			std::lock_guard<std::mutex> lock(registryMutex);
+			outputPath = path;
+		}
+		set_thread_name(thread_name);
+	}
+
+	void set_thread_name(const char* thread_name)
+	{
+		ThreadBuffer& buffer = get_buffer();
+		std::lock_guard<std::mutex> lock(registryMutex);
+		buffer.name = thread_name;
+	}
+
+	void shutdown()
+	{
+		std::lock_guard<std::mutex> lock(registryMutex);
+		if (outputPath.empty())
+			return;
+
+		FILE* file = fopen(outputPath.c_str(), "w");
+		if (!file)
+		{
+			printf("Cannot open trace file %s\n", outputPath.c_str());
+			return;
+		}
+
+		fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+		bool first = true;
+		size_t dropped = 0;
+		for (const std::unique_ptr<ThreadBuffer>& buffer : registry)
+		{
+			fprintf(file, first ? "\n" : ",\n");
+			first = false;
+			fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+				buffer->tid, buffer->name.c_str());
+
+			const uint64_t written = buffer->written.load(std::memory_order_acquire);
+			const uint64_t begin = written > bufferCapacity ? written - bufferCapacity : 0;
+			dropped += size_t(begin);
+			for (uint64_t i = begin; i < written; ++i)
+				write_event(file, *buffer, buffer->events[i & bufferMask], first);
+		}
+		fprintf(file, "\n]}\n");
+		fclose(file);
+
+		printf("Trace written to %s (%zu oldest events overwritten)\n", outputPath.c_str(), dropped);
+		outputPath.clear();
+	}
+
+	void instant(const char* name)
+	{
+		push(Event{.name = name, .tsUs = now_us(), .kind = EventKind::Instant});
+	}
+
+	void counter(const char* name, int64_t value)
+	{
+		push(Event{.name = name, .tsUs = now_us(), .value = value, .kind = EventKind::Counter});
+	}
+
+	Scope::Scope(const char* name)
+		: name(name)
+		, startUs(now_us())
+	{
+	}
+
+	Scope::~Scope()
+	{
+		const uint64_t endUs = now_us();
+		push(Event{.name = name, .tsUs = startUs, .durUs = endUs - startUs, .kind = EventKind::Complete});
+	}
+} // namespace trace
+
+#endif
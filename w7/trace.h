@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+
+// Scoped trace markers which end up in a Chrome trace JSON (chrome://tracing, ui.perfetto.dev).
+// Everything here compiles to nothing unless W7_TRACING is defined (cmake -DW7_TRACING=ON).
+//
+// Each thread records into its own fixed size ring, so the recording side takes no locks.
+// The ring keeps the most recent events, which is what we want when looking at a stutter.
+
+#ifdef W7_TRACING
+
+namespace trace
+{
+	// Name given here shows up as the thread name in the viewer.
+	void init(const char* path, const char* thread_name);
+	void set_thread_name(const char* thread_name);
+
+	// Writes all recorded events to the file passed to init(). Call it once recording threads are done.
+	void shutdown();
+
+	// `name` must outlive the trace, string literals are expected.
+	void instant(const char* name);
+	void counter(const char* name, int64_t value);
+
+	class Scope
+	{
+	public:
+		explicit Scope(const char* name);
+		~Scope();
+
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+
+	private:
+		const char* name;
+		uint64_t startUs;
+	};
+} // namespace trace
+
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+
+#define TRACE_INIT(path, thread_name) trace::init(path, thread_name)
+#define TRACE_THREAD_NAME(thread_name) trace::set_thread_name(thread_name)
+#define TRACE_SHUTDOWN() trace::shutdown()
+#define TRACE_SCOPE(name) trace::Scope TRACE_CONCAT(traceScope_, __LINE__)(name)
+#define TRACE_INSTANT(name) trace::instant(name)
+#define TRACE_COUNTER(name, value) trace::counter(name, value)
+
+#else
+
+#define TRACE_INIT(path, thread_name) ((void)0)
+#define TRACE_THREAD_NAME(thread_name) ((void)0)
+#define TRACE_SHUTDOWN() ((void)0)
+#define TRACE_SCOPE(name) ((void)0)
+#define TRACE_INSTANT(name) ((void)0)
+#define TRACE_COUNTER(name, value) ((void)0)
+
+#endif
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+struct EntitySnapshot
+{
+	uint16_t eid;
+	float x;
+	float y;
+	float ori;
+};
+
+// Everything a network thread needs to build this tick's snapshot and time packets.
+struct WorldSnapshot
+{
+	uint32_t version = 0;
+	uint32_t timeMsec = 0;
+	std::vector<EntitySnapshot> entities;
+};
+
+// Latest world published by the simulation, read by every network thread.
+// A snapshot is immutable once published, readers keep their shared_ptr for as long as they serialize it,
+// the lock only guards swapping the pointer.
+class WorldState
+{
+public:
+	void publish(std::shared_ptr<const WorldSnapshot> snapshot)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		latest = std::move(snapshot);
+	}
+
+	std::shared_ptr<const WorldSnapshot> acquire() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return latest;
+	}
+
+private:
+	mutable std::mutex mutex;
+	std::shared_ptr<const WorldSnapshot> latest;
+};
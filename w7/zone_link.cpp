@@ -0,0 +1,179 @@
+#include "zone_link.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "protocol.h"
+
+
+size_t zone_of(float x, size_t num_zones)
+{
+	const float t = (std::clamp(x, -worldSize, worldSize) + worldSize) / (2.f * worldSize);
+	return std::min(size_t(t * num_zones), num_zones - 1);
+}
+
+float zone_min_x(size_t zone, size_t num_zones)
+{
+	return -worldSize + 2.f * worldSize * zone / num_zones;
+}
+
+float zone_max_x(size_t zone, size_t num_zones)
+{
+	return zone_min_x(zone + 1, num_zones);
+}
+
+uint16_t zone_eid_count(size_t num_zones)
+{
+	// invalid_entity is the last id, it never gets handed out
+	return uint16_t(invalid_entity / num_zones);
+}
+
+uint16_t zone_first_eid(size_t zone, size_t num_zones)
+{
+	return uint16_t(zone * zone_eid_count(num_zones));
+}
+
+// Zone servers run on one machine, the link is only reachable through loopback
+static const char* link_host = "127.0.0.1";
+
+static bool is_link_host(const ENetAddress& address)
+{
+	ENetAddress loopback;
+	enet_address_set_host_ip(&loopback, link_host);
+	return address.host == loopback.host;
+}
+
+ZoneLink::ZoneLink(size_t zone, size_t num_zones)
+	: zone(zone)
+	, numZones(num_zones)
+	, peers(num_zones, nullptr)
+	, lastConnectAttempt(num_zones, 0)
+{
+}
+
+ZoneLink::~ZoneLink()
+{
+	if (host)
+		enet_host_destroy(host);
+}
+
+bool ZoneLink::start()
+{
+	ENetAddress address;
+	enet_address_set_host_ip(&address, link_host);
+	address.port = uint16_t(zone_link_base_port + zone);
+	// at most two neighbours, a spare slot for a neighbour reconnecting before its old peer times out
+	host = enet_host_create(&address, 4, 2, 0, 0);
+	if (!host)
+	{
+		printf("Cannot create zone link on port %u\n", address.port);
+		return false;
+	}
+	return true;
+}
+
+void ZoneLink::connect(size_t neighbour, uint32_t cur_time)
+{
+	if (neighbour >= zone || peers[neighbour])
+		return;
+	if (lastConnectAttempt[neighbour] != 0 && cur_time - lastConnectAttempt[neighbour] < reconnectDelayMs)
+		return;
+	lastConnectAttempt[neighbour] = cur_time;
+
+	ENetAddress address;
+	enet_address_set_host_ip(&address, link_host);
+	address.port = uint16_t(zone_link_base_port + neighbour);
+	ENetPeer* peer = enet_host_connect(host, &address, 2, 0);
+	if (!peer)
+		return;
+	// a failed attempt ends in a DISCONNECT event that clears it again
+	peer->data = reinterpret_cast<void*>(neighbour + 1);
+	peers[neighbour] = peer;
+}
+
+void ZoneLink::update(uint32_t cur_time, std::vector<ZoneHandoff>& handoffs, std::vector<Entity>& ghosts)
+{
+	connect(leftNeighbour(), cur_time);
+	connect(rightNeighbour(), cur_time);
+
+	ENetEvent event;
+	while (enet_host_service(host, &event, 0) > 0)
+	{
+		switch (event.type)
+		{
+			case ENET_EVENT_TYPE_CONNECT:
+			{
+				// link hosts send from the port they listen on, so it tells which zone is on the other end; that only
+				// holds for a sender on this machine, anyone else could pick the port and forge handoffs
+				const ENetAddress& from = event.peer->address;
+				const size_t neighbour = size_t(from.port - zone_link_base_port);
+				if (!is_link_host(from) || from.port < zone_link_base_port || neighbour >= numZones ||
+					(neighbour != leftNeighbour() && neighbour != rightNeighbour()))
+				{
+					enet_peer_disconnect(event.peer, 0);
+					break;
+				}
+				event.peer->data = reinterpret_cast<void*>(neighbour + 1);
+				peers[neighbour] = event.peer;
+				printf("Zone %zu linked with zone %zu\n", zone, neighbour);
+				break;
+			}
+			case ENET_EVENT_TYPE_DISCONNECT:
+				if (event.peer->data)
+				{
+					const size_t neighbour = reinterpret_cast<size_t>(event.peer->data) - 1;
+					if (peers[neighbour] == event.peer)
+						peers[neighbour] = nullptr;
+					event.peer->data = nullptr;
+					printf("Zone %zu lost link with zone %zu\n", zone, neighbour);
+				}
+				break;
+			case ENET_EVENT_TYPE_RECEIVE:
+				switch (get_packet_type(event.packet))
+				{
+					case E_ZONE_TO_ZONE_HANDOFF:
+					{
+						ZoneHandoff handoff;
+						if (deserialize_zone_handoff(event.packet, handoff.ent, handoff.token))
+							handoffs.push_back(handoff);
+						break;
+					}
+					case E_ZONE_TO_ZONE_GHOSTS:
+						deserialize_zone_ghosts(event.packet, ghosts);
+						break;
+					default:
+						break;
+				};
+				enet_packet_destroy(event.packet);
+				break;
+			default:
+				break;
+		};
+	}
+	enet_host_flush(host);
+}
+
+bool ZoneLink::isConnected(size_t neighbour) const
+{
+	return peers[neighbour] && peers[neighbour]->state == ENET_PEER_STATE_CONNECTED;
+}
+
+bool ZoneLink::handoff(size_t neighbour, const Entity& ent, uint32_t token)
+{
+	if (!isConnected(neighbour))
+		return false;
+	ENetPacket* packet = create_zone_handoff_packet(ent, token);
+	if (enet_peer_send(peers[neighbour], 0, packet) < 0)
+	{
+		enet_packet_destroy(packet);
+		return false;
+	}
+	return true;
+}
+
+void ZoneLink::sendGhosts(size_t neighbour, const std::vector<Entity>& ents)
+{
+	if (ents.empty() || !isConnected(neighbour))
+		return;
+	enet_peer_send(peers[neighbour], 1, create_zone_ghosts_packet(ents.data(), uint16_t(ents.size())));
+}
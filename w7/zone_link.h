@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <enet/enet.h>
+#include <vector>
+
+#include "entity.h"
+
+
+// The world is cut along x into numZones equal strips, each simulated by its own server process.
+// x wraps around (see tile_val), so the last zone and the first one are neighbours too.
+constexpr size_t max_zones = 16;
+constexpr uint16_t client_base_port = 10131;
+constexpr uint16_t zone_link_base_port = 12131;
+constexpr uint16_t max_workers_per_zone = 64;
+// Owned entities this close to a border are mirrored to the zone on the other side
+constexpr float ghost_band = 10.f;
+// Ships are handed off only once this far past the border, so one wobbling on it doesn't bounce between zones
+constexpr float handoff_margin = 1.f;
+
+size_t zone_of(float x, size_t num_zones);
+float zone_min_x(size_t zone, size_t num_zones);
+float zone_max_x(size_t zone, size_t num_zones);
+// Base port clients of a zone connect to, its network threads take the ports after it
+inline uint16_t zone_client_port(size_t zone) { return uint16_t(client_base_port + zone * max_workers_per_zone); }
+// Zones don't share entity ids, each one hands out ids from its own range
+uint16_t zone_first_eid(size_t zone, size_t num_zones);
+uint16_t zone_eid_count(size_t num_zones);
+
+// A ship taken over from a neighbour, token is what its client has to join with (0: nobody controls it)
+struct ZoneHandoff
+{
+	Entity ent;
+	uint32_t token = 0;
+};
+
+// ENet link between a zone server and its neighbours, serviced from the simulation thread.
+// Handoffs are reliable; ghosts are unreliable and only ever the latest state.
+// The zone with the higher index connects, the other one accepts, so each pair has a single connection.
+class ZoneLink
+{
+public:
+	ZoneLink(size_t zone, size_t num_zones);
+	~ZoneLink();
+
+	ZoneLink(const ZoneLink&) = delete;
+	ZoneLink& operator=(const ZoneLink&) = delete;
+
+	bool start();
+
+	// Services the link host, (re)connects to neighbours and appends whatever arrived
+	void update(uint32_t cur_time, std::vector<ZoneHandoff>& handoffs, std::vector<Entity>& ghosts);
+
+	size_t leftNeighbour() const { return (zone + numZones - 1) % numZones; }
+	size_t rightNeighbour() const { return (zone + 1) % numZones; }
+	bool isConnected(size_t neighbour) const;
+
+	// false if the neighbour isn't connected, the entity stays here then
+	bool handoff(size_t neighbour, const Entity& ent, uint32_t token);
+	void sendGhosts(size_t neighbour, const std::vector<Entity>& ents);
+
+private:
+	void connect(size_t neighbour, uint32_t cur_time);
+
+private:
+	static constexpr uint32_t reconnectDelayMs = 1000;
+
+	size_t zone;
+	size_t numZones;
+	ENetHost* host = nullptr;
+	std::vector<ENetPeer*> peers; // indexed by zone, set while connecting or connected
+	std::vector<uint32_t> lastConnectAttempt;
+};